@@ -0,0 +1,354 @@
+#!/bin/sh
+#
+# Convergence benchmark of mstpd on Linux bridges joined by veth pairs.
+#
+# Builds a topology, lets it converge, injects a failure and measures the time
+# until the kernel port states are stable again, the BPDUs exchanged and the CPU
+# time used by mstpd meanwhile. One JSON object per measure is written to the
+# standard output (or appended to the file of -o), the progress to stderr.
+#
+# The kernel only hands the bridges of the initial network namespace to the
+# user space STP (through /sbin/bridge-stp), so the topology is built there and
+# a single mstpd runs all of its bridges. The interfaces are named bb*; nothing
+# named so may exist, and no other mstpd may run. Must be run as root.
+
+usage()
+{
+    cat >&2 <<EOF
+Usage: $0 [options]
+  -d <dir>       directory of the mstpd and mstpctl to run (default: ..)
+  -t <topology>  ring, mesh or clos (default: ring)
+  -n <bridges>   bridges of the ring or mesh, leaves of the clos (default: 4)
+  -S <spines>    spines of the clos (default: 2)
+  -p <links>     parallel links between two connected bridges (default: 1)
+  -m <mstis>     MSTIs created on every bridge, 0 to run RSTP (default: 0)
+  -e <events>    failures injected, out of rootport, rootbridge and priority
+                 (default: "rootport rootbridge priority")
+  -r <runs>      runs of every failure (default: 1)
+  -s <ms>        port states unchanged for that long are stable (default: 3000)
+  -T <s>         give up after that long (default: 60)
+  -o <file>      append the results to file
+EOF
+    exit 1
+}
+
+DIR="$(dirname "$0")/.."
+TOPOLOGY=ring
+BRIDGES=4
+SPINES=2
+LINKS=1
+MSTIS=0
+EVENTS="rootport rootbridge priority"
+RUNS=1
+SETTLE=3000
+TIMEOUT=60
+OUTPUT=
+
+while getopts d:t:n:S:p:m:e:r:s:T:o: opt; do
+    case "$opt" in
+        d) DIR="$OPTARG" ;;
+        t) TOPOLOGY="$OPTARG" ;;
+        n) BRIDGES="$OPTARG" ;;
+        S) SPINES="$OPTARG" ;;
+        p) LINKS="$OPTARG" ;;
+        m) MSTIS="$OPTARG" ;;
+        e) EVENTS="$OPTARG" ;;
+        r) RUNS="$OPTARG" ;;
+        s) SETTLE="$OPTARG" ;;
+        T) TIMEOUT="$OPTARG" ;;
+        o) OUTPUT="$OPTARG" ;;
+        *) usage ;;
+    esac
+done
+[ $OPTIND -gt $# ] || usage
+
+MSTPD="$DIR/mstpd"
+MSTPCTL="$DIR/mstpctl"
+PREFIX=bb
+LOG="${TMPDIR:-/tmp}/bench-mstpd.$$.log"
+CLK_TCK=$(getconf CLK_TCK)
+
+die()
+{
+    echo "$0: $*" >&2
+    exit 1
+}
+
+case "$TOPOLOGY" in
+    ring) [ "$BRIDGES" -ge 2 ] || die "a ring needs 2 bridges or more" ;;
+    mesh) [ "$BRIDGES" -ge 2 ] || die "a mesh needs 2 bridges or more" ;;
+    clos) [ "$BRIDGES" -ge 1 ] && [ "$SPINES" -ge 1 ] \
+              || die "a clos needs a leaf and a spine or more" ;;
+    *) usage ;;
+esac
+for event in $EVENTS; do
+    case "$event" in
+        rootport|rootbridge|priority) ;;
+        *) die "unknown failure $event" ;;
+    esac
+done
+[ "$(id -u)" = 0 ] || die "must be run as root"
+[ -x "$MSTPD" ] && [ -x "$MSTPCTL" ] || die "no mstpd and mstpctl in $DIR"
+! "$MSTPCTL" showloopstats > /dev/null 2>&1 || die "an mstpd is running already"
+! ip -o link show | grep -q "^[0-9]*: $PREFIX" \
+    || die "interfaces named $PREFIX* exist already"
+
+if [ "$TOPOLOGY" = clos ]; then
+    NUM=$((SPINES + BRIDGES))
+else
+    NUM=$BRIDGES
+fi
+
+now_ns()
+{
+    date +%s%N
+}
+
+# Links: bb<i>x<j>l<k> on bridge bbr<i> is the peer of bb<j>x<i>l<k>
+connect()
+{
+    k=1
+    while [ $k -le "$LINKS" ]; do
+        ip link add $PREFIX$1x$2l$k type veth peer name $PREFIX$2x$1l$k
+        ip link set $PREFIX$1x$2l$k master ${PREFIX}r$1
+        ip link set $PREFIX$2x$1l$k master ${PREFIX}r$2
+        ip link set $PREFIX$1x$2l$k up
+        ip link set $PREFIX$2x$1l$k up
+        k=$((k + 1))
+    done
+}
+
+build()
+{
+    i=1
+    while [ $i -le $NUM ]; do
+        ip link add ${PREFIX}r$i type bridge
+        ip link set ${PREFIX}r$i address 02:bb:00:00:$((i / 256 % 256)):$((i % 256))
+        i=$((i + 1))
+    done
+    case "$TOPOLOGY" in
+        ring)
+            i=1
+            while [ $i -lt $NUM ]; do
+                connect $i $((i + 1))
+                i=$((i + 1))
+            done
+            [ $NUM -gt 2 ] && connect $NUM 1
+            ;;
+        mesh)
+            i=1
+            while [ $i -le $NUM ]; do
+                j=$((i + 1))
+                while [ $j -le $NUM ]; do
+                    connect $i $j
+                    j=$((j + 1))
+                done
+                i=$((i + 1))
+            done
+            ;;
+        clos)
+            # Spines are bbr1 to bbr<spines>, leaves come next
+            i=1
+            while [ $i -le "$SPINES" ]; do
+                j=$((SPINES + 1))
+                while [ $j -le $NUM ]; do
+                    connect $i $j
+                    j=$((j + 1))
+                done
+                i=$((i + 1))
+            done
+            ;;
+    esac
+}
+
+teardown()
+{
+    [ -n "$MSTPD_PID" ] && kill "$MSTPD_PID" 2> /dev/null && wait "$MSTPD_PID"
+    MSTPD_PID=
+    for l in $(ip -o link show | sed -n "s/^[0-9]*: \($PREFIX[^:@]*\).*/\1/p"); do
+        ip link del "$l" 2> /dev/null
+    done
+}
+
+trap teardown EXIT
+trap 'exit 1' INT TERM
+
+start()
+{
+    "$MSTPD" -d -v 1 > "$LOG" 2>&1 &
+    MSTPD_PID=$!
+    n=0
+    until "$MSTPCTL" showloopstats > /dev/null 2>&1; do
+        n=$((n + 1))
+        [ $n -lt 50 ] || die "mstpd didn't start, see $LOG"
+        sleep 0.1
+    done
+    i=1
+    while [ $i -le $NUM ]; do
+        br=${PREFIX}r$i
+        ip link set $br type bridge stp_state 1
+        [ "$(cat /sys/class/net/$br/bridge/stp_state)" = 2 ] \
+            || die "$br runs the kernel STP: the bridge-stp helper refused it"
+        "$MSTPCTL" addbridge $br
+        # bbr1 is the root, bbr2 the next one
+        case $i in
+            1) prio=0 ;;
+            2) prio=1 ;;
+            *) prio=8 ;;
+        esac
+        if [ "$MSTIS" -gt 0 ]; then
+            "$MSTPCTL" setforcevers $br mstp
+            "$MSTPCTL" setmstconfid $br 0 bench
+            m=1
+            while [ $m -le "$MSTIS" ]; do
+                "$MSTPCTL" createtree $br $m
+                "$MSTPCTL" setvid2fid $br $m:$m
+                "$MSTPCTL" setfid2mstid $br $m:$m
+                "$MSTPCTL" settreeprio $br $m $prio
+                m=$((m + 1))
+            done
+        fi
+        "$MSTPCTL" settreeprio $br 0 $prio
+        ip link set $br up
+        i=$((i + 1))
+    done
+}
+
+# "port state" of every port of the benchmark bridges
+port_states()
+{
+    bridge -o link show | awk -v br="${PREFIX}r" '{
+        name = $2; sub(/:$/, "", name); sub(/@.*/, "", name);
+        master = ""; state = "";
+        for(i = 3; i < NF; ++i) {
+            if($i == "master") master = $(i + 1);
+            if($i == "state") state = $(i + 1);
+        }
+        if(index(master, br) == 1) print name, state;
+    }' | sort
+}
+
+# Sum of the BPDUs sent and received by the ports of the bridges from bbr$1
+# (default: all): "tx rx"
+bpdu_counts()
+{
+    i=${1:-1}
+    while [ $i -le $NUM ]; do
+        [ -d /sys/class/net/${PREFIX}r$i ] \
+            && "$MSTPCTL" showportdetail ${PREFIX}r$i
+        i=$((i + 1))
+    done | awk '
+        $1 == "Num" && $3 == "BPDU" && $4 ~ /^[0-9]+$/ {
+            if($2 == "TX") tx += $4; else if($2 == "RX") rx += $4;
+        }
+        END { print tx + 0, rx + 0 }'
+}
+
+# CPU time used by mstpd, in us
+cpu_us()
+{
+    if [ -r /proc/$MSTPD_PID/schedstat ]; then
+        awk '{ print int($1 / 1000) }' /proc/$MSTPD_PID/schedstat
+    else
+        # utime + stime; the name of the command may hold spaces
+        sed 's/.*) //' /proc/$MSTPD_PID/stat \
+            | awk -v hz=$CLK_TCK '{ print int(($12 + $13) * 1000000 / hz) }'
+    fi
+}
+
+# Wait until the port states are stable, from $1 (ns) when they were $2. Set
+# CONVERGED, CONVERGENCE_MS (to the last change) and CHANGES
+wait_stable()
+{
+    t0=$1
+    last=$t0
+    prev=$2
+    CHANGES=0
+    CONVERGED=false
+    while :; do
+        sleep 0.02
+        t=$(now_ns)
+        cur=$(port_states)
+        if [ "$cur" != "$prev" ]; then
+            CHANGES=$((CHANGES + 1))
+            last=$t
+            prev=$cur
+        elif [ $(((t - last) / 1000000)) -ge "$SETTLE" ] \
+             && ! echo "$cur" | grep -q " \(listening\|learning\)$"; then
+            CONVERGED=true
+            break
+        fi
+        [ $(((t - t0) / 1000000000)) -lt "$TIMEOUT" ] || break
+    done
+    CONVERGENCE_MS=$(((last - t0) / 1000000))
+}
+
+report()
+{
+    line="{\"time\":$(date +%s),\"version\":\"$("$MSTPD" -V)\""
+    line="$line,\"topology\":\"$TOPOLOGY\",\"bridges\":$NUM"
+    line="$line,\"ports\":$(port_states | wc -l),\"links\":$LINKS"
+    line="$line,\"mstis\":$MSTIS,\"event\":\"$1\",\"run\":$2"
+    line="$line,\"converged\":$CONVERGED,\"convergence_ms\":$CONVERGENCE_MS"
+    line="$line,\"state_changes\":$CHANGES"
+    line="$line,\"tx_bpdu\":$(($5 - $3)),\"rx_bpdu\":$(($6 - $4))"
+    line="$line,\"cpu_us\":$(($8 - $7))}"
+    if [ -n "$OUTPUT" ]; then
+        echo "$line" >> "$OUTPUT"
+    else
+        echo "$line"
+    fi
+    echo "$TOPOLOGY $1 #$2: converged $CONVERGED in $CONVERGENCE_MS ms" >&2
+}
+
+# Measure from now the convergence after $1
+measure()
+{
+    # The counters of the removed root go with it
+    if [ "$1" = rootbridge ]; then
+        counts=$(bpdu_counts 2)
+    else
+        counts=$(bpdu_counts)
+    fi
+    cpu=$(cpu_us)
+    states=$(port_states)
+    t=$(now_ns)
+    case "$1" in
+        rootport)
+            # The last bridge: a leaf in a clos
+            br=${PREFIX}r$NUM
+            port=$("$MSTPCTL" showbridge $br root-port)
+            [ -n "$port" ] || die "$br has no root port"
+            ip link set "$port" down
+            ;;
+        rootbridge)
+            # Switched off: its links go down as well, rather than the
+            # neighbours waiting for its information to age
+            ip link del ${PREFIX}r1
+            for l in $(ip -o link show \
+                       | sed -n "s/^[0-9]*: \(${PREFIX}1x[^:@]*\).*/\1/p"); do
+                ip link del "$l"
+            done
+            ;;
+        priority)
+            "$MSTPCTL" settreeprio ${PREFIX}r1 0 15
+            ;;
+    esac
+    wait_stable $t "$states"
+    report $1 $2 $counts $(bpdu_counts) $cpu $(cpu_us)
+}
+
+run=1
+while [ $run -le "$RUNS" ]; do
+    for event in $EVENTS; do
+        build
+        states=$(port_states)
+        t=$(now_ns)
+        start
+        wait_stable $t "$states"
+        report start $run 0 0 $(bpdu_counts) 0 $(cpu_us)
+        [ $CONVERGED = true ] && measure $event $run
+        teardown
+    done
+    run=$((run + 1))
+done
@@ -28,9 +28,12 @@
 #define BRIDGE_CTL_H
 
 #include <stdbool.h>
+#include <time.h>
 #include <net/if.h>
 #include <linux/if_ether.h>
 
+#include "mstp_types.h"
+
 typedef struct
 {
     int if_index;
@@ -40,6 +43,16 @@ typedef struct
     bool up;
 } sysdep_br_data_t;
 
+struct llc_header
+{
+    __u8 dest_addr[ETH_ALEN];
+    __u8 src_addr[ETH_ALEN];
+    __be16 len8023;
+    __u8 d_sap;
+    __u8 s_sap;
+    __u8 llc_ctrl;
+} __attribute__((packed));
+
 typedef struct
 {
     int if_index;
@@ -48,6 +61,20 @@ typedef struct
 
     bool up;
     int speed, duplex;
+
+    /* Header for transmitted BPDUs, only len8023 changes per frame */
+    struct llc_header tx_llc_header;
+
+    /* Warm start: seconds left to keep the adopted forwarding state of
+     * the CIST, and the state requested by the state machines meanwhile */
+    unsigned int warm_hold;
+    int warm_state;
+
+    /* BPDUs dropped by the kernel filter, as last counted */
+    unsigned long long kernel_filtered, kernel_rate_limited;
+
+    port_latency_t latency;
+    struct timespec last_tx; /* CLOCK_MONOTONIC, 0 = none since port up */
 } sysdep_if_data_t;
 
 #define GET_PORT_SPEED(port)    ((port)->sysdeps.speed)
@@ -81,10 +108,40 @@ extern struct rtnl_handle rth_state;
 
 int init_bridge_ops(void);
 
+/* Handle a link message recorded by mstpd -r */
+struct nlmsghdr;
+void brmon_replay_msg(struct nlmsghdr *n);
+
 int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags);
 
-void bridge_bpdu_rcv(int ifindex, const unsigned char *data, int len);
+int dump_port_states(void);
+
+void bridge_port_kernel_state(int if_index, int state);
+
+void bridge_set_warm_start(bool enable);
+
+void bridge_set_rx_fast_path(bool enable);
+
+int dump_bridge_ports(int br_index);
+
+int dump_bridge_stp_states(void);
+
+void bridge_stp_state(int br_index, int stp_state);
+
+void bridge_set_auto_adopt(bool enable);
+
+int bridge_add_auto_adopt_name(const char *name);
+
+/* rx_time: when the kernel received the frame (CLOCK_REALTIME), or NULL */
+void bridge_bpdu_rcv(int ifindex, const unsigned char *data, int len,
+                     const struct timespec *rx_time);
+
+void bridge_bpdu_tx_error(int ifindex);
+
+void bridge_bpdu_sent(int ifindex);
 
 void bridge_one_second(void);
 
+bool bridge_run_deferred(void);
+
 #endif /* BRIDGE_CTL_H */
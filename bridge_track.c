@@ -25,28 +25,83 @@
 ******************************************************************************/
 
 #include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <linux/param.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
 #include <asm/byteorder.h>
 
 #include "bridge_ctl.h"
+#include "bridge_track.h"
+#include "clock_gettime.h"
 #include "ctl_functions.h"
 #include "netif_utils.h"
 #include "packet.h"
 #include "log.h"
 #include "mstp.h"
 #include "driver.h"
-#include "libnetlink.h"
-
-#ifndef SYSFS_CLASS_NET
-#define SYSFS_CLASS_NET "/sys/class/net"
-#endif
+#include "epoll_loop.h"
+#include "conf_file.h"
+#include "record.h"
 
 static LIST_HEAD(bridges);
 
+/* Set while the state handed over by the previous instance of mstpd is
+ * being restored: the structures are created the usual way, but the
+ * kernel must not see the side effects, the saved state is what it has.
+ */
+static bool restoring;
+
+/* The MSTP engine of all bridges */
+static mstp_engine_t engine;
+static void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state);
+
+/* Warm start: when a bridge is added, its ports which the kernel is already
+ * forwarding keep forwarding while the state machines start from BEGIN,
+ * until they either confirm the forwarding state or find the port to be
+ * an Alternate or Backup one. A crash and restart of the daemon is then
+ * a non-event for the unchanged topology. The hold is bounded by the time
+ * the slowest (STP compatible) transition to forwarding takes.
+ */
+static bool warm_start;
+static struct
+{
+    int if_index;
+    int state;
+} *kernel_states;
+static int num_kernel_states;
+
+/* Auto-adoption: a bridge is added as soon as the kernel hands its STP over
+ * to user space, with no need for `mstpctl addbridge` from /sbin/bridge-stp.
+ * The kernel does this when the helper returns 0 and reports it as
+ * IFLA_BR_STP_STATE == BR_USER_STP. If the list of names is empty,
+ * all bridges are adopted.
+ */
+#define BR_USER_STP 2 /* from net/bridge/br_private.h */
+static bool auto_adopt;
+static char (*adopt_names)[IFNAMSIZ];
+static int num_adopt_names;
+
+/* LLC_PDU_xxx defines snitched from linux/net/llc_pdu.h */
+#define LLC_PDU_LEN_U   3   /* header and 1 control byte */
+#define LLC_PDU_TYPE_U  3   /* first two bits */
+
+/* 7.12.3 of 802.1D */
+#define LLC_SAP_BSPAN   0x42
+static const __u8 bridge_group_address[ETH_ALEN] =
+{
+    0x01, 0x80, 0xc2, 0x00, 0x00, 0x00
+};
+
+static void init_tx_llc_header(port_t *prt)
+{
+    struct llc_header *h = &prt->sysdeps.tx_llc_header;
+
+    memcpy(h->dest_addr, bridge_group_address, ETH_ALEN);
+    memcpy(h->src_addr, prt->sysdeps.macaddr, ETH_ALEN);
+    h->d_sap = h->s_sap = LLC_SAP_BSPAN;
+    h->llc_ctrl = LLC_PDU_TYPE_U;
+}
+
 static bridge_t * create_br(int if_index)
 {
     bridge_t *br;
@@ -60,7 +115,7 @@ static bridge_t * create_br(int if_index)
         goto err;
 
     INFO("Add bridge %s", br->sysdeps.name);
-    if(!MSTP_IN_bridge_create(br, br->sysdeps.macaddr))
+    if(!MSTP_IN_bridge_create(&engine, br, br->sysdeps.macaddr))
         goto err;
 
     list_add_tail(&br->list, &bridges);
@@ -81,6 +136,171 @@ static bridge_t * find_br(int if_index)
     return NULL;
 }
 
+void bridge_set_warm_start(bool enable)
+{
+    warm_start = enable;
+}
+
+void bridge_set_rx_fast_path(bool enable)
+{
+    MSTP_IN_set_rx_fast_path(&engine, enable);
+}
+
+void bridge_set_auto_adopt(bool enable)
+{
+    auto_adopt = enable;
+}
+
+int bridge_add_auto_adopt_name(const char *name)
+{
+    void *p;
+
+    if(strlen(name) >= IFNAMSIZ)
+        return -1;
+    p = realloc(adopt_names, (num_adopt_names + 1) * sizeof(*adopt_names));
+    TST(p != NULL, -1);
+    adopt_names = p;
+    strcpy(adopt_names[num_adopt_names++], name);
+    return 0;
+}
+
+static bool may_adopt(const char *name)
+{
+    int i;
+
+    if(!num_adopt_names)
+        return true;
+    for(i = 0; i < num_adopt_names; ++i)
+        if(0 == strcmp(adopt_names[i], name))
+            return true;
+    return false;
+}
+
+/* Called by dump_port_states() for every bridge port */
+void bridge_port_kernel_state(int if_index, int state)
+{
+    void *p;
+
+    if(!(num_kernel_states & 0x3F))
+    {
+        p = realloc(kernel_states,
+                    (num_kernel_states + 0x40) * sizeof(*kernel_states));
+        TST(p != NULL,);
+        kernel_states = p;
+    }
+    kernel_states[num_kernel_states].if_index = if_index;
+    kernel_states[num_kernel_states].state = state;
+    ++num_kernel_states;
+}
+
+static void forget_kernel_states(void)
+{
+    free(kernel_states);
+    kernel_states = NULL;
+    num_kernel_states = 0;
+}
+
+static bool kernel_port_forwarding(int if_index)
+{
+    int i;
+
+    for(i = 0; i < num_kernel_states; ++i)
+        if(kernel_states[i].if_index == if_index)
+            return BR_STATE_FORWARDING == kernel_states[i].state;
+    return false;
+}
+
+/* The adopted state of the port is either confirmed or given up */
+static void warm_release(port_t *prt, const char *reason)
+{
+    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
+
+    INFO_PRTNAME(prt->bridge, prt, "Adopted forwarding state %s", reason);
+    prt->sysdeps.warm_hold = 0;
+    if(BR_STATE_FORWARDING != prt->sysdeps.warm_state)
+    {
+        MSTP_OUT_set_state(cist, prt->sysdeps.warm_state);
+        MSTP_IN_port_status_changed(cist);
+    }
+}
+
+/* Received information blocks the port: the adopted forwarding state must
+ * go at once, the port could close a loop. The discarding state requested by
+ * the state machines starting from BEGIN doesn't mean that. */
+static bool warm_port_blocked(per_tree_port_t *cist)
+{
+    return ioReceived == cist->infoIs
+           && (roleAlternate == cist->role || roleBackup == cist->role);
+}
+
+/* After every run of the state machines: a role change blocking the port
+ * doesn't call MSTP_OUT_set_state(), the port being discarding for the state
+ * machines already */
+static void warm_hold_check(bridge_t *br)
+{
+    port_t *prt;
+
+    if(!warm_start)
+        return;
+    list_for_each_entry(prt, &br->ports, br_list)
+        if(prt->sysdeps.warm_hold
+           && warm_port_blocked(GET_CIST_PTP_FROM_PORT(prt)))
+            warm_release(prt, "dropped, port is not designated");
+}
+
+static void warm_hold_tick(bridge_t *br)
+{
+    port_t *prt;
+    per_tree_port_t *cist;
+
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        if(!prt->sysdeps.warm_hold)
+            continue;
+        cist = GET_CIST_PTP_FROM_PORT(prt);
+        /* The state machines don't call MSTP_OUT_set_state() for
+         * the forwarding state which the port already has */
+        if(cist->forwarding)
+        {
+            prt->sysdeps.warm_state = BR_STATE_FORWARDING;
+            warm_release(prt, "confirmed");
+        }
+        /* Ports found down when added */
+        else if(!prt->sysdeps.up)
+            warm_release(prt, "dropped, port is down");
+        else if(0 == --(prt->sysdeps.warm_hold))
+            warm_release(prt, "timed out");
+    }
+}
+
+/* Tell the kernel filter which BPDUs of the port mstpd wants.
+ * The kernel drops the BPDUs over the rate limit, unless mstpd has to keep
+ * the latest of them. */
+static void update_kernel_filter(port_t *prt)
+{
+    packet_port_set(prt->sysdeps.if_index,
+                    (prt->bpduFilterPort ? PACKET_PORT_FILTER : 0)
+                    | (prt->BpduGuardPort ? PACKET_PORT_GUARD : 0),
+                    (prt->BpduGuardPort || prt->bpduRateKeepLatest)
+                        ? 0 : prt->bpduRateLimit);
+}
+
+/* Count the BPDUs dropped by the kernel filter since the last time */
+static void count_kernel_filtered(port_t *prt)
+{
+    unsigned long long filtered, limited;
+
+    packet_port_dropped(prt->sysdeps.if_index, &filtered, &limited);
+    if(filtered > prt->sysdeps.kernel_filtered)
+        MSTP_IN_rx_bpdus_filtered(prt,
+                                  filtered - prt->sysdeps.kernel_filtered);
+    prt->sysdeps.kernel_filtered = filtered;
+    if(limited > prt->sysdeps.kernel_rate_limited)
+        MSTP_IN_rx_bpdus_rate_limited(prt,
+                                limited - prt->sysdeps.kernel_rate_limited);
+    prt->sysdeps.kernel_rate_limited = limited;
+}
+
 static port_t * create_if(bridge_t * br, int if_index)
 {
     port_t *prt;
@@ -92,6 +312,7 @@ static port_t * create_if(bridge_t * br, int if_index)
         goto err;
     if (get_hwaddr(prt->sysdeps.name, prt->sysdeps.macaddr))
         goto err;
+    init_tx_llc_header(prt);
 
     int portno;
     if(0 > (portno = get_bridge_portno(prt->sysdeps.name)))
@@ -108,9 +329,21 @@ static port_t * create_if(bridge_t * br, int if_index)
     INFO("Add iface %s as port#%d to bridge %s", prt->sysdeps.name,
          portno, br->sysdeps.name);
     prt->bridge = br;
+    if(kernel_port_forwarding(if_index))
+    {
+        prt->sysdeps.warm_hold = 2 * br->Forward_Delay;
+        prt->sysdeps.warm_state = BR_STATE_BLOCKING;
+    }
     if(!MSTP_IN_port_create_and_add_tail(prt, portno))
         goto err;
+    update_kernel_filter(prt);
 
+    if(prt->sysdeps.warm_hold)
+    {
+        GET_CIST_PTP_FROM_PORT(prt)->state = BR_STATE_FORWARDING;
+        INFO_PRTNAME(br, prt, "Keeping forwarding state for up to %u s",
+                     prt->sysdeps.warm_hold);
+    }
     return prt;
 err:
     free(prt);
@@ -130,6 +363,7 @@ static port_t * find_if(bridge_t * br, int if_index)
 
 static inline void delete_if(port_t *prt)
 {
+    packet_port_del(prt->sysdeps.if_index);
     MSTP_IN_delete_port(prt);
     free(prt);
 }
@@ -160,8 +394,24 @@ static bool delete_br_byindex(int if_index)
 void bridge_one_second(void)
 {
     bridge_t *br;
+    port_t *prt;
     list_for_each_entry(br, &bridges, list)
+    {
+        warm_hold_tick(br);
+        /* The rate limit engages on the drops of the kernel too */
+        list_for_each_entry(prt, &br->ports, br_list)
+            if(prt->bpduRateLimit)
+                count_kernel_filtered(prt);
         MSTP_IN_one_second(br);
+    }
+}
+
+/* Return true if some bridges still have state machines work pending */
+bool bridge_run_deferred(void)
+{
+    if(!list_empty(&engine.deferred_bridges))
+        record_input(RECORD_DEFERRED, 0, 0, NULL, 0);
+    return MSTP_IN_run_deferred(&engine);
 }
 
 /* New MAC address is stored in addr, which also holds the old value on entry.
@@ -186,6 +436,7 @@ static bool check_mac_address(char *name, __u8 *addr)
 
 static void set_br_up(bridge_t * br, bool up)
 {
+    port_t *prt;
     bool changed = false;
 
     if(up != br->sysdeps.up)
@@ -204,7 +455,14 @@ static void set_br_up(bridge_t * br, bool up)
     }
 
     if(changed)
+    {
+        /* The kernel disables the ports of a bridge which is down */
+        if(!up)
+            list_for_each_entry(prt, &br->ports, br_list)
+                if(prt->sysdeps.warm_hold)
+                    warm_release(prt, "dropped, bridge is down");
         MSTP_IN_set_bridge_enable(br, br->sysdeps.up);
+    }
 }
 
 static void set_if_up(port_t *prt, bool up)
@@ -217,6 +475,7 @@ static void set_if_up(port_t *prt, bool up)
     if(check_mac_address(prt->sysdeps.name, prt->sysdeps.macaddr))
     {
         /* MAC address changed */
+        init_tx_llc_header(prt);
         if(check_mac_address(prt->bridge->sysdeps.name,
            prt->bridge->sysdeps.macaddr))
         {
@@ -232,6 +491,8 @@ static void set_if_up(port_t *prt, bool up)
         {
             prt->sysdeps.up = false;
             changed = true;
+            if(prt->sysdeps.warm_hold)
+                warm_release(prt, "dropped, port is down");
         }
     }
     else
@@ -256,6 +517,9 @@ static void set_if_up(port_t *prt, bool up)
         {
             prt->sysdeps.up = true;
             changed = true;
+            /* Start over, as the engine does with the counts of the port */
+            memset(&prt->sysdeps.latency, 0, sizeof(prt->sysdeps.latency));
+            memset(&prt->sysdeps.last_tx, 0, sizeof(prt->sysdeps.last_tx));
         }
     }
     if(changed)
@@ -305,7 +569,16 @@ int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
                         break;
                     }
             }
-            prt = create_if(br, if_index);
+            /* The new port comes up with its configured parameters */
+            MSTP_IN_begin_config(br);
+            if(NULL != (prt = create_if(br, if_index)))
+            {
+                conf_file_apply(br);
+                set_if_up(prt, running); /* And speed and duplex */
+            }
+            MSTP_IN_end_config(br);
+            if(prt)
+                return 0;
         }
         if(!prt)
         {
@@ -347,29 +620,32 @@ int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
     return 0;
 }
 
-struct llc_header
+/* second - first, in microseconds */
+static long long time_diff_us(const struct timespec *second,
+                              const struct timespec *first)
 {
-    __u8 dest_addr[ETH_ALEN];
-    __u8 src_addr[ETH_ALEN];
-    __be16 len8023;
-    __u8 d_sap;
-    __u8 s_sap;
-    __u8 llc_ctrl;
-} __attribute__((packed));
-
-/* LLC_PDU_xxx defines snitched from linux/net/llc_pdu.h */
-#define LLC_PDU_LEN_U   3   /* header and 1 control byte */
-#define LLC_PDU_TYPE_U  3   /* first two bits */
+    return (second->tv_sec - first->tv_sec) * 1000000LL
+           + (second->tv_nsec - first->tv_nsec) / 1000;
+}
 
-/* 7.12.3 of 802.1D */
-#define LLC_SAP_BSPAN   0x42
-static const __u8 bridge_group_address[ETH_ALEN] =
+static void latency_add(latency_stats_t *l, long long us)
 {
-    0x01, 0x80, 0xc2, 0x00, 0x00, 0x00
-};
+    /* The realtime clock may step back */
+    if(0 > us)
+        us = 0;
+    if(UINT_MAX < us)
+        us = UINT_MAX;
+    l->last = us;
+    if(l->max < l->last)
+        l->max = l->last;
+    l->total += l->last;
+    ++(l->count);
+}
 
-void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
+void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len,
+                     const struct timespec *rx_time)
 {
+    struct timespec now, read_time;
     port_t *prt = NULL;
     bridge_t *br;
 
@@ -405,67 +681,45 @@ void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
     TST(l <= ETH_DATA_LEN && l <= len - ETH_HLEN && l >= LLC_PDU_LEN_U, );
     TST(h->d_sap == LLC_SAP_BSPAN && h->s_sap == LLC_SAP_BSPAN && (h->llc_ctrl & 0x3) == LLC_PDU_TYPE_U,);
 
+    if(rx_time)
+    {
+        clock_gettime(CLOCK_REALTIME, &now);
+        latency_add(&prt->sysdeps.latency.rx_queue,
+                    time_diff_us(&now, rx_time));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &read_time);
+
     MSTP_IN_rx_bpdu(prt,
                     /* Don't include LLC header */
                     (bpdu_t *)(data + sizeof(*h)), l - LLC_PDU_LEN_U);
-}
-
-static int br_set_state(struct rtnl_handle *rth, unsigned ifindex, __u8 state)
-{
-    struct
-    {
-        struct nlmsghdr n;
-        struct ifinfomsg ifi;
-        char buf[256];
-    } req;
-
-    memset(&req, 0, sizeof(req));
 
-    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_REPLACE;
-    req.n.nlmsg_type = RTM_SETLINK;
-    req.ifi.ifi_family = AF_BRIDGE;
-    req.ifi.ifi_index = ifindex;
-
-    addattr8(&req.n, sizeof(req.buf), IFLA_PROTINFO, state);
-
-    return rtnl_talk(rth, &req.n, 0, 0, NULL, NULL, NULL);
-}
-
-static int br_flush_port(char *ifname)
-{
-    char fname[128];
-    snprintf(fname, sizeof(fname), SYSFS_CLASS_NET "/%s/brport/flush", ifname);
-    int fd = open(fname, O_WRONLY);
-    TSTM(0 <= fd, -1, "Couldn't open flush file %s for write: %m", fname);
-    int write_result = write(fd, "1", 1);
-    close(fd);
-    TST(1 == write_result, -1);
-    return 0;
-}
-
-static int br_set_ageing_time(char *brname, unsigned int ageing_time)
-{
-    char fname[128], str_time[32];
-    snprintf(fname, sizeof(fname), SYSFS_CLASS_NET "/%s/bridge/ageing_time",
-             brname);
-    int fd = open(fname, O_WRONLY);
-    TSTM(0 <= fd, -1, "Couldn't open file %s for write: %m", fname);
-    int len = sprintf(str_time, "%u", ageing_time * HZ);
-    int write_result = write(fd, str_time, len);
-    close(fd);
-    TST(len == write_result, -1);
-    return 0;
+    /* The engine runs the state machines before returning, unless they
+     * are out of budget: the rest of the run is not counted then */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    latency_add(&prt->sysdeps.latency.rx_processing,
+                time_diff_us(&now, &read_time));
 }
 
 /* External actions for MSTP protocol */
 
-void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
+static void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
 {
     char * state_name;
     port_t *prt = ptp->port;
     bridge_t *br = prt->bridge;
 
+    if(restoring)
+        return;
+    if(prt->sysdeps.warm_hold && (0 == ptp->MSTID))
+    {
+        prt->sysdeps.warm_state = new_state;
+        if(BR_STATE_FORWARDING == new_state)
+            warm_release(prt, "confirmed");
+        else if(warm_port_blocked(ptp))
+            warm_release(prt, "dropped, port is not designated");
+        else
+            return;
+    }
     if(ptp->state == new_state)
         return;
     ptp->state = driver_set_new_state(ptp, new_state);
@@ -492,14 +746,6 @@ void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
             break;
     }
     INFO_MSTINAME(br, prt, ptp, "entering %s state", state_name);
-
-    /* Translate new CIST state to the kernel bridge code */
-    if(0 == ptp->MSTID)
-    { /* CIST */
-        if(0 > br_set_state(&rth_state, prt->sysdeps.if_index, ptp->state))
-            ERROR_PRTNAME(br, prt, "Couldn't set kernel bridge state %s",
-                          state_name);
-    }
 }
 
 /* This function initiates process of flushing
@@ -508,45 +754,58 @@ void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
  * When this process finishes, implementation should signal
  * this by calling MSTP_IN_all_fids_flushed(per_tree_port_t *ptp)
  */
-void MSTP_OUT_flush_all_fids(per_tree_port_t * ptp)
+static void MSTP_OUT_flush_all_fids(per_tree_port_t * ptp)
 {
     port_t *prt = ptp->port;
     bridge_t *br = prt->bridge;
 
-    /* Translate CIST flushing to the kernel bridge code */
-    if(0 == ptp->MSTID)
-    { /* CIST */
-        if(0 > br_flush_port(prt->sysdeps.name))
-            ERROR_PRTNAME(br, prt,
-                          "Couldn't flush kernel bridge forwarding database");
-    }
+    if(restoring)
+        return;
+
     /* Completion signal MSTP_IN_all_fids_flushed will be called by driver */
     INFO_MSTINAME(br, prt, ptp, "Flushing forwarding database");
     driver_flush_all_fids(ptp);
 }
 
-void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime)
+/* Completion of MSTP_OUT_flush_all_fids for an asynchronous driver */
+void bridge_track_fids_flushed(int br_index, int if_index, int mstid)
+{
+    bridge_t *br;
+    port_t *prt;
+    per_tree_port_t *ptp;
+
+    if(!(br = find_br(br_index)) || !(prt = find_if(br, if_index)))
+        return;
+    list_for_each_entry(ptp, &prt->trees, port_list)
+    {
+        if(__be16_to_cpu(ptp->MSTID) == mstid)
+        {
+            MSTP_IN_all_fids_flushed(ptp);
+            return;
+        }
+    }
+}
+
+static void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime)
 {
     unsigned int actual_ageing_time;
     bridge_t *br = prt->bridge;
 
+    if(restoring)
+        return;
+
     actual_ageing_time = driver_set_ageing_time(prt, ageingTime);
     INFO_PRTNAME(br, prt, "Setting new ageing time to %u", actual_ageing_time);
-
-    /*
-     * Translate new ageing time to the kernel bridge code.
-     * Kernel bridging code does not support per-port ageing time,
-     * so set ageing time for the whole bridge.
-     */
-    if(0 > br_set_ageing_time(br->sysdeps.name, actual_ageing_time))
-        ERROR_BRNAME(br, "Couldn't set new ageing time in kernel bridge");
 }
 
-void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
+static void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
 {
     char *bpdu_type, *tcflag;
     bridge_t *br = prt->bridge;
 
+    if(restoring)
+        return;
+
     switch(bpdu->protocolVersion)
     {
         case protoSTP:
@@ -589,28 +848,104 @@ void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t * bpdu, int size)
         LOG_PRTNAME(br, prt, "sending %s BPDU%s", bpdu_type, tcflag);
     }
 
-    struct llc_header h;
-    memcpy(h.dest_addr, bridge_group_address, ETH_ALEN);
-    memcpy(h.src_addr, prt->sysdeps.macaddr, ETH_ALEN);
-    h.len8023 = __cpu_to_be16(size + LLC_PDU_LEN_U);
-    h.d_sap = h.s_sap = LLC_SAP_BSPAN;
-    h.llc_ctrl = LLC_PDU_TYPE_U;
+    struct llc_header *h = &prt->sysdeps.tx_llc_header;
+    h->len8023 = __cpu_to_be16(size + LLC_PDU_LEN_U);
 
     struct iovec iov[2] =
     {
-        { .iov_base = &h, .iov_len = sizeof(h) },
+        { .iov_base = h, .iov_len = sizeof(*h) },
         { .iov_base = bpdu, .iov_len = size }
     };
 
-    packet_send(prt->sysdeps.if_index, iov, 2, sizeof(h) + size);
+    packet_send(prt->sysdeps.if_index, iov, 2, sizeof(*h) + size);
+}
+
+/* The kernel took the BPDU, which may have been queued for a while */
+void bridge_bpdu_sent(int if_index)
+{
+    struct timespec now;
+    port_t *prt = NULL;
+    bridge_t *br;
+
+    list_for_each_entry(br, &bridges, list)
+    {
+        if((prt = find_if(br, if_index)))
+            break;
+    }
+    if(!prt)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(prt->sysdeps.last_tx.tv_sec)
+        latency_add(&prt->sysdeps.latency.tx_bpdu_interval,
+                    time_diff_us(&now, &prt->sysdeps.last_tx));
+    prt->sysdeps.last_tx = now;
+}
+
+void bridge_bpdu_tx_error(int if_index)
+{
+    port_t *prt = NULL;
+    bridge_t *br;
+
+    list_for_each_entry(br, &bridges, list)
+    {
+        if((prt = find_if(br, if_index)))
+        {
+            ++(prt->num_tx_errors);
+            MSTP_IN_port_status_changed(GET_CIST_PTP_FROM_PORT(prt));
+            return;
+        }
+    }
 }
 
-void MSTP_OUT_shutdown_port(port_t *prt)
+static void MSTP_OUT_shutdown_port(port_t *prt)
 {
+    if(restoring)
+        return;
     if(0 > if_shutdown(prt->sysdeps.name))
         ERROR_PRTNAME(prt->bridge, prt, "Couldn't shutdown port");
 }
 
+/* The messages of mstp.c: PRINT, as log.h does */
+static void MSTP_OUT_log(mstp_engine_t *eng, int level, const char *func,
+                         const char *fmt, va_list ap)
+{
+    char msg[256];
+
+    if(level > log_level)
+        return;
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    if(LOG_LEVEL_ERROR == level)
+    {
+        PRINT(level, "error, %s: %s", func, msg);
+        ctl_err_log("%s\n", msg);
+    }
+    else
+        PRINT(level, "%s: %s", func, msg);
+}
+
+static const mstp_ops_t mstp_ops =
+{
+    .set_state = MSTP_OUT_set_state,
+    .flush_all_fids = MSTP_OUT_flush_all_fids,
+    .set_ageing_time = MSTP_OUT_set_ageing_time,
+    .tx_bpdu = MSTP_OUT_tx_bpdu,
+    .shutdown_port = MSTP_OUT_shutdown_port,
+    .create_bridge = driver_create_bridge,
+    .create_port = driver_create_port,
+    .delete_bridge = driver_delete_bridge,
+    .delete_port = driver_delete_port,
+    .state_machines_ran = warm_hold_check,
+    .log = MSTP_OUT_log,
+};
+
+static mstp_engine_t engine =
+{
+    .ops = &mstp_ops,
+    .rx_fast_path = true,
+    .deferred_bridges = LIST_HEAD_INIT(engine.deferred_bridges),
+};
+
 /* User interface commands */
 
 #define CTL_CHECK_BRIDGE                                       \
@@ -720,6 +1055,7 @@ int CTL_get_cist_port_status(int br_index, int port_index,
                              CIST_PortStatus *status)
 {
     CTL_CHECK_BRIDGE_PORT;
+    count_kernel_filtered(prt);
     MSTP_IN_get_cist_port_status(prt, status);
     return 0;
 }
@@ -735,8 +1071,12 @@ int CTL_get_msti_port_status(int br_index, int port_index, __u16 mstid,
 int CTL_set_cist_port_config(int br_index, int port_index,
                              CIST_PortConfig *cfg)
 {
+    int r;
+
     CTL_CHECK_BRIDGE_PORT;
-    return MSTP_IN_set_cist_port_config(prt, cfg);
+    r = MSTP_IN_set_cist_port_config(prt, cfg);
+    update_kernel_filter(prt);
+    return r;
 }
 
 int CTL_set_msti_port_config(int br_index, int port_index, __u16 mstid,
@@ -746,6 +1086,75 @@ int CTL_set_msti_port_config(int br_index, int port_index, __u16 mstid,
     return MSTP_IN_set_msti_port_config(ptp, cfg);
 }
 
+/* The bulk setters below apply none of the entries if one of them is bad */
+
+int CTL_set_cist_port_configs(int br_index, int num_entries,
+                              CIST_PortConfigEntry *entries)
+{
+    int i;
+    port_t *prt;
+
+    CTL_CHECK_BRIDGE;
+    for(i = 0; i < num_entries; ++i)
+    {
+        if(NULL == find_if(br, entries[i].port_index))
+        {
+            ERROR_BRNAME(br, "Couldn't find port with index %d",
+                         entries[i].port_index);
+            return -1;
+        }
+    }
+
+    MSTP_IN_begin_config(br);
+    for(i = 0; i < num_entries; ++i)
+    {
+        prt = find_if(br, entries[i].port_index);
+        MSTP_IN_set_cist_port_config(prt, &entries[i].cfg);
+        update_kernel_filter(prt);
+    }
+    MSTP_IN_end_config(br);
+    return 0;
+}
+
+static per_tree_port_t *find_ptp(bridge_t *br, const MSTI_PortConfigEntry *e)
+{
+    port_t *prt;
+    per_tree_port_t *ptp;
+
+    if(NULL == (prt = find_if(br, e->port_index)))
+    {
+        ERROR_BRNAME(br, "Couldn't find port with index %d", e->port_index);
+        return NULL;
+    }
+    list_for_each_entry(ptp, &prt->trees, port_list)
+        if(ptp->MSTID == __cpu_to_be16(e->mstid))
+            return ptp;
+    ERROR_PRTNAME(br, prt, "Couldn't find MSTI with ID %hu", e->mstid);
+    return NULL;
+}
+
+int CTL_set_msti_port_configs(int br_index, int num_entries,
+                              MSTI_PortConfigEntry *entries)
+{
+    int i;
+    per_tree_port_t *ptp;
+
+    CTL_CHECK_BRIDGE;
+    for(i = 0; i < num_entries; ++i)
+    {
+        if((NULL == (ptp = find_ptp(br, &entries[i])))
+           || MSTP_IN_check_msti_port_config(ptp, &entries[i].cfg))
+            return -1;
+    }
+
+    MSTP_IN_begin_config(br);
+    for(i = 0; i < num_entries; ++i)
+        MSTP_IN_set_msti_port_config(find_ptp(br, &entries[i]),
+                                     &entries[i].cfg);
+    MSTP_IN_end_config(br);
+    return 0;
+}
+
 int CTL_port_mcheck(int br_index, int port_index)
 {
     CTL_CHECK_BRIDGE_PORT;
@@ -759,6 +1168,12 @@ int CTL_set_debug_level(int level)
     return 0;
 }
 
+int CTL_get_loop_stats(epoll_loop_stats_t *stats)
+{
+    epoll_get_stats(stats);
+    return 0;
+}
+
 int CTL_get_mstilist(int br_index, int *num_mstis, __u16 *mstids)
 {
     CTL_CHECK_BRIDGE;
@@ -835,6 +1250,151 @@ int CTL_set_fids2mstids(int br_index, __u16 *fids2mstids)
     return MSTP_IN_set_all_fids2mstids(br, fids2mstids) ? 0 : -1;
 }
 
+int CTL_set_vid2fid_ranges(int br_index, int num_entries, MapRange *entries,
+                           int *num_changed, __u16 *changed_mstids)
+{
+    CTL_CHECK_BRIDGE;
+    return MSTP_IN_set_vid2fid_ranges(br, num_entries, entries, num_changed,
+                                      changed_mstids) ? 0 : -1;
+}
+
+int CTL_set_fid2mstid_ranges(int br_index, int num_entries, MapRange *entries,
+                             int *num_changed, __u16 *changed_mstids)
+{
+    CTL_CHECK_BRIDGE;
+    return MSTP_IN_set_fid2mstid_ranges(br, num_entries, entries, num_changed,
+                                        changed_mstids) ? 0 : -1;
+}
+
+/* Encode map[first..last] as ranges of equal values, at most
+ * MAP_RANGES_PER_REPLY of them; the client asks for the rest with
+ * first = entries[num_entries - 1].hi + 1 */
+#define GET_MAP_RANGES(map, to_cpu)                                    \
+    ({                                                                 \
+        int n = 0, i = first;                                          \
+        if((first < min) || (first > max))                             \
+            return -1;                                                 \
+        while((i <= max) && (n < MAP_RANGES_PER_REPLY))                \
+        {                                                              \
+            entries[n].lo = i;                                         \
+            entries[n].value = to_cpu(map[i]);                         \
+            while((i < max) && (map[i + 1] == map[i]))                 \
+                ++i;                                                   \
+            entries[n++].hi = i++;                                     \
+        }                                                              \
+        *num_entries = n;                                              \
+    })
+
+int CTL_get_vid2fid_ranges(int br_index, __u16 first, int *num_entries,
+                           MapRange *entries)
+{
+    const int min = 1, max = MAX_VID;
+    CTL_CHECK_BRIDGE;
+    GET_MAP_RANGES(br->vid2fid, (__u16));
+    return 0;
+}
+
+int CTL_get_fid2mstid_ranges(int br_index, __u16 first, int *num_entries,
+                             MapRange *entries)
+{
+    const int min = 0, max = MAX_FID;
+    CTL_CHECK_BRIDGE;
+    GET_MAP_RANGES(br->fid2mstid, __be16_to_cpu);
+    return 0;
+}
+
+int CTL_get_port_latency(int br_index, int port_index,
+                         port_latency_t *latency)
+{
+    CTL_CHECK_BRIDGE_PORT;
+    *latency = prt->sysdeps.latency;
+    return 0;
+}
+
+int CTL_get_changes(int br_index, __u64 since, __u64 *generation,
+                    int *num_entries, ChangeEntry *entries)
+{
+    mstp_change_t changes[CHANGES_PER_REPLY];
+    port_t *prt;
+    int n, i;
+
+    CTL_CHECK_BRIDGE;
+    list_for_each_entry(prt, &br->ports, br_list)
+        count_kernel_filtered(prt);
+    if(0 > (n = MSTP_IN_get_changes(br, since, CHANGES_PER_REPLY, changes)))
+        return -1;
+    for(i = 0; i < n; ++i)
+    {
+        ChangeEntry *e = &entries[i];
+
+        memset(e, 0, sizeof(*e));
+        e->generation = changes[i].generation;
+        e->type = changes[i].type;
+        switch(changes[i].type)
+        {
+            case MSTP_CHANGE_BRIDGE:
+                MSTP_IN_get_cist_bridge_status(br, &e->s.bridge);
+                break;
+            case MSTP_CHANGE_TREE:
+                e->mstid = __be16_to_cpu(changes[i].tree->MSTID);
+                MSTP_IN_get_msti_bridge_status(changes[i].tree, &e->s.tree);
+                break;
+            case MSTP_CHANGE_PORT:
+                e->port_index = changes[i].port->sysdeps.if_index;
+                MSTP_IN_get_cist_port_status(changes[i].port, &e->s.port);
+                break;
+            case MSTP_CHANGE_TREE_PORT:
+                e->port_index = changes[i].ptp->port->sysdeps.if_index;
+                e->mstid = __be16_to_cpu(changes[i].ptp->MSTID);
+                MSTP_IN_get_msti_port_status(changes[i].ptp,
+                                             &e->s.tree_port);
+                break;
+        }
+    }
+    *num_entries = n;
+    *generation = br->engine->generation;
+    return 0;
+}
+
+/* Called for every netlink report of the STP state of a bridge */
+void bridge_stp_state(int br_index, int stp_state)
+{
+    char name[IFNAMSIZ];
+    bridge_t *br;
+    int br_flags;
+
+    if(!auto_adopt || !index_to_name(br_index, name) || !may_adopt(name))
+        return;
+
+    br = find_br(br_index);
+    if(BR_USER_STP != stp_state)
+    {
+        if(br)
+            delete_br_byindex(br_index);
+        return;
+    }
+    if(br)
+        return;
+
+    if(warm_start && dump_port_states())
+        ERROR("Couldn't read kernel port states, warm start is disabled");
+    if(NULL == (br = create_br(br_index)))
+    {
+        ERROR("Couldn't create data for bridge interface %d", br_index);
+        forget_kernel_states();
+        return;
+    }
+    INFO_BRNAME(br, "Adopted: STP is in user space");
+    MSTP_IN_begin_config(br);
+    if(0 <= (br_flags = get_flags(br->sysdeps.name)))
+        set_br_up(br, !!(br_flags & IFF_UP));
+    if(dump_bridge_ports(br_index))
+        ERROR_BRNAME(br, "Couldn't read the list of ports");
+    conf_file_apply(br);
+    MSTP_IN_end_config(br);
+    forget_kernel_states();
+}
+
 int CTL_add_bridges(int *br_array, int* *ifaces_lists)
 {
     int i, j, ifcount, brcount = br_array[0];
@@ -844,6 +1404,9 @@ int CTL_add_bridges(int *br_array, int* *ifaces_lists)
     int *if_array;
     bool found;
 
+    if(warm_start && dump_port_states())
+        ERROR("Couldn't read kernel port states, warm start is disabled");
+
     for(i = 1; i <= brcount; ++i)
     {
         if(NULL == (br = find_br(br_array[i])))
@@ -852,11 +1415,13 @@ int CTL_add_bridges(int *br_array, int* *ifaces_lists)
             {
                 ERROR("Couldn't create data for bridge interface %d",
                       br_array[i]);
+                forget_kernel_states();
                 return -1;
             }
             if(0 <= (br_flags = get_flags(br->sysdeps.name)))
                 set_br_up(br, !!(br_flags & IFF_UP));
         }
+        MSTP_IN_begin_config(br);
         if_array = ifaces_lists[i - 1];
         ifcount = if_array[0];
         /* delete all interfaces which are not in list */
@@ -903,8 +1468,11 @@ int CTL_add_bridges(int *br_array, int* *ifaces_lists)
                                (if_flags & (IFF_UP | IFF_RUNNING))
                          );
         }
+        conf_file_apply(br);
+        MSTP_IN_end_config(br);
     }
 
+    forget_kernel_states();
     return 0;
 }
 
@@ -918,6 +1486,18 @@ int CTL_del_bridges(int *br_array)
     return 0;
 }
 
+void bridge_track_reconfigure(void)
+{
+    bridge_t *br;
+
+    list_for_each_entry(br, &bridges, list)
+    {
+        MSTP_IN_begin_config(br);
+        conf_file_apply(br);
+        MSTP_IN_end_config(br);
+    }
+}
+
 int bridge_track_fini(void)
 {
     INFO("Stopping all bridges");
@@ -928,3 +1508,235 @@ int bridge_track_fini(void)
     }
     return 0;
 }
+
+/* Hitless restart.
+ * The state of all bridges is saved as raw copies of the MSTP structures,
+ * so it can only be restored by an mstpd which has the same layout of them.
+ * SNAPSHOT_VERSION must be bumped whenever the meaning of some field changes
+ * without changing the size of the structures.
+ *
+ * Layout: snapshot_hdr_t, then for every bridge: snapshot_br_hdr_t,
+ * bridge_t, num_trees * tree_t (CIST first), then for every port:
+ * port_t, num_trees * per_tree_port_t (CIST first).
+ */
+#define SNAPSHOT_VERSION    1
+
+typedef struct
+{
+    __u32 version;
+    __u32 bridge_size, tree_size, port_size, ptp_size;
+    __u32 num_bridges;
+} snapshot_hdr_t;
+
+typedef struct
+{
+    __u32 num_trees;
+    __u32 num_ports;
+} snapshot_br_hdr_t;
+
+static void snapshot_count(bridge_t *br, snapshot_br_hdr_t *bh)
+{
+    struct list_head *l;
+
+    bh->num_trees = bh->num_ports = 0;
+    list_for_each(l, &br->trees)
+        ++(bh->num_trees);
+    list_for_each(l, &br->ports)
+        ++(bh->num_ports);
+}
+
+static inline size_t snapshot_br_len(const snapshot_br_hdr_t *bh)
+{
+    return sizeof(*bh) + sizeof(bridge_t) + bh->num_trees * sizeof(tree_t)
+           + bh->num_ports * (sizeof(port_t)
+                              + bh->num_trees * sizeof(per_tree_port_t));
+}
+
+#define SNAPSHOT_PUT(p, x) ({ memcpy((p), (x), sizeof(*(x))); \
+                              (p) += sizeof(*(x)); })
+
+/* Allocates the buffer, which the caller must free */
+int bridge_track_snapshot(void **buf, size_t *len)
+{
+    snapshot_hdr_t hdr =
+    {
+        .version = SNAPSHOT_VERSION,
+        .bridge_size = sizeof(bridge_t),
+        .tree_size = sizeof(tree_t),
+        .port_size = sizeof(port_t),
+        .ptp_size = sizeof(per_tree_port_t),
+        .num_bridges = 0,
+    };
+    snapshot_br_hdr_t bh;
+    bridge_t *br;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    __u8 *p;
+
+    *len = sizeof(hdr);
+    list_for_each_entry(br, &bridges, list)
+    {
+        /* The next instance starts with a new kernel filter */
+        list_for_each_entry(prt, &br->ports, br_list)
+            count_kernel_filtered(prt);
+        snapshot_count(br, &bh);
+        *len += snapshot_br_len(&bh);
+        ++hdr.num_bridges;
+    }
+
+    TST((*buf = malloc(*len)) != NULL, -1);
+
+    p = *buf;
+    SNAPSHOT_PUT(p, &hdr);
+    list_for_each_entry(br, &bridges, list)
+    {
+        snapshot_count(br, &bh);
+        SNAPSHOT_PUT(p, &bh);
+        SNAPSHOT_PUT(p, br);
+        list_for_each_entry(tree, &br->trees, bridge_list)
+            SNAPSHOT_PUT(p, tree);
+        list_for_each_entry(prt, &br->ports, br_list)
+        {
+            SNAPSHOT_PUT(p, prt);
+            list_for_each_entry(ptp, &prt->trees, port_list)
+                SNAPSHOT_PUT(p, ptp);
+        }
+    }
+
+    return 0;
+}
+
+/* Check that the snapshot was taken by a compatible mstpd and is complete */
+bool bridge_track_snapshot_valid(const void *buf, size_t len)
+{
+    const snapshot_hdr_t *hdr = buf;
+    const snapshot_br_hdr_t *bh;
+    size_t offset = sizeof(*hdr);
+    int i;
+
+    if(len < sizeof(*hdr))
+        return false;
+    if(SNAPSHOT_VERSION != hdr->version
+       || sizeof(bridge_t) != hdr->bridge_size
+       || sizeof(tree_t) != hdr->tree_size
+       || sizeof(port_t) != hdr->port_size
+       || sizeof(per_tree_port_t) != hdr->ptp_size)
+    {
+        ERROR("Incompatible snapshot: version %u, sizes %u/%u/%u/%u instead "
+              "of version %u, sizes %zu/%zu/%zu/%zu", hdr->version,
+              hdr->bridge_size, hdr->tree_size, hdr->port_size,
+              hdr->ptp_size, SNAPSHOT_VERSION, sizeof(bridge_t),
+              sizeof(tree_t), sizeof(port_t), sizeof(per_tree_port_t));
+        return false;
+    }
+
+    for(i = 0; i < hdr->num_bridges; ++i)
+    {
+        if(len - offset < sizeof(*bh))
+            goto truncated;
+        bh = buf + offset;
+        if(0 == bh->num_trees || (MAX_IMPLEMENTATION_MSTIS + 1) < bh->num_trees
+           || MAX_PORT_NUMBER < bh->num_ports)
+        {
+            ERROR("Bad snapshot: %u trees, %u ports",
+                  bh->num_trees, bh->num_ports);
+            return false;
+        }
+        if(len - offset < snapshot_br_len(bh))
+            goto truncated;
+        offset += snapshot_br_len(bh);
+    }
+    if(offset == len)
+        return true;
+
+truncated:
+    ERROR("Bad snapshot: length %zu", len);
+    return false;
+}
+
+static void restore_br(const snapshot_br_hdr_t *bh)
+{
+    const bridge_t *saved = (const void *)(bh + 1);
+    const tree_t *saved_trees = (const void *)(saved + 1);
+    const __u8 *saved_ports = (const void *)(saved_trees + bh->num_trees);
+    size_t port_len = sizeof(port_t) + bh->num_trees * sizeof(per_tree_port_t);
+    const port_t *saved_prt;
+    bridge_t *br;
+    port_t *prt;
+    struct list_head *l;
+    int i, num_trees = 0;
+
+    if(!(br = create_br(saved->sysdeps.if_index)))
+    {
+        ERROR("Couldn't restore bridge %s", saved->sysdeps.name);
+        return;
+    }
+    for(i = 1; i < bh->num_trees; ++i)
+        if(!MSTP_IN_create_msti(br, __be16_to_cpu(saved_trees[i].MSTID)))
+            break;
+    list_for_each(l, &br->trees)
+        ++num_trees;
+    if(num_trees != bh->num_trees)
+    {
+        ERROR("Couldn't restore MSTIs of bridge %s", br->sysdeps.name);
+        delete_br_byindex(br->sysdeps.if_index);
+        return;
+    }
+
+    /* Create all ports first: doing so runs the state machines,
+     * which can change the state of the ports restored before */
+    for(i = 0; i < bh->num_ports; ++i)
+    {
+        saved_prt = (const void *)(saved_ports + i * port_len);
+        if(!create_if(br, saved_prt->sysdeps.if_index))
+            INFO("Port %s of bridge %s is gone", saved_prt->sysdeps.name,
+                 br->sysdeps.name);
+    }
+
+    MSTP_IN_restore_bridge(br, saved, saved_trees);
+    br->sysdeps.up = saved->sysdeps.up;
+    memcpy(br->sysdeps.macaddr, saved->sysdeps.macaddr, ETH_ALEN);
+
+    list_for_each_entry(prt, &br->ports, br_list)
+    {
+        saved_prt = NULL;
+        for(i = 0; i < bh->num_ports; ++i)
+        {
+            saved_prt = (const void *)(saved_ports + i * port_len);
+            if(saved_prt->sysdeps.if_index == prt->sysdeps.if_index)
+                break;
+        }
+        if(!saved_prt || (i == bh->num_ports))
+            continue;
+        MSTP_IN_restore_port(prt, saved_prt,
+                             (const per_tree_port_t *)(saved_prt + 1));
+        /* Kernel changes after the snapshot will be detected the usual way,
+         * as changes relative to what the previous instance saw */
+        prt->sysdeps.up = saved_prt->sysdeps.up;
+        prt->sysdeps.speed = saved_prt->sysdeps.speed;
+        prt->sysdeps.duplex = saved_prt->sysdeps.duplex;
+        memcpy(prt->sysdeps.macaddr, saved_prt->sysdeps.macaddr, ETH_ALEN);
+        init_tx_llc_header(prt);
+        update_kernel_filter(prt);
+    }
+
+    INFO("Restored bridge %s", br->sysdeps.name);
+}
+
+/* The snapshot must have been checked with bridge_track_snapshot_valid() */
+void bridge_track_restore(const void *buf, size_t len)
+{
+    const snapshot_hdr_t *hdr = buf;
+    const __u8 *p = buf + sizeof(*hdr);
+    int i;
+
+    restoring = true;
+    for(i = 0; i < hdr->num_bridges; ++i)
+    {
+        const snapshot_br_hdr_t *bh = (const void *)p;
+        restore_br(bh);
+        p += snapshot_br_len(bh);
+    }
+    restoring = false;
+}
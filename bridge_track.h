@@ -21,6 +21,18 @@
 #ifndef MSTPD_BRIDGE_TRACK_H
 #define MSTPD_BRIDGE_TRACK_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 int bridge_track_fini(void);
+/* Apply the configuration file to all bridges */
+void bridge_track_reconfigure(void);
+
+/* A driver is done flushing the tree mstid of the port */
+void bridge_track_fids_flushed(int br_index, int if_index, int mstid);
+
+int bridge_track_snapshot(void **buf, size_t *len);
+bool bridge_track_snapshot_valid(const void *buf, size_t len);
+void bridge_track_restore(const void *buf, size_t len);
 
 #endif
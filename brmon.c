@@ -15,15 +15,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
+#include <linux/if_link.h>
 
 #include "log.h"
 #include "libnetlink.h"
 #include "bridge_ctl.h"
 #include "netif_utils.h"
 #include "epoll_loop.h"
+#include "handover.h"
+#include "record.h"
 
 /* RFC 2863 operational status */
 enum
@@ -58,6 +64,35 @@ static struct epoll_event_handler br_handler;
 
 struct rtnl_handle rth_state;
 
+/* Like parse_rtattr(), but also finds attributes flagged as nested */
+static struct rtattr *find_rta(struct rtattr *rta, int len,
+                               unsigned short type)
+{
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+        if(type == (rta->rta_type & NLA_TYPE_MASK))
+            return rta;
+    return NULL;
+}
+
+/* IFLA_BR_STP_STATE of a bridge, -1 if the link is not a bridge */
+static int bridge_stp_state_of(struct ifinfomsg *ifi, int len)
+{
+    struct rtattr *linkinfo, *kind, *data, *state;
+
+    if(!(linkinfo = find_rta(IFLA_RTA(ifi), len, IFLA_LINKINFO)))
+        return -1;
+    kind = find_rta(RTA_DATA(linkinfo), RTA_PAYLOAD(linkinfo),
+                    IFLA_INFO_KIND);
+    if(!kind || strncmp(RTA_DATA(kind), "bridge", RTA_PAYLOAD(kind)))
+        return -1;
+    data = find_rta(RTA_DATA(linkinfo), RTA_PAYLOAD(linkinfo),
+                    IFLA_INFO_DATA);
+    if(!data)
+        return -1;
+    state = find_rta(RTA_DATA(data), RTA_PAYLOAD(data), IFLA_BR_STP_STATE);
+    return state ? *(__u32 *)RTA_DATA(state) : -1;
+}
+
 static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
                     void *arg)
 {
@@ -72,6 +107,8 @@ static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
     if(n->nlmsg_type == NLMSG_DONE)
         return 0;
 
+    record_input(RECORD_NETLINK, 0, 0, n, n->nlmsg_len);
+
     len -= NLMSG_LENGTH(sizeof(*ifi));
     if(len < 0)
     {
@@ -163,20 +200,266 @@ static int dump_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
 
     bridge_notify(br_index, ifi->ifi_index, newlink, ifi->ifi_flags);
 
+    /* Bridges are reported with their STP state in AF_UNSPEC messages */
+    if(newlink && (AF_UNSPEC == af_family))
+    {
+        int stp_state = bridge_stp_state_of(ifi, len);
+        if(0 <= stp_state)
+            bridge_stp_state(ifi->ifi_index, stp_state);
+    }
+
     return 0;
 }
 
-static inline void br_ev_handler(uint32_t events, struct epoll_event_handler *h)
+void brmon_replay_msg(struct nlmsghdr *n)
 {
+    dump_msg(NULL, n, NULL);
+}
+
+static inline bool br_ev_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    /* rtnl_listen() reads until the socket is drained */
     if(rtnl_listen(&rth, dump_msg, stdout) < 0)
     {
         ERROR("Error on bridge monitoring socket\n");
     }
+    return false;
+}
+
+/* Links collected from a dump on rth_state. They are handled after the dump
+ * has finished, because the handling itself talks on rth_state. */
+typedef struct
+{
+    int num;
+    struct
+    {
+        int if_index;
+        int value;
+    } link[];
+} link_list_t;
+
+typedef struct
+{
+    link_list_t *list;
+    void *arg; /* of dump_links() */
+} dump_links_ctx_t;
+
+static int link_list_add(link_list_t **list, int if_index, int value)
+{
+    link_list_t *p = *list;
+
+    if(!(p->num & 0xF))
+    {
+        p = realloc(p, sizeof(*p) + (p->num + 0x10) * sizeof(p->link[0]));
+        if(!p)
+            return -1;
+        *list = p;
+    }
+    p->link[p->num].if_index = if_index;
+    p->link[p->num].value = value;
+    ++(p->num);
+    return 0;
+}
+
+/* A dump is recorded for mstpd-replay as the number of links, then one
+ * answer per link */
+static link_list_t *replay_links(link_list_t *list)
+{
+    int i, num, r, link[2];
+
+    record_replay_answer(RECORD_Q_LINKS, &num, NULL, 0);
+    for(i = 0; i < num; ++i)
+    {
+        record_replay_answer(RECORD_Q_LINK, &r, link, sizeof(link));
+        if(r || link_list_add(&list, link[0], link[1]))
+            num = -1;
+    }
+    if(0 <= num)
+        return list;
+    free(list);
+    return NULL;
+}
+
+static void record_links(link_list_t *list)
+{
+    int i;
+
+    record_answer(RECORD_Q_LINKS, list ? list->num : -1, NULL, 0);
+    for(i = 0; list && (i < list->num); ++i)
+        record_answer(RECORD_Q_LINK, 0, &list->link[i],
+                      sizeof(list->link[i]));
+}
+
+static link_list_t *dump_links(int family, rtnl_filter_t filter, void *arg)
+{
+    dump_links_ctx_t ctx = { calloc(1, sizeof(link_list_t)), arg };
+
+    if(!ctx.list)
+        return NULL;
+    if(record_replaying())
+        return replay_links(ctx.list);
+    if(rtnl_wilddump_request(&rth_state, family, RTM_GETLINK) < 0)
+    {
+        ERROR("Cannot send dump request: %m\n");
+        goto err;
+    }
+    if(rtnl_dump_filter(&rth_state, filter, &ctx, NULL, NULL) < 0)
+    {
+        ERROR("Dump terminated\n");
+        goto err;
+    }
+    record_links(ctx.list);
+    return ctx.list;
+err:
+    record_links(NULL);
+    free(ctx.list);
+    return NULL;
+}
+
+static int port_state_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                          void *arg)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    struct rtattr *rta, *protinfo = NULL, *master = NULL;
+    struct rtattr *prtb[IFLA_BRPORT_MAX + 1];
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    dump_links_ctx_t *ctx = arg;
+
+    if(n->nlmsg_type != RTM_NEWLINK || len < 0
+       || ifi->ifi_family != AF_BRIDGE)
+        return 0;
+
+    /* Not parse_rtattr(): newer kernels flag IFLA_PROTINFO as nested */
+    for(rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if(IFLA_PROTINFO == (rta->rta_type & NLA_TYPE_MASK))
+            protinfo = rta;
+        else if(IFLA_MASTER == rta->rta_type)
+            master = rta;
+    }
+    if(!master || !protinfo)
+        return 0;
+
+    /* Old kernels report the bare state */
+    if(1 == RTA_PAYLOAD(protinfo))
+        return link_list_add(&ctx->list, ifi->ifi_index,
+                             *(__u8 *)RTA_DATA(protinfo));
+    parse_rtattr_nested(prtb, IFLA_BRPORT_MAX, protinfo);
+    if(prtb[IFLA_BRPORT_STATE])
+        return link_list_add(&ctx->list, ifi->ifi_index,
+                             *(__u8 *)RTA_DATA(prtb[IFLA_BRPORT_STATE]));
+    return 0;
+}
+
+/* Read the kernel state of all bridge ports in one dump */
+int dump_port_states(void)
+{
+    link_list_t *ports = dump_links(PF_BRIDGE, port_state_msg, NULL);
+    int i;
+
+    if(!ports)
+        return -1;
+    for(i = 0; i < ports->num; ++i)
+        bridge_port_kernel_state(ports->link[i].if_index,
+                                 ports->link[i].value);
+    free(ports);
+    return 0;
+}
+
+static int bridge_port_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                           void *arg)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    struct rtattr *master;
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    dump_links_ctx_t *ctx = arg;
+    int br_index = *(int *)ctx->arg;
+
+    if(n->nlmsg_type != RTM_NEWLINK || len < 0
+       || ifi->ifi_family != AF_BRIDGE)
+        return 0;
+    master = find_rta(IFLA_RTA(ifi), len, IFLA_MASTER);
+    if(!master || (br_index != *(int *)RTA_DATA(master))
+       || (br_index == ifi->ifi_index))
+        return 0;
+    return link_list_add(&ctx->list, ifi->ifi_index, ifi->ifi_flags);
+}
+
+/* Report all ports of the bridge to bridge_notify() as new links */
+int dump_bridge_ports(int br_index)
+{
+    link_list_t *ports = dump_links(PF_BRIDGE, bridge_port_msg, &br_index);
+    int i;
+
+    if(!ports)
+        return -1;
+    for(i = 0; i < ports->num; ++i)
+        bridge_notify(br_index, ports->link[i].if_index, true,
+                      ports->link[i].value);
+    free(ports);
+    return 0;
+}
+
+static int stp_state_msg(const struct sockaddr_nl *who, struct nlmsghdr *n,
+                         void *arg)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(n);
+    int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    dump_links_ctx_t *ctx = arg;
+    int stp_state;
+
+    if(n->nlmsg_type != RTM_NEWLINK || len < 0
+       || 0 > (stp_state = bridge_stp_state_of(ifi, len)))
+        return 0;
+    return link_list_add(&ctx->list, ifi->ifi_index, stp_state);
+}
+
+/* Report the STP state of all bridges to bridge_stp_state() */
+int dump_bridge_stp_states(void)
+{
+    link_list_t *bridges = dump_links(AF_UNSPEC, stp_state_msg, NULL);
+    int i;
+
+    if(!bridges)
+        return -1;
+    for(i = 0; i < bridges->num; ++i)
+        bridge_stp_state(bridges->link[i].if_index, bridges->link[i].value);
+    free(bridges);
+    return 0;
+}
+
+/* Take the monitoring socket of the previous instance */
+static int rtnl_adopt(struct rtnl_handle *rth, int fd)
+{
+    socklen_t addr_len = sizeof(rth->local);
+
+    memset(rth, 0, sizeof(*rth));
+    rth->fd = fd;
+    if(getsockname(fd, (struct sockaddr *)&rth->local, &addr_len) < 0)
+    {
+        ERROR("Cannot getsockname: %m\n");
+        return -1;
+    }
+    rth->seq = time(NULL);
+    /* rtnl_dump_filter() expects a blocking socket */
+    if(fcntl(fd, F_SETFL, 0) < 0)
+    {
+        ERROR("Error clearing O_NONBLOCK: %m\n");
+        return -1;
+    }
+    return 0;
 }
 
 int init_bridge_ops(void)
 {
-    if(rtnl_open(&rth, RTMGRP_LINK) < 0)
+    int fd = handover_get_fd(HANDOVER_FD_NETLINK);
+
+    if(0 <= fd)
+    {
+        if(rtnl_adopt(&rth, fd) < 0)
+            return -1;
+    }
+    else if(rtnl_open(&rth, RTMGRP_LINK) < 0)
     {
         ERROR("Couldn't open rtnl socket for monitoring\n");
         return -1;
@@ -194,7 +477,9 @@ int init_bridge_ops(void)
         return -1;
     }
 
-    if(rtnl_dump_filter(&rth, dump_msg, stdout, NULL, NULL) < 0)
+    /* Events queued in the adopted socket before the dump are not lost */
+    if(rtnl_dump_filter(&rth, dump_msg, stdout,
+                        (0 <= fd) ? dump_msg : NULL, stdout) < 0)
     {
         ERROR("Dump terminated\n");
         return -1;
@@ -209,9 +494,11 @@ int init_bridge_ops(void)
     br_handler.fd = rth.fd;
     br_handler.arg = NULL;
     br_handler.handler = br_ev_handler;
+    br_handler.priority = EPOLL_PRIO_LINK;
 
     if(add_epoll(&br_handler) < 0)
         return -1;
 
+    handover_set_fd(HANDOVER_FD_NETLINK, rth.fd);
     return 0;
 }
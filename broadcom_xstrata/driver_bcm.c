@@ -0,0 +1,549 @@
+/*
+ * driver_bcm.c	Driver plugin for the Broadcom Xstrata.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ * Authors: Vitalii Demianets <dvitasgs@gmail.com>
+ * Authors: Vladimir Cotfas <unix_router@yahoo.com> -- Broadcom Xstrata support
+ */
+
+/*
+ * Build:  gcc -shared -fPIC -I.. -o mstpd-bcm.so driver_bcm.c -lutil
+ * Run:    mstpd -P /path/to/mstpd-bcm.so
+ *
+ * The plugin keeps one bcm CLI session open on a pty for the whole life of
+ * mstpd. The port state changes and the flushes of an event loop turn come
+ * in as vectors; each vector is queued for bcm as one CLI line, and written
+ * without waiting for the previous lines to complete. bcm prints its prompt
+ * when it is done with a line: this is when the flushes of that line are
+ * reported done. bcm knows no MSTIs: it gets the CIST states, and flushes
+ * whole ports.
+ * When the session dies, a new one is started a second later. It gets all
+ * the current states first, then the lines of the flushes not done yet.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pty.h>
+#include <termios.h>
+#include <net/if.h>
+#include <sys/wait.h>
+#include <sys/timerfd.h>
+#include <linux/if_bridge.h>
+
+#include "driver_plugin.h"
+#include "list.h"
+
+#define BCM_PATH    "/bin/bcm"
+#define BCM_PROMPT  "BCM.0> "
+
+/* Seconds between the end of a session and the start of the next one */
+#define BCM_RESTART_DELAY   1
+/* Milliseconds to wait for bcm to exit on SIGKILL */
+#define BCM_KILL_WAIT_MS    100
+
+#define ERROR(_fmt, _args...) \
+    host->log(MSTPD_DRIVER_LOG_ERROR, "bcm: " _fmt, ##_args)
+#define INFO(_fmt, _args...) \
+    host->log(MSTPD_DRIVER_LOG_INFO, "bcm: " _fmt, ##_args)
+#define DEBUG(_fmt, _args...) \
+    host->log(MSTPD_DRIVER_LOG_DEBUG, "bcm: " _fmt, ##_args)
+
+static const char* port_states_bcm[] =
+{
+    [BR_STATE_DISABLED]   = "Disable",
+    [BR_STATE_LISTENING]  = "LIsten",
+    [BR_STATE_LEARNING]   = "LEarn",
+    [BR_STATE_FORWARDING] = "Forward",
+    [BR_STATE_BLOCKING]   = "Disable",
+};
+
+static const char* if_linux2bcm(const char* name)
+{
+    if((NULL == name) || ('\0' == name[0]))
+        return "???";
+
+    if(!strcmp(name, "GbE1"))
+        return "ge3";
+    if(!strcmp(name, "GbE2"))
+        return "ge4";
+
+    return "???";
+}
+
+/* A CLI line for bcm, done when bcm prints the next prompt after it */
+typedef struct
+{
+    struct list_head list;
+    char *line;
+    int len, written;
+    int num_flushes;
+    struct
+    {
+        int br_ifindex, ifindex;
+    } flushes[];
+} transaction_t;
+
+/* The last state set for a (port, tree), to be set again in a new session */
+typedef struct
+{
+    struct list_head list;
+    int br_ifindex, ifindex, mstid, state;
+    char name[IFNAMSIZ];
+} port_state_t;
+
+static const struct mstpd_driver_host *host;
+static int bcm_fd = -1;
+static pid_t bcm_pid = -1;
+/* The bcm of the last session, until it has exited */
+static pid_t stopped_pid = -1;
+static int restart_fd = -1;
+/* Lines not done yet, oldest first: those written to bcm come first */
+static LIST_HEAD(transactions);
+static LIST_HEAD(port_states);
+/* The last characters printed by bcm, to spot the prompt */
+static char recent[sizeof(BCM_PROMPT) - 1];
+
+static void bcm_stop(void);
+
+static transaction_t *new_transaction(const char *line, int num_flushes)
+{
+    transaction_t *tr;
+
+    if(NULL == (tr = calloc(1, sizeof(*tr)
+                               + num_flushes * sizeof(tr->flushes[0]))))
+        return NULL;
+    if(NULL == (tr->line = strdup(line)))
+    {
+        free(tr);
+        return NULL;
+    }
+    tr->len = strlen(line);
+    tr->num_flushes = num_flushes;
+    return tr;
+}
+
+static void free_transaction(transaction_t *tr)
+{
+    list_del(&tr->list);
+    free(tr->line);
+    free(tr);
+}
+
+/* Write what bcm can take of the queued lines */
+static int write_output(void)
+{
+    transaction_t *tr;
+    int l;
+
+    list_for_each_entry(tr, &transactions, list)
+    {
+        while(tr->written < tr->len)
+        {
+            l = write(bcm_fd, tr->line + tr->written, tr->len - tr->written);
+            if(0 > l)
+            {
+                if((EAGAIN == errno) || (EINTR == errno))
+                    return 0;
+                ERROR("Couldn't write to bcm: %m");
+                return -1;
+            }
+            tr->written += l;
+        }
+    }
+    return 0;
+}
+
+/* Start a new session in BCM_RESTART_DELAY seconds */
+static void restart_later(void)
+{
+    struct itimerspec its = { .it_value.tv_sec = BCM_RESTART_DELAY };
+
+    bcm_stop();
+    if(timerfd_settime(restart_fd, 0, &its, NULL))
+        ERROR("Couldn't schedule the restart of bcm: %m");
+}
+
+/* Queue one line; it stays queued until bcm is done with it, through
+ * the restarts of the session */
+static void send_line(transaction_t *tr)
+{
+    DEBUG("CMD: %s", tr->line);
+    list_add_tail(&tr->list, &transactions);
+    if((0 <= bcm_fd) && write_output())
+        restart_later();
+}
+
+/* The oldest pending line is done */
+static void transaction_done(void)
+{
+    transaction_t *tr;
+    int i;
+
+    if(list_empty(&transactions))
+        return;
+    tr = list_entry(transactions.next, transaction_t, list);
+    if(tr->written < tr->len)
+        return;
+    for(i = 0; i < tr->num_flushes; ++i)
+        host->flush_done(tr->flushes[i].br_ifindex, tr->flushes[i].ifindex,
+                         MSTPD_DRIVER_ALL_TREES);
+    free_transaction(tr);
+}
+
+static void bcm_read(int fd, void *arg)
+{
+    char buf[256];
+    int i, l;
+
+    /* bcm reads on: push the lines it couldn't take yet */
+    if(write_output())
+    {
+        restart_later();
+        return;
+    }
+
+    l = read(fd, buf, sizeof(buf));
+    if(0 > l && ((EAGAIN == errno) || (EINTR == errno)))
+        return;
+    if(0 >= l)
+    {
+        /* EIO when bcm has exited */
+        ERROR("bcm session closed");
+        restart_later();
+        return;
+    }
+    for(i = 0; i < l; ++i)
+    {
+        memmove(recent, recent + 1, sizeof(recent) - 1);
+        recent[sizeof(recent) - 1] = buf[i];
+        if(!memcmp(recent, BCM_PROMPT, sizeof(recent)))
+            transaction_done();
+    }
+}
+
+/* One line setting num states */
+static transaction_t *states_transaction(const struct mstpd_driver_state
+                                         *states, int num)
+{
+    char *line;
+    transaction_t *tr;
+    int i, len = 0, size = num * 40 + 2;
+
+    if(NULL == (line = malloc(size)))
+        return NULL;
+    for(i = 0; i < num; ++i)
+        len += snprintf(line + len, size - len, "%sport %s stp=%s",
+                        len ? "; " : "", if_linux2bcm(states[i].port.name),
+                        port_states_bcm[states[i].state]);
+    snprintf(line + len, size - len, "\n");
+    tr = new_transaction(line, 0);
+    free(line);
+    return tr;
+}
+
+/* The line setting all the states known, for a new session */
+static transaction_t *all_states_transaction(void)
+{
+    struct mstpd_driver_state *states;
+    port_state_t *ps;
+    transaction_t *tr;
+    int num = 0;
+
+    list_for_each_entry(ps, &port_states, list)
+        ++num;
+    if(0 == num)
+        return NULL;
+    if(NULL == (states = calloc(num, sizeof(*states))))
+        return NULL;
+    num = 0;
+    list_for_each_entry(ps, &port_states, list)
+    {
+        states[num].port.br_ifindex = ps->br_ifindex;
+        states[num].port.ifindex = ps->ifindex;
+        states[num].port.name = ps->name;
+        states[num].mstid = ps->mstid;
+        states[num].state = ps->state;
+        ++num;
+    }
+    tr = states_transaction(states, num);
+    free(states);
+    return tr;
+}
+
+static int bcm_start(void)
+{
+    struct termios tio;
+    transaction_t *tr;
+    int fd;
+
+    if(0 > (bcm_pid = forkpty(&fd, NULL, NULL, NULL)))
+    {
+        ERROR("Couldn't start bcm: %m");
+        return -1;
+    }
+    if(0 == bcm_pid)
+    {
+        execl(BCM_PATH, "bcm", NULL);
+        _exit(127);
+    }
+
+    /* Don't echo the commands back */
+    if(0 == tcgetattr(fd, &tio))
+    {
+        tio.c_lflag &= ~ECHO;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    bcm_fd = fd;
+    if(host->watch_fd(fd, bcm_read, NULL))
+    {
+        bcm_stop();
+        return -1;
+    }
+    memset(recent, 0, sizeof(recent));
+    /* Ahead of the flushes left by the previous session: the states as
+     * they are now, after the first prompt which tells that bcm is ready */
+    if((tr = all_states_transaction()))
+        list_add(&tr->list, &transactions);
+    if((tr = new_transaction("", 0)))
+        list_add(&tr->list, &transactions);
+    INFO("bcm session started, pid %d", bcm_pid);
+    if(write_output())
+    {
+        bcm_stop();
+        return -1;
+    }
+    return 0;
+}
+
+/* Reap the bcm of the last session without waiting for it. With kill, one
+ * which hasn't exited on SIGTERM is killed, and waited for a little while */
+static void bcm_reap(bool kill_it)
+{
+    int i;
+
+    if(0 >= stopped_pid)
+        return;
+    if(0 == waitpid(stopped_pid, NULL, WNOHANG))
+    {
+        if(!kill_it)
+            return;
+        kill(stopped_pid, SIGKILL);
+        for(i = 0; 0 == waitpid(stopped_pid, NULL, WNOHANG); ++i)
+        {
+            if(BCM_KILL_WAIT_MS <= i)
+            {
+                ERROR("bcm (pid %d) doesn't exit", stopped_pid);
+                return;
+            }
+            usleep(1000);
+        }
+    }
+    stopped_pid = -1;
+}
+
+static void bcm_restart(int fd, void *arg)
+{
+    __u64 expirations;
+
+    if(sizeof(expirations) != read(fd, &expirations, sizeof(expirations)))
+        return;
+    /* It has had BCM_RESTART_DELAY seconds to exit */
+    bcm_reap(true);
+    if((0 > bcm_fd) && bcm_start())
+        restart_later();
+}
+
+/* Close the session. The lines of the flushes will be written again to the
+ * next session; those of the states are not needed, as it gets them all */
+static void bcm_stop(void)
+{
+    transaction_t *tr, *nxt;
+
+    if(0 <= bcm_fd)
+    {
+        host->watch_fd(bcm_fd, NULL, NULL);
+        close(bcm_fd);
+        bcm_fd = -1;
+    }
+    if(0 < bcm_pid)
+    {
+        /* Not waited for: it could hang, and mstpd with it */
+        bcm_reap(true);
+        kill(bcm_pid, SIGTERM);
+        stopped_pid = bcm_pid;
+        bcm_pid = -1;
+        bcm_reap(false);
+    }
+    list_for_each_entry_safe(tr, nxt, &transactions, list)
+    {
+        if(0 == tr->num_flushes)
+            free_transaction(tr);
+        else
+            tr->written = 0;
+    }
+}
+
+static void bcm_fini(void)
+{
+    transaction_t *tr, *nxt;
+    port_state_t *ps, *pnxt;
+
+    bcm_stop();
+    bcm_reap(true);
+    if(0 <= restart_fd)
+    {
+        host->watch_fd(restart_fd, NULL, NULL);
+        close(restart_fd);
+        restart_fd = -1;
+    }
+    list_for_each_entry_safe(tr, nxt, &transactions, list)
+        free_transaction(tr);
+    list_for_each_entry_safe(ps, pnxt, &port_states, list)
+    {
+        list_del(&ps->list);
+        free(ps);
+    }
+}
+
+/* Forget the states of the port, or of all the ports of the bridge when
+ * ifindex is 0 */
+static void forget_states(int br_ifindex, int ifindex)
+{
+    port_state_t *ps, *nxt;
+
+    list_for_each_entry_safe(ps, nxt, &port_states, list)
+    {
+        if((ps->br_ifindex != br_ifindex)
+           || (ifindex && (ps->ifindex != ifindex)))
+            continue;
+        list_del(&ps->list);
+        free(ps);
+    }
+}
+
+static void bcm_delete_bridge(const struct mstpd_driver_port *br)
+{
+    forget_states(br->br_ifindex, 0);
+}
+
+static void bcm_delete_port(const struct mstpd_driver_port *port)
+{
+    forget_states(port->br_ifindex, port->ifindex);
+}
+
+static void remember_state(const struct mstpd_driver_state *s)
+{
+    port_state_t *ps;
+
+    list_for_each_entry(ps, &port_states, list)
+    {
+        if((ps->br_ifindex == s->port.br_ifindex)
+           && (ps->ifindex == s->port.ifindex) && (ps->mstid == s->mstid))
+        {
+            ps->state = s->state;
+            return;
+        }
+    }
+    if(NULL == (ps = calloc(1, sizeof(*ps))))
+    {
+        ERROR("Out of memory");
+        return;
+    }
+    ps->br_ifindex = s->port.br_ifindex;
+    ps->ifindex = s->port.ifindex;
+    ps->mstid = s->mstid;
+    ps->state = s->state;
+    if(s->port.name)
+        strncpy(ps->name, s->port.name, sizeof(ps->name) - 1);
+    list_add_tail(&ps->list, &port_states);
+}
+
+static void bcm_set_states(const struct mstpd_driver_state *states, int num)
+{
+    transaction_t *tr;
+    int i;
+
+    for(i = 0; i < num; ++i)
+        remember_state(&states[i]);
+    /* Otherwise the next session gets them */
+    if(0 > bcm_fd)
+        return;
+    if(NULL == (tr = states_transaction(states, num)))
+    {
+        ERROR("Out of memory");
+        return;
+    }
+    send_line(tr);
+}
+
+static void bcm_flush(const struct mstpd_driver_flush *flushes, int num)
+{
+    char *line;
+    transaction_t *tr = NULL;
+    int i, len = 0, size = num * 40 + 2;
+
+    if(NULL != (line = malloc(size)))
+    {
+        for(i = 0; i < num; ++i)
+            len += snprintf(line + len, size - len, "%sl2 clear port=%s",
+                            len ? "; " : "",
+                            if_linux2bcm(flushes[i].port.name));
+        snprintf(line + len, size - len, "\n");
+        tr = new_transaction(line, num);
+        free(line);
+    }
+    if(NULL == tr)
+    {
+        ERROR("Out of memory");
+        for(i = 0; i < num; ++i)
+            host->flush_done(flushes[i].port.br_ifindex,
+                             flushes[i].port.ifindex, flushes[i].mstid);
+        return;
+    }
+    for(i = 0; i < num; ++i)
+    {
+        tr->flushes[i].br_ifindex = flushes[i].port.br_ifindex;
+        tr->flushes[i].ifindex = flushes[i].port.ifindex;
+    }
+    send_line(tr);
+}
+
+static const struct mstpd_driver bcm_driver =
+{
+    .abi_version = MSTPD_DRIVER_ABI_VERSION,
+    .name = "broadcom-xstrata",
+    .caps = MSTPD_DRIVER_CAP_ASYNC_FLUSH,
+    .fini = bcm_fini,
+    .delete_bridge = bcm_delete_bridge,
+    .delete_port = bcm_delete_port,
+    .set_states = bcm_set_states,
+    .flush = bcm_flush,
+};
+
+const struct mstpd_driver *mstpd_driver_init(const struct mstpd_driver_host *h)
+{
+    if(MSTPD_DRIVER_ABI_VERSION != h->abi_version)
+        return NULL;
+    host = h;
+    if(0 > (restart_fd = timerfd_create(CLOCK_MONOTONIC,
+                                        TFD_NONBLOCK | TFD_CLOEXEC)))
+        return NULL;
+    if(host->watch_fd(restart_fd, bcm_restart, NULL) || bcm_start())
+    {
+        bcm_fini();
+        return NULL;
+    }
+    return &bcm_driver;
+}
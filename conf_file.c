@@ -0,0 +1,1082 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/* Declarative configuration file.
+ *
+ * The file describes the wanted configuration of the bridges; the keywords
+ * are the names of the corresponding mstpctl commands without "set":
+ *
+ *   bridge br0
+ *       forcevers mstp
+ *       mstconfid 1 region1
+ *       trees 1 2
+ *       fid2mstid 1:1 2:2
+ *       vid2fid 1:1-100 2:101-200
+ *       treeprio 0 4
+ *   port eth0
+ *       portadminedge yes
+ *       treeportcost 1 20000
+ *
+ * Whenever a bridge or a port appears, and on every reload (SIGHUP), the
+ * running configuration is compared with the file and only the differences
+ * are applied, all of them in one transaction with one run of the state
+ * machines per bridge. Parameters which are not in the file are left alone.
+ * A file with errors is rejected as a whole.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <asm/byteorder.h>
+
+#include "conf_file.h"
+#include "bridge_ctl.h"
+#include "bridge_track.h"
+#include "ctl_functions.h"
+#include "epoll_loop.h"
+#include "record.h"
+#include "log.h"
+
+#define CONF_MAX_ARGS   64
+
+typedef struct
+{
+    struct list_head list;
+    __u16 mstid;
+    __u8 bridge_priority;
+} conf_tree_t;
+
+typedef struct
+{
+    struct list_head list;
+    __u16 mstid;
+    MSTI_PortConfig cfg;
+} conf_ptp_t;
+
+typedef struct
+{
+    struct list_head list;
+    char name[IFNAMSIZ];
+    CIST_PortConfig cfg;
+    struct list_head ptps;
+} conf_port_t;
+
+typedef struct
+{
+    struct list_head list;
+    char name[IFNAMSIZ];
+    CIST_BridgeConfig cfg;
+
+    bool set_mstconfid;
+    __u16 revision;
+    __u8 mstconfname[CONFIGURATION_NAME_LEN];
+
+    bool set_mstis;
+    int num_mstis;
+    __u16 mstids[MAX_IMPLEMENTATION_MSTIS];
+
+    bool set_vids2fids;
+    __u16 vids2fids[MAX_VID + 1];
+    bool set_fids2mstids;
+    __u16 fids2mstids[MAX_FID + 1];
+
+    struct list_head trees;
+    struct list_head ports;
+} conf_bridge_t;
+
+static const char *conf_path;
+static LIST_HEAD(conf_bridges);
+static struct epoll_event_handler sighup_handler;
+
+/* Parsing */
+
+typedef struct
+{
+    const char *path;
+    int line;
+    conf_bridge_t *br;
+    conf_port_t *prt;
+} parse_ctx_t;
+
+#define PARSE_ERROR(ctx, fmt, ...) \
+    ERROR("%s:%d: " fmt, (ctx)->path, (ctx)->line, ##__VA_ARGS__)
+
+static bool parse_uint(parse_ctx_t *ctx, const char *s, unsigned long max,
+                       unsigned long *value)
+{
+    char *end;
+
+    *value = strtoul(s, &end, 0);
+    if(('\0' == *s) || ('\0' != *end) || ('-' == *s) || (*value > max))
+    {
+        PARSE_ERROR(ctx, "Bad value '%s' (expected 0..%lu)", s, max);
+        return false;
+    }
+    return true;
+}
+
+static int parse_enum(parse_ctx_t *ctx, const char *s,
+                      const char *const *opts)
+{
+    int i;
+
+    for(i = 0; opts[i]; ++i)
+        if(0 == strcmp(s, opts[i]))
+            return i;
+    PARSE_ERROR(ctx, "Bad value '%s'", s);
+    return -1;
+}
+
+static int parse_yesno(parse_ctx_t *ctx, const char *s)
+{
+    static const char *const opts[] = { "no", "yes", NULL };
+    return parse_enum(ctx, s, opts);
+}
+
+/* "<value>:<index list>", the list as for mstpctl setvid2fid */
+static bool parse_map(parse_ctx_t *ctx, const char *s, __u16 *array,
+                      unsigned int max_index, bool no_zero_index,
+                      unsigned long max_value)
+{
+    char buf[256], *list, *item, *save, *dash;
+    unsigned long value, first, last, i;
+
+    if((strlen(s) >= sizeof(buf))
+       || (NULL == (list = strchr(strcpy(buf, s), ':'))))
+    {
+        PARSE_ERROR(ctx, "Bad map '%s' (expected <value>:<list>)", s);
+        return false;
+    }
+    *list++ = '\0';
+    if(!parse_uint(ctx, buf, max_value, &value))
+        return false;
+
+    for(item = strtok_r(list, ",", &save); item;
+        item = strtok_r(NULL, ",", &save))
+    {
+        if(0 == strcmp(item, "*"))
+        {
+            for(i = no_zero_index ? 1 : 0; i <= max_index; ++i)
+                if(array[i] > max_value)
+                    array[i] = value;
+            continue;
+        }
+        if(NULL != (dash = strchr(item, '-')))
+            *dash++ = '\0';
+        if(!parse_uint(ctx, item, max_index, &first)
+           || !parse_uint(ctx, dash ? dash : item, max_index, &last))
+            return false;
+        if(first > last)
+        {
+            i = first;
+            first = last;
+            last = i;
+        }
+        if(no_zero_index && (0 == first))
+        {
+            PARSE_ERROR(ctx, "Index 0 is not allowed in '%s'", s);
+            return false;
+        }
+        for(i = first; i <= last; ++i)
+            array[i] = value;
+    }
+    return true;
+}
+
+static conf_ptp_t *get_conf_ptp(conf_port_t *prt, __u16 mstid)
+{
+    conf_ptp_t *ptp;
+
+    list_for_each_entry(ptp, &prt->ptps, list)
+        if(ptp->mstid == mstid)
+            return ptp;
+    if(NULL == (ptp = calloc(1, sizeof(*ptp))))
+        return NULL;
+    ptp->mstid = mstid;
+    list_add_tail(&ptp->list, &prt->ptps);
+    return ptp;
+}
+
+#define KW_BRIDGE   0x01
+#define KW_PORT     0x02
+#define KW_VARARGS  (-1)
+
+typedef bool (*kw_parser_t)(parse_ctx_t *ctx, int argc, char *const *argv);
+
+typedef struct
+{
+    const char *name;
+    int scope;
+    int nargs; /* KW_VARARGS == one or more */
+    kw_parser_t parse;
+} keyword_t;
+
+static bool kw_bridge(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    conf_bridge_t *br;
+
+    if(strlen(argv[1]) >= IFNAMSIZ)
+    {
+        PARSE_ERROR(ctx, "Bad bridge name '%s'", argv[1]);
+        return false;
+    }
+    list_for_each_entry(br, &conf_bridges, list)
+        if(0 == strcmp(br->name, argv[1]))
+        {
+            PARSE_ERROR(ctx, "Bridge %s is already described", argv[1]);
+            return false;
+        }
+    if(NULL == (br = calloc(1, sizeof(*br))))
+    {
+        PARSE_ERROR(ctx, "Out of memory");
+        return false;
+    }
+    strcpy(br->name, argv[1]);
+    INIT_LIST_HEAD(&br->trees);
+    INIT_LIST_HEAD(&br->ports);
+    list_add_tail(&br->list, &conf_bridges);
+    ctx->br = br;
+    ctx->prt = NULL;
+    return true;
+}
+
+static bool kw_port(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    conf_port_t *prt;
+
+    if(strlen(argv[1]) >= IFNAMSIZ)
+    {
+        PARSE_ERROR(ctx, "Bad port name '%s'", argv[1]);
+        return false;
+    }
+    list_for_each_entry(prt, &ctx->br->ports, list)
+        if(0 == strcmp(prt->name, argv[1]))
+        {
+            PARSE_ERROR(ctx, "Port %s is already described", argv[1]);
+            return false;
+        }
+    if(NULL == (prt = calloc(1, sizeof(*prt))))
+    {
+        PARSE_ERROR(ctx, "Out of memory");
+        return false;
+    }
+    strcpy(prt->name, argv[1]);
+    INIT_LIST_HEAD(&prt->ptps);
+    list_add_tail(&prt->list, &ctx->br->ports);
+    ctx->prt = prt;
+    return true;
+}
+
+#define KW_BRIDGE_UINT(kw, field, max)                                  \
+static bool kw_ ## kw(parse_ctx_t *ctx, int argc, char *const *argv)    \
+{                                                                       \
+    unsigned long v;                                                    \
+    if(!parse_uint(ctx, argv[1], max, &v))                              \
+        return false;                                                   \
+    ctx->br->cfg.field = v;                                             \
+    ctx->br->cfg.set_ ## field = true;                                  \
+    return true;                                                        \
+}
+
+KW_BRIDGE_UINT(maxage, bridge_max_age, 255)
+KW_BRIDGE_UINT(fdelay, bridge_forward_delay, 255)
+KW_BRIDGE_UINT(maxhops, max_hops, 255)
+KW_BRIDGE_UINT(hello, bridge_hello_time, 255)
+KW_BRIDGE_UINT(ageing, bridge_ageing_time, UINT_MAX)
+KW_BRIDGE_UINT(flushwindow, fdb_flush_window, 255)
+KW_BRIDGE_UINT(txholdcount, tx_hold_count, UINT_MAX)
+
+static bool kw_forcevers(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    static const char *const opts[] = { "stp", "rstp", "mstp", NULL };
+    static const protocol_version_t vals[] = { protoSTP, protoRSTP, protoMSTP };
+    int i = parse_enum(ctx, argv[1], opts);
+
+    if(0 > i)
+        return false;
+    ctx->br->cfg.protocol_version = vals[i];
+    ctx->br->cfg.set_protocol_version = true;
+    return true;
+}
+
+static bool kw_mstconfid(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    unsigned long revision;
+
+    if(!parse_uint(ctx, argv[1], 0xFFFF, &revision))
+        return false;
+    if(strlen(argv[2]) >= CONFIGURATION_NAME_LEN)
+    {
+        PARSE_ERROR(ctx, "Configuration name '%s' is too long", argv[2]);
+        return false;
+    }
+    ctx->br->revision = revision;
+    memset(ctx->br->mstconfname, 0, sizeof(ctx->br->mstconfname));
+    strcpy((char *)ctx->br->mstconfname, argv[2]);
+    ctx->br->set_mstconfid = true;
+    return true;
+}
+
+static bool kw_trees(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    conf_bridge_t *br = ctx->br;
+    unsigned long mstid;
+    int i, j;
+
+    for(i = 1; i < argc; ++i)
+    {
+        if(!parse_uint(ctx, argv[i], MAX_MSTID, &mstid))
+            return false;
+        if(0 == mstid)
+        {
+            PARSE_ERROR(ctx, "The CIST (0) always exists");
+            return false;
+        }
+        for(j = 0; j < br->num_mstis; ++j)
+            if(br->mstids[j] == mstid)
+                break;
+        if(j < br->num_mstis)
+            continue;
+        if(br->num_mstis >= MAX_IMPLEMENTATION_MSTIS)
+        {
+            PARSE_ERROR(ctx, "Too many MSTIs");
+            return false;
+        }
+        br->mstids[br->num_mstis++] = mstid;
+    }
+    br->set_mstis = true;
+    return true;
+}
+
+static bool kw_treeprio(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    unsigned long mstid, prio;
+    conf_tree_t *tree;
+
+    if(!parse_uint(ctx, argv[1], MAX_MSTID, &mstid)
+       || !parse_uint(ctx, argv[2], 15, &prio))
+        return false;
+    list_for_each_entry(tree, &ctx->br->trees, list)
+        if(tree->mstid == mstid)
+        {
+            tree->bridge_priority = prio;
+            return true;
+        }
+    if(NULL == (tree = calloc(1, sizeof(*tree))))
+    {
+        PARSE_ERROR(ctx, "Out of memory");
+        return false;
+    }
+    tree->mstid = mstid;
+    tree->bridge_priority = prio;
+    list_add_tail(&tree->list, &ctx->br->trees);
+    return true;
+}
+
+static bool kw_vid2fid(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    conf_bridge_t *br = ctx->br;
+    int i;
+
+    if(!br->set_vids2fids)
+    {
+        memset(br->vids2fids, 0xFF, sizeof(br->vids2fids));
+        br->set_vids2fids = true;
+    }
+    for(i = 1; i < argc; ++i)
+        if(!parse_map(ctx, argv[i], br->vids2fids, MAX_VID, true, MAX_FID))
+            return false;
+    return true;
+}
+
+static bool kw_fid2mstid(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    conf_bridge_t *br = ctx->br;
+    int i;
+
+    if(!br->set_fids2mstids)
+    {
+        memset(br->fids2mstids, 0xFF, sizeof(br->fids2mstids));
+        br->set_fids2mstids = true;
+    }
+    for(i = 1; i < argc; ++i)
+        if(!parse_map(ctx, argv[i], br->fids2mstids, MAX_FID, false,
+                      MAX_MSTID))
+            return false;
+    return true;
+}
+
+static bool kw_portpathcost(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    unsigned long v;
+
+    if(!parse_uint(ctx, argv[1], MAX_PATH_COST, &v))
+        return false;
+    ctx->prt->cfg.admin_external_port_path_cost = v;
+    ctx->prt->cfg.set_admin_external_port_path_cost = true;
+    return true;
+}
+
+#define KW_PORT_YESNO(kw, field)                                        \
+static bool kw_ ## kw(parse_ctx_t *ctx, int argc, char *const *argv)    \
+{                                                                       \
+    int v = parse_yesno(ctx, argv[1]);                                  \
+    if(0 > v)                                                           \
+        return false;                                                   \
+    ctx->prt->cfg.field = v;                                            \
+    ctx->prt->cfg.set_ ## field = true;                                 \
+    return true;                                                        \
+}
+
+KW_PORT_YESNO(portadminedge, admin_edge_port)
+KW_PORT_YESNO(portautoedge, auto_edge_port)
+KW_PORT_YESNO(portrestrrole, restricted_role)
+KW_PORT_YESNO(portrestrtcn, restricted_tcn)
+KW_PORT_YESNO(bpduguard, bpdu_guard_port)
+KW_PORT_YESNO(portnetwork, network_port)
+KW_PORT_YESNO(portdonttxmt, dont_txmt)
+KW_PORT_YESNO(portbpdufilter, bpdu_filter_port)
+
+static bool kw_portbpdurate(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    static const char *const opts[] = { "drop", "latest", NULL };
+    unsigned long v;
+    int i;
+
+    if(!parse_uint(ctx, argv[1], UINT_MAX, &v)
+       || (0 > (i = parse_enum(ctx, argv[2], opts))))
+        return false;
+    ctx->prt->cfg.bpdu_rate_limit = v;
+    ctx->prt->cfg.bpdu_rate_keep_latest = i;
+    ctx->prt->cfg.set_bpdu_rate_limit = true;
+    return true;
+}
+
+static bool kw_portp2p(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    static const char *const opts[] = { "no", "yes", "auto", NULL };
+    static const admin_p2p_t vals[] = { p2pForceFalse, p2pForceTrue, p2pAuto };
+    int i = parse_enum(ctx, argv[1], opts);
+
+    if(0 > i)
+        return false;
+    ctx->prt->cfg.admin_p2p = vals[i];
+    ctx->prt->cfg.set_admin_p2p = true;
+    return true;
+}
+
+static bool kw_treeportprio(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    unsigned long mstid, prio;
+    conf_ptp_t *ptp;
+
+    if(!parse_uint(ctx, argv[1], MAX_MSTID, &mstid)
+       || !parse_uint(ctx, argv[2], 15, &prio))
+        return false;
+    if(NULL == (ptp = get_conf_ptp(ctx->prt, mstid)))
+    {
+        PARSE_ERROR(ctx, "Out of memory");
+        return false;
+    }
+    ptp->cfg.port_priority = prio;
+    ptp->cfg.set_port_priority = true;
+    return true;
+}
+
+static bool kw_treeportcost(parse_ctx_t *ctx, int argc, char *const *argv)
+{
+    unsigned long mstid, cost;
+    conf_ptp_t *ptp;
+
+    if(!parse_uint(ctx, argv[1], MAX_MSTID, &mstid)
+       || !parse_uint(ctx, argv[2], MAX_PATH_COST, &cost))
+        return false;
+    if(NULL == (ptp = get_conf_ptp(ctx->prt, mstid)))
+    {
+        PARSE_ERROR(ctx, "Out of memory");
+        return false;
+    }
+    ptp->cfg.admin_internal_port_path_cost = cost;
+    ptp->cfg.set_admin_internal_port_path_cost = true;
+    return true;
+}
+
+static const keyword_t keywords[] =
+{
+    {"bridge", 0, 1, kw_bridge},
+    {"port", KW_BRIDGE | KW_PORT, 1, kw_port},
+    /* Bridge parameters */
+    {"maxage", KW_BRIDGE, 1, kw_maxage},
+    {"fdelay", KW_BRIDGE, 1, kw_fdelay},
+    {"maxhops", KW_BRIDGE, 1, kw_maxhops},
+    {"hello", KW_BRIDGE, 1, kw_hello},
+    {"ageing", KW_BRIDGE, 1, kw_ageing},
+    {"flushwindow", KW_BRIDGE, 1, kw_flushwindow},
+    {"forcevers", KW_BRIDGE, 1, kw_forcevers},
+    {"txholdcount", KW_BRIDGE, 1, kw_txholdcount},
+    {"mstconfid", KW_BRIDGE, 2, kw_mstconfid},
+    {"trees", KW_BRIDGE, KW_VARARGS, kw_trees},
+    {"treeprio", KW_BRIDGE, 2, kw_treeprio},
+    {"vid2fid", KW_BRIDGE, KW_VARARGS, kw_vid2fid},
+    {"fid2mstid", KW_BRIDGE, KW_VARARGS, kw_fid2mstid},
+    /* Port parameters */
+    {"portpathcost", KW_PORT, 1, kw_portpathcost},
+    {"portadminedge", KW_PORT, 1, kw_portadminedge},
+    {"portautoedge", KW_PORT, 1, kw_portautoedge},
+    {"portp2p", KW_PORT, 1, kw_portp2p},
+    {"portrestrrole", KW_PORT, 1, kw_portrestrrole},
+    {"portrestrtcn", KW_PORT, 1, kw_portrestrtcn},
+    {"bpduguard", KW_PORT, 1, kw_bpduguard},
+    {"portnetwork", KW_PORT, 1, kw_portnetwork},
+    {"portdonttxmt", KW_PORT, 1, kw_portdonttxmt},
+    {"portbpdufilter", KW_PORT, 1, kw_portbpdufilter},
+    {"portbpdurate", KW_PORT, 2, kw_portbpdurate},
+    {"treeportprio", KW_PORT, 2, kw_treeportprio},
+    {"treeportcost", KW_PORT, 2, kw_treeportcost},
+};
+
+static bool parse_line(parse_ctx_t *ctx, char *line)
+{
+    char *argv[CONF_MAX_ARGS], *save, *p;
+    int argc = 0, scope, i;
+    const keyword_t *kw;
+
+    if(NULL != (p = strchr(line, '#')))
+        *p = '\0';
+    for(p = strtok_r(line, " \t\r\n", &save); p;
+        p = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if(argc >= CONF_MAX_ARGS)
+        {
+            PARSE_ERROR(ctx, "Too many arguments");
+            return false;
+        }
+        argv[argc++] = p;
+    }
+    if(0 == argc)
+        return true;
+
+    for(i = 0; i < COUNT_OF(keywords); ++i)
+        if(0 == strcmp(argv[0], keywords[i].name))
+            break;
+    if(i >= COUNT_OF(keywords))
+    {
+        PARSE_ERROR(ctx, "Unknown keyword '%s'", argv[0]);
+        return false;
+    }
+    kw = &keywords[i];
+
+    scope = ctx->prt ? KW_PORT : (ctx->br ? KW_BRIDGE : 0);
+    if(kw->scope && !(kw->scope & scope))
+    {
+        PARSE_ERROR(ctx, "'%s' is not allowed here%s", argv[0],
+                    (KW_BRIDGE == kw->scope && ctx->prt) ?
+                    ": bridge parameters must precede the ports" : "");
+        return false;
+    }
+    if((KW_VARARGS == kw->nargs) ? (argc < 2) : (argc != kw->nargs + 1))
+    {
+        PARSE_ERROR(ctx, "Wrong number of arguments for '%s'", argv[0]);
+        return false;
+    }
+    return kw->parse(ctx, argc, argv);
+}
+
+/* Cross checks which need the whole bridge */
+static bool check_bridge(parse_ctx_t *ctx, conf_bridge_t *br)
+{
+    conf_tree_t *tree;
+    conf_port_t *prt;
+    conf_ptp_t *ptp;
+    int i, j;
+
+#define HAS_MSTI(id)                                                   \
+    ({                                                                 \
+        for(j = 0; j < br->num_mstis && br->mstids[j] != (id); ++j)    \
+            ;                                                          \
+        (0 == (id)) || (j < br->num_mstis);                            \
+    })
+
+    /* Unmapped VIDs and FIDs go to FID 0 and the CIST */
+    if(br->set_vids2fids)
+        for(i = 0; i <= MAX_VID; ++i)
+            if(br->vids2fids[i] > MAX_FID)
+                br->vids2fids[i] = 0;
+    if(br->set_fids2mstids)
+        for(i = 0; i <= MAX_FID; ++i)
+            if(br->fids2mstids[i] > MAX_MSTID)
+                br->fids2mstids[i] = 0;
+
+    if(!br->set_mstis)
+        return true;
+    if(br->set_fids2mstids)
+        for(i = 0; i <= MAX_FID; ++i)
+            if(!HAS_MSTI(br->fids2mstids[i]))
+            {
+                ERROR("%s: bridge %s: FID %d is mapped to MSTI %hu, "
+                      "which is not in 'trees'", ctx->path, br->name, i,
+                      br->fids2mstids[i]);
+                return false;
+            }
+    list_for_each_entry(tree, &br->trees, list)
+        if(!HAS_MSTI(tree->mstid))
+        {
+            ERROR("%s: bridge %s: MSTI %hu is not in 'trees'",
+                  ctx->path, br->name, tree->mstid);
+            return false;
+        }
+    list_for_each_entry(prt, &br->ports, list)
+        list_for_each_entry(ptp, &prt->ptps, list)
+            if(!HAS_MSTI(ptp->mstid))
+            {
+                ERROR("%s: port %s: MSTI %hu is not in 'trees'",
+                      ctx->path, prt->name, ptp->mstid);
+                return false;
+            }
+#undef HAS_MSTI
+    return true;
+}
+
+static void free_conf(struct list_head *bridges)
+{
+    conf_bridge_t *br, *nbr;
+    conf_tree_t *tree, *ntree;
+    conf_port_t *prt, *nprt;
+    conf_ptp_t *ptp, *nptp;
+
+    list_for_each_entry_safe(br, nbr, bridges, list)
+    {
+        list_for_each_entry_safe(prt, nprt, &br->ports, list)
+        {
+            list_for_each_entry_safe(ptp, nptp, &prt->ptps, list)
+                free(ptp);
+            free(prt);
+        }
+        list_for_each_entry_safe(tree, ntree, &br->trees, list)
+            free(tree);
+        free(br);
+    }
+    INIT_LIST_HEAD(bridges);
+}
+
+/* The contents of the file, NUL-terminated, to be freed; NULL on error */
+static char *read_conf(size_t *len)
+{
+    char *text = NULL, *nt;
+    size_t size = 0, n;
+    FILE *f;
+
+    if(NULL == (f = fopen(conf_path, "r")))
+    {
+        ERROR("Can't open %s: %m", conf_path);
+        return NULL;
+    }
+    *len = 0;
+    do
+    {
+        if(size - *len < 4096)
+        {
+            if(NULL == (nt = realloc(text, size + 4096 + 1)))
+            {
+                ERROR("Out of memory reading %s", conf_path);
+                free(text);
+                fclose(f);
+                return NULL;
+            }
+            text = nt;
+            size += 4096;
+        }
+        *len += (n = fread(text + *len, 1, size - *len, f));
+    } while(n);
+    if(ferror(f))
+    {
+        ERROR("Can't read %s", conf_path);
+        free(text);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    text[*len] = '\0';
+    return text;
+}
+
+/* Parse the contents of the file into conf_bridges, text is modified.
+ * On error the previous contents of conf_bridges are kept.
+ */
+static int parse_conf(char *text)
+{
+    parse_ctx_t ctx = { .path = conf_path };
+    LIST_HEAD(old);
+    conf_bridge_t *br;
+    char *line, *next;
+    bool ok = true;
+
+    list_splice_init(&conf_bridges, &old);
+    for(line = text; ok && line; line = next)
+    {
+        if(NULL != (next = strchr(line, '\n')))
+            *next++ = '\0';
+        ++ctx.line;
+        ok = parse_line(&ctx, line);
+    }
+    if(ok)
+        list_for_each_entry(br, &conf_bridges, list)
+            if(!(ok = check_bridge(&ctx, br)))
+                break;
+
+    if(!ok)
+    {
+        ERROR("%s is not loaded", conf_path);
+        free_conf(&conf_bridges);
+        list_splice(&old, &conf_bridges);
+        return -1;
+    }
+    free_conf(&old);
+    INFO("Loaded %s", conf_path);
+    return 0;
+}
+
+static int load_conf(void)
+{
+    char *text;
+    size_t len;
+    int r;
+
+    if(NULL == (text = read_conf(&len)))
+        return -1;
+    r = parse_conf(text);
+    free(text);
+    return r;
+}
+
+/* Applying */
+
+static conf_bridge_t *find_conf_bridge(const char *name)
+{
+    conf_bridge_t *br;
+
+    list_for_each_entry(br, &conf_bridges, list)
+        if(0 == strcmp(br->name, name))
+            return br;
+    return NULL;
+}
+
+static tree_t *find_tree(bridge_t *br, __u16 mstid)
+{
+    tree_t *tree;
+
+    list_for_each_entry(tree, &br->trees, bridge_list)
+        if(__be16_to_cpu(tree->MSTID) == mstid)
+            return tree;
+    return NULL;
+}
+
+static per_tree_port_t *find_ptp(port_t *prt, __u16 mstid)
+{
+    per_tree_port_t *ptp;
+
+    list_for_each_entry(ptp, &prt->trees, port_list)
+        if(__be16_to_cpu(ptp->MSTID) == mstid)
+            return ptp;
+    return NULL;
+}
+
+#define DIFF(cfg, field, current)                                   \
+    do{                                                             \
+        if((cfg).set_ ## field && ((cfg).field != (current)))       \
+        {                                                           \
+            new_cfg.field = (cfg).field;                            \
+            new_cfg.set_ ## field = true;                           \
+            changed = true;                                         \
+        }                                                           \
+    }while(0)
+
+static int apply_bridge_params(bridge_t *br, conf_bridge_t *cbr)
+{
+    CIST_BridgeConfig new_cfg;
+    CIST_BridgeStatus status;
+    bool changed = false;
+
+    memset(&new_cfg, 0, sizeof(new_cfg));
+    MSTP_IN_get_cist_bridge_status(br, &status);
+    DIFF(cbr->cfg, bridge_max_age, status.bridge_max_age);
+    DIFF(cbr->cfg, bridge_forward_delay, status.bridge_forward_delay);
+    DIFF(cbr->cfg, protocol_version, status.protocol_version);
+    DIFF(cbr->cfg, tx_hold_count, status.tx_hold_count);
+    DIFF(cbr->cfg, max_hops, status.max_hops);
+    DIFF(cbr->cfg, bridge_hello_time, status.bridge_hello_time);
+    DIFF(cbr->cfg, bridge_ageing_time, status.Ageing_Time);
+    DIFF(cbr->cfg, fdb_flush_window, status.fdb_flush_window);
+    if(!changed)
+        return 0;
+    if(MSTP_IN_set_cist_bridge_config(br, &new_cfg))
+        ERROR_BRNAME(br, "Couldn't apply the bridge parameters");
+    return 1;
+}
+
+static int apply_port_params(port_t *prt, conf_port_t *cprt)
+{
+    CIST_PortConfig new_cfg;
+    CIST_PortStatus status;
+    bool changed = false;
+
+    memset(&new_cfg, 0, sizeof(new_cfg));
+    MSTP_IN_get_cist_port_status(prt, &status);
+    DIFF(cprt->cfg, admin_external_port_path_cost,
+         status.admin_external_port_path_cost);
+    DIFF(cprt->cfg, admin_edge_port, status.admin_edge_port);
+    DIFF(cprt->cfg, auto_edge_port, status.auto_edge_port);
+    DIFF(cprt->cfg, admin_p2p, status.admin_p2p);
+    DIFF(cprt->cfg, restricted_role, status.restricted_role);
+    DIFF(cprt->cfg, restricted_tcn, status.restricted_tcn);
+    DIFF(cprt->cfg, bpdu_guard_port, status.bpdu_guard_port);
+    DIFF(cprt->cfg, network_port, status.network_port);
+    DIFF(cprt->cfg, dont_txmt, status.dont_txmt);
+    DIFF(cprt->cfg, bpdu_filter_port, status.bpdu_filter_port);
+    /* The rate limit and its policy are set together */
+    if(cprt->cfg.set_bpdu_rate_limit
+       && ((cprt->cfg.bpdu_rate_limit != status.bpdu_rate_limit)
+           || (cprt->cfg.bpdu_rate_keep_latest
+               != status.bpdu_rate_keep_latest)))
+    {
+        new_cfg.bpdu_rate_limit = cprt->cfg.bpdu_rate_limit;
+        new_cfg.bpdu_rate_keep_latest = cprt->cfg.bpdu_rate_keep_latest;
+        new_cfg.set_bpdu_rate_limit = true;
+        changed = true;
+    }
+    if(!changed)
+        return 0;
+    /* Through the control function, which updates the kernel filter of the
+     * port too */
+    if(CTL_set_cist_port_config(prt->bridge->sysdeps.if_index,
+                                prt->sysdeps.if_index, &new_cfg))
+        ERROR_PRTNAME(prt->bridge, prt, "Couldn't apply the port parameters");
+    return 1;
+}
+
+static int apply_ptp_params(per_tree_port_t *ptp, conf_ptp_t *cptp)
+{
+    MSTI_PortConfig new_cfg;
+    MSTI_PortStatus status;
+    bool changed = false;
+
+    memset(&new_cfg, 0, sizeof(new_cfg));
+    MSTP_IN_get_msti_port_status(ptp, &status);
+    DIFF(cptp->cfg, admin_internal_port_path_cost,
+         status.admin_internal_port_path_cost);
+    DIFF(cptp->cfg, port_priority,
+         GET_PRIORITY_FROM_IDENTIFIER(status.port_id) >> 4);
+    if(!changed)
+        return 0;
+    if(MSTP_IN_set_msti_port_config(ptp, &new_cfg))
+        ERROR_MSTINAME(ptp->port->bridge, ptp->port, ptp,
+                       "Couldn't apply the port parameters");
+    return 1;
+}
+
+#undef DIFF
+
+void conf_file_apply(bridge_t *br)
+{
+    conf_bridge_t *cbr = find_conf_bridge(br->sysdeps.name);
+    __u16 map[MAX_VID > MAX_FID ? MAX_VID + 1 : MAX_FID + 1];
+    __u16 mstids[MAX_IMPLEMENTATION_MSTIS + 1];
+    conf_tree_t *ctree;
+    conf_port_t *cprt;
+    conf_ptp_t *cptp;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    int num_mstis, i, j, changes = 0;
+
+    if(NULL == cbr)
+        return;
+
+    /* MSTIs are created before the maps refer to them
+     * and deleted after the maps have released them */
+    if(cbr->set_mstis)
+        for(i = 0; i < cbr->num_mstis; ++i)
+            if(NULL == find_tree(br, cbr->mstids[i]))
+            {
+                if(CTL_create_msti(br->sysdeps.if_index, cbr->mstids[i]))
+                    ERROR_BRNAME(br, "Couldn't create MSTI %hu",
+                                 cbr->mstids[i]);
+                ++changes;
+            }
+
+    if(cbr->set_mstconfid
+       && ((__be16_to_cpu(br->MstConfigId.s.revision_level) != cbr->revision)
+           || memcmp(br->MstConfigId.s.configuration_name, cbr->mstconfname,
+                     CONFIGURATION_NAME_LEN)))
+    {
+        MSTP_IN_set_mst_config_id(br, cbr->revision, cbr->mstconfname);
+        ++changes;
+    }
+
+    if(cbr->set_fids2mstids)
+    {
+        for(i = 0; i <= MAX_FID; ++i)
+            if(__be16_to_cpu(br->fid2mstid[i]) != cbr->fids2mstids[i])
+                break;
+        if(i <= MAX_FID)
+        {
+            memcpy(map, cbr->fids2mstids, sizeof(cbr->fids2mstids));
+            if(!MSTP_IN_set_all_fids2mstids(br, map))
+                ERROR_BRNAME(br, "Couldn't apply the FID to MSTID map");
+            ++changes;
+        }
+    }
+
+    if(cbr->set_vids2fids
+       && memcmp(br->vid2fid + 1, cbr->vids2fids + 1,
+                 MAX_VID * sizeof(br->vid2fid[0])))
+    {
+        memcpy(map, cbr->vids2fids, sizeof(cbr->vids2fids));
+        if(!MSTP_IN_set_all_vids2fids(br, map))
+            ERROR_BRNAME(br, "Couldn't apply the VID to FID map");
+        ++changes;
+    }
+
+    if(cbr->set_mstis && MSTP_IN_get_mstilist(br, &num_mstis, mstids))
+        for(i = 0; i < num_mstis; ++i)
+        {
+            if(0 == mstids[i])
+                continue;
+            for(j = 0; j < cbr->num_mstis; ++j)
+                if(cbr->mstids[j] == mstids[i])
+                    break;
+            if(j < cbr->num_mstis)
+                continue;
+            if(CTL_delete_msti(br->sysdeps.if_index, mstids[i]))
+                ERROR_BRNAME(br, "Couldn't delete MSTI %hu", mstids[i]);
+            ++changes;
+        }
+
+    changes += apply_bridge_params(br, cbr);
+
+    list_for_each_entry(ctree, &cbr->trees, list)
+    {
+        if(NULL == (tree = find_tree(br, ctree->mstid)))
+        {
+            ERROR_BRNAME(br, "No MSTI %hu to set the priority of",
+                         ctree->mstid);
+            continue;
+        }
+        if((GET_PRIORITY_FROM_IDENTIFIER(tree->BridgeIdentifier) >> 4)
+           == ctree->bridge_priority)
+            continue;
+        MSTP_IN_set_msti_bridge_config(tree, ctree->bridge_priority);
+        ++changes;
+    }
+
+    /* Ports which are not (yet) in the bridge get their turn when they
+     * are added */
+    list_for_each_entry(cprt, &cbr->ports, list)
+        list_for_each_entry(prt, &br->ports, br_list)
+        {
+            if(strcmp(prt->sysdeps.name, cprt->name))
+                continue;
+            changes += apply_port_params(prt, cprt);
+            list_for_each_entry(cptp, &cprt->ptps, list)
+            {
+                if(NULL == (ptp = find_ptp(prt, cptp->mstid)))
+                {
+                    ERROR_PRTNAME(br, prt, "No MSTI %hu to set the port "
+                                  "parameters of", cptp->mstid);
+                    continue;
+                }
+                changes += apply_ptp_params(ptp, cptp);
+            }
+            break;
+        }
+
+    if(changes)
+        INFO_BRNAME(br, "%d configuration change(s) applied from %s",
+                    changes, conf_path);
+}
+
+/* Reload on SIGHUP */
+
+void conf_file_reload(char *text)
+{
+    if(0 == parse_conf(text))
+        bridge_track_reconfigure();
+}
+
+static bool sighup_ev_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    struct signalfd_siginfo si;
+    char *text;
+    size_t len;
+
+    if(sizeof(si) != read(h->fd, &si, sizeof(si)))
+        return false;
+    INFO("Got SIGHUP, reloading %s", conf_path);
+    if(NULL == (text = read_conf(&len)))
+        return true;
+    /* The contents, as the file may be gone when replaying */
+    record_input(RECORD_RELOAD, 0, 0, text, len);
+    conf_file_reload(text);
+    free(text);
+    return true;
+}
+
+int conf_file_init(const char *path)
+{
+    sigset_t mask;
+    int fd;
+
+    conf_path = path;
+    if(load_conf())
+        return -1;
+
+    /* SIGHUP means reload instead of quit */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    if(0 > sigprocmask(SIG_BLOCK, &mask, NULL))
+    {
+        ERROR("sigprocmask failed: %m");
+        return -1;
+    }
+    if(0 > (fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)))
+    {
+        ERROR("signalfd failed: %m");
+        return -1;
+    }
+    sighup_handler.fd = fd;
+    sighup_handler.arg = NULL;
+    sighup_handler.handler = sighup_ev_handler;
+    sighup_handler.priority = EPOLL_PRIO_CONTROL;
+    if(0 > add_epoll(&sighup_handler))
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* After a hitless restart the bridges are already there */
+    bridge_track_reconfigure();
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+#ifndef CONF_FILE_H
+#define CONF_FILE_H
+
+#include "mstp.h"
+
+/* Load the configuration file and reload it on SIGHUP.
+ * Return -1 if the file can't be loaded.
+ */
+int conf_file_init(const char *path);
+
+/* Bring the bridge in line with the configuration file.
+ * Must be called inside of MSTP_IN_begin_config()/MSTP_IN_end_config().
+ */
+void conf_file_apply(bridge_t *br);
+
+/* Reload the configuration from text, the contents of the file, as on
+ * SIGHUP; text is modified. For mstpd-replay.
+ */
+void conf_file_reload(char *text);
+
+#endif /* CONF_FILE_H */
@@ -27,13 +27,14 @@
 #ifndef CTL_SOCKET_H
 #define CTL_SOCKET_H
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
 #include <asm/byteorder.h>
 
-#include "mstp.h"
+#include "mstp_types.h"
 
 struct ctl_msg_hdr
 {
@@ -42,6 +43,7 @@ struct ctl_msg_hdr
     int lout;
     int llog;
     int res;
+    unsigned int id; /* request ID, sent back in the reply */
 };
 
 #define LOG_STRING_LEN 256
@@ -461,6 +463,239 @@ CTL_DECLARE(add_bridges);
 #define del_bridges_ARGS (int *br_array)
 CTL_DECLARE(del_bridges);
 
+/* get_loop_stats */
+#define CMD_CODE_get_loop_stats 124
+#define get_loop_stats_ARGS (epoll_loop_stats_t *stats)
+struct get_loop_stats_IN
+{
+};
+struct get_loop_stats_OUT
+{
+    epoll_loop_stats_t stats;
+};
+#define get_loop_stats_COPY_IN  ({ (void)0; })
+#define get_loop_stats_COPY_OUT ({ *stats = out->stats; })
+#define get_loop_stats_CALL (&out->stats)
+CTL_DECLARE(get_loop_stats);
+
+/* handover: sent by a new instance of mstpd started with -H */
+#define CMD_CODE_handover   125
+#define handover_ARGS (void)
+struct handover_IN
+{
+};
+struct handover_OUT
+{
+};
+#define handover_COPY_IN  ({ (void)0; })
+#define handover_COPY_OUT ({ (void)0; })
+#define handover_CALL ()
+CTL_DECLARE(handover);
+
+/* Max entries in one set_cist_port_configs or set_msti_port_configs
+ * message; longer vectors are sent in several messages */
+#define MAX_PORT_CONFIGS    1024
+
+/* set_cist_port_configs: set_cist_port_config for many ports of the bridge,
+ * all of them applied before one run of the state machines. None is applied
+ * if one of the entries is bad (unknown port or MSTI, invalid value) */
+#define CMD_CODE_set_cist_port_configs  126
+typedef struct
+{
+    int port_index;
+    CIST_PortConfig cfg;
+} CIST_PortConfigEntry;
+#define set_cist_port_configs_ARGS (int br_index, int num_entries, \
+                                    CIST_PortConfigEntry *entries)
+struct set_cist_port_configs_IN
+{
+    int br_index;
+    int num_entries;
+    CIST_PortConfigEntry entries[];
+};
+CTL_DECLARE(set_cist_port_configs);
+
+/* set_msti_port_configs: the same for set_msti_port_config */
+#define CMD_CODE_set_msti_port_configs  127
+typedef struct
+{
+    int port_index;
+    __u16 mstid;
+    MSTI_PortConfig cfg;
+} MSTI_PortConfigEntry;
+#define set_msti_port_configs_ARGS (int br_index, int num_entries, \
+                                    MSTI_PortConfigEntry *entries)
+struct set_msti_port_configs_IN
+{
+    int br_index;
+    int num_entries;
+    MSTI_PortConfigEntry entries[];
+};
+CTL_DECLARE(set_msti_port_configs);
+
+/* Max ranges in one set_vid2fid_ranges or set_fid2mstid_ranges message:
+ * enough for any map. The get_*_ranges replies carry fewer of them, the
+ * client asks again from where the previous reply stopped. */
+#define MAX_MAP_RANGES          (MAX_FID + 1)
+#define MAP_RANGES_PER_REPLY    256
+
+/* set_vid2fid_ranges: set the VID-to-FID map for the given ranges of VIDs,
+ * returns the MSTIDs of the trees whose set of VIDs has changed */
+#define CMD_CODE_set_vid2fid_ranges 128
+#define set_vid2fid_ranges_ARGS (int br_index, int num_entries,  \
+                                 MapRange *entries, int *num_changed, \
+                                 __u16 *changed_mstids)
+struct set_vid2fid_ranges_IN
+{
+    int br_index;
+    int num_entries;
+    MapRange entries[];
+};
+struct set_vid2fid_ranges_OUT
+{
+    int num_changed;
+    __u16 changed_mstids[MAX_IMPLEMENTATION_MSTIS + 1];
+};
+#define set_vid2fid_ranges_COPY_OUT ({ *num_changed = out->num_changed; \
+    memcpy(changed_mstids, out->changed_mstids,                         \
+           out->num_changed * sizeof(out->changed_mstids[0])); })
+#define set_vid2fid_ranges_CALL (in->br_index, in->num_entries, in->entries, \
+                                 &out->num_changed, out->changed_mstids)
+CTL_DECLARE(set_vid2fid_ranges);
+
+/* set_fid2mstid_ranges: the same for the FID-to-MSTID map */
+#define CMD_CODE_set_fid2mstid_ranges   129
+#define set_fid2mstid_ranges_ARGS (int br_index, int num_entries,  \
+                                   MapRange *entries, int *num_changed, \
+                                   __u16 *changed_mstids)
+struct set_fid2mstid_ranges_IN
+{
+    int br_index;
+    int num_entries;
+    MapRange entries[];
+};
+struct set_fid2mstid_ranges_OUT
+{
+    int num_changed;
+    __u16 changed_mstids[MAX_IMPLEMENTATION_MSTIS + 1];
+};
+#define set_fid2mstid_ranges_COPY_OUT ({ *num_changed = out->num_changed; \
+    memcpy(changed_mstids, out->changed_mstids,                           \
+           out->num_changed * sizeof(out->changed_mstids[0])); })
+#define set_fid2mstid_ranges_CALL (in->br_index, in->num_entries,         \
+                                   in->entries, &out->num_changed,        \
+                                   out->changed_mstids)
+CTL_DECLARE(set_fid2mstid_ranges);
+
+/* get_vid2fid_ranges: the VID-to-FID map as ranges, starting at VID first */
+#define CMD_CODE_get_vid2fid_ranges 130
+#define get_vid2fid_ranges_ARGS (int br_index, __u16 first, \
+                                 int *num_entries, MapRange *entries)
+struct get_vid2fid_ranges_IN
+{
+    int br_index;
+    __u16 first;
+};
+struct get_vid2fid_ranges_OUT
+{
+    int num_entries;
+    MapRange entries[MAP_RANGES_PER_REPLY];
+};
+#define get_vid2fid_ranges_COPY_IN \
+    ({ in->br_index = br_index; in->first = first; })
+#define get_vid2fid_ranges_COPY_OUT ({ *num_entries = out->num_entries; \
+    memcpy(entries, out->entries,                                       \
+           out->num_entries * sizeof(out->entries[0])); })
+#define get_vid2fid_ranges_CALL (in->br_index, in->first, \
+                                 &out->num_entries, out->entries)
+CTL_DECLARE(get_vid2fid_ranges);
+
+/* get_fid2mstid_ranges: the FID-to-MSTID map as ranges, starting at FID
+ * first */
+#define CMD_CODE_get_fid2mstid_ranges   131
+#define get_fid2mstid_ranges_ARGS (int br_index, __u16 first, \
+                                   int *num_entries, MapRange *entries)
+struct get_fid2mstid_ranges_IN
+{
+    int br_index;
+    __u16 first;
+};
+struct get_fid2mstid_ranges_OUT
+{
+    int num_entries;
+    MapRange entries[MAP_RANGES_PER_REPLY];
+};
+#define get_fid2mstid_ranges_COPY_IN \
+    ({ in->br_index = br_index; in->first = first; })
+#define get_fid2mstid_ranges_COPY_OUT ({ *num_entries = out->num_entries; \
+    memcpy(entries, out->entries,                                         \
+           out->num_entries * sizeof(out->entries[0])); })
+#define get_fid2mstid_ranges_CALL (in->br_index, in->first, \
+                                   &out->num_entries, out->entries)
+CTL_DECLARE(get_fid2mstid_ranges);
+
+/* get_changes: the bridge, trees, ports and tree ports whose status changed
+ * after generation since, oldest change first, with their status.
+ * generation is the current one. A full reply may have more after it: the
+ * client asks again with since = entries[num_entries - 1].generation. */
+#define CMD_CODE_get_changes    132
+#define CHANGES_PER_REPLY       128
+typedef struct
+{
+    __u64 generation;
+    int type;           /* MSTP_CHANGE_xxx */
+    int port_index;     /* MSTP_CHANGE_PORT and MSTP_CHANGE_TREE_PORT */
+    __u16 mstid;        /* MSTP_CHANGE_TREE and MSTP_CHANGE_TREE_PORT */
+    union
+    {
+        CIST_BridgeStatus bridge;
+        MSTI_BridgeStatus tree;
+        CIST_PortStatus port;
+        MSTI_PortStatus tree_port;
+    } s;
+} ChangeEntry;
+#define get_changes_ARGS (int br_index, __u64 since, __u64 *generation, \
+                          int *num_entries, ChangeEntry *entries)
+struct get_changes_IN
+{
+    int br_index;
+    __u64 since;
+};
+struct get_changes_OUT
+{
+    __u64 generation;
+    int num_entries;
+    ChangeEntry entries[CHANGES_PER_REPLY];
+};
+#define get_changes_COPY_IN \
+    ({ in->br_index = br_index; in->since = since; })
+#define get_changes_COPY_OUT ({ *generation = out->generation;   \
+    *num_entries = out->num_entries;                             \
+    memcpy(entries, out->entries,                                \
+           out->num_entries * sizeof(out->entries[0])); })
+#define get_changes_CALL (in->br_index, in->since, &out->generation, \
+                          &out->num_entries, out->entries)
+CTL_DECLARE(get_changes);
+
+/* get_port_latency */
+#define CMD_CODE_get_port_latency   133
+#define get_port_latency_ARGS (int br_index, int port_index, \
+                               port_latency_t *latency)
+struct get_port_latency_IN
+{
+    int br_index;
+    int port_index;
+};
+struct get_port_latency_OUT
+{
+    port_latency_t latency;
+};
+#define get_port_latency_COPY_IN \
+    ({ in->br_index = br_index; in->port_index = port_index; })
+#define get_port_latency_COPY_OUT ({ *latency = out->latency; })
+#define get_port_latency_CALL (in->br_index, in->port_index, &out->latency)
+CTL_DECLARE(get_port_latency);
+
 /* General case part in ctl command server switch */
 #define SERVER_MESSAGE_CASE(name)                            \
     case CMD_CODE_ ## name : do                              \
@@ -482,6 +717,45 @@ CTL_DECLARE(del_bridges);
         return r;                                            \
     }while(0)
 
+/* Case for the messages with a vector of up to max entries and no output */
+#define SERVER_VECTOR_MESSAGE_CASE(name, max)                            \
+    case CMD_CODE_ ## name : do                                          \
+    {                                                                    \
+        struct name ## _IN *in = inbuf;                                  \
+        if(sizeof(*in) > lin || 0 != lout                                \
+           || in->num_entries < 0 || in->num_entries > (max)             \
+           || lin != sizeof(*in)                                         \
+                     + in->num_entries * sizeof(in->entries[0]))         \
+        {                                                                \
+            LOG("Bad sizes lin %d or lout %d", lin, lout);               \
+            return -1;                                                   \
+        }                                                                \
+        return CTL_ ## name(in->br_index, in->num_entries, in->entries); \
+    }while(0)
+
+/* Case for the messages with a vector of up to max entries and an output */
+#define SERVER_VECTOR_OUT_MESSAGE_CASE(name, max)                        \
+    case CMD_CODE_ ## name : do                                          \
+    {                                                                    \
+        struct name ## _IN *in = inbuf;                                  \
+        struct name ## _OUT out0, *out = &out0;                          \
+        if(sizeof(*in) > lin || sizeof(*out) != lout                     \
+           || in->num_entries < 0 || in->num_entries > (max)             \
+           || lin != sizeof(*in)                                         \
+                     + in->num_entries * sizeof(in->entries[0]))         \
+        {                                                                \
+            LOG("Bad sizes lin %d or lout %d", lin, lout);               \
+            return -1;                                                   \
+        }                                                                \
+        memset(out, 0, sizeof(*out));                                    \
+        int r = CTL_ ## name name ## _CALL;                              \
+        if(r)                                                            \
+            return r;                                                    \
+        if(outbuf)                                                       \
+            memcpy(outbuf, out, lout);                                   \
+        return r;                                                        \
+    }while(0)
+
 /* Wraper for the control functions in the control command client */
 #define CLIENT_SIDE_FUNCTION(name)                               \
 CTL_DECLARE(name)                                                \
@@ -503,4 +777,66 @@ CTL_DECLARE(name)                                                \
     return 0;                                                    \
 }
 
+/* Client side of the messages with a vector of up to max entries and an
+ * output, always sent in one message */
+#define CLIENT_SIDE_VECTOR_OUT_FUNCTION(name, max)                        \
+CTL_DECLARE(name)                                                         \
+{                                                                         \
+    struct name ## _IN *in;                                               \
+    struct name ## _OUT out0, *out = &out0;                               \
+    int len, r, res = 0;                                                  \
+    LogString log = { .buf = "" };                                        \
+    if((0 > num_entries) || ((max) < num_entries))                        \
+        return -1;                                                        \
+    len = sizeof(*in) + num_entries * sizeof(in->entries[0]);             \
+    if(NULL == (in = malloc(len)))                                        \
+        return -1;                                                        \
+    in->br_index = br_index;                                              \
+    in->num_entries = num_entries;                                        \
+    memcpy(in->entries, entries, num_entries * sizeof(in->entries[0]));   \
+    r = send_ctl_message(CMD_CODE_ ## name, in, len, out, sizeof(*out),   \
+                         &log, &res);                                     \
+    free(in);                                                             \
+    if(r || res)                                                          \
+        LOG("Got return code %d, %d\n%s", r, res, log.buf);               \
+    if(r)                                                                 \
+        return r;                                                         \
+    if(res)                                                               \
+        return res;                                                       \
+    name ## _COPY_OUT;                                                    \
+    return 0;                                                             \
+}
+
+/* Client side of the messages with a vector of entries. Long vectors are
+ * split into several messages of MAX_PORT_CONFIGS entries at most. */
+#define CLIENT_SIDE_VECTOR_FUNCTION(name)                                 \
+CTL_DECLARE(name)                                                         \
+{                                                                         \
+    struct name ## _IN *in;                                               \
+    int i, n, len, r = 0, res = 0;                                        \
+    LogString log = { .buf = "" };                                        \
+    if(NULL == (in = malloc(sizeof(*in)                                   \
+                            + MAX_PORT_CONFIGS * sizeof(in->entries[0]))))\
+        return -1;                                                        \
+    for(i = 0; i < num_entries; i += n)                                   \
+    {                                                                     \
+        n = num_entries - i;                                              \
+        if(n > MAX_PORT_CONFIGS)                                          \
+            n = MAX_PORT_CONFIGS;                                         \
+        in->br_index = br_index;                                          \
+        in->num_entries = n;                                              \
+        memcpy(in->entries, entries + i, n * sizeof(in->entries[0]));     \
+        len = sizeof(*in) + n * sizeof(in->entries[0]);                   \
+        r = send_ctl_message(CMD_CODE_ ## name, in, len, NULL, 0,         \
+                             &log, &res);                                 \
+        if(r || res)                                                      \
+        {                                                                 \
+            LOG("Got return code %d, %d\n%s", r, res, log.buf);           \
+            break;                                                        \
+        }                                                                 \
+    }                                                                     \
+    free(in);                                                             \
+    return r ? r : res;                                                   \
+}
+
 #endif /* CTL_SOCKET_H */
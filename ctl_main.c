@@ -25,6 +25,7 @@
 #include <config.h>
 
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <dirent.h>
 #include <errno.h>
@@ -32,6 +33,7 @@
 #include <sys/stat.h>
 
 #include "ctl_socket_client.h"
+#include "mstp.h"
 #include "log.h"
 
 static int get_index_die(const char *ifname, const char *doc, bool die)
@@ -132,6 +134,10 @@ typedef enum {
     PARAM_TOPCHNGTIME,
     PARAM_TOPCHNGCNT,
     PARAM_TOPCHNGSTATE,
+    PARAM_NUMSMBUDGETEXH,
+    PARAM_NUMSMLIVELOCK,
+    PARAM_FDBFLUSHWINDOW,
+    PARAM_RAPIDAGEING,
     /* port params */
     PARAM_ROLE,
     PARAM_STATE,
@@ -167,6 +173,20 @@ typedef enum {
     PARAM_NUMTRANSFWD,
     PARAM_NUMTRANSBLK,
     PARAM_NUMBPDUFILTERED,
+    PARAM_NUMRXUNKNOWNMSTI,
+    PARAM_NUMTXERRORS,
+    PARAM_NUMRXBPDUFAST,
+    PARAM_BPDURATELIMIT,
+    PARAM_BPDURATEPOLICY,
+    PARAM_BPDURATELIMITED,
+    PARAM_NUMRXBPDURATELIMITED,
+    PARAM_NUMBPDURATELIMITENGAGED,
+    PARAM_NUMRAPIDAGEING,
+    PARAM_NUMFDBFLUSHREQUESTS,
+    PARAM_NUMFDBFLUSHES,
+    PARAM_RXQUEUELATENCY,
+    PARAM_RXPROCLATENCY,
+    PARAM_TXBPDUINTERVAL,
     PARAM_RCVDBPDU,
     PARAM_RCVDSTP,
     PARAM_RCVDRSTP,
@@ -200,6 +220,10 @@ static const cmd_param_t cist_bridge_params[] = {
     { PARAM_TOPCHNGTIME,  "time-since-topology-change" },
     { PARAM_TOPCHNGCNT,   "topology-change-count" },
     { PARAM_TOPCHNGSTATE, "topology-change" },
+    { PARAM_NUMSMBUDGETEXH, "num-sm-budget-exhausted" },
+    { PARAM_NUMSMLIVELOCK, "num-sm-livelock" },
+    { PARAM_FDBFLUSHWINDOW, "fdb-flush-window" },
+    { PARAM_RAPIDAGEING,  "rapid-ageing" },
 };
 
 static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
@@ -247,6 +271,14 @@ static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
                    s->topology_change_port);
             printf("  last topology change port  %s\n",
                    s->last_topology_change_port);
+            printf("  num sm budget exhausted    %u\n",
+                   s->num_sm_budget_exhausted);
+            printf("  num sm livelock            %u\n",
+                   s->num_sm_livelock);
+            printf("  fdb flush window           %u\n",
+                   s->fdb_flush_window);
+            printf("  rapid ageing               %s\n",
+                   BOOL_STR(s->rapid_ageing));
             break;
         case PARAM_ENABLED:
             printf("%s\n", BOOL_STR(s->enabled));
@@ -308,6 +340,18 @@ static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
         case PARAM_TOPCHNGSTATE:
             printf("%s\n", BOOL_STR(s->topology_change));
             break;
+        case PARAM_NUMSMBUDGETEXH:
+            printf("%u\n", s->num_sm_budget_exhausted);
+            break;
+        case PARAM_NUMSMLIVELOCK:
+            printf("%u\n", s->num_sm_livelock);
+            break;
+        case PARAM_FDBFLUSHWINDOW:
+            printf("%u\n", s->fdb_flush_window);
+            break;
+        case PARAM_RAPIDAGEING:
+            printf("%s\n", BOOL_STR(s->rapid_ageing));
+            break;
         default:
             return -2; /* -2 = unknown param */
     }
@@ -364,8 +408,13 @@ static int do_showbridge_fmt_json(const CIST_BridgeStatus *s,
                    BOOL_STR(s->topology_change));
             printf("\"topology-change-port\":\"%s\",",
                    s->topology_change_port);
-            printf("\"last-topology-change-port\":\"%s\"",
+            printf("\"last-topology-change-port\":\"%s\",",
                    s->last_topology_change_port);
+            printf("\"num-sm-budget-exhausted\":\"%u\",",
+                   s->num_sm_budget_exhausted);
+            printf("\"num-sm-livelock\":\"%u\",", s->num_sm_livelock);
+            printf("\"fdb-flush-window\":\"%u\",", s->fdb_flush_window);
+            printf("\"rapid-ageing\":\"%s\"", BOOL_STR(s->rapid_ageing));
             printf("}");
             break;
         case PARAM_ENABLED:
@@ -387,6 +436,10 @@ static int do_showbridge_fmt_json(const CIST_BridgeStatus *s,
         case PARAM_TOPCHNGTIME:
         case PARAM_TOPCHNGCNT:
         case PARAM_TOPCHNGSTATE:
+        case PARAM_NUMSMBUDGETEXH:
+        case PARAM_NUMSMLIVELOCK:
+        case PARAM_FDBFLUSHWINDOW:
+        case PARAM_RAPIDAGEING:
             /* Output individual parameters for the JSON
                format as plain text in quotes */
             printf("\"");
@@ -646,6 +699,8 @@ static int cmd_showtree(int argc, char *const *argv)
         _str;                                        \
     })
 
+#define BPDU_RATE_POLICY_STR(_keep_latest) ((_keep_latest) ? "latest" : "drop")
+
 #define ROLE_STR(_role)                                     \
     ({                                                      \
         port_role_t _r = _role;                             \
@@ -715,6 +770,20 @@ static const cmd_param_t cist_port_params[] = {
     { PARAM_NUMTRANSFWD,    "num-transition-fwd" },
     { PARAM_NUMTRANSBLK,    "num-transition-blk" },
     { PARAM_NUMBPDUFILTERED,"num-rx-bpdu-filtered" },
+    { PARAM_NUMRXUNKNOWNMSTI,"num-rx-unknown-msti" },
+    { PARAM_NUMTXERRORS,    "num-tx-errors" },
+    { PARAM_NUMRXBPDUFAST,  "num-rx-bpdu-fastpath" },
+    { PARAM_BPDURATELIMIT,  "bpdu-rate-limit" },
+    { PARAM_BPDURATEPOLICY, "bpdu-rate-policy" },
+    { PARAM_BPDURATELIMITED,"bpdu-rate-limited" },
+    { PARAM_NUMRXBPDURATELIMITED, "num-rx-bpdu-rate-limited" },
+    { PARAM_NUMBPDURATELIMITENGAGED, "num-bpdu-rate-limit-engaged" },
+    { PARAM_NUMRAPIDAGEING, "num-rapid-ageing" },
+    { PARAM_NUMFDBFLUSHREQUESTS, "num-fdb-flush-requests" },
+    { PARAM_NUMFDBFLUSHES,  "num-fdb-flushes" },
+    { PARAM_RXQUEUELATENCY, "rx-queue-latency" },
+    { PARAM_RXPROCLATENCY,  "rx-processing-latency" },
+    { PARAM_TXBPDUINTERVAL, "tx-bpdu-interval" },
     { PARAM_RCVDBPDU,       "received-bpdu" },
     { PARAM_RCVDSTP,        "received-stp" },
     { PARAM_RCVDRSTP,       "received-rstp" },
@@ -725,7 +794,13 @@ static const cmd_param_t cist_port_params[] = {
 
 static int detail = 0;
 
+/* last/avg/max of latency_stats_t, in microseconds */
+#define LATENCY_FMT "%u/%u/%u"
+#define LATENCY_ARGS(l) (l).last, \
+    (l).count ? (unsigned int)((l).total / (l).count) : 0, (l).max
+
 static int do_showport_fmt_plain(const CIST_PortStatus *s,
+                                 const port_latency_t *lat,
                                  const char *bridge_name,
                                  const char *port_name,
                                  param_id_t param_id)
@@ -794,6 +869,27 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
                 printf("Num RX TCN           %u\n", s->num_rx_tcn);
                 printf("  Num Transition FWD %-23u ", s->num_trans_fwd);
                 printf("Num Transition BLK   %u\n", s->num_trans_blk);
+                printf("  Num RX Unkn MSTI   %-23u ", s->num_rx_unknown_msti);
+                printf("Num TX Errors        %u\n", s->num_tx_errors);
+                printf("  Num RX BPDU Fast   %u\n", s->num_rx_bpdu_fast);
+                printf("  bpdu rate limit    %-10u %-12s ", s->bpdu_rate_limit,
+                       BPDU_RATE_POLICY_STR(s->bpdu_rate_keep_latest));
+                printf("bpdu rate limited    %s\n",
+                       BOOL_STR(s->bpdu_rate_limited));
+                printf("  Num RX Limited     %-23u ",
+                       s->num_rx_bpdu_rate_limited);
+                printf("Num Limit Engaged    %u\n",
+                       s->num_bpdu_rate_limit_engaged);
+                printf("  Num FDB Flush Req  %-23u ",
+                       s->num_fdb_flush_requests);
+                printf("Num FDB Flushes      %u\n", s->num_fdb_flushes);
+                printf("  Num Rapid Ageing   %u\n", s->num_rapid_ageing);
+                printf("  RX queue lat (us)  last/avg/max "LATENCY_FMT"\n",
+                       LATENCY_ARGS(lat->rx_queue));
+                printf("  RX proc lat (us)   last/avg/max "LATENCY_FMT"\n",
+                       LATENCY_ARGS(lat->rx_processing));
+                printf("  TX BPDU ivl (us)   last/avg/max "LATENCY_FMT"\n",
+                       LATENCY_ARGS(lat->tx_bpdu_interval));
                 printf("  Rcvd BPDU          %-23s ", BOOL_STR(s->rcvdBpdu));
                 printf("Rcvd STP             %s\n", BOOL_STR(s->rcvdSTP));
                 printf("  Rcvd RSTP          %-23s ", BOOL_STR(s->rcvdRSTP));
@@ -924,6 +1020,48 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
         case PARAM_NUMBPDUFILTERED:
             printf("%u\n", s->num_rx_bpdu_filtered);
             break;
+        case PARAM_NUMRXUNKNOWNMSTI:
+            printf("%u\n", s->num_rx_unknown_msti);
+            break;
+        case PARAM_NUMTXERRORS:
+            printf("%u\n", s->num_tx_errors);
+            break;
+        case PARAM_NUMRXBPDUFAST:
+            printf("%u\n", s->num_rx_bpdu_fast);
+            break;
+        case PARAM_BPDURATELIMIT:
+            printf("%u\n", s->bpdu_rate_limit);
+            break;
+        case PARAM_BPDURATEPOLICY:
+            printf("%s\n", BPDU_RATE_POLICY_STR(s->bpdu_rate_keep_latest));
+            break;
+        case PARAM_BPDURATELIMITED:
+            printf("%s\n", BOOL_STR(s->bpdu_rate_limited));
+            break;
+        case PARAM_NUMRXBPDURATELIMITED:
+            printf("%u\n", s->num_rx_bpdu_rate_limited);
+            break;
+        case PARAM_NUMBPDURATELIMITENGAGED:
+            printf("%u\n", s->num_bpdu_rate_limit_engaged);
+            break;
+        case PARAM_NUMRAPIDAGEING:
+            printf("%u\n", s->num_rapid_ageing);
+            break;
+        case PARAM_NUMFDBFLUSHREQUESTS:
+            printf("%u\n", s->num_fdb_flush_requests);
+            break;
+        case PARAM_NUMFDBFLUSHES:
+            printf("%u\n", s->num_fdb_flushes);
+            break;
+        case PARAM_RXQUEUELATENCY:
+            printf(LATENCY_FMT"\n", LATENCY_ARGS(lat->rx_queue));
+            break;
+        case PARAM_RXPROCLATENCY:
+            printf(LATENCY_FMT"\n", LATENCY_ARGS(lat->rx_processing));
+            break;
+        case PARAM_TXBPDUINTERVAL:
+            printf(LATENCY_FMT"\n", LATENCY_ARGS(lat->tx_bpdu_interval));
+            break;
         case PARAM_RCVDBPDU:
             printf("%s\n", BOOL_STR(s->rcvdBpdu));
             break;
@@ -950,6 +1088,7 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
 }
 
 static int do_showport_fmt_json(const CIST_PortStatus *s,
+                                const port_latency_t *lat,
                                 const char *bridge_name,
                                 const char *port_name,
                                 param_id_t param_id)
@@ -1027,6 +1166,30 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
                        s->num_trans_fwd);
                 printf("\"num-transition-blk\":\"%u\",",
                        s->num_trans_blk);
+                printf("\"num-rx-unknown-msti\":\"%u\",",
+                       s->num_rx_unknown_msti);
+                printf("\"num-tx-errors\":\"%u\",", s->num_tx_errors);
+                printf("\"num-rx-bpdu-fastpath\":\"%u\",",
+                       s->num_rx_bpdu_fast);
+                printf("\"bpdu-rate-limit\":\"%u\",", s->bpdu_rate_limit);
+                printf("\"bpdu-rate-policy\":\"%s\",",
+                       BPDU_RATE_POLICY_STR(s->bpdu_rate_keep_latest));
+                printf("\"bpdu-rate-limited\":\"%s\",",
+                       BOOL_STR(s->bpdu_rate_limited));
+                printf("\"num-rx-bpdu-rate-limited\":\"%u\",",
+                       s->num_rx_bpdu_rate_limited);
+                printf("\"num-bpdu-rate-limit-engaged\":\"%u\",",
+                       s->num_bpdu_rate_limit_engaged);
+                printf("\"num-rapid-ageing\":\"%u\",", s->num_rapid_ageing);
+                printf("\"num-fdb-flush-requests\":\"%u\",",
+                       s->num_fdb_flush_requests);
+                printf("\"num-fdb-flushes\":\"%u\",", s->num_fdb_flushes);
+                printf("\"rx-queue-latency\":\""LATENCY_FMT"\",",
+                       LATENCY_ARGS(lat->rx_queue));
+                printf("\"rx-processing-latency\":\""LATENCY_FMT"\",",
+                       LATENCY_ARGS(lat->rx_processing));
+                printf("\"tx-bpdu-interval\":\""LATENCY_FMT"\",",
+                       LATENCY_ARGS(lat->tx_bpdu_interval));
                 printf("\"received-bpdu\":\"%s\",",
                        BOOL_STR(s->rcvdBpdu));
                 printf("\"received-stp\":\"%s\",",
@@ -1104,6 +1267,12 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
         case PARAM_NUMTRANSFWD:
         case PARAM_NUMTRANSBLK:
         case PARAM_NUMBPDUFILTERED:
+        case PARAM_NUMRXUNKNOWNMSTI:
+        case PARAM_NUMTXERRORS:
+        case PARAM_NUMRXBPDUFAST:
+        case PARAM_RXQUEUELATENCY:
+        case PARAM_RXPROCLATENCY:
+        case PARAM_TXBPDUINTERVAL:
         case PARAM_RCVDBPDU:
         case PARAM_RCVDSTP:
         case PARAM_RCVDRSTP:
@@ -1113,7 +1282,7 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
             /* Output individual parameters for the JSON
                format as plain text in quotes */
             printf("\"");
-            int err = do_showport_fmt_plain(s, bridge_name, port_name,
+            int err = do_showport_fmt_plain(s, lat, bridge_name, port_name,
                                             param_id);
             printf("\"");
             return err;
@@ -1128,12 +1297,14 @@ static int do_showport(int br_index, const char *bridge_name,
                        const char *port_name, param_id_t param_id)
 {
     CIST_PortStatus s;
+    port_latency_t lat;
     int r = 0;
     int port_index = get_index_die(port_name, "port", false);
     if(0 > port_index)
         return port_index;
 
-    if((r = CTL_get_cist_port_status(br_index, port_index, &s)))
+    if((r = CTL_get_cist_port_status(br_index, port_index, &s))
+       || (r = CTL_get_port_latency(br_index, port_index, &lat)))
     {
         fprintf(stderr, "%s:%s Failed to get port state\n",
                 bridge_name, port_name);
@@ -1143,10 +1314,10 @@ static int do_showport(int br_index, const char *bridge_name,
     switch(format)
     {
         case FORMAT_PLAIN:
-            return do_showport_fmt_plain(&s, bridge_name, port_name,
+            return do_showport_fmt_plain(&s, &lat, bridge_name, port_name,
                                          param_id);
         case FORMAT_JSON:
-            return do_showport_fmt_json(&s, bridge_name, port_name,
+            return do_showport_fmt_json(&s, &lat, bridge_name, port_name,
                                         param_id);
         default:
             return -3; /* -3 = unsupported or unknown format */
@@ -1317,6 +1488,8 @@ static int do_showtreeport_fmt_plain(const MSTI_PortStatus *s,
            BR_ID_ARGS(s->designated_bridge));
     printf("designated port      "PRT_ID_FMT"\n",
            PRT_ID_ARGS(s->designated_port));
+    printf("  Num FDB Flush Req  %-23u ", s->num_fdb_flush_requests);
+    printf("Num FDB Flushes      %u\n", s->num_fdb_flushes);
 
     return 0;
 }
@@ -1343,8 +1516,11 @@ static int do_showtreeport_fmt_json(const MSTI_PortStatus *s,
            s->designated_internal_cost);
     printf("\"designated-bridge\":\""BR_ID_FMT"\",",
            BR_ID_ARGS(s->designated_bridge));
-    printf("\"designated-port\":\""PRT_ID_FMT"\"",
+    printf("\"designated-port\":\""PRT_ID_FMT"\",",
            PRT_ID_ARGS(s->designated_port));
+    printf("\"num-fdb-flush-requests\":\"%u\",",
+           s->num_fdb_flush_requests);
+    printf("\"num-fdb-flushes\":\"%u\"", s->num_fdb_flushes);
     printf("}");
 
     return 0;
@@ -1524,30 +1700,166 @@ static int cmd_setmstconfid(int argc, char *const *argv)
         r;                                                 \
     })
 
-#define set_port_cfg(field, value)                                  \
+/* Add the index of the port ifname to the list; exit if there is none */
+static void add_port_index(const char *ifname, int **list, int *num)
+{
+    int *l = realloc(*list, (*num + 1) * sizeof(**list));
+    if(NULL == l)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    l[(*num)++] = get_index(ifname, "port");
+    *list = l;
+}
+
+/* Parse a comma-separated list of ports, where swp1-48 stands for the ports
+ * swp1 to swp48 (unless there is a port with this very name).
+ * Return the number of ports; exit if a port can't be found.
+ */
+static int parse_port_list(const char *str, int **list)
+{
+    char *copy, *item, *save, *dash, *p;
+    char ifname[IFNAMSIZ];
+    unsigned long first, last, n;
+    int num = 0;
+
+    *list = NULL;
+    if(NULL == (copy = strdup(str)))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for(item = strtok_r(copy, ",", &save); item;
+        item = strtok_r(NULL, ",", &save))
+    {
+        dash = strrchr(item, '-');
+        if(!dash || (dash == item) || if_nametoindex(item))
+        {
+            add_port_index(item, list, &num);
+            continue;
+        }
+        /* The range bounds: digits before the dash and after it */
+        for(p = dash; (p > item) && isdigit(p[-1]); --p)
+            ;
+        if((p == dash) || (p == item) || !isdigit(dash[1]))
+        {
+            add_port_index(item, list, &num);
+            continue;
+        }
+        first = strtoul(p, NULL, 10);
+        last = strtoul(dash + 1, NULL, 10);
+        if(first > last)
+        {
+            fprintf(stderr, "Bad port range %s\n", item);
+            exit(1);
+        }
+        for(n = first; n <= last; ++n)
+        {
+            if((int)sizeof(ifname) <= snprintf(ifname, sizeof(ifname),
+                                               "%.*s%lu", (int)(p - item),
+                                               item, n))
+            {
+                fprintf(stderr, "Bad port range %s\n", item);
+                exit(1);
+            }
+            add_port_index(ifname, list, &num);
+        }
+    }
+    free(copy);
+    if(0 == num)
+    {
+        fprintf(stderr, "No port given\n");
+        exit(1);
+    }
+    return num;
+}
+
+/* Apply cfg to all the ports of the list, in one command when they are more
+ * than one so that the daemon runs the state machines only once.
+ */
+static int set_port_cfgs(int br_index, const char *ports, CIST_PortConfig *cfg)
+{
+    CIST_PortConfigEntry *entries;
+    int *list, num, i, r;
+
+    num = parse_port_list(ports, &list);
+    if(1 == num)
+    {
+        r = CTL_set_cist_port_config(br_index, list[0], cfg);
+        free(list);
+        return r;
+    }
+    if(NULL == (entries = calloc(num, sizeof(*entries))))
+    {
+        free(list);
+        return -1;
+    }
+    for(i = 0; i < num; ++i)
+    {
+        entries[i].port_index = list[i];
+        entries[i].cfg = *cfg;
+    }
+    r = CTL_set_cist_port_configs(br_index, num, entries);
+    free(entries);
+    free(list);
+    return r;
+}
+
+static int set_tree_port_cfgs(int br_index, const char *ports, int mstid,
+                              MSTI_PortConfig *cfg)
+{
+    MSTI_PortConfigEntry *entries;
+    int *list, num, i, r;
+
+    num = parse_port_list(ports, &list);
+    if(1 == num)
+    {
+        r = CTL_set_msti_port_config(br_index, list[0], mstid, cfg);
+        free(list);
+        return r;
+    }
+    if(NULL == (entries = calloc(num, sizeof(*entries))))
+    {
+        free(list);
+        return -1;
+    }
+    for(i = 0; i < num; ++i)
+    {
+        entries[i].port_index = list[i];
+        entries[i].mstid = mstid;
+        entries[i].cfg = *cfg;
+    }
+    r = CTL_set_msti_port_configs(br_index, num, entries);
+    free(entries);
+    free(list);
+    return r;
+}
+
+#define set_port_cfg(field, value)                           \
+    ({                                                       \
+        CIST_PortConfig c;                                   \
+        memset(&c, 0, sizeof(c));                            \
+        c.field = value;                                     \
+        c.set_ ## field = true;                              \
+        int r = set_port_cfgs(br_index, argv[2], &c);        \
+        if(r)                                                \
+            printf("Couldn't change port " #field "\n");     \
+        r;                                                   \
+    })
+
+#define set_tree_port_cfg(field, value)                             \
     ({                                                              \
-        CIST_PortConfig c;                                          \
+        MSTI_PortConfig c;                                          \
         memset(&c, 0, sizeof(c));                                   \
         c.field = value;                                            \
         c.set_ ## field = true;                                     \
-        int r = CTL_set_cist_port_config(br_index, port_index, &c); \
+        int r = set_tree_port_cfgs(br_index, argv[2], mstid, &c);   \
         if(r)                                                       \
-            printf("Couldn't change port " #field "\n");            \
+            printf("Couldn't change per-tree port " #field "\n");   \
         r;                                                          \
     })
 
-#define set_tree_port_cfg(field, value)                                    \
-    ({                                                                     \
-        MSTI_PortConfig c;                                                 \
-        memset(&c, 0, sizeof(c));                                          \
-        c.field = value;                                                   \
-        c.set_ ## field = true;                                            \
-        int r = CTL_set_msti_port_config(br_index, port_index, mstid, &c); \
-        if(r)                                                              \
-            printf("Couldn't change per-tree port " #field "\n");          \
-        r;                                                                 \
-    })
-
 static int cmd_setbridgemaxage(int argc, char *const *argv)
 {
     int br_index = get_index(argv[1], "bridge");
@@ -1618,6 +1930,14 @@ static int cmd_setbridgeageing(int argc, char *const *argv)
     return set_bridge_cfg(bridge_ageing_time, getuint(argv[2]));
 }
 
+static int cmd_setflushwindow(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    return set_bridge_cfg(fdb_flush_window, getuint(argv[2]));
+}
+
 static int cmd_settreeprio(int argc, char *const *argv)
 {
     int br_index = get_index(argv[1], "bridge");
@@ -1637,9 +1957,6 @@ static int cmd_setportpathcost(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     return set_port_cfg(admin_external_port_path_cost, getuint(argv[3]));
 }
 
@@ -1648,9 +1965,6 @@ static int cmd_setportadminedge(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     return set_port_cfg(admin_edge_port, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1659,9 +1973,6 @@ static int cmd_setportautoedge(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     return set_port_cfg(auto_edge_port, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1670,9 +1981,6 @@ static int cmd_setportp2p(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     const char *opts[] = { "no", "yes", "auto", NULL };
     int vals[] = { p2pForceFalse, p2pForceTrue, p2pAuto };
     return set_port_cfg(admin_p2p, vals[getenum(argv[3], opts)]);
@@ -1683,9 +1991,6 @@ static int cmd_setportrestrrole(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     return set_port_cfg(restricted_role, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1694,9 +1999,6 @@ static int cmd_setportrestrtcn(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     return set_port_cfg(restricted_tcn, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1705,9 +2007,6 @@ static int cmd_setportbpduguard(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     return set_port_cfg(bpdu_guard_port, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1716,20 +2015,30 @@ static int cmd_setportbpdufilter(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if (0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if (0 > port_index)
-        return port_index;
     return set_port_cfg(bpdu_filter_port, getyesno(argv[3], "yes", "no"));
 }
 
+static int cmd_setportbpdurate(int argc, char *const *argv)
+{
+    CIST_PortConfig c;
+    int r, br_index = get_index(argv[1], "bridge");
+    if (0 > br_index)
+        return br_index;
+    const char *opts[] = { "drop", "latest", NULL };
+    memset(&c, 0, sizeof(c));
+    c.bpdu_rate_limit = getuint(argv[3]);
+    c.bpdu_rate_keep_latest = (4 < argc) && getenum(argv[4], opts);
+    c.set_bpdu_rate_limit = true;
+    if((r = set_port_cfgs(br_index, argv[2], &c)))
+        printf("Couldn't change port bpdu_rate_limit\n");
+    return r;
+}
+
 static int cmd_setportnetwork(int argc, char *const *argv)
 {
     int br_index = get_index(argv[1], "bridge");
     if (0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if (0 > port_index)
-        return port_index;
     return set_port_cfg(network_port, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1738,9 +2047,6 @@ static int cmd_setportdonttxmt(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if (0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if (0 > port_index)
-        return port_index;
     return set_port_cfg(dont_txmt, getyesno(argv[3], "yes", "no"));
 }
 
@@ -1749,9 +2055,6 @@ static int cmd_settreeportprio(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     int mstid = get_id(argv[3], "mstid", MAX_MSTID);
     if(0 > mstid)
         return mstid;
@@ -1766,9 +2069,6 @@ static int cmd_settreeportcost(int argc, char *const *argv)
     int br_index = get_index(argv[1], "bridge");
     if(0 > br_index)
         return br_index;
-    int port_index = get_index(argv[2], "port");
-    if(0 > port_index)
-        return port_index;
     int mstid = get_id(argv[3], "mstid", MAX_MSTID);
     if(0 > mstid)
         return mstid;
@@ -1791,6 +2091,102 @@ static int cmd_debuglevel(int argc, char *const *argv)
     return CTL_set_debug_level(getuint(argv[1]));
 }
 
+static const char *const loop_class_names[EPOLL_NUM_PRIO] =
+{
+    [EPOLL_PRIO_PROTOCOL] = "protocol",
+    [EPOLL_PRIO_LINK] = "link",
+    [EPOLL_PRIO_CONTROL] = "control",
+};
+
+static unsigned int avg_latency(const epoll_class_stats_t *cs)
+{
+    return cs->events ? (unsigned int)(cs->total_latency / cs->events) : 0;
+}
+
+static int do_showloopstats_fmt_plain(const epoll_loop_stats_t *s)
+{
+    const epoll_class_stats_t *cs;
+    int prio;
+
+    printf("mstpd event loop\n");
+    printf("  turns          %u\n", s->turns);
+    printf("  events array   %u\n", s->ev_size);
+    printf("  low prio quota %u\n", s->low_prio_quota);
+    printf("  ticks          %-10u tick overruns  %u\n",
+           s->ticks, s->tick_overruns);
+    printf("  last lag (us)  %-10u max lag (us)   %u\n",
+           s->last_lag_us, s->max_lag_us);
+    printf("  lag alarm (ms) %-10u lag alarms     %u\n",
+           s->lag_alarm_ms, s->lag_alarms);
+    printf("  %-9s %10s %10s %9s %10s %12s %12s\n", "class", "events",
+           "calls", "max depth", "quota hits", "avg lat (us)",
+           "max lat (us)");
+    for(prio = 0; prio < EPOLL_NUM_PRIO; ++prio)
+    {
+        cs = &s->classes[prio];
+        printf("  %-9s %10u %10u %9u %10u %12u %12u\n",
+               loop_class_names[prio], cs->events,
+               cs->calls, cs->max_depth, cs->quota_hits, avg_latency(cs),
+               cs->max_latency);
+    }
+
+    return 0;
+}
+
+static int do_showloopstats_fmt_json(const epoll_loop_stats_t *s)
+{
+    const epoll_class_stats_t *cs;
+    int prio;
+
+    printf("{");
+    printf("\"turns\":\"%u\",", s->turns);
+    printf("\"events-array-size\":\"%u\",", s->ev_size);
+    printf("\"low-prio-quota\":\"%u\",", s->low_prio_quota);
+    printf("\"ticks\":\"%u\",", s->ticks);
+    printf("\"tick-overruns\":\"%u\",", s->tick_overruns);
+    printf("\"last-lag-us\":\"%u\",", s->last_lag_us);
+    printf("\"max-lag-us\":\"%u\",", s->max_lag_us);
+    printf("\"lag-alarm-ms\":\"%u\",", s->lag_alarm_ms);
+    printf("\"lag-alarms\":\"%u\",", s->lag_alarms);
+    printf("\"classes\":[");
+    for(prio = 0; prio < EPOLL_NUM_PRIO; ++prio)
+    {
+        cs = &s->classes[prio];
+        if(prio)
+            printf(",");
+        printf("{");
+        printf("\"class\":\"%s\",", loop_class_names[prio]);
+        printf("\"events\":\"%u\",", cs->events);
+        printf("\"calls\":\"%u\",", cs->calls);
+        printf("\"max-depth\":\"%u\",", cs->max_depth);
+        printf("\"quota-hits\":\"%u\",", cs->quota_hits);
+        printf("\"avg-latency-us\":\"%u\",", avg_latency(cs));
+        printf("\"max-latency-us\":\"%u\"", cs->max_latency);
+        printf("}");
+    }
+    printf("]}");
+
+    return 0;
+}
+
+static int cmd_showloopstats(int argc, char *const *argv)
+{
+    epoll_loop_stats_t s;
+
+    if(CTL_get_loop_stats(&s))
+        return -1;
+
+    switch(format)
+    {
+        case FORMAT_PLAIN:
+            return do_showloopstats_fmt_plain(&s);
+        case FORMAT_JSON:
+            return do_showloopstats_fmt_json(&s);
+        default:
+            return -3; /* -3 = unsupported or unknown format */
+    }
+}
+
 static int do_showmstilist_fmt_plain(const char *br_name,
                                      int num_mstis,
                                      const __u16 *mstids)
@@ -1931,6 +2327,59 @@ static int cmd_deletetree(int argc, char *const *argv)
     return CTL_delete_msti(br_index, mstid);
 }
 
+/* Read the map[min..max] from the ranges the daemon sends */
+static int get_map_ranges(int br_index, int min, int max,
+                          int (*get_ranges)(int, __u16, int *, MapRange *),
+                          __u16 *map)
+{
+    MapRange ranges[MAP_RANGES_PER_REPLY];
+    int first = min, num, i, j;
+
+    while(first <= max)
+    {
+        if(get_ranges(br_index, first, &num, ranges))
+            return -1;
+        if(0 >= num)
+            return -1;
+        for(i = 0; i < num; ++i)
+        {
+            if((ranges[i].lo != first) || (ranges[i].hi < ranges[i].lo)
+               || (ranges[i].hi > max))
+                return -1;
+            for(j = ranges[i].lo; j <= ranges[i].hi; ++j)
+                map[j] = ranges[i].value;
+            first = ranges[i].hi + 1;
+        }
+    }
+    return 0;
+}
+
+/* Send the entries of map[min..max] which are not 0xFFFF as ranges */
+static int set_map_ranges(int br_index, int min, int max,
+                          int (*set_ranges)(int, int, MapRange *, int *,
+                                            __u16 *),
+                          const __u16 *map)
+{
+    MapRange ranges[MAX_MAP_RANGES];
+    __u16 changed_mstids[MAX_IMPLEMENTATION_MSTIS + 1];
+    int num = 0, num_changed, i;
+
+    for(i = min; i <= max; ++i)
+    {
+        if(0xFFFF == map[i])
+            continue;
+        if(num && (ranges[num - 1].hi == i - 1)
+           && (ranges[num - 1].value == map[i]))
+        {
+            ranges[num - 1].hi = i;
+            continue;
+        }
+        ranges[num].lo = ranges[num].hi = i;
+        ranges[num++].value = map[i];
+    }
+    return set_ranges(br_index, num, ranges, &num_changed, changed_mstids);
+}
+
 static int do_showvid2fid_fmt(__u16 *vid2fid,
                               const char *br_name)
 {
@@ -2004,7 +2453,7 @@ static int cmd_showvid2fid(int argc, char *const *argv)
     if(0 > br_index)
         return br_index;
 
-    if(CTL_get_vids2fids(br_index, vid2fid))
+    if(get_map_ranges(br_index, 1, MAX_VID, CTL_get_vid2fid_ranges, vid2fid))
         return -1;
 
     switch(format)
@@ -2088,7 +2537,8 @@ static int cmd_showfid2mstid(int argc, char *const *argv)
     if(0 > br_index)
         return br_index;
 
-    if(CTL_get_fids2mstids(br_index, fid2mstid))
+    if(get_map_ranges(br_index, 0, MAX_FID, CTL_get_fid2mstid_ranges,
+                      fid2mstid))
         return -1;
 
     switch(format)
@@ -2101,6 +2551,123 @@ static int cmd_showfid2mstid(int argc, char *const *argv)
     }
 }
 
+static const char *const change_type_names[] =
+{
+    [MSTP_CHANGE_BRIDGE] = "bridge",
+    [MSTP_CHANGE_TREE] = "tree",
+    [MSTP_CHANGE_PORT] = "port",
+    [MSTP_CHANGE_TREE_PORT] = "treeport",
+};
+
+static void do_showchange(const ChangeEntry *e, bool first)
+{
+    char port_name[IFNAMSIZ];
+    unsigned int tc_count = 0;
+    int role = roleDisabled, state = BR_STATE_DISABLED;
+
+    if(e->port_index && !if_indextoname(e->port_index, port_name))
+        snprintf(port_name, sizeof(port_name), "%d", e->port_index);
+    switch(e->type)
+    {
+        case MSTP_CHANGE_BRIDGE:
+            tc_count = e->s.bridge.topology_change_count;
+            break;
+        case MSTP_CHANGE_TREE:
+            tc_count = e->s.tree.topology_change_count;
+            break;
+        case MSTP_CHANGE_PORT:
+            role = e->s.port.role;
+            state = e->s.port.state;
+            break;
+        case MSTP_CHANGE_TREE_PORT:
+            role = e->s.tree_port.role;
+            state = e->s.tree_port.state;
+            break;
+    }
+
+    if(FORMAT_JSON == format)
+    {
+        printf("%s{\"generation\":\"%llu\",\"type\":\"%s\"",
+               first ? "" : ",", (unsigned long long)e->generation,
+               change_type_names[e->type]);
+        if(e->port_index)
+            printf(",\"port\":\"%s\"", port_name);
+        if(MSTP_CHANGE_TREE == e->type || MSTP_CHANGE_TREE_PORT == e->type)
+            printf(",\"mstid\":\"%hu\"", e->mstid);
+        if(e->port_index)
+            printf(",\"role\":\"%s\",\"state\":\"%s\"}",
+                   ROLE_STR(role), STATE_STR(state));
+        else
+            printf(",\"topology-change-count\":\"%u\"}", tc_count);
+        return;
+    }
+
+    printf("%20llu %-8s", (unsigned long long)e->generation,
+           change_type_names[e->type]);
+    switch(e->type)
+    {
+        case MSTP_CHANGE_BRIDGE:
+            printf(" topology change count %u\n", tc_count);
+            break;
+        case MSTP_CHANGE_TREE:
+            printf(" %-15hu topology change count %u\n", e->mstid,
+                   tc_count);
+            break;
+        case MSTP_CHANGE_PORT:
+            printf(" %-15s %-10s %s\n", port_name, ROLE_STR(role),
+                   STATE_STR(state));
+            break;
+        case MSTP_CHANGE_TREE_PORT:
+            printf(" %-9s %5hu %-10s %s\n", port_name, e->mstid,
+                   ROLE_STR(role), STATE_STR(state));
+            break;
+    }
+}
+
+static int cmd_showchanges(int argc, char *const *argv)
+{
+    static ChangeEntry entries[CHANGES_PER_REPLY];
+    unsigned long long since = 0;
+    __u64 generation;
+    char *end;
+    int num, i;
+    bool first = true;
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+
+    if(2 < argc)
+    {
+        since = strtoull(argv[2], &end, 0);
+        if(0 == *argv[2] || 0 != *end)
+        {
+            fprintf(stderr, "Invalid generation %s\n", argv[2]);
+            return -1;
+        }
+    }
+
+    if(FORMAT_JSON == format)
+        printf("{\"bridge\":\"%s\",\"changes\":[", argv[1]);
+    else
+        printf("%s changes since generation %llu:\n", argv[1], since);
+    do
+    {
+        if(CTL_get_changes(br_index, since, &generation, &num, entries))
+            return -1;
+        for(i = 0; i < num; ++i, first = false)
+            do_showchange(&entries[i], first);
+        if(num)
+            since = entries[num - 1].generation;
+    } while(CHANGES_PER_REPLY == num);
+
+    if(FORMAT_JSON == format)
+        printf("],\"generation\":\"%llu\"}", (unsigned long long)generation);
+    else
+        printf("%s generation %llu\n", argv[1],
+               (unsigned long long)generation);
+    return 0;
+}
+
 static int ParseList(const char *str_c, __u16 *array,
                      __u16 max_index, const char *index_doc,
                      __u16 max_value, const char *value_doc,
@@ -2204,7 +2771,8 @@ static int cmd_setvid2fid(int argc, char *const *argv)
         if(0 > (ret = ParseList(argv[i], vids2fids, MAX_VID, "VID",
                                 MAX_FID, "FID", true)))
             return ret;
-    return CTL_set_vids2fids(br_index, vids2fids);
+    return set_map_ranges(br_index, 1, MAX_VID, CTL_set_vid2fid_ranges,
+                          vids2fids);
 }
 
 static int cmd_setfid2mstid(int argc, char *const *argv)
@@ -2219,7 +2787,8 @@ static int cmd_setfid2mstid(int argc, char *const *argv)
         if(0 > (ret = ParseList(argv[i], fids2mstids, MAX_FID, "FID",
                                 MAX_MSTID, "mstid", false)))
             return ret;
-    return CTL_set_fids2mstids(br_index, fids2mstids);
+    return set_map_ranges(br_index, 0, MAX_FID, CTL_set_fid2mstid_ranges,
+                          fids2mstids);
 }
 
 struct command
@@ -2251,6 +2820,9 @@ static const struct command commands[] =
      "<bridge>", "Show VID-to-FID allocation table"},
     {1, 0, "showfid2mstid", cmd_showfid2mstid,
      "<bridge>", "Show FID-to-MSTID allocation table"},
+    {1, 1, "showchanges", cmd_showchanges,
+     "<bridge> [<generation>]",
+     "Show what changed after the given generation (default 0)"},
     /* Show global port */
     {1, 32, "showport", cmd_showport,
      "<bridge> [<port>...[port] [param]]", "Show port state for the CIST"},
@@ -2285,6 +2857,9 @@ static const struct command commands[] =
      "<bridge> <hello_time>", "Set bridge hello time (1-10)"},
     {2, 0, "setageing", cmd_setbridgeageing,
      "<bridge> <ageing_time>", "Set bridge ageing time (10-1000000)"},
+    {2, 0, "setflushwindow", cmd_setflushwindow,
+     "<bridge> <seconds>",
+     "Coalesce the flushes of a port (0 = off, up to fdelay)"},
     {2, 0, "setforcevers", cmd_setbridgeforcevers,
      "<bridge> {mstp|rstp|stp}", "Force Spanning Tree protocol version"},
     {2, 0, "settxholdcount", cmd_setbridgetxholdcount,
@@ -2299,39 +2874,44 @@ static const struct command commands[] =
      "Set bridge priority (0-15) for the given MSTI"},
     /* Set global port */
     {3, 0, "setportpathcost", cmd_setportpathcost,
-     "<bridge> <port> <cost>",
+     "<bridge> <ports> <cost>",
      "Set port external path cost for the CIST (0 = auto)"},
     {3, 0, "setportadminedge", cmd_setportadminedge,
-     "<bridge> <port> {yes|no}", "Set initial edge state"},
+     "<bridge> <ports> {yes|no}", "Set initial edge state"},
     {3, 0, "setportautoedge", cmd_setportautoedge,
-     "<bridge> <port> {yes|no}", "Enable auto transition to/from edge state"},
+     "<bridge> <ports> {yes|no}", "Enable auto transition to/from edge state"},
     {3, 0, "setportp2p", cmd_setportp2p,
-     "<bridge> <port> {yes|no|auto}", "Set p2p detection mode"},
+     "<bridge> <ports> {yes|no|auto}", "Set p2p detection mode"},
     {3, 0, "setportrestrrole", cmd_setportrestrrole,
-     "<bridge> <port> {yes|no}", "Restrict port ability to take Root role"},
+     "<bridge> <ports> {yes|no}", "Restrict port ability to take Root role"},
     {3, 0, "setportrestrtcn", cmd_setportrestrtcn,
-     "<bridge> <port> {yes|no}",
+     "<bridge> <ports> {yes|no}",
      "Restrict port ability to propagate received TCNs"},
     {2, 0, "portmcheck", cmd_portmcheck,
      "<bridge> <port>", "Try to get back from STP to rapid (RSTP/MSTP) mode"},
     {3, 0, "setbpduguard", cmd_setportbpduguard,
-     "<bridge> <port> {yes|no}", "Set bpdu guard state"},
+     "<bridge> <ports> {yes|no}", "Set bpdu guard state"},
     /* Set tree port */
     {4, 0, "settreeportprio", cmd_settreeportprio,
-     "<bridge> <port> <mstid> <priority>",
+     "<bridge> <ports> <mstid> <priority>",
      "Set port priority (0-15) for the given MSTI"},
     {4, 0, "settreeportcost", cmd_settreeportcost,
-     "<bridge> <port> <mstid> <cost>",
+     "<bridge> <ports> <mstid> <cost>",
      "Set port internal path cost for the given MSTI (0 = auto)"},
     {3, 0, "setportnetwork", cmd_setportnetwork,
-     "<bridge> <port> {yes|no}", "Set port network state"},
+     "<bridge> <ports> {yes|no}", "Set port network state"},
     {3, 0, "setportdonttxmt", cmd_setportdonttxmt,
-     "<bridge> <port> {yes|no}", "Disable/Enable sending BPDU"},
+     "<bridge> <ports> {yes|no}", "Disable/Enable sending BPDU"},
     {3, 0, "setportbpdufilter", cmd_setportbpdufilter,
-     "<bridge> <port> {yes|no}", "Set BPDU filter state"},
+     "<bridge> <ports> {yes|no}", "Set BPDU filter state"},
+    {3, 1, "setportbpdurate", cmd_setportbpdurate,
+     "<bridge> <ports> <rate> [drop|latest]",
+     "Limit received BPDUs per second (0 = no limit)"},
 
     /* Other */
     {1, 0, "debuglevel", cmd_debuglevel, "<level>", "Level of verbosity"},
+    {0, 0, "showloopstats", cmd_showloopstats,
+     "", "Show mstpd event loop statistics"},
 };
 
 static const struct command *command_lookup(const char *cmd)
@@ -2373,6 +2953,8 @@ static void help(void)
     printf("                           processing\n");
     printf("  -f | --format <format>   Select output format (json, plain)\n");
     printf("commands:\n");
+    printf("  <ports> is a port or a comma-separated list of ports, where\n");
+    printf("  swp1-48 stands for the ports swp1 to swp48\n");
     command_helpall();
 }
 
@@ -2498,6 +3080,12 @@ skip_batch_validation:
     return 0;
 }
 
+/* Errors of libmstpctl */
+static void print_lib_log(int level, const char *msg)
+{
+    printf("%s\n", msg);
+}
+
 int main(int argc, char *const *argv)
 {
     const struct command *cmd;
@@ -2570,6 +3158,7 @@ int main(int argc, char *const *argv)
     if((argc == optind) && !batch_file)
         goto help;
 
+    mstpctl_set_log_handler(print_lib_log);
     if(ctl_client_init())
     {
         fprintf(stderr, "can't setup control connection\n");
@@ -2597,83 +3186,6 @@ help:
     return 1;
 }
 
-/* Implementation of client-side functions */
-CLIENT_SIDE_FUNCTION(get_cist_bridge_status)
-CLIENT_SIDE_FUNCTION(get_msti_bridge_status)
-CLIENT_SIDE_FUNCTION(set_cist_bridge_config)
-CLIENT_SIDE_FUNCTION(set_msti_bridge_config)
-CLIENT_SIDE_FUNCTION(get_cist_port_status)
-CLIENT_SIDE_FUNCTION(get_msti_port_status)
-CLIENT_SIDE_FUNCTION(set_cist_port_config)
-CLIENT_SIDE_FUNCTION(set_msti_port_config)
-CLIENT_SIDE_FUNCTION(port_mcheck)
-CLIENT_SIDE_FUNCTION(set_debug_level)
-CLIENT_SIDE_FUNCTION(get_mstilist)
-CLIENT_SIDE_FUNCTION(create_msti)
-CLIENT_SIDE_FUNCTION(delete_msti)
-CLIENT_SIDE_FUNCTION(get_mstconfid)
-CLIENT_SIDE_FUNCTION(set_mstconfid)
-CLIENT_SIDE_FUNCTION(get_vids2fids)
-CLIENT_SIDE_FUNCTION(get_fids2mstids)
-CLIENT_SIDE_FUNCTION(set_vid2fid)
-CLIENT_SIDE_FUNCTION(set_fid2mstid)
-CLIENT_SIDE_FUNCTION(set_vids2fids)
-CLIENT_SIDE_FUNCTION(set_fids2mstids)
-
-CTL_DECLARE(add_bridges)
-{
-    int res = 0;
-    LogString log = { .buf = "" };
-    int i, chunk_count, brcount, serialized_data_count;
-    int *serialized_data, *ptr;
-
-    chunk_count = serialized_data_count = (brcount = br_array[0]) + 1;
-    for(i = 0; i < brcount; ++i)
-        serialized_data_count += ifaces_lists[i][0] + 1;
-    if(NULL == (serialized_data = malloc(serialized_data_count * sizeof(int))))
-    {
-        LOG("out of memory, serialized_data_count = %d",
-            serialized_data_count);
-        return -1;
-    }
-    memcpy(serialized_data, br_array, chunk_count * sizeof(int));
-    ptr = serialized_data + chunk_count;
-    for(i = 0; i < brcount; ++i)
-    {
-        chunk_count = ifaces_lists[i][0] + 1;
-        memcpy(ptr, ifaces_lists[i], chunk_count * sizeof(int));
-        ptr += chunk_count;
-    }
-
-    int r = send_ctl_message(CMD_CODE_add_bridges, serialized_data,
-                             serialized_data_count * sizeof(int),
-                             NULL, 0, &log, &res);
-    free(serialized_data);
-    if(r || res)
-        LOG("Got return code %d, %d\n%s", r, res, log.buf);
-    if(r)
-        return r;
-    if(res)
-        return res;
-    return 0;
-}
-
-CTL_DECLARE(del_bridges)
-{
-    int res = 0;
-    LogString log = { .buf = "" };
-    int r = send_ctl_message(CMD_CODE_del_bridges,
-                             br_array, (br_array[0] + 1) * sizeof(int),
-                             NULL, 0, &log, &res);
-    if(r || res)
-        LOG("Got return code %d, %d\n%s", r, res, log.buf);
-    if(r)
-        return r;
-    if(res)
-        return res;
-    return 0;
-}
-
 /*********************** Logging *********************/
 
 void Dprintf(int level, const char *fmt, ...)
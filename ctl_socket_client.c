@@ -24,154 +24,526 @@
 
 ******************************************************************************/
 
+#include <stdlib.h>
+#include <errno.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <poll.h>
+#include <time.h>
 
-#include "ctl_functions.h"
+#include "libmstpctl.h"
+#include "ctl_socket_client.h"
 #define NO_DAEMON
+#include "list.h"
 #include "log.h"
 
-static int fd = -1;
+/* The library doesn't share the Dprintf() of the program linked with it */
+static mstpctl_log_handler_t log_handler;
+static void lib_log(int level, const char *fmt, ...)
+{
+    char logbuf[LOG_STRING_LEN];
+    va_list ap;
 
-int ctl_client_init(void)
+    if(!log_handler)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(logbuf, sizeof(logbuf), fmt, ap);
+    va_end(ap);
+    log_handler(level, logbuf);
+}
+#undef PRINT
+#define PRINT(_level, _fmt, _args...) lib_log(_level, _fmt, ##_args)
+
+void mstpctl_set_log_handler(mstpctl_log_handler_t handler)
+{
+    log_handler = handler;
+}
+
+/* A request waiting for its reply */
+struct mstpctl_request
+{
+    struct list_head list;
+    unsigned int id;
+    int cmd;
+    void *out;
+    int lout;
+    mstpctl_reply_cb_t cb;
+    void *arg;
+};
+
+struct mstpctl_conn
+{
+    int fd;
+    unsigned int next_id;
+    int num_pending;
+    struct list_head requests;
+};
+
+mstpctl_conn_t *mstpctl_open(void)
 {
-    struct sockaddr_un sa_svr;
+    struct sockaddr_un sa_svr, sa;
+    mstpctl_conn_t *conn;
     int s;
-    TST(strlen(MSTP_SERVER_SOCK_NAME) < sizeof(sa_svr.sun_path), -1);
+    TST(strlen(MSTP_SERVER_SOCK_NAME) < sizeof(sa_svr.sun_path), NULL);
 
-    if(0 > (s = socket(PF_UNIX, SOCK_DGRAM, 0)))
+    if(0 > (s = socket(PF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0)))
     {
         ERROR("Couldn't open unix socket: %m");
-        return -1;
+        return NULL;
     }
 
     set_socket_address(&sa_svr, MSTP_SERVER_SOCK_NAME);
 
-    struct sockaddr_un sa;
-    char tmpname[64];
-    sprintf(tmpname, "MSTPCTL_%d", getpid());
-    set_socket_address(&sa, tmpname);
     /* We need this bind. The autobind on connect isn't working properly.
      * The server doesn't get a proper sockaddr in recvmsg if we don't do this.
+     * Binding with no name gives every connection a name of its own.
      */
-    if(0 != bind(s, (struct sockaddr *)&sa, sizeof(sa)))
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if(0 != bind(s, (struct sockaddr *)&sa, sizeof(sa_family_t)))
     {
         ERROR("Couldn't bind socket: %m");
         close(s);
-        return -1;
+        return NULL;
     }
 
     if(0 != connect(s, (struct sockaddr *)&sa_svr, sizeof(sa_svr)))
     {
         ERROR("Couldn't connect to server");
         close(s);
-        return -1;
+        return NULL;
     }
-    fd = s;
 
-    return 0;
+    if(NULL == (conn = calloc(1, sizeof(*conn))))
+    {
+        ERROR("Out of memory");
+        close(s);
+        return NULL;
+    }
+    conn->fd = s;
+    conn->next_id = 1;
+    INIT_LIST_HEAD(&conn->requests);
+
+    return conn;
 }
 
-void ctl_client_cleanup(void)
+static void request_done(mstpctl_conn_t *conn, struct mstpctl_request *req,
+                         int r, int res, const char *log)
 {
-    if(fd >= 0)
-    {
-        close(fd);
-        fd = -1;
-    }
+    list_del(&req->list);
+    --(conn->num_pending);
+    if(req->cb)
+        req->cb(conn, req->id, r, res, log, req->arg);
+    free(req);
 }
 
-int send_ctl_message(int cmd, void *inbuf, int lin, void *outbuf, int lout,
-                     LogString *log, int *res)
+void mstpctl_close(mstpctl_conn_t *conn)
 {
+    struct mstpctl_request *req, *nxt;
+
+    if(!conn)
+        return;
+    list_for_each_entry_safe(req, nxt, &conn->requests, list)
+        request_done(conn, req, -1, 0, "");
+    close(conn->fd);
+    free(conn);
+}
+
+int mstpctl_fd(const mstpctl_conn_t *conn)
+{
+    return conn->fd;
+}
+
+int mstpctl_pending(const mstpctl_conn_t *conn)
+{
+    return conn->num_pending;
+}
+
+static struct mstpctl_request *find_request(mstpctl_conn_t *conn,
+                                            unsigned int id)
+{
+    struct mstpctl_request *req;
+
+    list_for_each_entry(req, &conn->requests, list)
+        if(req->id == id)
+            return req;
+    return NULL;
+}
+
+int mstpctl_send(mstpctl_conn_t *conn, int cmd, const void *in, int lin,
+                 void *out, int lout, mstpctl_reply_cb_t cb, void *arg,
+                 unsigned int *id)
+{
+    struct mstpctl_request *req;
     struct ctl_msg_hdr mhdr;
     struct msghdr msg;
-    struct iovec iov[3];
+    struct iovec iov[2];
     int l;
 
-    msg.msg_name = NULL;
-    msg.msg_namelen = 0;
+    if(NULL == (req = malloc(sizeof(*req))))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    req->id = conn->next_id++;
+    if(0 == conn->next_id)
+        conn->next_id = 1;
+    req->cmd = cmd;
+    req->out = out;
+    req->lout = lout;
+    req->cb = cb;
+    req->arg = arg;
+
+    memset(&msg, 0, sizeof(msg));
     msg.msg_iov = iov;
-    msg.msg_iovlen = 3;
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
+    msg.msg_iovlen = 2;
 
     mhdr.cmd = cmd;
     mhdr.lin = lin;
     mhdr.lout = lout;
-    mhdr.llog = sizeof(log->buf) - 1;
+    mhdr.llog = LOG_STRING_LEN - 1;
+    mhdr.res = 0;
+    mhdr.id = req->id;
     iov[0].iov_base = &mhdr;
     iov[0].iov_len = sizeof(mhdr);
-    iov[1].iov_base = (void *)inbuf;
+    iov[1].iov_base = (void *)in;
     iov[1].iov_len = lin;
-    iov[2].iov_base = log->buf;
-    iov[2].iov_len = 0;
 
-    l = sendmsg(fd, &msg, 0);
+    l = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+    if(l != sizeof(mhdr) + lin)
+    {
+        if(0 <= l)
+            errno = EMSGSIZE;
+        free(req);
+        return -1;
+    }
+
+    list_add_tail(&req->list, &conn->requests);
+    ++(conn->num_pending);
+    if(id)
+        *id = req->id;
+    return 0;
+}
+
+/* Handle one reply. Return 1 if there was one, 0 if none, -1 on error */
+static int process_one(mstpctl_conn_t *conn)
+{
+    struct mstpctl_request *req;
+    struct ctl_msg_hdr mhdr;
+    struct msghdr msg;
+    struct iovec iov[3];
+    LogString log;
+    int l;
+
+    /* Peek at the header to know where the reply goes */
+    l = recv(conn->fd, &mhdr, sizeof(mhdr), MSG_PEEK);
     if(0 > l)
     {
-        ERROR("Error sending message to server: %m");
+        if((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+            return 0;
+        ERROR("Error getting message from server: %m");
         return -1;
     }
-    if(l != sizeof(mhdr) + lin)
+    if((sizeof(mhdr) > l) || (NULL == (req = find_request(conn, mhdr.id))))
+    {
+        /* Garbage, or the reply to a cancelled request: drop it */
+        recv(conn->fd, &mhdr, 0, 0);
+        return 1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    iov[0].iov_base = &mhdr;
+    iov[0].iov_len = sizeof(mhdr);
+    iov[1].iov_base = req->out;
+    iov[1].iov_len = req->lout;
+    iov[2].iov_base = log.buf;
+    iov[2].iov_len = sizeof(log.buf);
+    l = recvmsg(conn->fd, &msg, 0);
+    if(0 > l)
     {
-        ERROR("Error sending message to server: Partial write");
+        ERROR("Error getting message from server: %m");
         return -1;
     }
+    if((msg.msg_flags & MSG_TRUNC)
+       || (l != sizeof(mhdr) + mhdr.lout + mhdr.llog)
+       || (mhdr.cmd != req->cmd)
+      )
+    {
+        ERROR("Error getting message from server: Bad format");
+        request_done(conn, req, -1, 0, "");
+        return 1;
+    }
+    if(mhdr.lout != req->lout)
+    {
+        ERROR("Error, unexpected result length %d, expected %d\n",
+              mhdr.lout, req->lout);
+        request_done(conn, req, -1, 0, "");
+        return 1;
+    }
+    if(sizeof(log.buf) <= mhdr.llog)
+    {
+        ERROR("Invalid log message length %d", mhdr.llog);
+        request_done(conn, req, -1, 0, "");
+        return 1;
+    }
+    log.buf[mhdr.llog] = 0;
+    request_done(conn, req, 0, mhdr.res, log.buf);
+    return 1;
+}
+
+int mstpctl_process(mstpctl_conn_t *conn)
+{
+    int r, n = 0;
+
+    while(0 < (r = process_one(conn)))
+        ++n;
+    return (0 > r) ? -1 : n;
+}
+
+void mstpctl_cancel(mstpctl_conn_t *conn, unsigned int id)
+{
+    struct mstpctl_request *req = find_request(conn, id);
+
+    if(req)
+    {
+        req->cb = NULL;
+        request_done(conn, req, -1, 0, "");
+    }
+}
 
-    iov[1].iov_base = outbuf;
-    iov[1].iov_len = lout;
-    iov[2].iov_base = log->buf;
-    iov[2].iov_len = sizeof(log->buf);
+/* Milliseconds left until deadline, 0 if passed */
+static int time_left(const struct timespec *deadline)
+{
+    struct timespec now;
+    long ms;
 
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (deadline->tv_sec - now.tv_sec) * 1000
+         + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return (0 < ms) ? ms : 0;
+}
+
+static void set_deadline(struct timespec *deadline, int timeout)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout / 1000;
+    deadline->tv_nsec += (timeout % 1000) * 1000000;
+    if(1000000000 <= deadline->tv_nsec)
+    {
+        ++(deadline->tv_sec);
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/* Wait until the socket is ready for events. Return 0, or -1 on timeout */
+static int wait_fd(mstpctl_conn_t *conn, short events,
+                   const struct timespec *deadline)
+{
     struct pollfd pfd;
-    int timeout = 5000; /* 5 s */
     int r;
 
-    pfd.fd = fd;
-    pfd.events = POLLIN;
+    pfd.fd = conn->fd;
+    pfd.events = events;
     do
     {
-        if(0 == (r = poll(&pfd, 1, timeout)))
+        if(0 == (r = poll(&pfd, 1, time_left(deadline))))
+            return -1;
+        if((0 > r) && (EINTR != errno))
         {
-            ERROR("Error getting message from server: Timeout");
+            ERROR("Error getting message from server: poll error: %m");
             return -1;
         }
-        if(0 > r)
+    }while(0 >= r);
+    return 0;
+}
+
+int mstpctl_wait(mstpctl_conn_t *conn, unsigned int id, int timeout)
+{
+    struct timespec deadline;
+
+    set_deadline(&deadline, timeout);
+    while(find_request(conn, id))
+    {
+        if(wait_fd(conn, POLLIN, &deadline))
+            return -1;
+        if(0 > mstpctl_process(conn))
+            return -1;
+    }
+    return 0;
+}
+
+struct call_result
+{
+    int r;
+    int res;
+    LogString *log;
+};
+
+static void call_done(mstpctl_conn_t *conn, unsigned int id, int r, int res,
+                      const char *log, void *arg)
+{
+    struct call_result *result = arg;
+
+    result->r = r;
+    result->res = res;
+    if(!result->log)
+        return;
+    strncpy(result->log->buf, log, sizeof(result->log->buf) - 1);
+    result->log->buf[sizeof(result->log->buf) - 1] = 0;
+}
+
+int mstpctl_call(mstpctl_conn_t *conn, int cmd, const void *in, int lin,
+                 void *out, int lout, LogString *log, int *res)
+{
+    struct call_result result = { .r = -1, .res = 0, .log = log };
+    struct timespec deadline;
+    unsigned int id;
+
+    set_deadline(&deadline, 5000); /* 5 s */
+    while(0 != mstpctl_send(conn, cmd, in, lin, out, lout, call_done,
+                            &result, &id))
+    {
+        if((EAGAIN != errno) && (EWOULDBLOCK != errno))
         {
-            ERROR("Error getting message from server: poll error: %m");
+            ERROR("Error sending message to server: %m");
+            return -1;
+        }
+        if(wait_fd(conn, POLLOUT, &deadline))
+        {
+            ERROR("Error sending message to server: Timeout");
             return -1;
         }
-    }while(0 == (pfd.revents & (POLLERR | POLLHUP | POLLNVAL | POLLIN)));
+    }
 
-    l = recvmsg(fd, &msg, 0);
-    if(0 > l)
+    if(mstpctl_wait(conn, id, time_left(&deadline)))
     {
-        ERROR("Error getting message from server: %m");
+        mstpctl_cancel(conn, id);
+        ERROR("Error getting message from server: Timeout");
         return -1;
     }
-    if((sizeof(mhdr) > l)
-       || (l != sizeof(mhdr) + mhdr.lout + mhdr.llog)
-       || (mhdr.cmd != cmd)
-      )
+    if(res)
+        *res = result.res;
+    return result.r;
+}
+
+/* The default connection, used by the CTL_ functions */
+static mstpctl_conn_t *default_conn;
+
+int ctl_client_init(void)
+{
+    if(NULL == (default_conn = mstpctl_open()))
+        return -1;
+    return 0;
+}
+
+void ctl_client_cleanup(void)
+{
+    mstpctl_close(default_conn);
+    default_conn = NULL;
+}
+
+mstpctl_conn_t *mstpctl_default_conn(void)
+{
+    return default_conn;
+}
+
+int send_ctl_message(int cmd, void *inbuf, int lin, void *outbuf, int lout,
+                     LogString *log, int *res)
+{
+    if(!default_conn)
     {
-        ERROR("Error getting message from server: Bad format");
+        ERROR("Not connected to mstpd");
         return -1;
     }
-    if(mhdr.lout != lout)
+    return mstpctl_call(default_conn, cmd, inbuf, lin, outbuf, lout, log,
+                        res);
+}
+
+/* Implementation of client-side functions */
+CLIENT_SIDE_FUNCTION(get_cist_bridge_status)
+CLIENT_SIDE_FUNCTION(get_msti_bridge_status)
+CLIENT_SIDE_FUNCTION(set_cist_bridge_config)
+CLIENT_SIDE_FUNCTION(set_msti_bridge_config)
+CLIENT_SIDE_FUNCTION(get_cist_port_status)
+CLIENT_SIDE_FUNCTION(get_msti_port_status)
+CLIENT_SIDE_FUNCTION(set_cist_port_config)
+CLIENT_SIDE_FUNCTION(set_msti_port_config)
+CLIENT_SIDE_FUNCTION(port_mcheck)
+CLIENT_SIDE_FUNCTION(set_debug_level)
+CLIENT_SIDE_FUNCTION(get_mstilist)
+CLIENT_SIDE_FUNCTION(create_msti)
+CLIENT_SIDE_FUNCTION(delete_msti)
+CLIENT_SIDE_FUNCTION(get_mstconfid)
+CLIENT_SIDE_FUNCTION(set_mstconfid)
+CLIENT_SIDE_FUNCTION(get_vids2fids)
+CLIENT_SIDE_FUNCTION(get_fids2mstids)
+CLIENT_SIDE_FUNCTION(set_vid2fid)
+CLIENT_SIDE_FUNCTION(set_fid2mstid)
+CLIENT_SIDE_FUNCTION(set_vids2fids)
+CLIENT_SIDE_FUNCTION(set_fids2mstids)
+CLIENT_SIDE_FUNCTION(get_loop_stats)
+CLIENT_SIDE_VECTOR_FUNCTION(set_cist_port_configs)
+CLIENT_SIDE_VECTOR_FUNCTION(set_msti_port_configs)
+CLIENT_SIDE_VECTOR_OUT_FUNCTION(set_vid2fid_ranges, MAX_MAP_RANGES)
+CLIENT_SIDE_VECTOR_OUT_FUNCTION(set_fid2mstid_ranges, MAX_MAP_RANGES)
+CLIENT_SIDE_FUNCTION(get_vid2fid_ranges)
+CLIENT_SIDE_FUNCTION(get_fid2mstid_ranges)
+CLIENT_SIDE_FUNCTION(get_changes)
+CLIENT_SIDE_FUNCTION(get_port_latency)
+
+CTL_DECLARE(add_bridges)
+{
+    int res = 0;
+    LogString log = { .buf = "" };
+    int i, chunk_count, brcount, serialized_data_count;
+    int *serialized_data, *ptr;
+
+    chunk_count = serialized_data_count = (brcount = br_array[0]) + 1;
+    for(i = 0; i < brcount; ++i)
+        serialized_data_count += ifaces_lists[i][0] + 1;
+    if(NULL == (serialized_data = malloc(serialized_data_count * sizeof(int))))
     {
-        ERROR("Error, unexpected result length %d, expected %d\n",
-              mhdr.lout, lout);
+        LOG("out of memory, serialized_data_count = %d",
+            serialized_data_count);
         return -1;
     }
-    if(sizeof(log->buf) <= mhdr.llog)
+    memcpy(serialized_data, br_array, chunk_count * sizeof(int));
+    ptr = serialized_data + chunk_count;
+    for(i = 0; i < brcount; ++i)
     {
-        ERROR("Invalid log message length %d", mhdr.llog);
-        return -1;
+        chunk_count = ifaces_lists[i][0] + 1;
+        memcpy(ptr, ifaces_lists[i], chunk_count * sizeof(int));
+        ptr += chunk_count;
     }
+
+    int r = send_ctl_message(CMD_CODE_add_bridges, serialized_data,
+                             serialized_data_count * sizeof(int),
+                             NULL, 0, &log, &res);
+    free(serialized_data);
+    if(r || res)
+        LOG("Got return code %d, %d\n%s", r, res, log.buf);
+    if(r)
+        return r;
+    if(res)
+        return res;
+    return 0;
+}
+
+CTL_DECLARE(del_bridges)
+{
+    int res = 0;
+    LogString log = { .buf = "" };
+    int r = send_ctl_message(CMD_CODE_del_bridges,
+                             br_array, (br_array[0] + 1) * sizeof(int),
+                             NULL, 0, &log, &res);
+    if(r || res)
+        LOG("Got return code %d, %d\n%s", r, res, log.buf);
+    if(r)
+        return r;
     if(res)
-        *res = mhdr.res;
-    log->buf[mhdr.llog] = 0;
+        return res;
     return 0;
 }
@@ -27,7 +27,7 @@
 #ifndef CTL_SOCKET_CLIENT_H
 #define CTL_SOCKET_CLIENT_H
 
-#include "ctl_functions.h"
+#include "libmstpctl.h"
 
 int send_ctl_message(int cmd, void *inbuf, int lin, void *outbuf, int lout,
                      LogString *log, int *res);
@@ -24,11 +24,14 @@
 
 ******************************************************************************/
 
+#include <stdlib.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 #include "ctl_socket_client.h"
 #include "epoll_loop.h"
+#include "handover.h"
+#include "record.h"
 #include "log.h"
 
 static int server_socket(void)
@@ -82,6 +85,16 @@ static int handle_message(int cmd, void *inbuf, int lin,
         SERVER_MESSAGE_CASE(set_fid2mstid);
         SERVER_MESSAGE_CASE(set_vids2fids);
         SERVER_MESSAGE_CASE(set_fids2mstids);
+        SERVER_MESSAGE_CASE(get_loop_stats);
+        SERVER_MESSAGE_CASE(handover);
+        SERVER_VECTOR_MESSAGE_CASE(set_cist_port_configs, MAX_PORT_CONFIGS);
+        SERVER_VECTOR_MESSAGE_CASE(set_msti_port_configs, MAX_PORT_CONFIGS);
+        SERVER_VECTOR_OUT_MESSAGE_CASE(set_vid2fid_ranges, MAX_MAP_RANGES);
+        SERVER_VECTOR_OUT_MESSAGE_CASE(set_fid2mstid_ranges, MAX_MAP_RANGES);
+        SERVER_MESSAGE_CASE(get_vid2fid_ranges);
+        SERVER_MESSAGE_CASE(get_fid2mstid_ranges);
+        SERVER_MESSAGE_CASE(get_changes);
+        SERVER_MESSAGE_CASE(get_port_latency);
 
         case CMD_CODE_add_bridges:
         {
@@ -196,11 +209,12 @@ void _ctl_err_log(char *fmt, ...)
     }
 }
 
-#define MSG_BUF_LEN 10000
+/* Fits the longest vector messages, see the checks in ctl_socket_init() */
+#define MSG_BUF_LEN 65536
 static unsigned char msg_inbuf[MSG_BUF_LEN];
 static unsigned char msg_outbuf[MSG_BUF_LEN];
 
-static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
+static bool ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
 {
     struct ctl_msg_hdr mhdr;
     struct msghdr msg;
@@ -221,7 +235,9 @@ static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
     iov[2].iov_base = NULL;
     iov[2].iov_len = 0;
     l = recvmsg(p->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
-    TST(l > 0,);
+    if((0 > l) && ((EAGAIN == errno) || (EWOULDBLOCK == errno)))
+        return false; /* drained */
+    TST(l > 0, false);
     if((0 != msg.msg_flags) || (sizeof(mhdr) > l)
        || (l != sizeof(mhdr) + mhdr.lin)
        || (MSG_BUF_LEN < mhdr.lout)
@@ -229,9 +245,11 @@ static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
       )
     {
         ERROR("CTL: Unexpected message. Ignoring");
-        return;
+        return true;
     }
 
+    record_input(RECORD_CTL, mhdr.cmd, mhdr.lout, msg_inbuf, mhdr.lin);
+
     msg_log_offset = 0;
     ctl_in_handler = 1;
 
@@ -251,7 +269,8 @@ static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
     iov[1].iov_len = mhdr.lout;
     iov[2].iov_base = msg_logbuf;
     iov[2].iov_len = mhdr.llog;
-    l = sendmsg(p->fd, &msg, MSG_NOSIGNAL);
+    /* Never block on a client which doesn't read its replies */
+    l = sendmsg(p->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
     if(0 > l)
         ERROR("CTL: Couldn't send response: %m");
     else if(l != sizeof(mhdr) + mhdr.lout + mhdr.llog)
@@ -263,20 +282,52 @@ static void ctl_rcv_handler(uint32_t events, struct epoll_event_handler *p)
 
     if(mhdr.cmd & RESPONSE_FIRST_HANDLE_LATER)
         handle_message(mhdr.cmd, msg_inbuf, mhdr.lin, msg_outbuf, mhdr.lout);
+    /* The next requests are for the new instance */
+    return !handover_done();
+}
+
+int ctl_replay_message(int cmd, void *inbuf, int lin, int lout)
+{
+    int r = 0;
+
+    if((MSG_BUF_LEN < lin) || (MSG_BUF_LEN < lout) || (0 > cmd))
+        return -1;
+    memcpy(msg_inbuf, inbuf, lin);
+
+    msg_log_offset = 0;
+    ctl_in_handler = 1;
+    if(!(cmd & RESPONSE_FIRST_HANDLE_LATER))
+        r = handle_message(cmd, msg_inbuf, lin, msg_outbuf, lout);
+    ctl_in_handler = 0;
+
+    if(cmd & RESPONSE_FIRST_HANDLE_LATER)
+        r = handle_message(cmd, msg_inbuf, lin, msg_outbuf, lout);
+    return r;
 }
 
 static struct epoll_event_handler ctl_handler = {0};
 
 int ctl_socket_init(void)
 {
-    int s = server_socket();
-    if(0 > s)
+    /* The name is still bound to the socket of the previous instance */
+    int s = handover_get_fd(HANDOVER_FD_CTL);
+
+    TST(sizeof(struct set_cist_port_configs_IN) + MAX_PORT_CONFIGS
+        * sizeof(CIST_PortConfigEntry) <= MSG_BUF_LEN, -1);
+    TST(sizeof(struct set_msti_port_configs_IN) + MAX_PORT_CONFIGS
+        * sizeof(MSTI_PortConfigEntry) <= MSG_BUF_LEN, -1);
+    TST(sizeof(struct set_vid2fid_ranges_IN) + MAX_MAP_RANGES
+        * sizeof(MapRange) <= MSG_BUF_LEN, -1);
+    TST(sizeof(struct get_changes_OUT) <= MSG_BUF_LEN, -1);
+    if(0 > s && 0 > (s = server_socket()))
         return -1;
 
     ctl_handler.fd = s;
     ctl_handler.handler = ctl_rcv_handler;
+    ctl_handler.priority = EPOLL_PRIO_CONTROL;
 
     TST(add_epoll(&ctl_handler) == 0, -1);
+    handover_set_fd(HANDOVER_FD_CTL, s);
     return 0;
 }
 
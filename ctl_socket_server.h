@@ -29,6 +29,8 @@
 
 int ctl_socket_init(void);
 void ctl_socket_cleanup(void);
+/* Handle a request recorded by mstpd -r, the response is dropped */
+int ctl_replay_message(int cmd, void *inbuf, int lin, int lout);
 
 extern int ctl_in_handler;
 void _ctl_err_log(char *fmt, ...);
@@ -23,5 +23,13 @@ bool driver_create_bridge(bridge_t *br, __u8 *macaddr);
 bool driver_create_port(port_t *prt, __u16 portno);
 void driver_delete_bridge(bridge_t *br);
 void driver_delete_port(port_t *prt);
+void driver_commit(void);
+void driver_set_plugin(const char *path);
+unsigned int driver_plugin_caps(void);
+
+/* The built-in driver (driver_linux.c) */
+struct mstpd_driver_host;
+const struct mstpd_driver *
+driver_linux_init(const struct mstpd_driver_host *host);
 
 #endif /* _MSTP_DRIVER_H */
@@ -9,89 +9,662 @@
  * Authors: Vitalii Demianets <dvitasgs@gmail.com>
  */
 
+/*
+ * The calls of driver.h are passed to the drivers of driver_plugin.h:
+ * the built-in Linux bridge driver, then the plugin given with mstpd -P.
+ * The port state changes of an event loop turn are queued and given to
+ * the drivers at the end of the turn (driver_commit()), or before a flush
+ * of their port done at once. So are the flushes for a driver which
+ * completes them asynchronously, at the end of the turn.
+ */
+
 #include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <net/if.h>
 #include <asm/byteorder.h>
 
 #include "log.h"
 #include "mstp.h"
+#include "epoll_loop.h"
+#include "bridge_track.h"
+#include "driver.h"
+#include "driver_plugin.h"
+#include "handover.h"
+#include "record.h"
+
+/* A (port, tree) with a state change or a flush */
+typedef struct
+{
+    int br_ifindex, ifindex;
+    char br_name[IFNAMSIZ], name[IFNAMSIZ];
+    int mstid;
+    int state;
+    int sent_mstid; /* flushes: the mstid given to the plugin */
+} entry_t;
+
+typedef struct
+{
+    entry_t *e;
+    int num, size;
+} queue_t;
+
+/* The drivers, in call order */
+static const struct mstpd_driver *drivers[2];
+static int num_drivers;
+static const struct mstpd_driver *linux_driver, *plugin;
+static const char *plugin_path;
+static void *plugin_handle;
+
+/* State changes of this turn */
+static queue_t states;
+/* Flushes of this turn for the plugin, and those it hasn't completed yet */
+static queue_t flushes, pending;
+
+/* A file descriptor watched for a driver */
+typedef struct
+{
+    struct list_head list;
+    struct epoll_event_handler h;
+    void (*cb)(int fd, void *arg);
+    void *arg;
+} watch_t;
+
+static LIST_HEAD(watches);
+
+static entry_t *queue_add(queue_t *q)
+{
+    entry_t *e;
+    int size;
+
+    if(q->num == q->size)
+    {
+        size = q->size ? 2 * q->size : 16;
+        if(NULL == (e = realloc(q->e, size * sizeof(*e))))
+        {
+            ERROR("Out of memory");
+            return NULL;
+        }
+        q->e = e;
+        q->size = size;
+    }
+    e = &q->e[q->num++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+static entry_t *queue_find(queue_t *q, const entry_t *key)
+{
+    int i;
+
+    for(i = 0; i < q->num; ++i)
+        if((q->e[i].br_ifindex == key->br_ifindex)
+           && (q->e[i].ifindex == key->ifindex)
+           && (q->e[i].mstid == key->mstid))
+            return &q->e[i];
+    return NULL;
+}
+
+/* Drop the entries of a port (ifindex 0: of all ports) and tree
+ * (mstid MSTPD_DRIVER_ALL_TREES: of all trees) */
+static void queue_purge(queue_t *q, int br_ifindex, int ifindex, int mstid)
+{
+    int i, n = 0;
+
+    for(i = 0; i < q->num; ++i)
+    {
+        if((q->e[i].br_ifindex == br_ifindex)
+           && ((0 == ifindex) || (q->e[i].ifindex == ifindex))
+           && ((MSTPD_DRIVER_ALL_TREES == mstid) || (q->e[i].mstid == mstid)))
+            continue;
+        q->e[n++] = q->e[i];
+    }
+    q->num = n;
+}
+
+static void set_entry(entry_t *e, per_tree_port_t *ptp)
+{
+    port_t *prt = ptp->port;
+    bridge_t *br = prt->bridge;
+
+    e->br_ifindex = br->sysdeps.if_index;
+    strcpy(e->br_name, br->sysdeps.name);
+    e->ifindex = prt->sysdeps.if_index;
+    strcpy(e->name, prt->sysdeps.name);
+    e->mstid = __be16_to_cpu(ptp->MSTID);
+}
+
+static void entry_port(struct mstpd_driver_port *p, const entry_t *e)
+{
+    p->br_ifindex = e->br_ifindex;
+    p->br_name = e->br_name;
+    p->ifindex = e->ifindex;
+    p->name = e->name;
+}
+
+static void bridge_port(struct mstpd_driver_port *p, bridge_t *br)
+{
+    p->br_ifindex = br->sysdeps.if_index;
+    p->br_name = br->sysdeps.name;
+    p->ifindex = 0;
+    p->name = NULL;
+}
+
+static void port_port(struct mstpd_driver_port *p, port_t *prt)
+{
+    bridge_port(p, prt->bridge);
+    p->ifindex = prt->sysdeps.if_index;
+    p->name = prt->sysdeps.name;
+}
+
+/* Does driver d know about the tree mstid? */
+static inline bool has_tree(const struct mstpd_driver *d, int mstid)
+{
+    return (0 == mstid) || (d->caps & MSTPD_DRIVER_CAP_MSTI_STATE);
+}
+
+static inline int flush_mstid(const struct mstpd_driver *d, int mstid)
+{
+    return (d->caps & MSTPD_DRIVER_CAP_MSTI_FLUSH) ? mstid
+                                                   : MSTPD_DRIVER_ALL_TREES;
+}
+
+/* Services to the drivers */
+
+static void host_flush_done(int br_ifindex, int ifindex, int mstid)
+{
+    queue_t done = { NULL, 0, 0 };
+    entry_t *e;
+    int i, n = 0;
+
+    record_input(RECORD_FLUSH_DONE, ifindex, mstid,
+                 &br_ifindex, sizeof(br_ifindex));
+
+    /* Completing a flush runs the state machines, which may queue more */
+    for(i = 0; i < pending.num; ++i)
+    {
+        if((pending.e[i].br_ifindex == br_ifindex)
+           && (pending.e[i].ifindex == ifindex)
+           && (pending.e[i].sent_mstid == mstid))
+        {
+            if((e = queue_add(&done)))
+                *e = pending.e[i];
+            continue;
+        }
+        pending.e[n++] = pending.e[i];
+    }
+    pending.num = n;
+
+    for(i = 0; i < done.num; ++i)
+        bridge_track_fids_flushed(done.e[i].br_ifindex, done.e[i].ifindex,
+                                  done.e[i].mstid);
+    free(done.e);
+}
+
+static bool watch_handler(uint32_t events, struct epoll_event_handler *h)
+{
+    watch_t *w = h->arg;
+
+    /* w may be gone when cb returns */
+    w->cb(h->fd, w->arg);
+    return false;
+}
+
+static int host_watch_fd(int fd, void (*cb)(int fd, void *arg), void *arg)
+{
+    watch_t *w;
+
+    list_for_each_entry(w, &watches, list)
+    {
+        if(w->h.fd != fd)
+            continue;
+        if(cb)
+        {
+            w->cb = cb;
+            w->arg = arg;
+            return 0;
+        }
+        remove_epoll(&w->h);
+        list_del(&w->list);
+        free(w);
+        return 0;
+    }
+    if(NULL == cb)
+        return 0;
+
+    TST(NULL != (w = calloc(1, sizeof(*w))), -1);
+    w->cb = cb;
+    w->arg = arg;
+    w->h.fd = fd;
+    w->h.arg = w;
+    w->h.handler = watch_handler;
+    w->h.priority = EPOLL_PRIO_LINK;
+    if(add_epoll(&w->h))
+    {
+        free(w);
+        return -1;
+    }
+    list_add_tail(&w->list, &watches);
+    return 0;
+}
+
+static const struct mstpd_driver_host host =
+{
+    .abi_version = MSTPD_DRIVER_ABI_VERSION,
+    .flush_done = host_flush_done,
+    .watch_fd = host_watch_fd,
+    .log = Dprintf,
+};
+
+/* Driver plugin to load by driver_mstp_init() */
+void driver_set_plugin(const char *path)
+{
+    plugin_path = path;
+}
+
+static int load_plugin(void)
+{
+    mstpd_driver_init_t init;
+
+    plugin_handle = dlopen(plugin_path, RTLD_NOW | RTLD_LOCAL);
+    TSTM(plugin_handle, -1, "Couldn't load driver plugin %s: %s",
+         plugin_path, dlerror());
+    init = (mstpd_driver_init_t)dlsym(plugin_handle, MSTPD_DRIVER_ENTRY);
+    TSTM(init, -1, "%s: no " MSTPD_DRIVER_ENTRY, plugin_path);
+    plugin = init(&host);
+    TSTM(plugin, -1, "Driver plugin %s failed to start", plugin_path);
+    if(MSTPD_DRIVER_ABI_VERSION != plugin->abi_version)
+    {
+        ERROR("Driver plugin %s has ABI version %u, mstpd has %u",
+              plugin_path, plugin->abi_version, MSTPD_DRIVER_ABI_VERSION);
+        if(plugin->fini)
+            plugin->fini();
+        plugin = NULL;
+        return -1;
+    }
+    INFO("Driver plugin %s (%s) loaded, capabilities 0x%x",
+         plugin->name, plugin_path, plugin->caps);
+    return 0;
+}
 
 /* Initialize driver objects & states */
 int driver_mstp_init()
 {
+    if(plugin_path && load_plugin())
+        return -1;
+    if(!plugin || !(plugin->caps & MSTPD_DRIVER_CAP_KERNEL))
+        drivers[num_drivers++] = linux_driver = driver_linux_init(&host);
+    if(plugin)
+        drivers[num_drivers++] = plugin;
     return 0;
 }
 
+/* Of the plugin, 0 without one */
+unsigned int driver_plugin_caps(void)
+{
+    return plugin ? plugin->caps : 0;
+}
+
 /* Cleanup driver objects & states */
 void driver_mstp_fini()
 {
+    watch_t *w, *nxt;
+    int i;
 
+    /* The last state changes, e.g. of the bridges being stopped. After a
+     * handover they are left to the new instance: those of the turn of the
+     * handover went before the snapshot */
+    if(handover_done())
+        states.num = flushes.num = 0;
+    else
+        driver_commit();
+    for(i = num_drivers - 1; 0 <= i; --i)
+        if(drivers[i]->fini)
+            drivers[i]->fini();
+    num_drivers = 0;
+    linux_driver = plugin = NULL;
+    list_for_each_entry_safe(w, nxt, &watches, list)
+    {
+        remove_epoll(&w->h);
+        list_del(&w->list);
+        free(w);
+    }
+    if(plugin_handle)
+        dlclose(plugin_handle);
+    plugin_handle = NULL;
+    states.num = flushes.num = pending.num = 0;
 }
 
 /* Driver hook that is called before a bridge is created */
 bool driver_create_bridge(bridge_t *br, __u8 *macaddr)
 {
+    struct mstpd_driver_port p;
+    int i;
+
+    bridge_port(&p, br);
+    for(i = 0; i < num_drivers; ++i)
+        if(drivers[i]->create_bridge
+           && !drivers[i]->create_bridge(&p, macaddr))
+            return false;
     return true;
 }
 
 /* Driver hook that is called before a port is created */
 bool driver_create_port(port_t *prt, __u16 portno)
 {
+    struct mstpd_driver_port p;
+    int i;
+
+    port_port(&p, prt);
+    for(i = 0; i < num_drivers; ++i)
+        if(drivers[i]->create_port && !drivers[i]->create_port(&p, portno))
+            return false;
     return true;
 }
 
 /* Driver hook that is called when a bridge is deleted */
 void driver_delete_bridge(bridge_t *br)
 {
+    struct mstpd_driver_port p;
+    int i;
 
+    bridge_port(&p, br);
+    queue_purge(&states, p.br_ifindex, 0, MSTPD_DRIVER_ALL_TREES);
+    queue_purge(&flushes, p.br_ifindex, 0, MSTPD_DRIVER_ALL_TREES);
+    for(i = 0; i < num_drivers; ++i)
+        if(drivers[i]->delete_bridge)
+            drivers[i]->delete_bridge(&p);
 }
 
 /* Driver hook that is called when a port is deleted */
 void driver_delete_port(port_t *prt)
 {
+    struct mstpd_driver_port p;
+    int i;
 
+    port_port(&p, prt);
+    queue_purge(&states, p.br_ifindex, p.ifindex, MSTPD_DRIVER_ALL_TREES);
+    queue_purge(&flushes, p.br_ifindex, p.ifindex, MSTPD_DRIVER_ALL_TREES);
+    for(i = 0; i < num_drivers; ++i)
+        if(drivers[i]->delete_port)
+            drivers[i]->delete_port(&p);
 }
 
-
 /*
  * Set new state (BR_STATE_xxx) for the given port and MSTI.
  * Return new actual state (BR_STATE_xxx) from driver.
+ * The state is given to the drivers by driver_commit().
  */
 int driver_set_new_state(per_tree_port_t *ptp, int new_state)
 {
-    /* TODO: insert driver-specific code here */
+    entry_t key, *e;
+
+    record_output(RECORD_STATE, ptp->port->sysdeps.if_index,
+                  (__be16_to_cpu(ptp->MSTID) << 8) | new_state, NULL, 0);
+    set_entry(&key, ptp);
+    if((e = queue_find(&states, &key)) || (e = queue_add(&states)))
+    {
+        *e = key;
+        e->state = new_state;
+    }
     return new_state;
 }
 
 bool driver_create_msti(bridge_t *br, __u16 mstid)
 {
-    /* TODO: send "create msti" command to driver */
+    struct mstpd_driver_port p;
+    int i;
+
+    bridge_port(&p, br);
+    for(i = 0; i < num_drivers; ++i)
+        if(has_tree(drivers[i], mstid) && drivers[i]->create_msti
+           && !drivers[i]->create_msti(&p, mstid))
+            return false;
     return true;
 }
 
 bool driver_delete_msti(bridge_t *br, __u16 mstid)
 {
-    /* TODO: send "delete msti" command to driver */
+    struct mstpd_driver_port p;
+    int i;
+
+    bridge_port(&p, br);
+    queue_purge(&states, p.br_ifindex, 0, mstid);
+    queue_purge(&flushes, p.br_ifindex, 0, mstid);
+    for(i = 0; i < num_drivers; ++i)
+        if(has_tree(drivers[i], mstid) && drivers[i]->delete_msti
+           && !drivers[i]->delete_msti(&p, mstid))
+            return false;
     return true;
 }
 
+/* Give the drivers at once the queued states of the port for the tree
+ * (mstid MSTPD_DRIVER_ALL_TREES: for all trees), ahead of a flush done at
+ * once: the port must not learn again from what the flush removes. */
+static void commit_port_states(const entry_t *key, int mstid)
+{
+    struct mstpd_driver_state v[MAX_IMPLEMENTATION_MSTIS + 1];
+    entry_t e[MAX_IMPLEMENTATION_MSTIS + 1];
+    int i, j, m, n = 0, num_left = 0;
+
+    for(i = 0; i < states.num; ++i)
+    {
+        if((states.e[i].br_ifindex == key->br_ifindex)
+           && (states.e[i].ifindex == key->ifindex)
+           && ((MSTPD_DRIVER_ALL_TREES == mstid)
+               || (states.e[i].mstid == mstid))
+           && (n < MAX_IMPLEMENTATION_MSTIS + 1))
+        {
+            e[n++] = states.e[i];
+            continue;
+        }
+        states.e[num_left++] = states.e[i];
+    }
+    states.num = num_left;
+    if(0 == n)
+        return;
+
+    for(i = 0; i < num_drivers; ++i)
+    {
+        if(!drivers[i]->set_states)
+            continue;
+        for(j = m = 0; j < n; ++j)
+        {
+            if(!has_tree(drivers[i], e[j].mstid))
+                continue;
+            entry_port(&v[m].port, &e[j]);
+            v[m].mstid = e[j].mstid;
+            v[m].state = e[j].state;
+            ++m;
+        }
+        if(m)
+            drivers[i]->set_states(v, m);
+    }
+}
+
+/*
+ * Flush the forwarding database of the port for the tree.
+ * MSTP_IN_all_fids_flushed(ptp) is called right away, unless the plugin
+ * completes its flushes asynchronously: then it is called when the plugin
+ * reports the flush done.
+ */
 void driver_flush_all_fids(per_tree_port_t *ptp)
 {
-    /* TODO: do real flushing.
-     * Make it asynchronous, with completion function calling
-     * MSTP_IN_all_fids_flushed(ptp)
-     */
-    MSTP_IN_all_fids_flushed(ptp);
+    const struct mstpd_driver *d;
+    struct mstpd_driver_flush f;
+    entry_t key, *e;
+    bool wait = false;
+    int i;
+
+    set_entry(&key, ptp);
+    for(i = 0; i < num_drivers; ++i)
+    {
+        d = drivers[i];
+        if(!d->flush || !has_tree(d, key.mstid))
+            continue;
+        /* Entries learned on a port which kept forwarding are still valid
+         * in the kernel bridge */
+        if((d == linux_driver) && (0 == key.mstid)
+           && ptp->port->sysdeps.warm_hold)
+            continue;
+        if(d->caps & MSTPD_DRIVER_CAP_ASYNC_FLUSH)
+        {
+            /* A flush already queued will do */
+            if(!queue_find(&flushes, &key) && (e = queue_add(&flushes)))
+            {
+                *e = key;
+                e->sent_mstid = flush_mstid(d, key.mstid);
+            }
+            wait = true;
+            continue;
+        }
+        entry_port(&f.port, &key);
+        f.mstid = flush_mstid(d, key.mstid);
+        commit_port_states(&key, f.mstid);
+        d->flush(&f, 1);
+    }
+    if(!wait)
+        MSTP_IN_all_fids_flushed(ptp);
 }
 
 /*
  * Set new ageing time (in seconds) for the port.
  * Return new actual ageing time from driver (the ageing timer granularity
  *  in the hardware can be more than 1 sec)
+ * The plugin has the last word, so it is asked first.
  */
 unsigned int driver_set_ageing_time(port_t *prt, unsigned int ageingTime)
 {
-    /* TODO: do set new ageing time */
+    struct mstpd_driver_port p;
+    int i;
+
+    port_port(&p, prt);
+    for(i = num_drivers - 1; 0 <= i; --i)
+        if(drivers[i]->set_ageing_time)
+            ageingTime = drivers[i]->set_ageing_time(&p, ageingTime);
     return ageingTime;
 }
+
+/* Give the queued state changes to the drivers */
+static int commit_states(void)
+{
+    static queue_t sending;
+    static struct mstpd_driver_state *v;
+    static int v_size;
+    struct mstpd_driver_state *nv;
+    queue_t q;
+    int i, j, n;
+
+    if(0 == states.num)
+        return 0;
+    /* Room for all of them before any is moved: they stay queued if not */
+    if(v_size < states.num)
+    {
+        TST(NULL != (nv = realloc(v, states.num * sizeof(*v))), 0);
+        v = nv;
+        v_size = states.num;
+    }
+    /* The drivers may cause more state changes meanwhile */
+    q = states;
+    states = sending;
+    states.num = 0;
+
+    for(i = 0; i < num_drivers; ++i)
+    {
+        if(!drivers[i]->set_states)
+            continue;
+        for(j = n = 0; j < q.num; ++j)
+        {
+            if(!has_tree(drivers[i], q.e[j].mstid))
+                continue;
+            entry_port(&v[n].port, &q.e[j]);
+            v[n].mstid = q.e[j].mstid;
+            v[n].state = q.e[j].state;
+            ++n;
+        }
+        if(n)
+            drivers[i]->set_states(v, n);
+    }
+    sending = q;
+    return q.num;
+}
+
+/* Give the queued flushes to the plugin, but those of the (port, tree)s
+ * which still wait for a previous one */
+static int commit_flushes(void)
+{
+    static queue_t sending;
+    static struct mstpd_driver_flush *v;
+    static int v_size;
+    struct mstpd_driver_flush *nv;
+    entry_t *e;
+    int i, j, n = 0, num_left = 0;
+
+    if(0 == flushes.num)
+        return 0;
+    /* Room for all of them before any is moved: they stay queued if not */
+    if(v_size < flushes.num)
+    {
+        TST(NULL != (nv = realloc(v, flushes.num * sizeof(*v))), 0);
+        v = nv;
+        v_size = flushes.num;
+    }
+    sending.num = 0;
+    for(i = 0; i < flushes.num; ++i)
+    {
+        for(j = 0; j < pending.num; ++j)
+            if((pending.e[j].br_ifindex == flushes.e[i].br_ifindex)
+               && (pending.e[j].ifindex == flushes.e[i].ifindex)
+               && (pending.e[j].sent_mstid == flushes.e[i].sent_mstid))
+                break;
+        if((j < pending.num) || (NULL == (e = queue_add(&pending))))
+        {
+            flushes.e[num_left++] = flushes.e[i];
+            continue;
+        }
+        *e = flushes.e[i];
+        /* One flush per (port, sent_mstid) */
+        for(j = 0; j < sending.num; ++j)
+            if((sending.e[j].ifindex == e->ifindex)
+               && (sending.e[j].br_ifindex == e->br_ifindex)
+               && (sending.e[j].sent_mstid == e->sent_mstid))
+                break;
+        if(j < sending.num)
+            continue;
+        if(NULL == (e = queue_add(&sending)))
+        {
+            /* Not sent, so not pending either */
+            --pending.num;
+            flushes.e[num_left++] = flushes.e[i];
+            continue;
+        }
+        *e = flushes.e[i];
+    }
+    flushes.num = num_left;
+    if(0 == sending.num)
+        return 0;
+
+    for(n = 0; n < sending.num; ++n)
+    {
+        entry_port(&v[n].port, &sending.e[n]);
+        v[n].mstid = sending.e[n].sent_mstid;
+    }
+    /* The plugin, or the driver standing in for it in mstpd-replay */
+    for(i = 0; i < num_drivers; ++i)
+        if(drivers[i]->caps & MSTPD_DRIVER_CAP_ASYNC_FLUSH)
+            drivers[i]->flush(v, n);
+    return n;
+}
+
+/*
+ * Called at the end of every event loop turn, after all the state machines
+ * runs of the turn.
+ */
+void driver_commit(void)
+{
+    int rounds = 0;
+
+    /* Flushes done at once run the state machines, which may queue more */
+    while((0 < commit_states() + commit_flushes()) && (4 > ++rounds))
+        ;
+}
@@ -0,0 +1,125 @@
+/*
+ * driver_linux.c    The built-in driver: the Linux bridge.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ * The kernel bridge only knows the CIST: it gets the CIST port states
+ * (netlink) and the flushes of whole ports and the ageing time (sysfs).
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/param.h>
+#include <linux/if_bridge.h>
+
+#include "bridge_ctl.h"
+#include "driver_plugin.h"
+#include "libnetlink.h"
+#include "log.h"
+
+#ifndef SYSFS_CLASS_NET
+#define SYSFS_CLASS_NET "/sys/class/net"
+#endif
+
+static int br_set_state(struct rtnl_handle *rth, unsigned ifindex, __u8 state)
+{
+    struct
+    {
+        struct nlmsghdr n;
+        struct ifinfomsg ifi;
+        char buf[256];
+    } req;
+
+    memset(&req, 0, sizeof(req));
+
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_REPLACE;
+    req.n.nlmsg_type = RTM_SETLINK;
+    req.ifi.ifi_family = AF_BRIDGE;
+    req.ifi.ifi_index = ifindex;
+
+    addattr8(&req.n, sizeof(req.buf), IFLA_PROTINFO, state);
+
+    return rtnl_talk(rth, &req.n, 0, 0, NULL, NULL, NULL);
+}
+
+static int br_flush_port(const char *ifname)
+{
+    char fname[128];
+    snprintf(fname, sizeof(fname), SYSFS_CLASS_NET "/%s/brport/flush", ifname);
+    int fd = open(fname, O_WRONLY);
+    TSTM(0 <= fd, -1, "Couldn't open flush file %s for write: %m", fname);
+    int write_result = write(fd, "1", 1);
+    close(fd);
+    TST(1 == write_result, -1);
+    return 0;
+}
+
+static int br_set_ageing_time(const char *brname, unsigned int ageing_time)
+{
+    char fname[128], str_time[32];
+    snprintf(fname, sizeof(fname), SYSFS_CLASS_NET "/%s/bridge/ageing_time",
+             brname);
+    int fd = open(fname, O_WRONLY);
+    TSTM(0 <= fd, -1, "Couldn't open file %s for write: %m", fname);
+    int len = sprintf(str_time, "%u", ageing_time * HZ);
+    int write_result = write(fd, str_time, len);
+    close(fd);
+    TST(len == write_result, -1);
+    return 0;
+}
+
+static void linux_set_states(const struct mstpd_driver_state *states, int num)
+{
+    int i;
+
+    for(i = 0; i < num; ++i)
+        if(0 > br_set_state(&rth_state, states[i].port.ifindex,
+                            states[i].state))
+            ERROR("%s:%s Couldn't set kernel bridge state %d",
+                  states[i].port.br_name, states[i].port.name,
+                  states[i].state);
+}
+
+static void linux_flush(const struct mstpd_driver_flush *flushes, int num)
+{
+    int i;
+
+    for(i = 0; i < num; ++i)
+        if(0 > br_flush_port(flushes[i].port.name))
+            ERROR("%s:%s Couldn't flush kernel bridge forwarding database",
+                  flushes[i].port.br_name, flushes[i].port.name);
+}
+
+/*
+ * Kernel bridging code does not support per-port ageing time,
+ * so set ageing time for the whole bridge.
+ */
+static unsigned int linux_set_ageing_time(const struct mstpd_driver_port *port,
+                                          unsigned int ageing_time)
+{
+    if(0 > br_set_ageing_time(port->br_name, ageing_time))
+        ERROR("%s Couldn't set new ageing time in kernel bridge",
+              port->br_name);
+    return ageing_time;
+}
+
+static const struct mstpd_driver linux_driver =
+{
+    .abi_version = MSTPD_DRIVER_ABI_VERSION,
+    .name = "linux",
+    .caps = 0,
+    .set_states = linux_set_states,
+    .flush = linux_flush,
+    .set_ageing_time = linux_set_ageing_time,
+};
+
+const struct mstpd_driver *
+driver_linux_init(const struct mstpd_driver_host *host)
+{
+    return &linux_driver;
+}
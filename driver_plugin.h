@@ -0,0 +1,123 @@
+/*
+ * driver_plugin.h    Driver plugin ABI.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version
+ *  2 of the License, or (at your option) any later version.
+ *
+ * A driver plugin is a shared object loaded by mstpd at startup
+ * (mstpd -P <plugin.so>). It exports MSTPD_DRIVER_ENTRY, which gets the
+ * services of mstpd and returns the operations of the driver.
+ *
+ * The port state changes of a whole event loop turn are handed to the
+ * driver at once, as a vector, at the end of the turn. So are the flushes
+ * for a driver with MSTPD_DRIVER_CAP_ASYNC_FLUSH, which reports them done
+ * later with host->flush_done(). Other drivers get every flush as soon as
+ * the state machines ask for it, and are done with it when flush() returns;
+ * the queued state changes of the flushed port come first, in their own
+ * set_states() call.
+ *
+ * The Linux bridge itself is driven by a built-in driver (driver_linux.c),
+ * which runs before the plugin unless the plugin has
+ * MSTPD_DRIVER_CAP_KERNEL.
+ */
+
+#ifndef _MSTP_DRIVER_PLUGIN_H
+#define _MSTP_DRIVER_PLUGIN_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/* Bump on every incompatible change of the structures below */
+#define MSTPD_DRIVER_ABI_VERSION    1
+
+#define MSTPD_DRIVER_ENTRY          "mstpd_driver_init"
+
+/* Capabilities of a driver */
+/* Sets the states of the MSTIs; otherwise only the CIST states are given */
+#define MSTPD_DRIVER_CAP_MSTI_STATE     0x01
+/* Flushes one tree of a port; otherwise all trees of the port are flushed
+ * at once (mstid is MSTPD_DRIVER_ALL_TREES) */
+#define MSTPD_DRIVER_CAP_MSTI_FLUSH     0x02
+/* Reports the flushes done with host->flush_done() */
+#define MSTPD_DRIVER_CAP_ASYNC_FLUSH    0x04
+/* Takes care of the kernel bridge, the built-in driver is not used */
+#define MSTPD_DRIVER_CAP_KERNEL         0x08
+
+#define MSTPD_DRIVER_ALL_TREES      -1
+
+/* Log levels, as LOG_LEVEL_xxx of log.h */
+#define MSTPD_DRIVER_LOG_ERROR      1
+#define MSTPD_DRIVER_LOG_INFO       2
+#define MSTPD_DRIVER_LOG_DEBUG      3
+
+/* A port of a bridge; the names are valid during the call only.
+ * For the calls about a whole bridge, ifindex is 0 and name NULL. */
+struct mstpd_driver_port
+{
+    int br_ifindex;
+    const char *br_name;
+    int ifindex;
+    const char *name;
+};
+
+struct mstpd_driver_state
+{
+    struct mstpd_driver_port port;
+    int mstid;      /* 0 for the CIST */
+    int state;      /* BR_STATE_xxx of linux/if_bridge.h */
+};
+
+struct mstpd_driver_flush
+{
+    struct mstpd_driver_port port;
+    int mstid;      /* 0 for the CIST, or MSTPD_DRIVER_ALL_TREES */
+};
+
+/* Services of mstpd to the driver */
+struct mstpd_driver_host
+{
+    unsigned int abi_version;
+    /* The flush of (port, mstid) is done */
+    void (*flush_done)(int br_ifindex, int ifindex, int mstid);
+    /* Call cb from the event loop whenever fd is readable;
+     * cb == NULL stops watching fd. Return 0 or -1. */
+    int (*watch_fd)(int fd, void (*cb)(int fd, void *arg), void *arg);
+    /* Log at MSTPD_DRIVER_LOG_xxx */
+    void (*log)(int level, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+};
+
+/* Operations of the driver; any of them may be NULL */
+struct mstpd_driver
+{
+    unsigned int abi_version;   /* MSTPD_DRIVER_ABI_VERSION */
+    const char *name;
+    unsigned int caps;          /* MSTPD_DRIVER_CAP_xxx */
+
+    void (*fini)(void);
+
+    /* Called before the object is created; false refuses it */
+    bool (*create_bridge)(const struct mstpd_driver_port *br,
+                          const __u8 *macaddr);
+    bool (*create_port)(const struct mstpd_driver_port *port, __u16 portno);
+    bool (*create_msti)(const struct mstpd_driver_port *br, __u16 mstid);
+    void (*delete_bridge)(const struct mstpd_driver_port *br);
+    void (*delete_port)(const struct mstpd_driver_port *port);
+    bool (*delete_msti)(const struct mstpd_driver_port *br, __u16 mstid);
+
+    /* The state changes of one event loop turn, one per (port, tree) */
+    void (*set_states)(const struct mstpd_driver_state *states, int num);
+    /* The flushes of one event loop turn (or a single one, see above) */
+    void (*flush)(const struct mstpd_driver_flush *flushes, int num);
+    /* Return the actual ageing time (in seconds) */
+    unsigned int (*set_ageing_time)(const struct mstpd_driver_port *port,
+                                    unsigned int ageing_time);
+};
+
+/* The type of MSTPD_DRIVER_ENTRY; return NULL if the driver can't work */
+typedef const struct mstpd_driver *
+    (*mstpd_driver_init_t)(const struct mstpd_driver_host *host);
+
+#endif /* _MSTP_DRIVER_PLUGIN_H */
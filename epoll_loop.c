@@ -27,17 +27,42 @@
 #include <config.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 
 #include "log.h"
 #include "epoll_loop.h"
 #include "bridge_ctl.h"
+#include "mstp.h"
+#include "driver.h"
+#include "packet.h"
 #include "clock_gettime.h"
+#include "record.h"
 
 /* globals */
 static int epoll_fd = -1;
-static struct timespec nexttimeout;
+
+/* The one second tick comes from a CLOCK_MONOTONIC timerfd. Tick number N
+ * is scheduled at tick_start + N seconds, the difference between the
+ * actual and the scheduled time is the loop lag.
+ */
+static struct epoll_event_handler tick_handler;
+static struct timespec tick_start;
+static unsigned int lag_alarm_ms = EPOLL_LAG_ALARM_MS;
+static bool lag_alarm_raised;
+
+/* The ready events array grows while epoll_wait keeps filling it up */
+#define EV_SIZE_MIN 16
+#define EV_SIZE_MAX 256
+static struct epoll_event *ev;
+static int ev_size;
+
+static unsigned int low_prio_quota = EPOLL_LOW_PRIO_QUOTA;
+static epoll_loop_stats_t stats;
 
 int init_epoll(void)
 {
@@ -90,73 +115,259 @@ void clear_epoll(void)
         close(epoll_fd);
 }
 
-static inline int time_diff(struct timespec *second, struct timespec *first)
+static inline unsigned int time_diff_us(struct timespec *second,
+                                        struct timespec *first)
+{
+    return (second->tv_sec - first->tv_sec) * 1000000
+            + (second->tv_nsec - first->tv_nsec) / 1000;
+}
+
+void epoll_set_low_prio_quota(unsigned int quota)
+{
+    low_prio_quota = (0 < quota) ? quota : 1;
+}
+
+void epoll_set_lag_alarm(unsigned int ms)
+{
+    lag_alarm_ms = ms;
+}
+
+void epoll_get_stats(epoll_loop_stats_t *st)
+{
+    *st = stats;
+    st->ev_size = ev_size;
+    st->low_prio_quota = low_prio_quota;
+    st->lag_alarm_ms = lag_alarm_ms;
+}
+
+static bool tick_rcv(uint32_t events, struct epoll_event_handler *h)
+{
+    uint64_t expirations;
+    struct timespec now, scheduled;
+    unsigned int lag;
+
+    if(sizeof(expirations) != read(h->fd, &expirations, sizeof(expirations)))
+    {
+        if((EAGAIN != errno) && (EWOULDBLOCK != errno))
+            ERROR("timerfd read failed: %m");
+        return false;
+    }
+
+    /* The lag is measured against the oldest tick not yet served */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    scheduled = tick_start;
+    scheduled.tv_sec += stats.ticks + 1;
+    if((now.tv_sec > scheduled.tv_sec) || ((now.tv_sec == scheduled.tv_sec)
+                                           && (now.tv_nsec > scheduled.tv_nsec)))
+        lag = time_diff_us(&now, &scheduled);
+    else
+        lag = 0;
+    stats.last_lag_us = lag;
+    if(stats.max_lag_us < lag)
+        stats.max_lag_us = lag;
+
+    if(lag_alarm_ms && (lag >= lag_alarm_ms * 1000))
+    {
+        if(!lag_alarm_raised)
+        {
+            ERROR("Event loop lags %u ms behind the 1 s tick, "
+                  "hello deadlines are at risk", lag / 1000);
+            ++(stats.lag_alarms);
+            lag_alarm_raised = true;
+        }
+    }
+    else
+        lag_alarm_raised = false;
+
+    /* Catch up with every tick missed while the loop was busy */
+    stats.ticks += expirations;
+    if(1 < expirations)
+        stats.tick_overruns += expirations - 1;
+    while(expirations--)
+    {
+        record_input(RECORD_TICK, 0, 0, NULL, 0);
+        bridge_one_second();
+    }
+
+    return false;
+}
+
+static int init_tick(void)
+{
+    struct itimerspec its =
+    {
+        .it_interval = { .tv_sec = 1, .tv_nsec = 0 },
+    };
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if(0 > fd)
+    {
+        ERROR("timerfd_create failed: %m\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tick_start);
+    its.it_value = tick_start;
+    ++(its.it_value.tv_sec);
+    if(0 > timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL))
+    {
+        ERROR("timerfd_settime failed: %m\n");
+        close(fd);
+        return -1;
+    }
+
+    tick_handler.fd = fd;
+    tick_handler.handler = tick_rcv;
+    /* Dispatched ahead of the classes by epoll_main_loop() */
+    tick_handler.priority = EPOLL_PRIO_PROTOCOL;
+    if(0 > add_epoll(&tick_handler))
+    {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void grow_events_array(void)
 {
-    return (second->tv_sec - first->tv_sec) * 1000
-            + (second->tv_nsec - first->tv_nsec) / 1000000;
+    struct epoll_event *new_ev;
+
+    if(EV_SIZE_MAX <= ev_size)
+        return;
+    if(NULL == (new_ev = realloc(ev, 2 * ev_size * sizeof(*ev))))
+        return;
+    ev = new_ev;
+    ev_size *= 2;
 }
 
-static inline void run_timeouts(void)
+/* Serve the ready events of one class, calling each handler until its fd is
+ * drained or the class has used up its quota for this turn. Nothing more is
+ * served once a handler has set *quit (e.g. after a handover, the new
+ * instance owns the bridges).
+ */
+static void dispatch_class(int prio, int nev, struct timespec *wakeup,
+                           volatile bool *quit)
 {
-    bridge_one_second();
-    ++(nexttimeout.tv_sec);
+    epoll_class_stats_t *cs = &stats.classes[prio];
+    unsigned int quota, served = 0, latency;
+    struct timespec tv;
+    bool more = false;
+    int i;
+
+    quota = (EPOLL_PRIO_PROTOCOL == prio) ? EPOLL_PROTOCOL_QUOTA
+                                          : low_prio_quota;
+    for(i = 0; i < nev; ++i)
+    {
+        struct epoll_event_handler *p = ev[i].data.ptr;
+        if(!p || (p->priority != prio) || !p->handler)
+            continue;
+        if(*quit)
+            break;
+        if(served >= quota)
+        {
+            more = true;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &tv);
+        latency = time_diff_us(&tv, wakeup);
+        ++(cs->events);
+        cs->total_latency += latency;
+        if(cs->max_latency < latency)
+            cs->max_latency = latency;
+
+        do {
+            more = p->handler(ev[i].events, p);
+            ++served;
+            /* handler could have removed itself */
+            p = ev[i].data.ptr;
+        } while(more && p && (served < quota) && !*quit);
+        if(!p)
+            more = false;
+    }
+
+    cs->calls += served;
+    if(cs->max_depth < served)
+        cs->max_depth = served;
+    if(more)
+        ++(cs->quota_hits);
 }
 
 int epoll_main_loop(volatile bool *quit)
 {
-    clock_gettime(CLOCK_MONOTONIC, &nexttimeout);
-    ++(nexttimeout.tv_sec);
-#define EV_SIZE 8
-    struct epoll_event ev[EV_SIZE];
+    ev_size = EV_SIZE_MIN;
+    if(NULL == (ev = malloc(ev_size * sizeof(*ev))))
+    {
+        ERROR("Out of memory for the epoll events array\n");
+        return -1;
+    }
 
-    while(!*quit)
+    if(init_tick())
     {
-        int r, i;
-        int timeout;
+        free(ev);
+        return -1;
+    }
 
+    while(!*quit)
+    {
+        int r, i, prio;
+        int timeout = -1;
         struct timespec tv;
-        clock_gettime(CLOCK_MONOTONIC, &tv);
-        timeout = time_diff(&nexttimeout, &tv);
-        if(timeout < 0 || timeout > 1000)
-        {
-            run_timeouts();
-            /*
-             * Check if system time has changed.
-             */
-            if(timeout < -4000 || timeout > 1000)
-            {
-                /* Most probably, system time has changed */
-                nexttimeout.tv_nsec = tv.tv_nsec;
-                nexttimeout.tv_sec = tv.tv_sec + 1;
-            }
+
+        /* Resume the state machines runs which went out of budget,
+         * don't sleep if some of them are still unfinished */
+        if(bridge_run_deferred())
             timeout = 0;
-        }
 
-        r = epoll_wait(epoll_fd, ev, EV_SIZE, timeout);
+        /* Apply the port state changes of the previous turn, then send
+         * the BPDUs it queued */
+        driver_commit();
+        packet_flush();
+        record_flush();
+
+        r = epoll_wait(epoll_fd, ev, ev_size, timeout);
         if(r < 0 && errno != EINTR)
         {
             ERROR("epoll_wait: %m\n");
+            free(ev);
             return -1;
         }
+        if(r <= 0)
+            continue;
+        clock_gettime(CLOCK_MONOTONIC, &tv);
+        ++(stats.turns);
+
         for(i = 0; i < r; ++i)
         {
             struct epoll_event_handler *p = ev[i].data.ptr;
             if(p != NULL)
                 p->ref_ev = &ev[i];
         }
-        for (i = 0; i < r; ++i)
+        /* The tick is served before any class, so that a flood of BPDUs
+         * using up the protocol quota can't hold the timers back.
+         * Then protocol packets first, control requests last. Events left
+         * over by a class quota are reported again by the next epoll_wait.
+         */
+        if(tick_handler.ref_ev)
         {
-            struct epoll_event_handler *p = ev[i].data.ptr;
-            if(p && p->handler)
-                p->handler(ev[i].events, p);
+            tick_handler.ref_ev->data.ptr = NULL;
+            tick_handler.ref_ev = NULL;
+            tick_rcv(EPOLLIN, &tick_handler);
         }
-        for (i = 0; i < r; ++i)
+        for(prio = 0; (prio < EPOLL_NUM_PRIO) && !*quit; ++prio)
+            dispatch_class(prio, r, &tv, quit);
+        for(i = 0; i < r; ++i)
         {
             struct epoll_event_handler *p = ev[i].data.ptr;
             if(p != NULL)
                 p->ref_ev = NULL;
         }
+
+        if(r == ev_size)
+            grow_events_array();
     }
 
+    remove_epoll(&tick_handler);
+    close(tick_handler.fd);
+    free(ev);
     return 0;
 }
@@ -29,13 +29,26 @@
 
 #include <sys/epoll.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <sys/time.h>
 
+#include "mstp_types.h"
+
+/* Max handler calls per loop turn for the protocol class */
+#define EPOLL_PROTOCOL_QUOTA    64
+/* Default max handler calls per loop turn for each of the other classes */
+#define EPOLL_LOW_PRIO_QUOTA    4
+/* Default loop lag (ms) behind the 1 s tick to log an alarm at */
+#define EPOLL_LAG_ALARM_MS      500
+
 struct epoll_event_handler
 {
     int fd;
     void *arg;
-    void (*handler) (uint32_t events, struct epoll_event_handler * p);
+    /* Handles one event. Returns true if more events may be ready on fd,
+     * false if fd has been drained */
+    bool (*handler) (uint32_t events, struct epoll_event_handler * p);
+    int priority; /* EPOLL_PRIO_* */
     struct epoll_event *ref_ev; /* if set, epoll loop has reference to this,
                                    so mark that ref as NULL while freeing */
 };
@@ -50,4 +63,10 @@ int add_epoll(struct epoll_event_handler *h);
 
 int remove_epoll(struct epoll_event_handler *h);
 
+void epoll_set_low_prio_quota(unsigned int quota);
+
+void epoll_set_lag_alarm(unsigned int ms);
+
+void epoll_get_stats(epoll_loop_stats_t *stats);
+
 #endif /* EPOLL_LOOP_H */
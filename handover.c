@@ -0,0 +1,413 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/* Hitless restart.
+ *
+ * The new instance of mstpd listens on HANDOVER_SOCK_NAME and sends the
+ * handover command to the running one. The running instance connects back,
+ * passes its sockets (SCM_RIGHTS) along with the snapshot of the protocol
+ * state, and exits without touching the kernel as soon as the new instance
+ * has accepted them. No BPDU or netlink event is lost in between: they
+ * wait in the very same sockets.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include "handover.h"
+#include "bridge_track.h"
+#include "ctl_functions.h"
+#include "mstp.h"
+#include "driver.h"
+#include "packet.h"
+#include "log.h"
+
+#define HANDOVER_SOCK_NAME  ".mstp_handover"
+#define HANDOVER_MAGIC      0x4d535450 /* "MSTP" */
+#define HANDOVER_VERSION    1
+#define HANDOVER_TIMEOUT    5 /* seconds */
+#define HANDOVER_MAX_LEN    (64 * 1024 * 1024)
+
+typedef struct
+{
+    __u32 magic;
+    __u32 version;
+    __u32 len; /* of the snapshot which follows */
+} handover_hdr_t;
+
+typedef union
+{
+    char buf[CMSG_SPACE(HANDOVER_NUM_FDS * sizeof(int))];
+    struct cmsghdr align;
+} handover_control_t;
+
+extern volatile bool quit; /* main.c */
+
+static int fds[HANDOVER_NUM_FDS] = { [0 ... HANDOVER_NUM_FDS - 1] = -1 };
+static void *snapshot;
+static size_t snapshot_len;
+static bool handed_over;
+
+void handover_set_fd(int which, int fd)
+{
+    fds[which] = fd;
+}
+
+int handover_get_fd(int which)
+{
+    return fds[which];
+}
+
+bool handover_done(void)
+{
+    return handed_over;
+}
+
+/* Sockets are only handed to (and taken from) the same user */
+static bool peer_trusted(int s, pid_t *pid)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if(0 > getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+    {
+        ERROR("Couldn't get handover peer credentials: %m");
+        return false;
+    }
+    if(cred.uid != geteuid())
+    {
+        ERROR("Handover peer pid %d has uid %u", cred.pid, cred.uid);
+        return false;
+    }
+    *pid = cred.pid;
+    return true;
+}
+
+static void set_timeouts(int s)
+{
+    struct timeval tv = { .tv_sec = HANDOVER_TIMEOUT, .tv_usec = 0 };
+
+    if(0 > setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))
+       || 0 > setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+        ERROR("Couldn't set handover socket timeouts: %m");
+}
+
+static bool read_all(int s, void *buf, size_t len)
+{
+    ssize_t l;
+
+    while(len)
+    {
+        l = recv(s, buf, len, 0);
+        if((0 > l) && (EINTR == errno))
+            continue;
+        if(0 >= l)
+            return false;
+        buf += l;
+        len -= l;
+    }
+    return true;
+}
+
+static bool write_all(int s, const void *buf, size_t len)
+{
+    ssize_t l;
+
+    while(len)
+    {
+        l = send(s, buf, len, MSG_NOSIGNAL);
+        if((0 > l) && (EINTR == errno))
+            continue;
+        if(0 > l)
+            return false;
+        buf += l;
+        len -= l;
+    }
+    return true;
+}
+
+/* Running instance: hand everything over to the new one */
+int CTL_handover(void)
+{
+    struct sockaddr_un sa;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    handover_control_t control;
+    handover_hdr_t hdr;
+    void *buf;
+    size_t len;
+    pid_t pid = 0;
+    int i, s;
+    __u8 ack = 0;
+
+    for(i = 0; i < HANDOVER_NUM_FDS; ++i)
+        if(0 > fds[i])
+        {
+            ERROR("Socket %d is not ready for handover", i);
+            return -1;
+        }
+
+    /* The state changes and BPDUs queued by this turn leave with this
+     * instance: the new one starts from the states set in the kernel */
+    driver_commit();
+    packet_flush();
+
+    if(bridge_track_snapshot(&buf, &len))
+        return -1;
+
+    if(0 > (s = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)))
+    {
+        ERROR("Couldn't open handover socket: %m");
+        free(buf);
+        return -1;
+    }
+    set_socket_address(&sa, HANDOVER_SOCK_NAME);
+    if(0 != connect(s, (struct sockaddr *)&sa, sizeof(sa)))
+    {
+        ERROR("Couldn't connect to the new mstpd: %m");
+        goto out;
+    }
+    if(!peer_trusted(s, &pid))
+        goto out;
+    set_timeouts(s);
+
+    hdr.magic = HANDOVER_MAGIC;
+    hdr.version = HANDOVER_VERSION;
+    hdr.len = len;
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if(sizeof(hdr) != sendmsg(s, &msg, MSG_NOSIGNAL)
+       || !write_all(s, buf, len) || !read_all(s, &ack, 1))
+    {
+        ERROR("Handover to mstpd pid %d failed: %m", pid);
+        goto out;
+    }
+    if(!ack)
+    {
+        ERROR("mstpd pid %d refused the handover", pid);
+        goto out;
+    }
+
+    INFO("Handed over to mstpd pid %d, exiting", pid);
+    handed_over = true;
+    quit = true;
+out:
+    close(s);
+    free(buf);
+    return handed_over ? 0 : -1;
+}
+
+/* New instance: receive the sockets and the snapshot */
+static bool receive_snapshot(int s)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    handover_control_t control;
+    handover_hdr_t hdr;
+    int i, num_fds = 0, rfds[sizeof(control.buf) / sizeof(int)];
+    ssize_t l;
+
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    l = recvmsg(s, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if(SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type)
+        {
+            num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(rfds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+        }
+    }
+
+    if(sizeof(hdr) != l || (msg.msg_flags & MSG_CTRUNC)
+       || HANDOVER_NUM_FDS != num_fds)
+    {
+        ERROR("Bad handover message: length %zd, %d sockets", l, num_fds);
+        goto err;
+    }
+    if(HANDOVER_MAGIC != hdr.magic || HANDOVER_VERSION != hdr.version
+       || HANDOVER_MAX_LEN < hdr.len)
+    {
+        ERROR("Incompatible handover: magic 0x%08x, version %u, length %u",
+              hdr.magic, hdr.version, hdr.len);
+        goto err;
+    }
+    if(NULL == (snapshot = malloc(hdr.len)))
+    {
+        ERROR("Out of memory for the snapshot (%u bytes)", hdr.len);
+        goto err;
+    }
+    if(!read_all(s, snapshot, hdr.len))
+    {
+        ERROR("Couldn't read the snapshot: %m");
+        goto err;
+    }
+    if(!bridge_track_snapshot_valid(snapshot, hdr.len))
+        goto err;
+
+    snapshot_len = hdr.len;
+    memcpy(fds, rfds, sizeof(fds));
+    return true;
+
+err:
+    free(snapshot);
+    snapshot = NULL;
+    for(i = 0; i < num_fds; ++i)
+        close(rfds[i]);
+    return false;
+}
+
+int handover_receive(void)
+{
+    struct sockaddr_un sa;
+    struct ctl_msg_hdr mhdr;
+    struct pollfd pfd[2];
+    int i, ls, cs = -1, s = -1, r = -1;
+    pid_t pid;
+    __u8 ack;
+
+    if(0 > (ls = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)))
+    {
+        ERROR("Couldn't open handover socket: %m");
+        return -1;
+    }
+    set_socket_address(&sa, HANDOVER_SOCK_NAME);
+    if(0 != bind(ls, (struct sockaddr *)&sa, sizeof(sa)) || 0 != listen(ls, 1))
+    {
+        ERROR("Couldn't bind handover socket: %m");
+        goto out;
+    }
+
+    /* Ask the running instance to connect back.
+     * Autobind the request socket, so that the reply can reach us. */
+    if(0 > (cs = socket(PF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)))
+    {
+        ERROR("Couldn't open unix socket: %m");
+        goto out;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if(0 != bind(cs, (struct sockaddr *)&sa, sizeof(sa_family_t)))
+    {
+        ERROR("Couldn't bind unix socket: %m");
+        goto out;
+    }
+    memset(&mhdr, 0, sizeof(mhdr));
+    mhdr.cmd = CMD_CODE_handover;
+    set_socket_address(&sa, MSTP_SERVER_SOCK_NAME);
+    if(0 > sendto(cs, &mhdr, sizeof(mhdr), 0, (struct sockaddr *)&sa,
+                  sizeof(sa)))
+    {
+        if(ECONNREFUSED == errno)
+        {
+            INFO("No running mstpd to take over from");
+            r = 1;
+        }
+        else
+            ERROR("Couldn't send handover request: %m");
+        goto out;
+    }
+
+    /* The reply only comes first if the running instance failed */
+    pfd[0].fd = ls;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = cs;
+    pfd[1].events = POLLIN;
+    if(0 >= poll(pfd, 2, HANDOVER_TIMEOUT * 1000) || !(pfd[0].revents & POLLIN))
+    {
+        ERROR("The running mstpd didn't hand over");
+        goto out;
+    }
+    if(0 > (s = accept4(ls, NULL, NULL, SOCK_CLOEXEC)))
+    {
+        ERROR("Couldn't accept handover connection: %m");
+        goto out;
+    }
+    if(!peer_trusted(s, &pid))
+        goto out;
+    set_timeouts(s);
+
+    ack = receive_snapshot(s);
+    if(!write_all(s, &ack, 1) && ack)
+    {
+        ERROR("Couldn't confirm the handover: %m");
+        /* The sockets are still used by the running instance */
+        for(i = 0; i < HANDOVER_NUM_FDS; ++i)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+        free(snapshot);
+        snapshot = NULL;
+        goto out;
+    }
+    if(!ack)
+        goto out;
+
+    /* Wait for the reply, the previous instance exits after sending it */
+    pfd[1].revents = 0;
+    if(0 < poll(&pfd[1], 1, HANDOVER_TIMEOUT * 1000))
+        recv(cs, &mhdr, sizeof(mhdr), 0);
+    INFO("Took over from mstpd pid %d", pid);
+    r = 0;
+out:
+    if(0 <= s)
+        close(s);
+    if(0 <= cs)
+        close(cs);
+    close(ls);
+    return r;
+}
+
+void handover_restore(void)
+{
+    if(!snapshot)
+        return;
+    bridge_track_restore(snapshot, snapshot_len);
+    free(snapshot);
+    snapshot = NULL;
+}
@@ -0,0 +1,50 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <stdbool.h>
+
+/* Sockets passed from the running mstpd to its successor */
+enum
+{
+    HANDOVER_FD_CTL,
+    HANDOVER_FD_PACKET,
+    HANDOVER_FD_NETLINK,
+    HANDOVER_NUM_FDS
+};
+
+/* Every module registers its socket, so that it can be handed over */
+void handover_set_fd(int which, int fd);
+/* Socket received from the previous instance, or -1 */
+int handover_get_fd(int which);
+
+/* Take over from the running mstpd, if any.
+ * Return 0 on success, 1 if there is no mstpd to take over from, -1 on error.
+ */
+int handover_receive(void);
+/* Restore the state received by handover_receive() */
+void handover_restore(void);
+
+/* True if this instance has handed over and must exit quietly */
+bool handover_done(void);
+
+#endif /* HANDOVER_H */
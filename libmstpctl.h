@@ -0,0 +1,95 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/* libmstpctl: the client side of the mstpd control socket.
+ *
+ * The messages are those of ctl_functions.h: the request is the _IN struct
+ * of a command, the reply its _OUT struct. The CTL_ functions declared there
+ * send one request on the default connection and wait for the reply.
+ *
+ * A connection (mstpctl_open()) may also have any number of requests
+ * outstanding: mstpctl_send() returns at once, and the reply callback is
+ * called from mstpctl_process() when the caller's event loop finds
+ * mstpctl_fd() readable.
+ */
+
+#ifndef LIBMSTPCTL_H
+#define LIBMSTPCTL_H
+
+#include "ctl_functions.h"
+
+typedef struct mstpctl_conn mstpctl_conn_t;
+
+/* Called once for every request sent with mstpctl_send(): with r = 0 when
+ * the reply has been stored in the out buffer of the request, res being the
+ * return code of the command in mstpd and log its error messages; with
+ * r = -1 if the reply is malformed or the connection is closed before.
+ */
+typedef void (*mstpctl_reply_cb_t)(mstpctl_conn_t *conn, unsigned int id,
+                                   int r, int res, const char *log,
+                                   void *arg);
+
+typedef void (*mstpctl_log_handler_t)(int level, const char *msg);
+
+/* Open a connection to mstpd. Return NULL if mstpd can't be reached. */
+mstpctl_conn_t *mstpctl_open(void);
+
+/* Close the connection; the requests still waiting for a reply fail. */
+void mstpctl_close(mstpctl_conn_t *conn);
+
+/* The non-blocking socket of the connection, readable when replies wait
+ * for mstpctl_process(). */
+int mstpctl_fd(const mstpctl_conn_t *conn);
+
+/* Send a request; out (lout bytes) must stay valid until cb is called.
+ * Store the ID of the request in *id when id isn't NULL.
+ * Return 0, or -1 with errno set (EAGAIN when mstpd can't keep up).
+ */
+int mstpctl_send(mstpctl_conn_t *conn, int cmd, const void *in, int lin,
+                 void *out, int lout, mstpctl_reply_cb_t cb, void *arg,
+                 unsigned int *id);
+
+/* Handle the replies waiting on the socket, without blocking.
+ * Return the number of replies handled, or -1 on socket error.
+ */
+int mstpctl_process(mstpctl_conn_t *conn);
+
+/* Number of the requests still waiting for their reply */
+int mstpctl_pending(const mstpctl_conn_t *conn);
+
+/* Block until the reply to the request id has been handled, or timeout ms
+ * have passed (the request then keeps waiting). Return 0 or -1.
+ */
+int mstpctl_wait(mstpctl_conn_t *conn, unsigned int id, int timeout);
+
+/* Forget the request id: its callback won't be called, its reply dropped */
+void mstpctl_cancel(mstpctl_conn_t *conn, unsigned int id);
+
+/* Send a request and wait for the reply (5 s at most), the blocking way */
+int mstpctl_call(mstpctl_conn_t *conn, int cmd, const void *in, int lin,
+                 void *out, int lout, LogString *log, int *res);
+
+/* The connection the CTL_ functions use; opened by ctl_client_init() */
+mstpctl_conn_t *mstpctl_default_conn(void);
+
+/* Where the library reports its errors; nowhere by default */
+void mstpctl_set_log_handler(mstpctl_log_handler_t handler);
+
+#endif /* LIBMSTPCTL_H */
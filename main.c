@@ -33,6 +33,7 @@
 #include <signal.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/types.h>
 
 #include "epoll_loop.h"
@@ -44,6 +45,9 @@
 #include "ctl_socket_server.h"
 #include "driver.h"
 #include "bridge_track.h"
+#include "handover.h"
+#include "conf_file.h"
+#include "record.h"
 
 #define APP_NAME    "mstpd"
 
@@ -116,14 +120,76 @@ int main(int argc, char *argv[])
 {
     int c;
     int daemonize = 1;
-
-    while((c = getopt(argc, argv, "Vdsv:")) != -1)
+    bool qdisc_bypass = false;
+    bool take_over = false;
+    const char *conf_path = NULL;
+    const char *record_path = NULL;
+    bool auto_adopt = false;
+    unsigned int caps;
+
+    while((c = getopt(argc, argv, "Ab:c:VdFHL:P:qr:sv:Q:W")) != -1)
     {
         switch (c)
         {
+            case 'A':
+                auto_adopt = true;
+                bridge_set_auto_adopt(true);
+                break;
+            case 'b':
+                if(bridge_add_auto_adopt_name(optarg))
+                {
+                    ERROR("Invalid bridge name %s", optarg);
+                    exit(1);
+                }
+                break;
+            case 'c':
+                /* daemon() changes the working directory */
+                if(NULL == (conf_path = realpath(optarg, NULL)))
+                {
+                    ERROR("Invalid configuration file %s: %m", optarg);
+                    exit(1);
+                }
+                break;
             case 'd':
                 daemonize = 0;
                 break;
+            case 'F':
+                bridge_set_rx_fast_path(false);
+                break;
+            case 'H':
+                take_over = true;
+                break;
+            case 'L':
+            {
+                char *end;
+                unsigned long l;
+                l = strtoul(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l > UINT_MAX / 1000)
+                {
+                    ERROR("Invalid lag alarm threshold %s", optarg);
+                    exit(1);
+                }
+                epoll_set_lag_alarm(l);
+                break;
+            }
+            case 'P':
+            {
+                /* daemon() changes the working directory */
+                char *path = realpath(optarg, NULL);
+                if(NULL == path)
+                {
+                    ERROR("Invalid driver plugin %s: %m", optarg);
+                    exit(1);
+                }
+                driver_set_plugin(path);
+                break;
+            }
+            case 'q':
+                qdisc_bypass = true;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
             case 's':
                 print_to_syslog = 1;
                 break;
@@ -140,6 +206,22 @@ int main(int argc, char *argv[])
                 log_level = l;
                 break;
             }
+            case 'Q':
+            {
+                char *end;
+                unsigned long l;
+                l = strtoul(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l == 0 || l > UINT_MAX)
+                {
+                    ERROR("Invalid event quota %s", optarg);
+                    exit(1);
+                }
+                epoll_set_low_prio_quota(l);
+                break;
+            }
+            case 'W':
+                bridge_set_warm_start(true);
+                break;
             case 'V':
                 printf(PACKAGE_VERSION "\n");
                 return 0;
@@ -159,6 +241,15 @@ int main(int argc, char *argv[])
     if (sanity_check() < 0)
 	return EXIT_FAILURE;
 
+    /* Before daemonizing: the caller falls back to a cold restart if the
+     * running instance didn't hand over */
+    if(take_over && (0 > handover_receive()))
+        return EXIT_FAILURE;
+
+    /* Input recording for mstpd-replay, see record.h */
+    if(record_path && record_open(record_path))
+        return EXIT_FAILURE;
+
     if(daemonize)
     {
         FILE *f = fopen(MSTPD_PID_FILE, "w");
@@ -178,17 +269,33 @@ int main(int argc, char *argv[])
     }
 
     TST(signal_init() == 0, -1);
-    TST(driver_mstp_init() == 0, -1);
     TST(init_epoll() == 0, -1);
+    /* The driver may watch file descriptors of its own */
+    TST(driver_mstp_init() == 0, -1);
     TST(ctl_socket_init() == 0, -1);
-    TST(packet_sock_init() == 0, -1);
+    TST(packet_sock_init(qdisc_bypass) == 0, -1);
     TST(netsock_init() == 0, -1);
+    handover_restore();
+    packet_filter_init();
     TST(init_bridge_ops() == 0, -1);
+    caps = driver_plugin_caps();
+    record_input(RECORD_START, auto_adopt, !!conf_path, &caps, sizeof(caps));
+    if(conf_path)
+        TST(conf_file_init(conf_path) == 0, -1);
+    /* Bridges which are already in user STP mode */
+    if(auto_adopt)
+        TST(dump_bridge_stp_states() == 0, -1);
 
     c = epoll_main_loop(&quit);
-    bridge_track_fini();
+    /* After a handover the ports belong to the new instance */
+    if(!handover_done())
+    {
+        record_input(RECORD_STOP, 0, 0, NULL, 0);
+        bridge_track_fini();
+    }
     ctl_socket_cleanup();
     driver_mstp_fini();
+    record_close();
 
     return c;
 }
@@ -263,12 +370,17 @@ static void printout_mesh(bridge_t *br)
 
 static bool test_ports_trees_mesh(void)
 {
+    /* No outputs: nothing reaches the kernel */
+    static const mstp_ops_t test_ops;
+    static mstp_engine_t test_engine;
+    MSTP_IN_init_engine(&test_engine, &test_ops, NULL);
+
     bridge_t *br = calloc(1, sizeof(*br));
     if(!br)
         return false;
     strcpy(br->sysdeps.name, "BR_TEST");
     br->sysdeps.macaddr[5] = 0xED;
-    if(!MSTP_IN_bridge_create(br, br->sysdeps.macaddr))
+    if(!MSTP_IN_bridge_create(&test_engine, br, br->sysdeps.macaddr))
     {
         free(br);
         return false;
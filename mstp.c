@@ -29,32 +29,197 @@
  */
 
 /* Important coding convention:
- *   All functions that have dry_run argument must follow the
- *   return value convention:
- *      They should return true if state change detected during dry run.
- *      Otherwise (!dry_run || !state_change) they return false.
+ *   All *_run functions must follow the return value convention:
+ *      They should return true if they made a state transition
+ *      (or changed at least one state variable).
+ *      Otherwise they return false.
+ *   The recursive *_run calls from the transition functions ignore the
+ *   return value, only the outermost call reports the progress.
  */
 
 #include <config.h>
 
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
 #include <asm/byteorder.h>
 
 #include "mstp.h"
 #include "log.h"
-#include "driver.h"
-#include "clock_gettime.h"
 
 static void PTSM_tick(port_t *prt);
-static bool TCSM_run(per_tree_port_t *ptp, bool dry_run);
+static bool TCSM_run(per_tree_port_t *ptp);
 static void BDSM_begin(port_t *prt);
 static void br_state_machines_begin(bridge_t *br);
 static void prt_state_machines_begin(port_t *prt);
 static void tree_state_machines_begin(tree_t *tree);
 static void br_state_machines_run(bridge_t *br);
 static void updtbrAssuRcvdInfoWhile(port_t *prt);
+static void updtRcvdInfoWhile(per_tree_port_t *ptp);
+static void recordAgreement(per_tree_port_t *ptp);
+static void recordMastered(per_tree_port_t *ptp);
+static void recordProposal(per_tree_port_t *ptp);
+
+/* The logging macros of bridge_ctl.h log through the engine of the bridge */
+static void mstp_log(bridge_t *br, int level, const char *func,
+                     const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#undef ERROR_BRNAME
+#undef INFO_BRNAME
+#undef LOG_BRNAME
+#undef ERROR_PRTNAME
+#undef INFO_PRTNAME
+#undef LOG_PRTNAME
+#undef ERROR_MSTINAME
+#undef INFO_MSTINAME
+#undef LOG_MSTINAME
+#undef SMLOG_MSTINAME
+
+#define BRLOG(_level, _br, _fmt, _args...) \
+    mstp_log(_br, _level, __PRETTY_FUNCTION__, "%s " _fmt, \
+             _br->sysdeps.name, ##_args)
+#define PRTLOG(_level, _br, _prt, _fmt, _args...) \
+    mstp_log(_br, _level, __PRETTY_FUNCTION__, "%s:%s " _fmt, \
+             _br->sysdeps.name, _prt->sysdeps.name, ##_args)
+#define MSTILOG(_level, _br, _prt, _ptp, _fmt, _args...) \
+    mstp_log(_br, _level, __PRETTY_FUNCTION__, "%s:%s:%hu " _fmt, \
+             _br->sysdeps.name, _prt->sysdeps.name, \
+             __be16_to_cpu(_ptp->MSTID), ##_args)
+
+#define ERROR_BRNAME(_br, _fmt, _args...) \
+    BRLOG(LOG_LEVEL_ERROR, _br, _fmt, ##_args)
+#define INFO_BRNAME(_br, _fmt, _args...) \
+    BRLOG(LOG_LEVEL_INFO, _br, _fmt, ##_args)
+#define LOG_BRNAME(_br, _fmt, _args...) \
+    BRLOG(LOG_LEVEL_DEBUG, _br, _fmt, ##_args)
+#define ERROR_PRTNAME(_br, _prt, _fmt, _args...) \
+    PRTLOG(LOG_LEVEL_ERROR, _br, _prt, _fmt, ##_args)
+#define INFO_PRTNAME(_br, _prt, _fmt, _args...) \
+    PRTLOG(LOG_LEVEL_INFO, _br, _prt, _fmt, ##_args)
+#define LOG_PRTNAME(_br, _prt, _fmt, _args...) \
+    PRTLOG(LOG_LEVEL_DEBUG, _br, _prt, _fmt, ##_args)
+#define ERROR_MSTINAME(_br, _prt, _ptp, _fmt, _args...) \
+    MSTILOG(LOG_LEVEL_ERROR, _br, _prt, _ptp, _fmt, ##_args)
+#define INFO_MSTINAME(_br, _prt, _ptp, _fmt, _args...) \
+    MSTILOG(LOG_LEVEL_INFO, _br, _prt, _ptp, _fmt, ##_args)
+#define LOG_MSTINAME(_br, _prt, _ptp, _fmt, _args...) \
+    MSTILOG(LOG_LEVEL_DEBUG, _br, _prt, _ptp, _fmt, ##_args)
+#define SMLOG_MSTINAME(_ptp, _fmt, _args...) \
+    MSTILOG(LOG_LEVEL_STATE_MACHINE_TRANSITION, _ptp->port->bridge, \
+            _ptp->port, _ptp, _fmt, ##_args)
+
+static void mstp_log(bridge_t *br, int level, const char *func,
+                     const char *fmt, ...)
+{
+    mstp_engine_t *eng = br->engine;
+    va_list ap;
+
+    if(!eng->ops->log)
+        return;
+    va_start(ap, fmt);
+    eng->ops->log(eng, level, func, fmt, ap);
+    va_end(ap);
+}
+
+/* Something shown by the status of the object (MSTP_IN_get_xxx_status())
+ * is written: the object gets the next generation of the engine, see
+ * MSTP_IN_get_changes(). The CIST shows in the statuses of the bridge and
+ * of the ports. */
+static inline void br_changed(bridge_t *br)
+{
+    br->generation = ++br->engine->generation;
+}
+
+static inline void tree_changed(tree_t *tree)
+{
+    if(tree->MSTID)
+        tree->generation = ++tree->bridge->engine->generation;
+    else
+        br_changed(tree->bridge);
+}
+
+static inline void prt_changed(port_t *prt)
+{
+    prt->generation = ++prt->bridge->engine->generation;
+}
+
+static inline void ptp_changed(per_tree_port_t *ptp)
+{
+    if(ptp->MSTID)
+        ptp->generation = ++ptp->port->bridge->engine->generation;
+    else
+        prt_changed(ptp->port);
+}
+
+/* Set field of the status of obj, which is of kind br, tree, prt or ptp */
+#define set_status(kind, obj, field, value) do{    \
+    typeof((obj)->field) _status_new = (value);     \
+    if((obj)->field != _status_new)                 \
+    {                                               \
+        (obj)->field = _status_new;                 \
+        kind##_changed(obj);                        \
+    }                                               \
+    }while(0)
+
+/* External actions, through the ops of the engine of the bridge */
+
+static inline void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state)
+{
+    const mstp_ops_t *ops = ptp->port->bridge->engine->ops;
+
+    if(ops->set_state)
+        ops->set_state(ptp, new_state);
+    /* The state and the counts of transitions */
+    ptp_changed(ptp);
+}
+
+static inline void MSTP_OUT_flush_all_fids(per_tree_port_t *ptp)
+{
+    const mstp_ops_t *ops = ptp->port->bridge->engine->ops;
+
+    if(ops->flush_all_fids)
+        ops->flush_all_fids(ptp);
+    else
+        MSTP_IN_all_fids_flushed(ptp);
+}
+
+static inline void MSTP_OUT_set_ageing_time(port_t *prt,
+                                            unsigned int ageingTime)
+{
+    const mstp_ops_t *ops = prt->bridge->engine->ops;
+
+    if(ops->set_ageing_time)
+        ops->set_ageing_time(prt, ageingTime);
+}
+
+static inline void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    const mstp_ops_t *ops = prt->bridge->engine->ops;
+
+    if(ops->tx_bpdu)
+        ops->tx_bpdu(prt, bpdu, size);
+    /* The counts of BPDUs sent */
+    prt_changed(prt);
+}
+
+static inline void MSTP_OUT_shutdown_port(port_t *prt)
+{
+    const mstp_ops_t *ops = prt->bridge->engine->ops;
+
+    if(ops->shutdown_port)
+        ops->shutdown_port(prt);
+}
+
+static inline void MSTP_OUT_state_machines_ran(bridge_t *br)
+{
+    const mstp_ops_t *ops = br->engine->ops;
+
+    if(ops->state_machines_ran)
+        ops->state_machines_ran(br);
+}
 
 #define FOREACH_PORT_IN_BRIDGE(port, bridge) \
     list_for_each_entry((port), &(bridge)->ports, br_list)
@@ -65,6 +230,29 @@ static void updtbrAssuRcvdInfoWhile(port_t *prt);
 #define FOREACH_PTP_IN_PORT(ptp, port) \
     list_for_each_entry((ptp), &(port)->trees, port_list)
 
+/* The statuses of the bridge and of all its trees and ports */
+static void all_changed(bridge_t *br)
+{
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+
+    br_changed(br);
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        tree_changed(tree);
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        prt_changed(prt);
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            ptp_changed(ptp);
+    }
+}
+
+/* Max number of state machines passes for a bridge in one run */
+#define SM_RUN_BUDGET       64
+/* Number of consecutive runs out of budget to suspect a livelock */
+#define SM_LIVELOCK_RUNS    1000
+
 /* 17.20.11 of 802.1D */
 #define rstpVersion(br) ((br)->ForceProtocolVersion >= protoRSTP)
 /* Bridge assurance is operational only when NetworkPort type is configured
@@ -72,6 +260,15 @@ static void updtbrAssuRcvdInfoWhile(port_t *prt);
  */
 #define assurancePort(prt) ((prt)->NetworkPort && (prt)->operPointToPointMAC \
                             && (prt)->sendRSTP)
+/* Drop the cached transmit BPDUs of all ports of the bridge */
+static void invalidate_tx_bpdus(bridge_t *br)
+{
+    port_t *prt;
+
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        prt->txBpduValid = false;
+}
+
 /*
  * Recalculate configuration digest. (13.7)
  */
@@ -87,6 +284,8 @@ static void RecalcConfigDigest(bridge_t *br)
 
     hmac_md5((void *)vid2mstid, sizeof(vid2mstid), mstp_key, sizeof(mstp_key),
              (caddr_t)br->MstConfigId.s.configuration_digest);
+    invalidate_tx_bpdus(br);
+    ++(br->configEpoch);
 }
 
 /*
@@ -120,6 +319,17 @@ static void tree_default_internal_vars(tree_t *tree)
      */
 }
 
+/* Is any port of the bridge in rapid ageing */
+static bool rapid_ageing(bridge_t *br)
+{
+    port_t *prt;
+
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        if(prt->rapidAgeingWhile)
+            return true;
+    return false;
+}
+
 static void port_default_internal_vars(port_t *prt)
 {
     prt->infoInternal = false;
@@ -130,12 +340,21 @@ static void port_default_internal_vars(port_t *prt)
     assign(prt->brAssuRcvdInfoWhile, 0u);
     prt->BaInconsistent = false;
     prt->num_rx_bpdu_filtered = 0;
+    prt->num_rx_bpdu_rate_limited = 0;
+    prt->num_bpdu_rate_limit_engaged = 0;
+    prt->num_rapid_ageing = 0;
+    prt->bpduRateLimited = false;
+    prt->bpduRateLimitedNow = false;
+    prt->limitedBpduSize = 0;
     prt->num_rx_bpdu = 0;
     prt->num_rx_tcn = 0;
     prt->num_tx_bpdu = 0;
     prt->num_tx_tcn = 0;
     prt->num_trans_fwd = 0;
     prt->num_trans_blk = 0;
+    prt->num_rx_unknown_msti = 0;
+    prt->num_tx_errors = 0;
+    prt->num_rx_bpdu_fast = 0;
 
     /* The following are initialized in BEGIN state:
      * - mdelayWhile. mcheck, sendRSTP: in Port Protocol Migration SM
@@ -157,6 +376,10 @@ static void ptp_default_internal_vars(per_tree_port_t *ptp)
     ptp->mastered = false;
     memset(&ptp->msgPriority, 0, sizeof(ptp->msgPriority));
     memset(&ptp->msgTimes, 0, sizeof(ptp->msgTimes));
+    assign(ptp->fdbFlushHoldWhile, 0u);
+    ptp->fdbFlushPending = false;
+    ptp->num_fdb_flush_requests = 0;
+    ptp->num_fdb_flushes = 0;
 
     /* The following are initialized in BEGIN state:
      * - rcvdMsg: in Port Receive SM
@@ -197,6 +420,7 @@ static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
     assign(tree->BridgeTimes.Hello_Time, br->Hello_Time);
 
     tree_default_internal_vars(tree);
+    tree_changed(tree);
 
     return tree;
 }
@@ -226,22 +450,40 @@ static per_tree_port_t * create_ptp(tree_t *tree, port_t *prt)
     ptp->calledFromFlushRoutine = false;
 
     ptp_default_internal_vars(ptp);
+    ptp_changed(ptp);
 
     return ptp;
 }
 
 /* External events */
 
-bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr)
+void MSTP_IN_init_engine(mstp_engine_t *eng, const mstp_ops_t *ops,
+                         void *arg)
+{
+    eng->ops = ops;
+    eng->arg = arg;
+    eng->rx_fast_path = true;
+    INIT_LIST_HEAD(&eng->deferred_bridges);
+}
+
+bool MSTP_IN_bridge_create(mstp_engine_t *eng, bridge_t *br, __u8 *macaddr)
 {
     tree_t *cist;
 
-    if (!driver_create_bridge(br, macaddr))
+    br->engine = eng;
+    if(eng->ops->create_bridge && !eng->ops->create_bridge(br, macaddr))
         return false;
 
     /* Initialize all fields except sysdeps and anchor */
     INIT_LIST_HEAD(&br->ports);
     INIT_LIST_HEAD(&br->trees);
+    INIT_LIST_HEAD(&br->deferred_list);
+    br->smExhaustedRuns = 0;
+    br->num_sm_budget_exhausted = 0;
+    br->num_sm_livelock = 0;
+    br->configDepth = 0;
+    br->configRunPending = false;
+    br_changed(br);
     br->bridgeEnabled = false;
     memset(br->vid2fid, 0, sizeof(br->vid2fid));
     memset(br->fid2mstid, 0, sizeof(br->fid2mstid));
@@ -260,6 +502,7 @@ bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr)
     assign(br->Migrate_Time, 3u); /* 17.14 of 802.1D */
     assign(br->Ageing_Time, 300u);/* 8.8.3 Table 8-3 */
     assign(br->Hello_Time, (__u8)2);     /* 17.14 of 802.1D */
+    assign(br->FdbFlushWindow, 0u);
 
     bridge_default_internal_vars(br);
 
@@ -277,7 +520,8 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
     per_tree_port_t *ptp, *nxt;
     bridge_t *br = prt->bridge;
 
-    if (!driver_create_port(prt, portno))
+    if(br->engine->ops->create_port
+       && !br->engine->ops->create_port(prt, portno))
         return false;
 
     /* Initialize all fields except sysdeps and bridge */
@@ -302,7 +546,11 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
     prt->NetworkPort = false;
     prt->dontTxmtBpdu = false;
     prt->bpduFilterPort = false;
+    prt->bpduRateLimit = 0;
+    prt->bpduRateKeepLatest = false;
+    prt->bpduTokens = 0;
     prt->deleted = false;
+    prt_changed(prt);
 
     port_default_internal_vars(prt);
 
@@ -330,6 +578,7 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
      * because it heavily depends on the fact that port is added to the tail.
      */
     list_add_tail(&prt->br_list, &br->ports);
+    br_changed(br);
 
     prt_state_machines_begin(prt);
     return true;
@@ -340,7 +589,16 @@ void MSTP_IN_delete_port(port_t *prt)
     per_tree_port_t *ptp, *nxt;
     bridge_t *br = prt->bridge;
 
-    driver_delete_port(prt);
+    /* Don't leave the bridge in rapid ageing */
+    if(prt->rapidAgeingWhile)
+    {
+        assign(prt->rapidAgeingWhile, 0u);
+        if(!rapid_ageing(br))
+            MSTP_OUT_set_ageing_time(prt, br->Ageing_Time);
+    }
+
+    if(br->engine->ops->delete_port)
+        br->engine->ops->delete_port(prt);
 
     prt->deleted = true;
     if(prt->portEnabled)
@@ -357,6 +615,7 @@ void MSTP_IN_delete_port(port_t *prt)
     }
 
     list_del(&prt->br_list);
+    br_changed(br);
     br_state_machines_run(br);
 }
 
@@ -365,9 +624,11 @@ void MSTP_IN_delete_bridge(bridge_t *br)
     tree_t *tree, *nxt_tree;
     port_t *prt, *nxt_prt;
 
-    driver_delete_bridge(br);
+    if(br->engine->ops->delete_bridge)
+        br->engine->ops->delete_bridge(br);
 
     br->bridgeEnabled = false;
+    list_del_init(&br->deferred_list);
 
     /* We SHOULD first delete all ports and only THEN delete all tree_t
      * structures as the tree_t structure contains the head for the per-port
@@ -389,6 +650,97 @@ void MSTP_IN_delete_bridge(bridge_t *br)
     }
 }
 
+/* The generations of the previous instance stay in the past */
+static void restore_generation(mstp_engine_t *eng, __u64 generation)
+{
+    if(eng->generation < generation)
+        eng->generation = generation;
+}
+
+/* Hitless restart: overwrite the freshly created bridge and its trees with
+ * the state saved by the previous instance of mstpd.
+ * Anchors, pointers and sysdeps of the new structures are kept.
+ * saved_trees are in the order of br->trees, CIST first.
+ */
+void MSTP_IN_restore_bridge(bridge_t *br, const bridge_t *saved,
+                            const tree_t *saved_trees)
+{
+    struct list_head list = br->list, ports = br->ports, trees = br->trees;
+    sysdep_br_data_t sysdeps = br->sysdeps;
+    mstp_engine_t *engine = br->engine;
+    tree_t *tree;
+
+    *br = *saved;
+    br->list = list;
+    br->ports = ports;
+    br->trees = trees;
+    br->sysdeps = sysdeps;
+    br->engine = engine;
+    /* Unfinished runs will be resumed by the next event */
+    INIT_LIST_HEAD(&br->deferred_list);
+    br->smExhaustedRuns = 0;
+
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        struct list_head bridge_list = tree->bridge_list;
+        ports = tree->ports;
+
+        *tree = *saved_trees++;
+        tree->bridge_list = bridge_list;
+        tree->bridge = br;
+        tree->ports = ports;
+        restore_generation(engine, tree->generation);
+    }
+    restore_generation(engine, br->generation);
+}
+
+/* Same as above for the port and its per-tree data.
+ * saved_ptps are in the order of prt->trees, CIST first.
+ */
+void MSTP_IN_restore_port(port_t *prt, const port_t *saved,
+                          const per_tree_port_t *saved_ptps)
+{
+    struct list_head br_list = prt->br_list, trees = prt->trees;
+    bridge_t *br = prt->bridge;
+    sysdep_if_data_t sysdeps = prt->sysdeps;
+    per_tree_port_t *ptp;
+
+    *prt = *saved;
+    prt->br_list = br_list;
+    prt->bridge = br;
+    prt->trees = trees;
+    prt->sysdeps = sysdeps;
+    restore_generation(br->engine, prt->generation);
+
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        struct list_head port_list = ptp->port_list;
+        struct list_head tree_list = ptp->tree_list;
+        tree_t *tree = ptp->tree;
+        uintptr_t offset;
+
+        *ptp = *saved_ptps;
+        ptp->port_list = port_list;
+        ptp->tree_list = tree_list;
+        ptp->port = prt;
+        ptp->tree = tree;
+        restore_generation(br->engine, ptp->generation);
+        /* rcvdMstiConfig points into the old copy of rcvdBpduData */
+        if(saved_ptps->rcvdMstiConfig)
+        {
+            offset = (uintptr_t)saved_ptps->rcvdMstiConfig
+                     - ((uintptr_t)saved_ptps->port
+                        + offsetof(port_t, rcvdBpduData));
+            if(offset < sizeof(prt->rcvdBpduData))
+                ptp->rcvdMstiConfig = (msti_configuration_message_t *)
+                    ((__u8 *)&prt->rcvdBpduData + offset);
+            else
+                ptp->rcvdMstiConfig = NULL;
+        }
+        ++saved_ptps;
+    }
+}
+
 void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr)
 {
     tree_t *tree;
@@ -402,6 +754,7 @@ void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr)
         memcpy(tree->BridgeIdentifier.s.mac_address, macaddr, ETH_ALEN);
         tree->BridgePriority.RootID = tree->BridgePriority.RRootID =
             tree->BridgePriority.DesignatedBridgeID = tree->BridgeIdentifier;
+        tree_changed(tree);
     }
 
     if(changed)
@@ -445,6 +798,7 @@ void MSTP_IN_set_bridge_enable(bridge_t *br, bool up)
             ptp_default_internal_vars(ptp);
         }
     }
+    all_changed(br);
     br_state_machines_begin(br);
 }
 
@@ -464,6 +818,7 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         if(prt->ExternalPortPathCost != new_ExternalPathCost)
         {
             assign(prt->ExternalPortPathCost, new_ExternalPathCost);
+            prt_changed(prt);
             changed = true;
         }
         FOREACH_PTP_IN_PORT(ptp, prt)
@@ -474,6 +829,7 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
             if(ptp->InternalPortPathCost != new_InternalPathCost)
             {
                 assign(ptp->InternalPortPathCost, new_InternalPathCost);
+                ptp_changed(ptp);
                 changed = true;
             }
         }
@@ -494,6 +850,7 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         if(prt->operPointToPointMAC != new_p2p)
         {
             prt->operPointToPointMAC = new_p2p;
+            prt_changed(prt);
             changed = true;
         }
 
@@ -503,10 +860,17 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
             prt->BpduGuardError = false;
             prt->BaInconsistent = false;
             prt->num_rx_bpdu_filtered = 0;
+            prt->num_rx_bpdu_rate_limited = 0;
+            prt->num_bpdu_rate_limit_engaged = 0;
+            prt->num_rapid_ageing = 0;
             prt->num_rx_bpdu = 0;
             prt->num_rx_tcn = 0;
             prt->num_tx_bpdu = 0;
             prt->num_tx_tcn = 0;
+            prt->num_rx_unknown_msti = 0;
+            prt->num_tx_errors = 0;
+            prt->num_rx_bpdu_fast = 0;
+            prt_changed(prt);
             changed = true;
             /* When port is enabled, initialize bridge assurance timer,
              * so that enough time is given before port is put in
@@ -520,6 +884,7 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         if(prt->portEnabled)
         {
             prt->portEnabled = false;
+            prt_changed(prt);
             changed = true;
         }
     }
@@ -528,13 +893,50 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         br_state_machines_run(prt->bridge);
 }
 
+static void rx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
+
+/* Refill the BPDU bucket of the port, once per second */
+static void bpdu_rate_tick(port_t *prt)
+{
+    if(!prt->bpduRateLimit)
+        return;
+    prt->bpduTokens = prt->bpduRateLimit;
+    if(prt->bpduRateLimited && !prt->bpduRateLimitedNow)
+    {
+        prt->bpduRateLimited = false;
+        prt_changed(prt);
+        INFO_PRTNAME(prt->bridge, prt, "BPDU rate limit disengaged");
+    }
+    prt->bpduRateLimitedNow = false;
+}
+
+static void fdb_flush(per_tree_port_t *ptp);
+
+/* A flush held back by the flush window is done when the window ends */
+static void fdb_flush_tick(per_tree_port_t *ptp)
+{
+    if(!ptp->fdbFlushHoldWhile || --(ptp->fdbFlushHoldWhile))
+        return;
+    if(ptp->fdbFlushPending)
+    {
+        ptp->fdbFlushPending = false;
+        fdb_flush(ptp);
+    }
+}
+
 void MSTP_IN_one_second(bridge_t *br)
 {
-    port_t *prt;
+    port_t *prt, *ageing_port = NULL;
+    per_tree_port_t *ptp;
     tree_t *tree;
+    bpdu_t bpdu;
+    int size;
 
     ++(br->uptime);
 
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        bpdu_rate_tick(prt);
+
     if(!br->bridgeEnabled)
         return;
 
@@ -551,36 +953,239 @@ void MSTP_IN_one_second(bridge_t *br)
             if((--(prt->rapidAgeingWhile)) == 0)
             {
                 if(!prt->deleted)
-                    MSTP_OUT_set_ageing_time(prt, br->Ageing_Time);
+                    ageing_port = prt;
             }
         }
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            fdb_flush_tick(ptp);
+    }
+    /* Rapid ageing ends with the period of the last port */
+    if(ageing_port && !rapid_ageing(br))
+    {
+        MSTP_OUT_set_ageing_time(ageing_port, br->Ageing_Time);
+        br_changed(br);
     }
 
     br_state_machines_run(br);
+
+    /* The latest of the BPDUs over the limit gets the first token */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(!prt->limitedBpduSize || !prt->bpduTokens)
+            continue;
+        --(prt->bpduTokens);
+        size = prt->limitedBpduSize;
+        prt->limitedBpduSize = 0;
+        memcpy(&bpdu, &prt->limitedBpdu, size);
+        rx_bpdu(prt, &bpdu, size);
+    }
 }
 
 void MSTP_IN_all_fids_flushed(per_tree_port_t *ptp)
 {
     bridge_t *br = ptp->port->bridge;
-    ptp->fdbFlush = false;
+    /* Not done yet with a flush held back by the flush window */
+    ptp->fdbFlush = ptp->fdbFlushPending;
     if(!br->bridgeEnabled)
         return;
     if(!ptp->calledFromFlushRoutine)
     {
-        TCSM_run(ptp, false /* actual run */);
+        TCSM_run(ptp);
         br_state_machines_run(br);
     }
 }
 
+/* Whether the BPDU last received on the port conveys a message for MSTID */
+static bool msti_msg_conveyed(port_t *prt, __be16 MSTID)
+{
+    msti_configuration_message_t *msti_msg;
+    int i;
+
+    for(i = 0, msti_msg = prt->rcvdBpduData.mstConfiguration;
+        i < prt->rcvdBpduNumOfMstis;
+        ++i, ++msti_msg)
+    {
+        if((msti_msg->mstiRRootID.s.priority & __constant_cpu_to_be16(0x0FFF))
+           == MSTID)
+            return true;
+    }
+    return false;
+}
+
+/* In a stable topology a port keeps receiving the very same BPDU every
+ * Hello Time. Processing it again changes nothing but the timers of the
+ * Port Receive and Port Information state machines, provided that:
+ *  - the BPDU is byte-identical to the last one processed on the port,
+ *    and the bridge configuration hasn't changed since then;
+ *  - it carries no TC, TC Ack or Proposal flags;
+ *  - the Port Information state machines of the conveyed trees have stayed
+ *    in CURRENT since that BPDU was processed, so rcvInfo() would return
+ *    the same result now (or RepeatedDesignatedInfo instead of
+ *    SuperiorDesignatedInfo);
+ *  - the record* procedures yield what is already recorded.
+ * In that case do the remaining actions in place and skip the state
+ * machines run. Return false if the full path must be taken.
+ */
+static bool rx_bpdu_fast_path(port_t *prt, bpdu_t *bpdu, int size)
+{
+    struct
+    {
+        bool agreed, proposing, proposed, mastered;
+    } saved[MAX_IMPLEMENTATION_MSTIS + 1];
+    bridge_t *br = prt->bridge;
+    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
+    per_tree_port_t *ptp;
+    msti_configuration_message_t *msti_msg;
+    bool changed;
+    int i;
+
+    if(!br->engine->rx_fast_path
+       || (prt->rcvdBpduEpoch != br->configEpoch)
+       || (prt->rcvdBpduSize != size)
+       || (bpduTypeTCN == bpdu->bpduType)
+       || (bpdu->flags & ((1 << offsetTc) | (1 << offsetTcAck)
+                          | (1 << offsetProposal)))
+       || (PRSM_RECEIVE != prt->PRSM_state)
+       || !prt->portEnabled || prt->operEdge || prt->BaInconsistent
+       || !((protoRSTP <= bpdu->protocolVersion) ? prt->rcvdRSTP
+                                                 : prt->rcvdSTP)
+      )
+        return false;
+
+    if(protoMSTP == bpdu->protocolVersion)
+    {
+        for(i = 0, msti_msg = bpdu->mstConfiguration;
+            i < prt->rcvdBpduNumOfMstis;
+            ++i, ++msti_msg)
+        {
+            if(msti_msg->flags & ((1 << offsetTc) | (1 << offsetProposal)))
+                return false;
+        }
+    }
+
+    if(0 != memcmp(&prt->rcvdBpduData, bpdu,
+                   (size < sizeof(bpdu_t)) ? size : sizeof(bpdu_t)))
+        return false;
+
+    /* setRcvdMsgs() has left rcvdMstiConfig set exactly for the MSTIs
+     * conveyed in this BPDU.
+     */
+    i = 0;
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        if(((cist == ptp) || ptp->rcvdMstiConfig)
+           && (!ptp->rcvdInfoRepeatable || (PISM_CURRENT != ptp->PISM_state)
+               || (InferiorDesignatedInfo == ptp->rcvdInfo)))
+            return false;
+        /* An MSTI which has not recorded its message (e.g. created since
+         * the BPDU was processed) must get it through setRcvdMsgs().
+         */
+        if((cist != ptp) && !ptp->rcvdMstiConfig && prt->rcvdInternal
+           && msti_msg_conveyed(prt, ptp->MSTID))
+            return false;
+        saved[i].agreed = ptp->agreed;
+        saved[i].proposing = ptp->proposing;
+        saved[i].proposed = ptp->proposed;
+        saved[i].mastered = ptp->mastered;
+        ++i;
+    }
+
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        if((cist != ptp) && !ptp->rcvdMstiConfig)
+            continue;
+        /* PISM_RECEIVE */
+        recordMastered(ptp);
+        switch(ptp->rcvdInfo)
+        {
+            case SuperiorDesignatedInfo:
+            case RepeatedDesignatedInfo:
+                /* PISM_REPEATED_DESIGNATED */
+                recordProposal(ptp);
+                recordAgreement(ptp);
+                break;
+            case InferiorRootAlternateInfo:
+                /* PISM_NOT_DESIGNATED */
+                recordAgreement(ptp);
+                break;
+            default:
+                /* PISM_OTHER */
+                break;
+        }
+    }
+
+    i = 0;
+    changed = false;
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        if((saved[i].agreed != ptp->agreed)
+           || (saved[i].proposing != ptp->proposing)
+           || (saved[i].proposed != ptp->proposed)
+           || (saved[i].mastered != ptp->mastered))
+        {
+            changed = true;
+            ptp->agreed = saved[i].agreed;
+            ptp->proposing = saved[i].proposing;
+            ptp->proposed = saved[i].proposed;
+            ptp->mastered = saved[i].mastered;
+        }
+        ++i;
+    }
+    if(changed)
+        return false;
+
+    /* 13.28 Port Receive state machine, RECEIVE state */
+    assign(prt->edgeDelayWhile, br->Migrate_Time);
+    /* 13.32 Port Information state machine, REPEATED_DESIGNATED state */
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        if(((cist == ptp) || ptp->rcvdMstiConfig)
+           && ((SuperiorDesignatedInfo == ptp->rcvdInfo)
+               || (RepeatedDesignatedInfo == ptp->rcvdInfo)))
+            updtRcvdInfoWhile(ptp);
+    }
+    updtbrAssuRcvdInfoWhile(prt);
+
+    return true;
+}
+
+void MSTP_IN_rx_bpdus_filtered(port_t *prt, unsigned int count)
+{
+    prt->num_rx_bpdu += count;
+    prt->num_rx_bpdu_filtered += count;
+    prt_changed(prt);
+}
+
+static void bpdu_rate_limit_engage(port_t *prt)
+{
+    prt->bpduRateLimitedNow = true;
+    if(prt->bpduRateLimited)
+        return;
+    prt->bpduRateLimited = true;
+    ++(prt->num_bpdu_rate_limit_engaged);
+    INFO_PRTNAME(prt->bridge, prt, "BPDU rate limit engaged (%u per second)",
+                 prt->bpduRateLimit);
+}
+
+void MSTP_IN_rx_bpdus_rate_limited(port_t *prt, unsigned int count)
+{
+    prt->num_rx_bpdu += count;
+    prt->num_rx_bpdu_rate_limited += count;
+    prt_changed(prt);
+    if(count)
+        bpdu_rate_limit_engage(prt);
+}
+
 /* NOTE: bpdu pointer is unaligned, but it works because
  * bpdu_t is packed. Don't try to cast bpdu to non-packed type ;)
  */
 void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
 {
-    int mstis_size;
     bridge_t *br = prt->bridge;
 
     ++(prt->num_rx_bpdu);
+    /* And the other counts below */
+    prt_changed(prt);
 
     if(prt->BpduGuardPort)
     {
@@ -599,6 +1204,34 @@ void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
         return;
     }
 
+    if(prt->bpduRateLimit)
+    {
+        if(!prt->bpduTokens)
+        {
+            ++(prt->num_rx_bpdu_rate_limited);
+            bpdu_rate_limit_engage(prt);
+            if(prt->bpduRateKeepLatest)
+            {
+                if(size > (int)sizeof(bpdu_t))
+                    size = sizeof(bpdu_t);
+                memcpy(&prt->limitedBpdu, bpdu, size);
+                prt->limitedBpduSize = size;
+            }
+            return;
+        }
+        --(prt->bpduTokens);
+        /* A newer BPDU supersedes the kept one */
+        prt->limitedBpduSize = 0;
+    }
+
+    rx_bpdu(prt, bpdu, size);
+}
+
+static void rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    int mstis_size;
+    bridge_t *br = prt->bridge;
+
     if(!br->bridgeEnabled)
     {
         INFO_PRTNAME(br, prt, "Received BPDU while bridge is disabled");
@@ -685,6 +1318,8 @@ bpdu_validation_failed:
             goto bpdu_validation_failed;
     }
 
+    /* The counts, rcvdBpdu and BaInconsistent below */
+    prt_changed(prt);
     if((protoSTP == bpdu->protocolVersion) && (bpduTypeTCN == bpdu->bpduType))
     {
         ++(prt->num_rx_tcn);
@@ -695,6 +1330,12 @@ bpdu_validation_failed:
             ++(prt->num_rx_tcn);
     }
 
+    if(rx_bpdu_fast_path(prt, bpdu, size))
+    {
+        ++(prt->num_rx_bpdu_fast);
+        return;
+    }
+
     assign(prt->rcvdBpduData, *bpdu);
     prt->rcvdBpdu = true;
 
@@ -707,6 +1348,54 @@ bpdu_validation_failed:
     updtbrAssuRcvdInfoWhile(prt);
 
     br_state_machines_run(br);
+
+    prt->rcvdBpduSize = size;
+    prt->rcvdBpduEpoch = br->configEpoch;
+}
+
+void MSTP_IN_set_rx_fast_path(mstp_engine_t *eng, bool enable)
+{
+    eng->rx_fast_path = enable;
+}
+
+/* Configuration transaction: the changes made up to MSTP_IN_end_config()
+ * take effect with a single run of the state machines */
+void MSTP_IN_begin_config(bridge_t *br)
+{
+    ++(br->configDepth);
+}
+
+void MSTP_IN_end_config(bridge_t *br)
+{
+    if(0 == br->configDepth || 0 != --(br->configDepth))
+        return;
+    if(br->configRunPending)
+    {
+        br->configRunPending = false;
+        br_state_machines_run(br);
+    }
+}
+
+/* Resume the state machines of the bridges left unsettled by
+ * br_state_machines_run(), one run budget per bridge in round-robin order.
+ * Return true if some bridges still have work left for the next turn.
+ */
+bool MSTP_IN_run_deferred(mstp_engine_t *eng)
+{
+    LIST_HEAD(turn);
+    bridge_t *br;
+
+    /* Bridges that exhaust their budget again are queued to the tail of
+     * deferred_bridges and will be served on the next turn */
+    list_splice_init(&eng->deferred_bridges, &turn);
+    while(!list_empty(&turn))
+    {
+        br = list_entry(turn.next, bridge_t, deferred_list);
+        list_del_init(&br->deferred_list);
+        br_state_machines_run(br);
+    }
+
+    return !list_empty(&eng->deferred_bridges);
 }
 
 /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
@@ -739,6 +1428,10 @@ void MSTP_IN_get_cist_bridge_status(bridge_t *br, CIST_BridgeStatus *status)
     status->enabled = br->bridgeEnabled;
     assign(status->bridge_hello_time, br->Hello_Time);
     assign(status->Ageing_Time, br->Ageing_Time);
+    assign(status->num_sm_budget_exhausted, br->num_sm_budget_exhausted);
+    assign(status->num_sm_livelock, br->num_sm_livelock);
+    assign(status->fdb_flush_window, br->FdbFlushWindow);
+    status->rapid_ageing = rapid_ageing(br);
 }
 
 /* 12.8.1.2 Read MSTI Bridge Protocol Parameters */
@@ -806,6 +1499,20 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
         }
     }
 
+    /* A held back flush must not wait longer than a port takes to go
+     * from discarding to forwarding */
+    if(cfg->set_fdb_flush_window || cfg->set_bridge_forward_delay)
+    {
+        if((cfg->set_fdb_flush_window ? cfg->fdb_flush_window
+                                      : br->FdbFlushWindow)
+           > new_forward_delay)
+        {
+            ERROR_BRNAME(br, "Bridge FDB Flush Window must be between 0 "
+                "and Bridge Forward Delay (%hhu seconds)", new_forward_delay);
+            r = -1;
+        }
+    }
+
     if(cfg->set_protocol_version)
     {
         switch(cfg->protocol_version)
@@ -873,6 +1580,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
         {
             assign(br->Max_Age, new_max_age);
             assign(br->Forward_Delay, new_forward_delay);
+            br_changed(br);
             changed = changedBridgeTimes = true;
         }
     }
@@ -882,6 +1590,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
       )
     {
         br->ForceProtocolVersion = cfg->protocol_version;
+        br_changed(br);
         changed = init = true;
     }
 
@@ -892,6 +1601,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
             assign(br->Transmit_Hold_Count, cfg->tx_hold_count);
             FOREACH_PORT_IN_BRIDGE(prt, br)
                 assign(prt->txCount, 0u);
+            br_changed(br);
             changed = true;
         }
     }
@@ -901,6 +1611,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
         if(cfg->max_hops != br->MaxHops)
         {
             assign(br->MaxHops, cfg->max_hops);
+            br_changed(br);
             changed = changedBridgeTimes = true;
         }
     }
@@ -912,6 +1623,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
             INFO_BRNAME(br, "bridge hello_time new=%hhu, old=%hhu",
                         cfg->bridge_hello_time, br->Hello_Time);
             assign(br->Hello_Time, cfg->bridge_hello_time);
+            br_changed(br);
             changed = changedBridgeTimes = true;
         }
     }
@@ -923,6 +1635,32 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
             INFO_BRNAME(br, "bridge ageing_time new=%u, old=%u",
                         cfg->bridge_ageing_time, br->Ageing_Time);
             assign(br->Ageing_Time, cfg->bridge_ageing_time);
+            br_changed(br);
+        }
+    }
+
+    if(cfg->set_fdb_flush_window)
+    {
+        if(cfg->fdb_flush_window != br->FdbFlushWindow)
+        {
+            INFO_BRNAME(br, "bridge fdb_flush_window new=%u, old=%u",
+                        cfg->fdb_flush_window, br->FdbFlushWindow);
+            assign(br->FdbFlushWindow, cfg->fdb_flush_window);
+            br_changed(br);
+            /* The windows already open end no later than a new one */
+            FOREACH_TREE_IN_BRIDGE(tree, br)
+                FOREACH_PTP_IN_TREE(ptp, tree)
+                {
+                    if(ptp->fdbFlushHoldWhile <= br->FdbFlushWindow)
+                        continue;
+                    assign(ptp->fdbFlushHoldWhile, br->FdbFlushWindow);
+                    if(ptp->fdbFlushHoldWhile || !ptp->fdbFlushPending)
+                        continue;
+                    ptp->fdbFlushPending = false;
+                    fdb_flush(ptp);
+                    /* The Topology Change state machine waits for it */
+                    changed = true;
+                }
         }
     }
 
@@ -950,12 +1688,15 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
                  *   to the port's Hello_Time.
                  */
                 assign(ptp->portTimes.Hello_Time, br->Hello_Time);
+                ptp_changed(ptp);
             }
         }
+        invalidate_tx_bpdus(br);
     }
 
     if(changed && br->bridgeEnabled)
     {
+        ++(br->configEpoch);
         if(init)
             br_state_machines_begin(br);
         else
@@ -983,6 +1724,7 @@ int MSTP_IN_set_msti_bridge_config(tree_t *tree, __u8 bridge_priority)
     if(GET_PRIORITY_FROM_IDENTIFIER(tree->BridgeIdentifier) == valuePri)
         return 0;
     SET_PRIORITY_IN_IDENTIFIER(valuePri, tree->BridgeIdentifier);
+    tree_changed(tree);
     tree->BridgePriority.RootID = tree->BridgePriority.RRootID =
         tree->BridgePriority.DesignatedBridgeID = tree->BridgeIdentifier;
     /* 12.8.1.4.4 do not require reselect, but I think it is needed,
@@ -1035,6 +1777,7 @@ void MSTP_IN_get_cist_port_status(port_t *prt, CIST_PortStatus *status)
     status->network_port = prt->NetworkPort;
     status->ba_inconsistent = prt->BaInconsistent;
     status->bpdu_filter_port = prt->bpduFilterPort;
+    status->dont_txmt = prt->dontTxmtBpdu;
     status->num_rx_bpdu_filtered = prt->num_rx_bpdu_filtered;
     status->num_rx_bpdu = prt->num_rx_bpdu;
     status->num_rx_tcn = prt->num_rx_tcn;
@@ -1042,6 +1785,17 @@ void MSTP_IN_get_cist_port_status(port_t *prt, CIST_PortStatus *status)
     status->num_tx_tcn = prt->num_tx_tcn;
     status->num_trans_fwd = prt->num_trans_fwd;
     status->num_trans_blk = prt->num_trans_blk;
+    status->num_rx_unknown_msti = prt->num_rx_unknown_msti;
+    status->num_tx_errors = prt->num_tx_errors;
+    status->num_rx_bpdu_fast = prt->num_rx_bpdu_fast;
+    status->bpdu_rate_limit = prt->bpduRateLimit;
+    status->bpdu_rate_keep_latest = prt->bpduRateKeepLatest;
+    status->bpdu_rate_limited = prt->bpduRateLimited;
+    status->num_rx_bpdu_rate_limited = prt->num_rx_bpdu_rate_limited;
+    status->num_bpdu_rate_limit_engaged = prt->num_bpdu_rate_limit_engaged;
+    status->num_rapid_ageing = prt->num_rapid_ageing;
+    status->num_fdb_flush_requests = cist->num_fdb_flush_requests;
+    status->num_fdb_flushes = cist->num_fdb_flushes;
     status->rcvdBpdu = prt->rcvdBpdu;
     status->rcvdRSTP = prt->rcvdRSTP;
     status->rcvdSTP = prt->rcvdSTP;
@@ -1068,6 +1822,74 @@ void MSTP_IN_get_msti_port_status(per_tree_port_t *ptp,
     assign(status->designated_port, ptp->portPriority.DesignatedPortID);
     status->role = ptp->role;
     status->disputed = ptp->disputed;
+    status->num_fdb_flush_requests = ptp->num_fdb_flush_requests;
+    status->num_fdb_flushes = ptp->num_fdb_flushes;
+}
+
+static int cmp_changes(const void *a, const void *b)
+{
+    __u64 ga = ((const mstp_change_t *)a)->generation;
+    __u64 gb = ((const mstp_change_t *)b)->generation;
+
+    return (ga > gb) - (ga < gb);
+}
+
+int MSTP_IN_get_changes(bridge_t *br, __u64 since, int max,
+                        mstp_change_t *changes)
+{
+    mstp_change_t *all;
+    tree_t *tree;
+    port_t *prt;
+    per_tree_port_t *ptp;
+    int num_trees = 0, num_ports = 0, n = 0;
+
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        ++num_trees;
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        ++num_ports;
+    /* The bridge, its trees, its ports and their trees */
+    if(!(all = calloc((1 + num_ports) * num_trees, sizeof(*all))))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return -1;
+    }
+
+#define ADD_CHANGE(_type, _field, _obj)             \
+    if((_obj)->generation > since)                  \
+    {                                               \
+        all[n].generation = (_obj)->generation;     \
+        all[n].type = (_type);                      \
+        all[n++]._field = (_obj);                   \
+    }
+
+    if(br->generation > since)
+    {
+        all[n].generation = br->generation;
+        all[n++].type = MSTP_CHANGE_BRIDGE;
+    }
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        if(tree->MSTID)
+            ADD_CHANGE(MSTP_CHANGE_TREE, tree, tree);
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        ADD_CHANGE(MSTP_CHANGE_PORT, port, prt);
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            if(ptp->MSTID)
+                ADD_CHANGE(MSTP_CHANGE_TREE_PORT, ptp, ptp);
+    }
+#undef ADD_CHANGE
+
+    qsort(all, n, sizeof(*all), cmp_changes);
+    if(n > max)
+        n = max;
+    memcpy(changes, all, n * sizeof(*all));
+    free(all);
+    return n;
+}
+
+void MSTP_IN_port_status_changed(per_tree_port_t *ptp)
+{
+    ptp_changed(ptp);
 }
 
 /* 12.8.2.3 Set CIST port parameters */
@@ -1093,8 +1915,9 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
         }
     }
 
-    /* Secondly, do set */
+    /* Secondly, do set. Every field set shows in the status */
     changed = false;
+    prt_changed(prt);
 
     if(cfg->set_admin_external_port_path_cost)
     {
@@ -1219,12 +2042,47 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
         }
     }
 
+    if(cfg->set_bpdu_rate_limit)
+    {
+        if((prt->bpduRateLimit != cfg->bpdu_rate_limit)
+           || (prt->bpduRateKeepLatest != cfg->bpdu_rate_keep_latest))
+        {
+            prt->bpduRateLimit = cfg->bpdu_rate_limit;
+            prt->bpduRateKeepLatest = cfg->bpdu_rate_keep_latest;
+            prt->bpduTokens = prt->bpduRateLimit;
+            prt->bpduRateLimited = false;
+            prt->bpduRateLimitedNow = false;
+            prt->limitedBpduSize = 0;
+            prt->num_rx_bpdu_rate_limited = 0;
+            INFO_PRTNAME(br, prt, "bpduRateLimit new=%u%s", prt->bpduRateLimit,
+                         prt->bpduRateKeepLatest ? " (keep latest)" : "");
+        }
+    }
+
     if(changed && prt->portEnabled)
+    {
+        ++(prt->bridge->configEpoch);
         br_state_machines_run(prt->bridge);
+    }
 
     return 0;
 }
 
+/* Validation part of MSTP_IN_set_msti_port_config() */
+int MSTP_IN_check_msti_port_config(per_tree_port_t *ptp,
+                                   const MSTI_PortConfig *cfg)
+{
+    port_t *prt = ptp->port;
+
+    if(cfg->set_port_priority && (15 < cfg->port_priority))
+    {
+        ERROR_MSTINAME(prt->bridge, prt, ptp,
+                       "Port Priority must be between 0 and 15");
+        return -1;
+    }
+    return 0;
+}
+
 /* 12.8.2.4 Set MSTI port parameters */
 int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
 {
@@ -1234,18 +2092,16 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
     port_t *prt = ptp->port;
     bridge_t *br = prt->bridge;
 
+    if(MSTP_IN_check_msti_port_config(ptp, cfg))
+        return -1;
+
     if(cfg->set_port_priority)
     {
-        if(15 < cfg->port_priority)
-        {
-            ERROR_MSTINAME(br, prt, ptp,
-                           "Port Priority must be between 0 and 15");
-            return -1;
-        }
         valuePri = cfg->port_priority << 4;
         if(GET_PRIORITY_FROM_IDENTIFIER(ptp->portId) != valuePri)
         {
             SET_PRIORITY_IN_IDENTIFIER(valuePri, ptp->portId);
+            ptp_changed(ptp);
             changed = true;
         }
     }
@@ -1253,6 +2109,7 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
     if(cfg->set_admin_internal_port_path_cost)
     {
         ptp->AdminInternalPortPathCost = cfg->admin_internal_port_path_cost;
+        ptp_changed(ptp);
         new_InternalPathCost = (0 == ptp->AdminInternalPortPathCost) ?
                                  compute_pcost(GET_PORT_SPEED(prt))
                                : ptp->AdminInternalPortPathCost;
@@ -1291,6 +2148,29 @@ int MSTP_IN_port_mcheck(port_t *prt)
     return 0;
 }
 
+/* Add the tree to the list of the trees whose VIDs have changed */
+static void note_changed_tree(__be16 MSTID, int *num_changed,
+                              __u16 *changed_mstids)
+{
+    __u16 mstid = __be16_to_cpu(MSTID);
+    int i;
+
+    for(i = 0; i < *num_changed; ++i)
+        if(changed_mstids[i] == mstid)
+            return;
+    changed_mstids[(*num_changed)++] = mstid;
+}
+
+static bool mstid_exists(bridge_t *br, __be16 MSTID)
+{
+    tree_t *tree;
+
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        if(tree->MSTID == MSTID)
+            return true;
+    return false;
+}
+
 /* 12.10.3.8 Set VID to FID allocation */
 bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
 {
@@ -1445,6 +2325,112 @@ bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids)
     return true;
 }
 
+/* Set the VID-to-FID mappings given as ranges. Only the VIDs whose FID
+ * differs are touched, and the digest is recomputed only if a VID moves to
+ * another tree. The MSTIDs of the trees which got or lost VIDs are returned
+ * in changed_mstids, which must have room for MAX_IMPLEMENTATION_MSTIS + 1.
+ */
+bool MSTP_IN_set_vid2fid_ranges(bridge_t *br, int num_ranges,
+                                MapRange *ranges, int *num_changed,
+                                __u16 *changed_mstids)
+{
+    __be16 prev_MSTID, MSTID;
+    int i, vid;
+
+    *num_changed = 0;
+    for(i = 0; i < num_ranges; ++i)
+    {
+        if((ranges[i].lo < 1) || (ranges[i].lo > ranges[i].hi)
+           || (ranges[i].hi > MAX_VID) || (ranges[i].value > MAX_FID))
+        {
+            ERROR_BRNAME(br, "Error allocating VIDs(%hu-%hu) to FID(%hu)",
+                         ranges[i].lo, ranges[i].hi, ranges[i].value);
+            return false;
+        }
+    }
+
+    for(i = 0; i < num_ranges; ++i)
+    {
+        MSTID = br->fid2mstid[ranges[i].value];
+        for(vid = ranges[i].lo; vid <= ranges[i].hi; ++vid)
+        {
+            if(br->vid2fid[vid] == ranges[i].value)
+                continue;
+            prev_MSTID = br->fid2mstid[br->vid2fid[vid]];
+            br->vid2fid[vid] = ranges[i].value;
+            if(prev_MSTID != MSTID)
+            {
+                note_changed_tree(prev_MSTID, num_changed, changed_mstids);
+                note_changed_tree(MSTID, num_changed, changed_mstids);
+            }
+        }
+    }
+    if(*num_changed)
+    {
+        RecalcConfigDigest(br);
+        br_state_machines_begin(br);
+    }
+
+    return true;
+}
+
+/* Set the FID-to-MSTID mappings given as ranges, see above */
+bool MSTP_IN_set_fid2mstid_ranges(bridge_t *br, int num_ranges,
+                                  MapRange *ranges, int *num_changed,
+                                  __u16 *changed_mstids)
+{
+    __be16 prev_fid2mstid[MAX_FID + 1];
+    bool fid2mstid_changed;
+    int i, fid, vid;
+
+    *num_changed = 0;
+    for(i = 0; i < num_ranges; ++i)
+    {
+        if((ranges[i].lo > ranges[i].hi) || (ranges[i].hi > MAX_FID)
+           || (ranges[i].value > MAX_MSTID)
+           || !mstid_exists(br, __cpu_to_be16(ranges[i].value)))
+        {
+            ERROR_BRNAME(br, "Error allocating FIDs(%hu-%hu) to MSTID(%hu)",
+                         ranges[i].lo, ranges[i].hi, ranges[i].value);
+            return false;
+        }
+    }
+
+    memcpy(prev_fid2mstid, br->fid2mstid, sizeof(prev_fid2mstid));
+    fid2mstid_changed = false;
+    for(i = 0; i < num_ranges; ++i)
+    {
+        for(fid = ranges[i].lo; fid <= ranges[i].hi; ++fid)
+        {
+            if(br->fid2mstid[fid] == __cpu_to_be16(ranges[i].value))
+                continue;
+            br->fid2mstid[fid] = __cpu_to_be16(ranges[i].value);
+            fid2mstid_changed = true;
+        }
+    }
+    /* Only the FIDs in use by some VLAN move VIDs between the trees */
+    if(fid2mstid_changed)
+    {
+        for(vid = 1; vid <= MAX_VID; ++vid)
+        {
+            fid = br->vid2fid[vid];
+            if(prev_fid2mstid[fid] == br->fid2mstid[fid])
+                continue;
+            note_changed_tree(prev_fid2mstid[fid], num_changed,
+                              changed_mstids);
+            note_changed_tree(br->fid2mstid[fid], num_changed,
+                              changed_mstids);
+        }
+    }
+    if(*num_changed)
+    {
+        RecalcConfigDigest(br);
+        br_state_machines_begin(br);
+    }
+
+    return true;
+}
+
 /* 12.12.1.1 Read MSTI List */
 bool MSTP_IN_get_mstilist(bridge_t *br, int *num_mstis, __u16 *mstids)
 {
@@ -1533,6 +2519,13 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
     }
 
     list_add(&new_tree->bridge_list, &tree_after->bridge_list);
+    br_changed(br);
+    /* The BPDUs last received on the ports carry no message for the new
+     * MSTI as far as setRcvdMsgs() knows: don't take them as repeated.
+     */
+    ++(br->configEpoch);
+    /* Every port now has one more MSTI message to send */
+    invalidate_tx_bpdus(br);
     /* There are no FIDs allocated to this MSTID, so VID-to-MSTID mapping
      *  did not change. So, no need in RecalcConfigDigest.
      * Just initialize state machines for this tree.
@@ -1591,6 +2584,9 @@ bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid)
         free(ptp);
     }
     free(tree);
+    br_changed(br);
+    ++(br->configEpoch);
+    invalidate_tx_bpdus(br);
 
     /* There are no FIDs allocated to this MSTID, so VID-to-MSTID mapping
      *  did not change. So, no need in RecalcConfigDigest.
@@ -1639,6 +2635,7 @@ static void set_TopologyChange(tree_t *tree, bool hint_SetToYes, port_t *port)
         strncpy(tree->topology_change_port, tree->last_topology_change_port,
                 IFNAMSIZ);
         strncpy(tree->last_topology_change_port, port->sysdeps.name, IFNAMSIZ);
+        tree_changed(tree);
         return;
     }
 
@@ -1657,6 +2654,7 @@ static void set_TopologyChange(tree_t *tree, bool hint_SetToYes, port_t *port)
             return;
         }
     }
+    tree_changed(tree);
 }
 
 /* Helper functions, compare two priority vectors */
@@ -1763,22 +2761,12 @@ static bool betterorsameInfo(per_tree_port_t *ptp, port_info_origin_t newInfoIs)
 }
 
 /* 13.26.2 clearAllRcvdMsgs */
-static bool clearAllRcvdMsgs(port_t *prt, bool dry_run)
+static void clearAllRcvdMsgs(port_t *prt)
 {
     per_tree_port_t *ptp;
 
-    if(dry_run)
-    {
-        FOREACH_PTP_IN_PORT(ptp, prt)
-            if(ptp->rcvdMsg)
-                return true;
-        return false;
-    }
-
     FOREACH_PTP_IN_PORT(ptp, prt)
         ptp->rcvdMsg = false;
-
-    return false;
 }
 
 /* 13.26.3 clearReselectTree */
@@ -1843,7 +2831,7 @@ static port_info_t rcvInfo(per_tree_port_t *ptp)
 
     if(bpduTypeTCN == b->bpduType)
     {
-        prt->rcvdTcn = true;
+        set_status(prt, prt, rcvdTcn, true);
         FOREACH_PTP_IN_PORT(ptp_1, prt)
             ptp_1->rcvdTc = true;
         return OtherInfo;
@@ -2064,12 +3052,12 @@ static void recordDispute(per_tree_port_t *ptp)
          */
         if(prt->rcvdBpduData.flags & (1 << offsetLearnig))
         {
-            ptp->disputed = true;
+            set_status(ptp, ptp, disputed, true);
             ptp->agreed = false;
             if(!prt->rcvdInternal)
                 list_for_each_entry_continue(ptp, &prt->trees, port_list)
                 {
-                    ptp->disputed = true;
+                    set_status(ptp, ptp, disputed, true);
                     ptp->agreed = false;
                 }
         }
@@ -2078,7 +3066,7 @@ static void recordDispute(per_tree_port_t *ptp)
     /* MSTI */
     if(ptp->rcvdMstiConfig->flags & (1 << offsetLearnig))
     {
-        ptp->disputed = true;
+        set_status(ptp, ptp, disputed, true);
         ptp->agreed = false;
     }
 }
@@ -2103,7 +3091,11 @@ static void recordMastered(per_tree_port_t *ptp)
 /* 13.26.f) recordPriority */
 static void recordPriority(per_tree_port_t *ptp)
 {
-    assign(ptp->portPriority, ptp->msgPriority);
+    if(cmp(ptp->portPriority, !=, ptp->msgPriority))
+    {
+        assign(ptp->portPriority, ptp->msgPriority);
+        ptp_changed(ptp);
+    }
 }
 
 /* 13.26.10 recordProposal */
@@ -2152,9 +3144,27 @@ static void recordTimes(per_tree_port_t *ptp)
     assign(prev_Hello_Time, ptp->portTimes.Hello_Time);
     assign(ptp->portTimes, ptp->msgTimes);
     assign(ptp->portTimes.Hello_Time, prev_Hello_Time);
+    ptp_changed(ptp);
+}
+
+/* Flush now, and open the flush window */
+static void fdb_flush(per_tree_port_t *ptp)
+{
+    assign(ptp->fdbFlushHoldWhile, ptp->port->bridge->FdbFlushWindow);
+    ++(ptp->num_fdb_flushes);
+    ptp_changed(ptp);
+    ptp->calledFromFlushRoutine = true;
+    MSTP_OUT_flush_all_fids(ptp);
+    ptp->calledFromFlushRoutine = false;
 }
 
-/* 13.24.s) + 17.19.7 of 802.1D : fdbFlush */
+/* 13.24.s) + 17.19.7 of 802.1D : fdbFlush
+ * A flush asked for within the flush window is held back until the window
+ * ends, fdbFlush staying TRUE meanwhile: the entries learned before the
+ * request are still removed before the port learns again (13.36).
+ * The Linux bridge has one ageing time, so the rapid ageing of the ports is
+ * merged into one period of the bridge.
+ */
 static void set_fdbFlush(per_tree_port_t *ptp)
 {
     port_t *prt = ptp->port;
@@ -2170,29 +3180,56 @@ static void set_fdbFlush(per_tree_port_t *ptp)
     if(rstpVersion(br))
     {
         ptp->fdbFlush = true;
-        ptp->calledFromFlushRoutine = true;
-        MSTP_OUT_flush_all_fids(ptp);
-        ptp->calledFromFlushRoutine = false;
+        ++(ptp->num_fdb_flush_requests);
+        ptp_changed(ptp);
+        if(ptp->fdbFlushHoldWhile)
+            ptp->fdbFlushPending = true;
+        else
+            fdb_flush(ptp);
     }
     else
     {
         per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
         unsigned int FwdDelay = cist->designatedTimes.Forward_Delay;
         /* Initiate rapid ageing */
-        MSTP_OUT_set_ageing_time(prt, FwdDelay);
-        assign(prt->rapidAgeingWhile, FwdDelay);
+        if(!rapid_ageing(br))
+        {
+            MSTP_OUT_set_ageing_time(prt, FwdDelay);
+            br_changed(br);
+        }
+        if(prt->rapidAgeingWhile < FwdDelay)
+            assign(prt->rapidAgeingWhile, FwdDelay);
+        ++(prt->num_rapid_ageing);
+        prt_changed(prt);
         ptp->fdbFlush = false;
     }
 }
 
+/* Size of the table used by setRcvdMsgs() to index received MSTI
+ * configuration messages by MSTID. Must be a power of 2 and larger than
+ * MAX_STANDARD_MSTIS, so that open addressing always finds a free slot.
+ */
+#define RCVD_MSTI_TABLE_SIZE  (2 * MAX_STANDARD_MSTIS)
+
 /* 13.26.12 setRcvdMsgs */
 static void setRcvdMsgs(port_t *prt)
 {
+    struct
+    {
+        __be16 MSTID; /* 0 == empty slot */
+        bool used;
+        msti_configuration_message_t *msg;
+    } table[RCVD_MSTI_TABLE_SIZE];
     msti_configuration_message_t *msti_msg;
     int i;
+    unsigned int slot, unknown;
     __be16 msg_MSTID;
-    bool found;
-    per_tree_port_t *ptp = GET_CIST_PTP_FROM_PORT(prt);
+    per_tree_port_t *ptp;
+
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        ptp->rcvdInfoRepeatable = true;
+
+    ptp = GET_CIST_PTP_FROM_PORT(prt);
     ptp->rcvdMsg = true;
 
     /* 802.1Q-2005 says:
@@ -2201,41 +3238,84 @@ static void setRcvdMsgs(port_t *prt)
      * No need to do something special here, we already have rcvdBpduData.
      */
 
-    if(prt->rcvdInternal)
+    if(!prt->rcvdInternal)
     {
         list_for_each_entry_continue(ptp, &prt->trees, port_list)
+            ptp->rcvdMstiConfig = NULL;
+        return;
+    }
+
+    /* Index the MSTI messages conveyed in the BPDU by MSTID in one pass,
+     * so that each of our MSTIs below is found without scanning the whole
+     * message list again. If the same MSTID is conveyed twice, the first
+     * message wins.
+     */
+    memset(table, 0, sizeof(table));
+    unknown = 0;
+    for(i = 0, msti_msg = prt->rcvdBpduData.mstConfiguration;
+        i < prt->rcvdBpduNumOfMstis;
+        ++i, ++msti_msg)
+    {
+        msg_MSTID = msti_msg->mstiRRootID.s.priority
+                    & __constant_cpu_to_be16(0x0FFF);
+        if(0 == msg_MSTID)
+        { /* MSTID 0 is the CIST, it can't be conveyed in MSTI message */
+            ++unknown;
+            continue;
+        }
+        slot = __be16_to_cpu(msg_MSTID) & (RCVD_MSTI_TABLE_SIZE - 1);
+        while(table[slot].MSTID && (table[slot].MSTID != msg_MSTID))
+            slot = (slot + 1) & (RCVD_MSTI_TABLE_SIZE - 1);
+        if(!table[slot].MSTID)
         {
-            found = false;
-            /* Find if message for this MSTI is conveyed in the BPDU */
-            for(i = 0, msti_msg = prt->rcvdBpduData.mstConfiguration;
-                i < prt->rcvdBpduNumOfMstis;
-                ++i, ++msti_msg)
-            {
-                msg_MSTID = msti_msg->mstiRRootID.s.priority
-                            & __constant_cpu_to_be16(0x0FFF);
-                if(msg_MSTID == ptp->MSTID)
-                {
-                    found = true;
-                    break;
-                }
-            }
-            if(found)
-            {
-                ptp->rcvdMsg = true;
-                /* 802.1Q-2005 says:
-                 *   "Make available each MSTI message and the common parts of
-                 *    the CIST message priority (the CIST Root Identifier,
-                 *    External Root Path Cost and Regional Root Identifier)
-                 *    to the Port Information state machine for that MSTI"
-                 * We set pointer to the MSTI configuration message for
-                 * fast access, while do not anything special for common
-                 * parts of the message, as the whole message is available
-                 * in rcvdBpduData.
-                 */
-                ptp->rcvdMstiConfig = msti_msg;
-            }
+            table[slot].MSTID = msg_MSTID;
+            table[slot].msg = msti_msg;
+        }
+    }
+
+    list_for_each_entry_continue(ptp, &prt->trees, port_list)
+    {
+        /* Find if message for this MSTI is conveyed in the BPDU */
+        slot = __be16_to_cpu(ptp->MSTID) & (RCVD_MSTI_TABLE_SIZE - 1);
+        while(table[slot].MSTID && (table[slot].MSTID != ptp->MSTID))
+            slot = (slot + 1) & (RCVD_MSTI_TABLE_SIZE - 1);
+        if(table[slot].MSTID)
+        {
+            table[slot].used = true;
+            ptp->rcvdMsg = true;
+            /* 802.1Q-2005 says:
+             *   "Make available each MSTI message and the common parts of
+             *    the CIST message priority (the CIST Root Identifier,
+             *    External Root Path Cost and Regional Root Identifier)
+             *    to the Port Information state machine for that MSTI"
+             * We set pointer to the MSTI configuration message for
+             * fast access, while do not anything special for common
+             * parts of the message, as the whole message is available
+             * in rcvdBpduData.
+             */
+            ptp->rcvdMstiConfig = table[slot].msg;
+        }
+        else
+            ptp->rcvdMstiConfig = NULL;
+    }
+
+    /* Messages for MSTIs which are not configured on this bridge are
+     * silently ignored by the standard. Count them, as within one region
+     * they mean that the MSTI lists of the bridges are out of sync.
+     */
+    for(slot = 0; slot < RCVD_MSTI_TABLE_SIZE; ++slot)
+    {
+        if(table[slot].MSTID && !table[slot].used)
+        {
+            LOG_PRTNAME(prt->bridge, prt,
+                        "received message for unknown MSTI %hu",
+                        __be16_to_cpu(table[slot].MSTID));
+            ++unknown;
         }
     }
+    prt->num_rx_unknown_msti += unknown;
+    if(unknown)
+        prt_changed(prt);
 }
 
 /* 13.26.13 setReRootTree */
@@ -2288,7 +3368,7 @@ static void setTcFlags(per_tree_port_t *ptp)
         prt = ptp->port;
         cistFlags = prt->rcvdBpduData.flags;
         if(cistFlags & (1 << offsetTcAck))
-            prt->rcvdTcAck = true;
+            set_status(prt, prt, rcvdTcAck, true);
         if(cistFlags & (1 << offsetTc))
         {
             ptp->rcvdTc = true;
@@ -2344,36 +3424,43 @@ static void syncMaster(bridge_t *br)
 /* 13.26.19 txConfig */
 static void txConfig(port_t *prt)
 {
-    bpdu_t b;
+    bpdu_t *b = &prt->txBpduData;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
 
     if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
         return;
 
-    b.protocolIdentifier = 0;
-    b.protocolVersion = protoSTP;
-    b.bpduType = bpduTypeConfig;
+    if(!prt->txBpduValid || (bpduTypeConfig != b->bpduType))
+    {
+        b->protocolIdentifier = 0;
+        b->protocolVersion = protoSTP;
+        b->bpduType = bpduTypeConfig;
+        assign(b->cistRootID, cist->designatedPriority.RootID);
+        assign(b->cistExtRootPathCost,
+               cist->designatedPriority.ExtRootPathCost);
+        assign(b->cistRRootID, cist->designatedPriority.DesignatedBridgeID);
+        assign(b->cistPortID, cist->designatedPriority.DesignatedPortID);
+        b->MessageAge[0] = cist->designatedTimes.Message_Age;
+        b->MessageAge[1] = 0;
+        b->MaxAge[0] = cist->designatedTimes.Max_Age;
+        b->MaxAge[1] = 0;
+        b->HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
+        b->HelloTime[1] = 0;
+        b->ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
+        b->ForwardDelay[1] = 0;
+        prt->txBpduSize = CONFIG_BPDU_SIZE;
+        prt->txBpduValid = true;
+    }
+
     /* Standard says "tcWhile ... for the Port". Which one tcWhile?
      * I guess that this means tcWhile for the CIST.
      * But that is only a guess and I could be wrong here ;)
      */
-    b.flags = (0 != cist->tcWhile) ? (1 << offsetTc) : 0;
+    b->flags = (0 != cist->tcWhile) ? (1 << offsetTc) : 0;
     if(prt->tcAck)
-        b.flags |= (1 << offsetTcAck);
-    assign(b.cistRootID, cist->designatedPriority.RootID);
-    assign(b.cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
-    assign(b.cistRRootID, cist->designatedPriority.DesignatedBridgeID);
-    assign(b.cistPortID, cist->designatedPriority.DesignatedPortID);
-    b.MessageAge[0] = cist->designatedTimes.Message_Age;
-    b.MessageAge[1] = 0;
-    b.MaxAge[0] = cist->designatedTimes.Max_Age;
-    b.MaxAge[1] = 0;
-    b.HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
-    b.HelloTime[1] = 0;
-    b.ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
-    b.ForwardDelay[1] = 0;
-
-    MSTP_OUT_tx_bpdu(prt, &b, CONFIG_BPDU_SIZE);
+        b->flags |= (1 << offsetTcAck);
+
+    MSTP_OUT_tx_bpdu(prt, b, prt->txBpduSize);
 }
 
 static inline __u8 message_role_from_port_role(per_tree_port_t *ptp)
@@ -2396,91 +3483,60 @@ static inline __u8 message_role_from_port_role(per_tree_port_t *ptp)
     }
 }
 
-/* 802.1Q-2005: 13.26.20 txMstp
- * 802.1Q-2011: 13.27.27 txRstp
+/* Encode everything but the flags of the RST/MST BPDU into the port's
+ * transmit cache. The flags are filled in by txMstp on every transmit.
  */
-static void txMstp(port_t *prt)
+static void encodeMstp(port_t *prt)
 {
-    bpdu_t b;
+    bpdu_t *b = &prt->txBpduData;
     bridge_t *br = prt->bridge;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
     int msti_msgs_total_size;
     per_tree_port_t *ptp;
     msti_configuration_message_t *msti_msg;
 
-    if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
-        return;
-
-    b.protocolIdentifier = 0;
-    b.bpduType = bpduTypeRST;
-    /* Standard says "{tcWhile, agree, proposing} ... for the Port".
-     * Which one {tcWhile, agree, proposing}?
-     * I guess that this means {tcWhile, agree, proposing} for the CIST.
-     * But that is only a guess and I could be wrong here ;)
-     */
-    b.flags = BPDU_FLAGS_ROLE_SET(message_role_from_port_role(cist));
-    if(0 != cist->tcWhile)
-        b.flags |= (1 << offsetTc);
-    if(cist->proposing)
-        b.flags |= (1 << offsetProposal);
-    if(cist->learning)
-        b.flags |= (1 << offsetLearnig);
-    if(cist->forwarding)
-        b.flags |= (1 << offsetForwarding);
-    if(cist->agree)
-        b.flags |= (1 << offsetAgreement);
-    assign(b.cistRootID, cist->designatedPriority.RootID);
-    assign(b.cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
-    assign(b.cistRRootID, cist->designatedPriority.RRootID);
-    assign(b.cistPortID, cist->designatedPriority.DesignatedPortID);
-    b.MessageAge[0] = cist->designatedTimes.Message_Age;
-    b.MessageAge[1] = 0;
-    b.MaxAge[0] = cist->designatedTimes.Max_Age;
-    b.MaxAge[1] = 0;
-    b.HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
-    b.HelloTime[1] = 0;
-    b.ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
-    b.ForwardDelay[1] = 0;
-
-    b.version1_len = 0;
+    b->protocolIdentifier = 0;
+    b->bpduType = bpduTypeRST;
+    assign(b->cistRootID, cist->designatedPriority.RootID);
+    assign(b->cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
+    assign(b->cistRRootID, cist->designatedPriority.RRootID);
+    assign(b->cistPortID, cist->designatedPriority.DesignatedPortID);
+    b->MessageAge[0] = cist->designatedTimes.Message_Age;
+    b->MessageAge[1] = 0;
+    b->MaxAge[0] = cist->designatedTimes.Max_Age;
+    b->MaxAge[1] = 0;
+    b->HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
+    b->HelloTime[1] = 0;
+    b->ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
+    b->ForwardDelay[1] = 0;
+
+    b->version1_len = 0;
+
+    prt->txBpduValid = true;
 
     if(br->ForceProtocolVersion < protoMSTP)
     {
-        b.protocolVersion = protoRSTP;
-        MSTP_OUT_tx_bpdu(prt, &b, RST_BPDU_SIZE);
+        b->protocolVersion = protoRSTP;
+        prt->txBpduSize = RST_BPDU_SIZE;
         return;
     }
 
-    b.protocolVersion = protoMSTP;
+    b->protocolVersion = protoMSTP;
 
     /* MST specific fields */
-    assign(b.mstConfigurationIdentifier, br->MstConfigId);
-    assign(b.cistIntRootPathCost, cist->designatedPriority.IntRootPathCost);
-    assign(b.cistBridgeID, cist->designatedPriority.DesignatedBridgeID);
-    assign(b.cistRemainingHops, cist->designatedTimes.remainingHops);
+    assign(b->mstConfigurationIdentifier, br->MstConfigId);
+    assign(b->cistIntRootPathCost, cist->designatedPriority.IntRootPathCost);
+    assign(b->cistBridgeID, cist->designatedPriority.DesignatedBridgeID);
+    assign(b->cistRemainingHops, cist->designatedTimes.remainingHops);
 
     msti_msgs_total_size = 0;
     ptp = cist;
-    msti_msg = b.mstConfiguration;
+    msti_msg = b->mstConfiguration;
     /* 13.26.20.f) requires that msti configs should be inserted in
      * MSTID order. This is met by inserting trees in port's list of trees
      * in sorted (by MSTID) order (see MSTP_IN_create_msti) */
     list_for_each_entry_continue(ptp, &prt->trees, port_list)
     {
-        msti_msg->flags =
-            BPDU_FLAGS_ROLE_SET(message_role_from_port_role(ptp));
-        if(0 != ptp->tcWhile)
-            msti_msg->flags |= (1 << offsetTc);
-        if(ptp->proposing)
-            msti_msg->flags |= (1 << offsetProposal);
-        if(ptp->learning)
-            msti_msg->flags |= (1 << offsetLearnig);
-        if(ptp->forwarding)
-            msti_msg->flags |= (1 << offsetForwarding);
-        if(ptp->agree)
-            msti_msg->flags |= (1 << offsetAgreement);
-        if(ptp->master)
-            msti_msg->flags |= (1 << offsetMaster);
         assign(msti_msg->mstiRRootID, ptp->designatedPriority.RRootID);
         assign(msti_msg->mstiIntRootPathCost,
                ptp->designatedPriority.IntRootPathCost);
@@ -2494,10 +3550,72 @@ static void txMstp(port_t *prt)
         ++msti_msg;
     }
 
-    assign(b.version3_len, __cpu_to_be16(MST_BPDU_VER3LEN_WO_MSTI_MSGS
-                                         + msti_msgs_total_size));
-    MSTP_OUT_tx_bpdu(prt, &b, MST_BPDU_SIZE_WO_MSTI_MSGS
-                              + msti_msgs_total_size);
+    assign(b->version3_len, __cpu_to_be16(MST_BPDU_VER3LEN_WO_MSTI_MSGS
+                                          + msti_msgs_total_size));
+    prt->txBpduSize = MST_BPDU_SIZE_WO_MSTI_MSGS + msti_msgs_total_size;
+}
+
+/* 802.1Q-2005: 13.26.20 txMstp
+ * 802.1Q-2011: 13.27.27 txRstp
+ */
+static void txMstp(port_t *prt)
+{
+    bpdu_t *b = &prt->txBpduData;
+    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
+    per_tree_port_t *ptp;
+    msti_configuration_message_t *msti_msg;
+
+    if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
+        return;
+
+    /* Priority vectors and times rarely change between hellos, so the
+     * BPDU is re-encoded only when its cached copy has been invalidated.
+     */
+    if(!prt->txBpduValid || (bpduTypeRST != b->bpduType))
+        encodeMstp(prt);
+
+    /* Standard says "{tcWhile, agree, proposing} ... for the Port".
+     * Which one {tcWhile, agree, proposing}?
+     * I guess that this means {tcWhile, agree, proposing} for the CIST.
+     * But that is only a guess and I could be wrong here ;)
+     */
+    b->flags = BPDU_FLAGS_ROLE_SET(message_role_from_port_role(cist));
+    if(0 != cist->tcWhile)
+        b->flags |= (1 << offsetTc);
+    if(cist->proposing)
+        b->flags |= (1 << offsetProposal);
+    if(cist->learning)
+        b->flags |= (1 << offsetLearnig);
+    if(cist->forwarding)
+        b->flags |= (1 << offsetForwarding);
+    if(cist->agree)
+        b->flags |= (1 << offsetAgreement);
+
+    if(protoMSTP == b->protocolVersion)
+    {
+        ptp = cist;
+        msti_msg = b->mstConfiguration;
+        list_for_each_entry_continue(ptp, &prt->trees, port_list)
+        {
+            msti_msg->flags =
+                BPDU_FLAGS_ROLE_SET(message_role_from_port_role(ptp));
+            if(0 != ptp->tcWhile)
+                msti_msg->flags |= (1 << offsetTc);
+            if(ptp->proposing)
+                msti_msg->flags |= (1 << offsetProposal);
+            if(ptp->learning)
+                msti_msg->flags |= (1 << offsetLearnig);
+            if(ptp->forwarding)
+                msti_msg->flags |= (1 << offsetForwarding);
+            if(ptp->agree)
+                msti_msg->flags |= (1 << offsetAgreement);
+            if(ptp->master)
+                msti_msg->flags |= (1 << offsetMaster);
+            ++msti_msg;
+        }
+    }
+
+    MSTP_OUT_tx_bpdu(prt, b, prt->txBpduSize);
 }
 
 /* 13.26.a) txTcn */
@@ -2520,9 +3638,9 @@ static void txTcn(port_t *prt)
 static void updtBPDUVersion(port_t *prt)
 {
     if(protoRSTP <= prt->rcvdBpduData.protocolVersion)
-        prt->rcvdRSTP = true;
+        set_status(prt, prt, rcvdRSTP, true);
     else
-        prt->rcvdSTP = true;
+        set_status(prt, prt, rcvdSTP, true);
 }
 
 /* 13.26.22 updtRcvdInfoWhile */
@@ -2601,6 +3719,9 @@ static void updtRolesTree(tree_t *tree)
     port_priority_vector_t root_path_priority;
     bridge_identifier_t prevRRootID = tree->rootPriority.RRootID;
     __be32 prevExtRootPathCost = tree->rootPriority.ExtRootPathCost;
+    port_priority_vector_t prevRootPriority = tree->rootPriority;
+    port_identifier_t prevRootPortId = tree->rootPortId;
+    times_t prevRootTimes = tree->rootTimes;
     bool cist = (0 == tree->MSTID);
 
     /* a), b) Select new root priority vector = {rootPriority, rootPortId} */
@@ -2679,6 +3800,10 @@ static void updtRolesTree(tree_t *tree)
     {
         assign(tree->rootTimes, tree->BridgeTimes);
     }
+    if(cmp(tree->rootPriority, !=, prevRootPriority)
+       || cmp(tree->rootPortId, !=, prevRootPortId)
+       || cmp(tree->rootTimes, !=, prevRootTimes))
+        tree_changed(tree);
 
     FOREACH_PTP_IN_TREE(ptp, tree)
     {
@@ -2707,6 +3832,9 @@ static void updtRolesTree(tree_t *tree)
          *    don't have Hello_Time member.
          */
         assign(ptp->designatedTimes.Hello_Time, ptp->portTimes.Hello_Time);
+
+        /* Designated priority and times are what we transmit */
+        prt->txBpduValid = false;
     }
 
     /* syncMaster */
@@ -2878,29 +4006,20 @@ static void PTSM_tick(port_t *prt)
 }
 
 /* 13.28  Port Receive state machine */
-#define PRSM_begin(prt) PRSM_to_DISCARD((prt), false)
-static bool PRSM_to_DISCARD(port_t *prt, bool dry_run)
+#define PRSM_begin(prt) PRSM_to_DISCARD(prt)
+static void PRSM_to_DISCARD(port_t *prt)
 {
-    if(dry_run)
-    {
-        return (prt->PRSM_state != PRSM_DISCARD)
-               || prt->rcvdBpdu || prt->rcvdRSTP || prt->rcvdSTP
-               || (prt->edgeDelayWhile != prt->bridge->Migrate_Time)
-               || clearAllRcvdMsgs(prt, dry_run);
-    }
-
     prt->PRSM_state = PRSM_DISCARD;
 
-    prt->rcvdBpdu = false;
-    prt->rcvdRSTP = false;
-    prt->rcvdSTP = false;
-    clearAllRcvdMsgs(prt, false /* actual run */);
+    set_status(prt, prt, rcvdBpdu, false);
+    set_status(prt, prt, rcvdRSTP, false);
+    set_status(prt, prt, rcvdSTP, false);
+    clearAllRcvdMsgs(prt);
     assign(prt->edgeDelayWhile, prt->bridge->Migrate_Time);
 
     /* No need to run, no one condition will be met
      * if(!begin)
-     *     PRSM_run(prt, false); */
-    return false;
+     *     PRSM_run(prt); */
 }
 
 static void PRSM_to_RECEIVE(port_t *prt)
@@ -2910,15 +4029,15 @@ static void PRSM_to_RECEIVE(port_t *prt)
     updtBPDUVersion(prt);
     prt->rcvdInternal = fromSameRegion(prt);
     setRcvdMsgs(prt);
-    prt->operEdge = false;
-    prt->rcvdBpdu = false;
+    set_status(prt, prt, operEdge, false);
+    set_status(prt, prt, rcvdBpdu, false);
     assign(prt->edgeDelayWhile, prt->bridge->Migrate_Time);
 
     /* No need to run, no one condition will be met
-      PRSM_run(prt, false); */
+      PRSM_run(prt); */
 }
 
-static bool PRSM_run(port_t *prt, bool dry_run)
+static bool PRSM_run(port_t *prt)
 {
     per_tree_port_t *ptp;
     bool rcvdAnyMsg;
@@ -2926,7 +4045,8 @@ static bool PRSM_run(port_t *prt, bool dry_run)
     if((prt->rcvdBpdu || (prt->edgeDelayWhile != prt->bridge->Migrate_Time))
        && !prt->portEnabled)
     {
-        return PRSM_to_DISCARD(prt, dry_run);
+        PRSM_to_DISCARD(prt);
+        return true;
     }
 
     switch(prt->PRSM_state)
@@ -2934,9 +4054,8 @@ static bool PRSM_run(port_t *prt, bool dry_run)
         case PRSM_DISCARD:
             if(prt->rcvdBpdu && prt->portEnabled)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRSM_to_RECEIVE(prt);
+                return true;
             }
             return false;
         case PRSM_RECEIVE:
@@ -2951,9 +4070,8 @@ static bool PRSM_run(port_t *prt, bool dry_run)
             }
             if(prt->rcvdBpdu && prt->portEnabled && !rcvdAnyMsg)
             {
-                if(dry_run) /* at least rcvdBpdu will change */
-                    return true;
                 PRSM_to_RECEIVE(prt);
+                return true;
             }
         default:
             return false;
@@ -2962,7 +4080,7 @@ static bool PRSM_run(port_t *prt, bool dry_run)
 
 /* 13.29  Port Protocol Migration state machine */
 
-static bool PPMSM_run(port_t *prt, bool dry_run);
+static bool PPMSM_run(port_t *prt);
 #define PPMSM_begin(prt) PPMSM_to_CHECKING_RSTP(prt)
 
 static void PPMSM_to_CHECKING_RSTP(port_t *prt/*, bool begin*/)
@@ -2971,35 +4089,35 @@ static void PPMSM_to_CHECKING_RSTP(port_t *prt/*, bool begin*/)
 
     bridge_t *br = prt->bridge;
     prt->mcheck = false;
-    prt->sendRSTP = rstpVersion(br);
+    set_status(prt, prt, sendRSTP, rstpVersion(br));
     assign(prt->mdelayWhile, br->Migrate_Time);
 
     /* No need to run, no one condition will be met
      * if(!begin)
-     *     PPMSM_run(prt, false); */
+     *     PPMSM_run(prt); */
 }
 
 static void PPMSM_to_SELECTING_STP(port_t *prt)
 {
     prt->PPMSM_state = PPMSM_SELECTING_STP;
 
-    prt->sendRSTP = false;
+    set_status(prt, prt, sendRSTP, false);
     assign(prt->mdelayWhile, prt->bridge->Migrate_Time);
 
-    PPMSM_run(prt, false /* actual run */);
+    PPMSM_run(prt);
 }
 
 static void PPMSM_to_SENSING(port_t *prt)
 {
     prt->PPMSM_state = PPMSM_SENSING;
 
-    prt->rcvdRSTP = false;
-    prt->rcvdSTP = false;
+    set_status(prt, prt, rcvdRSTP, false);
+    set_status(prt, prt, rcvdSTP, false);
 
-    PPMSM_run(prt, false /* actual run */);
+    PPMSM_run(prt);
 }
 
-static bool PPMSM_run(port_t *prt, bool dry_run)
+static bool PPMSM_run(port_t *prt)
 {
     bridge_t *br = prt->bridge;
 
@@ -3009,40 +4127,33 @@ static bool PPMSM_run(port_t *prt, bool dry_run)
             if((prt->mdelayWhile != br->Migrate_Time)
                && !prt->portEnabled)
             {
-                if(dry_run) /* at least mdelayWhile will change */
-                    return true;
                 PPMSM_to_CHECKING_RSTP(prt);
-                return false;
+                return true;
             }
             if(0 == prt->mdelayWhile)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PPMSM_to_SENSING(prt);
+                return true;
             }
             return false;
         case PPMSM_SELECTING_STP:
             if(0 == prt->mdelayWhile || !prt->portEnabled || prt->mcheck)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PPMSM_to_SENSING(prt);
+                return true;
             }
             return false;
         case PPMSM_SENSING:
             if(!prt->portEnabled || prt->mcheck
                || (rstpVersion(br) && !prt->sendRSTP && prt->rcvdRSTP))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PPMSM_to_CHECKING_RSTP(prt);
-                return false;
+                return true;
             }
             if(prt->sendRSTP && prt->rcvdSTP)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PPMSM_to_SELECTING_STP(prt);
+                return true;
             }
             return false;
     }
@@ -3055,22 +4166,22 @@ static void BDSM_to_EDGE(port_t *prt/*, bool begin*/)
 {
     prt->BDSM_state = BDSM_EDGE;
 
-    prt->operEdge = true;
+    set_status(prt, prt, operEdge, true);
 
     /* No need to run, no one condition will be met
      * if(!begin)
-     *     BDSM_run(prt, false); */
+     *     BDSM_run(prt); */
 }
 
 static void BDSM_to_NOT_EDGE(port_t *prt/*, bool begin*/)
 {
     prt->BDSM_state = BDSM_NOT_EDGE;
 
-    prt->operEdge = false;
+    set_status(prt, prt, operEdge, false);
 
     /* No need to run, no one condition will be met
      * if(!begin)
-     *     BDSM_run(prt, false); */
+     *     BDSM_run(prt); */
 }
 
 static void BDSM_begin(port_t *prt/*, bool begin*/)
@@ -3081,7 +4192,7 @@ static void BDSM_begin(port_t *prt/*, bool begin*/)
         BDSM_to_NOT_EDGE(prt/*, begin*/);
 }
 
-static bool BDSM_run(port_t *prt, bool dry_run)
+static bool BDSM_run(port_t *prt)
 {
     per_tree_port_t *cist;
 
@@ -3092,9 +4203,8 @@ static bool BDSM_run(port_t *prt, bool dry_run)
                || !prt->operEdge
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 BDSM_to_NOT_EDGE(prt);
+                return true;
             }
             return false;
         case BDSM_NOT_EDGE:
@@ -3110,9 +4220,8 @@ static bool BDSM_run(port_t *prt, bool dry_run)
                    && cist->proposing)
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 BDSM_to_EDGE(prt);
+                return true;
             }
         default:
             return false;
@@ -3121,27 +4230,20 @@ static bool BDSM_run(port_t *prt, bool dry_run)
 
 /* 13.31  Port Transmit state machine */
 
-static bool PTSM_run(port_t *prt, bool dry_run);
-#define PTSM_begin(prt) PTSM_to_TRANSMIT_INIT((prt), true, false)
+static bool PTSM_run(port_t *prt);
+#define PTSM_begin(prt) PTSM_to_TRANSMIT_INIT((prt), true)
 
-static bool PTSM_to_TRANSMIT_INIT(port_t *prt, bool begin, bool dry_run)
+static void PTSM_to_TRANSMIT_INIT(port_t *prt, bool begin)
 {
-    if(dry_run)
-    {
-        return (prt->PTSM_state != PTSM_TRANSMIT_INIT)
-               || (!prt->newInfo) || (!prt->newInfoMsti)
-               || (0 != prt->txCount);
-    }
-
     prt->PTSM_state = PTSM_TRANSMIT_INIT;
 
     prt->newInfo = true;
     prt->newInfoMsti = true;
     assign(prt->txCount, 0u);
+    prt->txBpduValid = false;
 
     if(!begin && prt->portEnabled) /* prevent infinite loop */
-        PTSM_run(prt, false /* actual run */);
-    return false;
+        PTSM_run(prt);
 }
 
 static void PTSM_to_TRANSMIT_CONFIG(port_t *prt)
@@ -3151,9 +4253,9 @@ static void PTSM_to_TRANSMIT_CONFIG(port_t *prt)
     prt->newInfo = false;
     txConfig(prt);
     ++(prt->txCount);
-    prt->tcAck = false;
+    set_status(prt, prt, tcAck, false);
 
-    PTSM_run(prt, false /* actual run */);
+    PTSM_run(prt);
 }
 
 static void PTSM_to_TRANSMIT_TCN(port_t *prt)
@@ -3164,7 +4266,7 @@ static void PTSM_to_TRANSMIT_TCN(port_t *prt)
     txTcn(prt);
     ++(prt->txCount);
 
-    PTSM_run(prt, false /* actual run */);
+    PTSM_run(prt);
 }
 
 static void PTSM_to_TRANSMIT_RSTP(port_t *prt)
@@ -3175,9 +4277,9 @@ static void PTSM_to_TRANSMIT_RSTP(port_t *prt)
     prt->newInfoMsti = false;
     txMstp(prt);
     ++(prt->txCount);
-    prt->tcAck = false;
+    set_status(prt, prt, tcAck, false);
 
-    PTSM_run(prt, false /* actual run */);
+    PTSM_run(prt);
 }
 
 static void PTSM_to_TRANSMIT_PERIODIC(port_t *prt)
@@ -3206,7 +4308,7 @@ static void PTSM_to_TRANSMIT_PERIODIC(port_t *prt)
     prt->newInfoMsti = prt->newInfoMsti
                        || mstiDesignatedOrTCpropagatingRootPort;
 
-    PTSM_run(prt, false /* actual run */);
+    PTSM_run(prt);
 }
 
 static void PTSM_to_IDLE(port_t *prt)
@@ -3216,10 +4318,10 @@ static void PTSM_to_IDLE(port_t *prt)
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
     prt->helloWhen = cist->portTimes.Hello_Time;
 
-    PTSM_run(prt, false /* actual run */);
+    PTSM_run(prt);
 }
 
-static bool PTSM_run(port_t *prt, bool dry_run)
+static bool PTSM_run(port_t *prt)
 {
    /* bool allTransmitReady; */
     per_tree_port_t *ptp;
@@ -3228,7 +4330,11 @@ static bool PTSM_run(port_t *prt, bool dry_run)
 
     if(!prt->portEnabled)
     {
-        return PTSM_to_TRANSMIT_INIT(prt, false, dry_run);
+        if((PTSM_TRANSMIT_INIT == prt->PTSM_state)
+           && prt->newInfo && prt->newInfoMsti && (0 == prt->txCount))
+            return false; /* already there, nothing would change */
+        PTSM_to_TRANSMIT_INIT(prt, false);
+        return true;
     }
 
     switch(prt->PTSM_state)
@@ -3242,10 +4348,8 @@ static bool PTSM_run(port_t *prt, bool dry_run)
         case PTSM_TRANSMIT_RSTP:
            /* return; */
         case PTSM_TRANSMIT_PERIODIC:
-            if(dry_run) /* state change */
-                return true;
             PTSM_to_IDLE(prt); /* UnConditional Transition */
-            return false;
+            return true;
         case PTSM_IDLE:
             /* allTransmitReady = true; */
             ptp = GET_CIST_PTP_FROM_PORT(prt);
@@ -3268,10 +4372,8 @@ static bool PTSM_run(port_t *prt, bool dry_run)
             }
             if(0 == prt->helloWhen)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PTSM_to_TRANSMIT_PERIODIC(prt);
-                return false;
+                return true;
             }
             if(!(prt->txCount < prt->bridge->Transmit_Hold_Count))
                 return false;
@@ -3285,27 +4387,21 @@ static bool PTSM_run(port_t *prt, bool dry_run)
                    || assurancePort(prt)
                   )
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PTSM_to_TRANSMIT_RSTP(prt);
-                    return false;
+                    return true;
                 }
             }
             else
             { /* fallback to STP */
                 if(prt->newInfo && (roleDesignated == cistRole))
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PTSM_to_TRANSMIT_CONFIG(prt);
-                    return false;
+                    return true;
                 }
                 if(prt->newInfo && (roleRoot == cistRole))
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PTSM_to_TRANSMIT_TCN(prt);
-                    return false;
+                    return true;
                 }
             }
             return false;
@@ -3322,7 +4418,7 @@ static bool PTSM_run(port_t *prt, bool dry_run)
 #define PISM_LOG(_fmt, _args...) {}
 #endif /* PISM_ENABLE_LOG */
 
-static bool PISM_run(per_tree_port_t *ptp, bool dry_run);
+static bool PISM_run(per_tree_port_t *ptp);
 #define PISM_begin(ptp) PISM_to_DISABLED((ptp), true)
 
 static void PISM_to_DISABLED(per_tree_port_t *ptp, bool begin)
@@ -3336,12 +4432,13 @@ static void PISM_to_DISABLED(per_tree_port_t *ptp, bool begin)
     ptp->agree = false;
     ptp->agreed = false;
     assign(ptp->rcvdInfoWhile, 0u);
+    ptp->rcvdInfoRepeatable = false;
     ptp->infoIs = ioDisabled;
     ptp->reselect = true;
     ptp->selected = false;
 
     if(!begin)
-        PISM_run(ptp, false /* actual run */);
+        PISM_run(ptp);
 }
 
 static void PISM_to_AGED(per_tree_port_t *ptp)
@@ -3349,11 +4446,12 @@ static void PISM_to_AGED(per_tree_port_t *ptp)
     PISM_LOG("");
     ptp->PISM_state = PISM_AGED;
 
+    ptp->rcvdInfoRepeatable = false;
     ptp->infoIs = ioAged;
     ptp->reselect = true;
     ptp->selected = false;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_UPDATE(per_tree_port_t *ptp)
@@ -3367,7 +4465,9 @@ static void PISM_to_UPDATE(per_tree_port_t *ptp)
     ptp->synced = ptp->synced && ptp->agreed;
     assign(ptp->portPriority, ptp->designatedPriority);
     assign(ptp->portTimes, ptp->designatedTimes);
+    ptp_changed(ptp);
     ptp->updtInfo = false;
+    ptp->rcvdInfoRepeatable = false;
     ptp->infoIs = ioMine;
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
@@ -3376,7 +4476,7 @@ static void PISM_to_UPDATE(per_tree_port_t *ptp)
     else
         prt->newInfoMsti = true;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_SUPERIOR_DESIGNATED(per_tree_port_t *ptp)
@@ -3402,7 +4502,7 @@ static void PISM_to_SUPERIOR_DESIGNATED(per_tree_port_t *ptp)
     ptp->selected = false;
     ptp->rcvdMsg = false;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_REPEATED_DESIGNATED(per_tree_port_t *ptp)
@@ -3419,7 +4519,7 @@ static void PISM_to_REPEATED_DESIGNATED(per_tree_port_t *ptp)
     updtRcvdInfoWhile(ptp);
     ptp->rcvdMsg = false;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_INFERIOR_DESIGNATED(per_tree_port_t *ptp)
@@ -3430,7 +4530,7 @@ static void PISM_to_INFERIOR_DESIGNATED(per_tree_port_t *ptp)
     recordDispute(ptp);
     ptp->rcvdMsg = false;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_NOT_DESIGNATED(per_tree_port_t *ptp)
@@ -3442,7 +4542,7 @@ static void PISM_to_NOT_DESIGNATED(per_tree_port_t *ptp)
     setTcFlags(ptp);
     ptp->rcvdMsg = false;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_OTHER(per_tree_port_t *ptp)
@@ -3452,7 +4552,7 @@ static void PISM_to_OTHER(per_tree_port_t *ptp)
 
     ptp->rcvdMsg = false;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_CURRENT(per_tree_port_t *ptp)
@@ -3460,7 +4560,7 @@ static void PISM_to_CURRENT(per_tree_port_t *ptp)
     PISM_LOG("");
     ptp->PISM_state = PISM_CURRENT;
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
 static void PISM_to_RECEIVE(per_tree_port_t *ptp)
@@ -3471,20 +4571,18 @@ static void PISM_to_RECEIVE(per_tree_port_t *ptp)
     ptp->rcvdInfo = rcvInfo(ptp);
     recordMastered(ptp);
 
-    PISM_run(ptp, false /* actual run */);
+    PISM_run(ptp);
 }
 
-static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
+static bool PISM_run(per_tree_port_t *ptp)
 {
     bool rcvdXstMsg, updtXstInfo;
     port_t *prt = ptp->port;
 
     if((!prt->portEnabled) && (ioDisabled != ptp->infoIs))
     {
-        if(dry_run) /* at least infoIs will change */
-            return true;
         PISM_to_DISABLED(ptp, false);
-        return false;
+        return true;
     }
 
     switch(ptp->PISM_state)
@@ -3492,24 +4590,20 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
         case PISM_DISABLED:
             if(prt->portEnabled)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PISM_to_AGED(ptp);
-                return false;
+                return true;
             }
             if(ptp->rcvdMsg)
             {
-                if(dry_run) /* at least rcvdMsg will change */
-                    return true;
                 PISM_to_DISABLED(ptp, false);
+                return true;
             }
             return false;
         case PISM_AGED:
             if(ptp->selected && ptp->updtInfo)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PISM_to_UPDATE(ptp);
+                return true;
             }
             return false;
         case PISM_UPDATE:
@@ -3523,10 +4617,8 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
         case PISM_NOT_DESIGNATED:
             /* return; */
         case PISM_OTHER:
-            if(dry_run) /* state change */
-                return true;
             PISM_to_CURRENT(ptp);
-            return false;
+            return true;
         case PISM_CURRENT:
             /*
              * Although 802.1Q-2005 does not define rcvdXstMsg and updtXstInfo
@@ -3549,54 +4641,39 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
             }
             if(rcvdXstMsg && !updtXstInfo)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PISM_to_RECEIVE(ptp);
-                return false;
+                return true;
             }
             if((ioReceived == ptp->infoIs) && (0 == ptp->rcvdInfoWhile)
                && !ptp->updtInfo && !rcvdXstMsg)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PISM_to_AGED(ptp);
-                return false;
+                return true;
             }
             if(ptp->selected && ptp->updtInfo)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PISM_to_UPDATE(ptp);
+                return true;
             }
             return false;
         case PISM_RECEIVE:
             switch(ptp->rcvdInfo)
             {
                 case SuperiorDesignatedInfo:
-                    if(dry_run) /* state change */
-                        return true;
                     PISM_to_SUPERIOR_DESIGNATED(ptp);
-                    return false;
+                    return true;
                 case RepeatedDesignatedInfo:
-                    if(dry_run) /* state change */
-                        return true;
                     PISM_to_REPEATED_DESIGNATED(ptp);
-                    return false;
+                    return true;
                 case InferiorDesignatedInfo:
-                    if(dry_run) /* state change */
-                        return true;
                     PISM_to_INFERIOR_DESIGNATED(ptp);
-                    return false;
+                    return true;
                 case InferiorRootAlternateInfo:
-                    if(dry_run) /* state change */
-                        return true;
                     PISM_to_NOT_DESIGNATED(ptp);
-                    return false;
+                    return true;
                 case OtherInfo:
-                    if(dry_run) /* state change */
-                        return true;
                     PISM_to_OTHER(ptp);
-                    return false;
+                    return true;
             }
             return false;
     }
@@ -3606,7 +4683,7 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
 
 /* 13.33  Port Role Selection state machine */
 
-static bool PRSSM_run(tree_t *tree, bool dry_run);
+static bool PRSSM_run(tree_t *tree);
 #define PRSSM_begin(tree) PRSSM_to_INIT_TREE(tree)
 
 static void PRSSM_to_INIT_TREE(tree_t *tree/*, bool begin*/)
@@ -3619,7 +4696,7 @@ static void PRSSM_to_INIT_TREE(tree_t *tree/*, bool begin*/)
      * because transition to this state can be initiated only by BEGIN var.
      * In other words, this function is called via xxx_begin macro only.
      * if(!begin)
-     *     PRSSM_run(prt, false); */
+     *     PRSSM_run(prt); */
 }
 
 static void PRSSM_to_ROLE_SELECTION(tree_t *tree)
@@ -3631,28 +4708,24 @@ static void PRSSM_to_ROLE_SELECTION(tree_t *tree)
     setSelectedTree(tree);
 
     /* No need to run, no one condition will be met
-      PRSSM_run(tree, false); */
+      PRSSM_run(tree); */
 }
 
-static bool PRSSM_run(tree_t *tree, bool dry_run)
+static bool PRSSM_run(tree_t *tree)
 {
     per_tree_port_t *ptp;
 
     switch(tree->PRSSM_state)
     {
         case PRSSM_INIT_TREE:
-            if(dry_run) /* state change */
-                return true;
             PRSSM_to_ROLE_SELECTION(tree);
-            return false;
+            return true;
         case PRSSM_ROLE_SELECTION:
             FOREACH_PTP_IN_TREE(ptp, tree)
                 if(ptp->reselect)
                 {
-                    if(dry_run) /* at least reselect will change */
-                        return true;
                     PRSSM_to_ROLE_SELECTION(tree);
-                    return false;
+                    return true;
                 }
             return false;
     }
@@ -3668,8 +4741,8 @@ static bool PRSSM_run(tree_t *tree, bool dry_run)
 #define PRTSM_LOG(_fmt, _args...) {}
 #endif /* PRTSM_ENABLE_LOG */
 
-static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run);
-#define PRTSM_run(ptp, dry_run) PRTSM_runr((ptp), false, (dry_run))
+static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call);
+#define PRTSM_run(ptp) PRTSM_runr((ptp), false)
 #define PRTSM_begin(ptp) PRTSM_to_INIT_PORT(ptp)
 
  /* Disabled Port role transitions */
@@ -3682,7 +4755,7 @@ static void PRTSM_to_INIT_PORT(per_tree_port_t *ptp/*, bool begin*/)
     unsigned int MaxAge, FwdDelay;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(ptp->port);
 
-    ptp->role = roleDisabled;
+    set_status(ptp, ptp, role, roleDisabled);
     ptp->learn = false;
     ptp->forward = false;
     ptp->synced = false;
@@ -3700,7 +4773,7 @@ static void PRTSM_to_INIT_PORT(per_tree_port_t *ptp/*, bool begin*/)
      * because transition to this state can be initiated only by BEGIN var.
      * In other words, this function is called via xxx_begin macro only.
      * if(!begin)
-     *     PRTSM_runr(ptp, false, false); */
+     *     PRTSM_runr(ptp, false); */
 }
 
 static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
@@ -3727,11 +4800,11 @@ static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
      * Solution: do not follow the standard, and do role = roleDisabled
      *  instead of role = selectedRole.
      */
-    ptp->role = roleDisabled;
+    set_status(ptp, ptp, role, roleDisabled);
     ptp->learn = false;
     ptp->forward = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DISABLED_PORT(per_tree_port_t *ptp, unsigned int MaxAge)
@@ -3745,7 +4818,7 @@ static void PRTSM_to_DISABLED_PORT(per_tree_port_t *ptp, unsigned int MaxAge)
     ptp->sync = false;
     ptp->reRoot = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
  /* MasterPort role transitions */
@@ -3758,7 +4831,7 @@ static void PRTSM_to_MASTER_PROPOSED(per_tree_port_t *ptp)
     setSyncTree(ptp->tree);
     ptp->proposed = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_AGREED(per_tree_port_t *ptp)
@@ -3770,7 +4843,7 @@ static void PRTSM_to_MASTER_AGREED(per_tree_port_t *ptp)
     ptp->sync = false;
     ptp->agree = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_SYNCED(per_tree_port_t *ptp)
@@ -3782,7 +4855,7 @@ static void PRTSM_to_MASTER_SYNCED(per_tree_port_t *ptp)
     ptp->synced = true;
     ptp->sync = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_RETIRED(per_tree_port_t *ptp)
@@ -3792,7 +4865,7 @@ static void PRTSM_to_MASTER_RETIRED(per_tree_port_t *ptp)
 
     ptp->reRoot = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_FORWARD(per_tree_port_t *ptp)
@@ -3804,7 +4877,7 @@ static void PRTSM_to_MASTER_FORWARD(per_tree_port_t *ptp)
     assign(ptp->fdWhile, 0u);
     ptp->agreed = ptp->port->sendRSTP;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -3815,7 +4888,7 @@ static void PRTSM_to_MASTER_LEARN(per_tree_port_t *ptp, unsigned int forwardDela
     ptp->learn = true;
     assign(ptp->fdWhile, forwardDelay);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_DISCARD(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -3825,10 +4898,10 @@ static void PRTSM_to_MASTER_DISCARD(per_tree_port_t *ptp, unsigned int forwardDe
 
     ptp->learn = false;
     ptp->forward = false;
-    ptp->disputed = false;
+    set_status(ptp, ptp, disputed, false);
     assign(ptp->fdWhile, forwardDelay);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_MASTER_PORT(per_tree_port_t *ptp)
@@ -3836,9 +4909,9 @@ static void PRTSM_to_MASTER_PORT(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_PORT;
 
-    ptp->role = roleMaster;
+    set_status(ptp, ptp, role, roleMaster);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
  /* RootPort role transitions */
@@ -3851,7 +4924,7 @@ static void PRTSM_to_ROOT_PROPOSED(per_tree_port_t *ptp)
     setSyncTree(ptp->tree);
     ptp->proposed = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ROOT_AGREED(per_tree_port_t *ptp)
@@ -3869,7 +4942,7 @@ static void PRTSM_to_ROOT_AGREED(per_tree_port_t *ptp)
     else
         prt->newInfoMsti = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ROOT_SYNCED(per_tree_port_t *ptp)
@@ -3880,7 +4953,7 @@ static void PRTSM_to_ROOT_SYNCED(per_tree_port_t *ptp)
     ptp->synced = true;
     ptp->sync = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_REROOT(per_tree_port_t *ptp)
@@ -3890,7 +4963,7 @@ static void PRTSM_to_REROOT(per_tree_port_t *ptp)
 
     setReRootTree(ptp->tree);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ROOT_FORWARD(per_tree_port_t *ptp)
@@ -3901,7 +4974,7 @@ static void PRTSM_to_ROOT_FORWARD(per_tree_port_t *ptp)
     assign(ptp->fdWhile, 0u);
     ptp->forward = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ROOT_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -3912,7 +4985,7 @@ static void PRTSM_to_ROOT_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
     assign(ptp->fdWhile, forwardDelay);
     ptp->learn = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_REROOTED(per_tree_port_t *ptp)
@@ -3922,7 +4995,7 @@ static void PRTSM_to_REROOTED(per_tree_port_t *ptp)
 
     ptp->reRoot = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ROOT_PORT(per_tree_port_t *ptp, unsigned int FwdDelay)
@@ -3930,10 +5003,10 @@ static void PRTSM_to_ROOT_PORT(per_tree_port_t *ptp, unsigned int FwdDelay)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ROOT_PORT;
 
-    ptp->role = roleRoot;
+    set_status(ptp, ptp, role, roleRoot);
     assign(ptp->rrWhile, FwdDelay);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
  /* DesignatedPort role transitions */
@@ -3961,7 +5034,7 @@ static void PRTSM_to_DESIGNATED_PROPOSE(per_tree_port_t *ptp)
     else
         prt->newInfoMsti = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_AGREED(per_tree_port_t *ptp)
@@ -3979,7 +5052,7 @@ static void PRTSM_to_DESIGNATED_AGREED(per_tree_port_t *ptp)
     else
         prt->newInfoMsti = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_SYNCED(per_tree_port_t *ptp)
@@ -3991,7 +5064,7 @@ static void PRTSM_to_DESIGNATED_SYNCED(per_tree_port_t *ptp)
     ptp->synced = true;
     ptp->sync = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_RETIRED(per_tree_port_t *ptp)
@@ -4001,7 +5074,7 @@ static void PRTSM_to_DESIGNATED_RETIRED(per_tree_port_t *ptp)
 
     ptp->reRoot = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_FORWARD(per_tree_port_t *ptp)
@@ -4013,7 +5086,7 @@ static void PRTSM_to_DESIGNATED_FORWARD(per_tree_port_t *ptp)
     assign(ptp->fdWhile, 0u);
     ptp->agreed = ptp->port->sendRSTP;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -4024,7 +5097,7 @@ static void PRTSM_to_DESIGNATED_LEARN(per_tree_port_t *ptp, unsigned int forward
     ptp->learn = true;
     assign(ptp->fdWhile, forwardDelay);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_DISCARD(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -4034,10 +5107,10 @@ static void PRTSM_to_DESIGNATED_DISCARD(per_tree_port_t *ptp, unsigned int forwa
 
     ptp->learn = false;
     ptp->forward = false;
-    ptp->disputed = false;
+    set_status(ptp, ptp, disputed, false);
     assign(ptp->fdWhile, forwardDelay);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_DESIGNATED_PORT(per_tree_port_t *ptp)
@@ -4045,9 +5118,9 @@ static void PRTSM_to_DESIGNATED_PORT(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_PORT;
 
-    ptp->role = roleDesignated;
+    set_status(ptp, ptp, role, roleDesignated);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
  /* AlternatePort and BackupPort role transitions */
@@ -4057,11 +5130,11 @@ static void PRTSM_to_BLOCK_PORT(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_BLOCK_PORT;
 
-    ptp->role = ptp->selectedRole;
+    set_status(ptp, ptp, role, ptp->selectedRole);
     ptp->learn = false;
     ptp->forward = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_BACKUP_PORT(per_tree_port_t *ptp, unsigned int HelloTime)
@@ -4071,7 +5144,7 @@ static void PRTSM_to_BACKUP_PORT(per_tree_port_t *ptp, unsigned int HelloTime)
 
     assign(ptp->rbWhile, 2 * HelloTime);
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ALTERNATE_PROPOSED(per_tree_port_t *ptp)
@@ -4082,7 +5155,7 @@ static void PRTSM_to_ALTERNATE_PROPOSED(per_tree_port_t *ptp)
     setSyncTree(ptp->tree);
     ptp->proposed = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ALTERNATE_AGREED(per_tree_port_t *ptp)
@@ -4099,7 +5172,7 @@ static void PRTSM_to_ALTERNATE_AGREED(per_tree_port_t *ptp)
     else
         prt->newInfoMsti = true;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
 static void PRTSM_to_ALTERNATE_PORT(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -4113,10 +5186,10 @@ static void PRTSM_to_ALTERNATE_PORT(per_tree_port_t *ptp, unsigned int forwardDe
     ptp->sync = false;
     ptp->reRoot = false;
 
-    PRTSM_runr(ptp, true, false /* actual run */);
+    PRTSM_runr(ptp, true);
 }
 
-static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
+static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call)
 {
     /* Following vars do not need recalculating on recursive calls */
     static unsigned int MaxAge, FwdDelay, forwardDelay, HelloTime;
@@ -4156,31 +5229,21 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         switch(ptp->selectedRole)
         {
             case roleDisabled:
-                if(dry_run) /* at least role will change */
-                    return true;
                 PRTSM_to_DISABLE_PORT(ptp);
-                return false;
+                return true;
             case roleMaster:
-                if(dry_run) /* at least role will change */
-                    return true;
                 PRTSM_to_MASTER_PORT(ptp);
-                return false;
+                return true;
             case roleRoot:
-                if(dry_run) /* at least role will change */
-                    return true;
                 PRTSM_to_ROOT_PORT(ptp, FwdDelay);
-                return false;
+                return true;
             case roleDesignated:
-                if(dry_run) /* at least role will change */
-                    return true;
                 PRTSM_to_DESIGNATED_PORT(ptp);
-                return false;
+                return true;
             case roleAlternate:
             case roleBackup:
-                if(dry_run) /* at least role will change */
-                    return true;
                 PRTSM_to_BLOCK_PORT(ptp);
-                return false;
+                return true;
         }
     }
 
@@ -4222,18 +5285,15 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
     {
      /* Disabled Port role transitions */
         case PRTSM_INIT_PORT:
-            if(dry_run) /* state change */
-                return true;
             PRTSM_to_DISABLE_PORT(ptp);
-            return false;
+            return true;
         case PRTSM_DISABLE_PORT:
             if(ptp->selected && !ptp->updtInfo
                && !ptp->learning && !ptp->forwarding
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_DISABLED_PORT(ptp, MaxAge);
+                return true;
             }
             return false;
         case PRTSM_DISABLED_PORT:
@@ -4242,9 +5302,8 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                    || (ptp->fdWhile != MaxAge))
               )
             {
-                if(dry_run) /* one of (sync,reRoot,synced,fdWhile) will change */
-                    return true;
                 PRTSM_to_DISABLED_PORT(ptp, MaxAge);
+                return true;
             }
             return false;
      /* MasterPort role transitions */
@@ -4261,19 +5320,15 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         case PRTSM_MASTER_LEARN:
             /* return; */
         case PRTSM_MASTER_DISCARD:
-            if(dry_run) /* state change */
-                return true;
             PRTSM_to_MASTER_PORT(ptp);
-            return false;
+            return true;
         case PRTSM_MASTER_PORT:
             if(!(ptp->selected && !ptp->updtInfo))
                 return false;
             if(ptp->reRoot && (0 == ptp->rrWhile))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_RETIRED(ptp);
-                return false;
+                return true;
             }
             if((!ptp->learning && !ptp->forwarding && !ptp->synced)
                || (ptp->agreed && !ptp->synced)
@@ -4281,44 +5336,34 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                || (ptp->sync && ptp->synced)
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_SYNCED(ptp);
-                return false;
+                return true;
             }
             if((allSynced && !ptp->agree)
                || (ptp->proposed && ptp->agree)
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_AGREED(ptp);
-                return false;
+                return true;
             }
             if(ptp->proposed && !ptp->agree)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_PROPOSED(ptp);
-                return false;
+                return true;
             }
             if(((0 == ptp->fdWhile) || allSynced)
                && ptp->learn && !ptp->forward
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_FORWARD(ptp);
-                return false;
+                return true;
             }
             if(((0 == ptp->fdWhile) || allSynced)
                && !ptp->learn
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_LEARN(ptp, forwardDelay);
-                return false;
+                return true;
             }
             if(((ptp->sync && !ptp->synced)
                 || (ptp->reRoot && (0 != ptp->rrWhile))
@@ -4327,10 +5372,8 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                && !prt->operEdge && (ptp->learn || ptp->forward)
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_MASTER_DISCARD(ptp, forwardDelay);
-                return false;
+                return true;
             }
             return false;
      /* RootPort role transitions */
@@ -4347,40 +5390,30 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         case PRTSM_ROOT_LEARN:
             /* return; */
         case PRTSM_REROOTED:
-            if(dry_run) /* state change */
-                return true;
             PRTSM_to_ROOT_PORT(ptp, FwdDelay);
-            return false;
+            return true;
         case PRTSM_ROOT_PORT:
             if(!(ptp->selected && !ptp->updtInfo))
                 return false;
             if(!ptp->forward && !ptp->reRoot)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_REROOT(ptp);
-                return false;
+                return true;
             }
             if((ptp->agreed && !ptp->synced) || (ptp->sync && ptp->synced))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ROOT_SYNCED(ptp);
-                return false;
+                return true;
             }
             if((allSynced && !ptp->agree) || (ptp->proposed && ptp->agree))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ROOT_AGREED(ptp);
-                return false;
+                return true;
             }
             if(ptp->proposed && !ptp->agree)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ROOT_PROPOSED(ptp);
-                return false;
+                return true;
             }
             /* 17.20.10 of 802.1D : reRooted */
             reRooted = true;
@@ -4398,32 +5431,24 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             {
                 if(!ptp->learn)
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PRTSM_to_ROOT_LEARN(ptp, forwardDelay);
-                    return false;
+                    return true;
                 }
                 else if(!ptp->forward)
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PRTSM_to_ROOT_FORWARD(ptp);
-                    return false;
+                    return true;
                 }
             }
             if(ptp->reRoot && ptp->forward)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_REROOTED(ptp);
-                return false;
+                return true;
             }
             if(ptp->rrWhile != FwdDelay)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ROOT_PORT(ptp, FwdDelay);
-                return false;
+                return true;
             }
             return false;
      /* DesignatedPort role transitions */
@@ -4440,19 +5465,15 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         case PRTSM_DESIGNATED_LEARN:
             /* return; */
         case PRTSM_DESIGNATED_DISCARD:
-            if(dry_run) /* state change */
-                return true;
             PRTSM_to_DESIGNATED_PORT(ptp);
-            return false;
+            return true;
         case PRTSM_DESIGNATED_PORT:
             if(!(ptp->selected && !ptp->updtInfo))
                 return false;
             if(ptp->reRoot && (0 == ptp->rrWhile))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_DESIGNATED_RETIRED(ptp);
-                return false;
+                return true;
             }
             if((!ptp->learning && !ptp->forwarding && !ptp->synced)
                || (ptp->agreed && !ptp->synced)
@@ -4460,25 +5481,19 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                || (ptp->sync && ptp->synced)
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_DESIGNATED_SYNCED(ptp);
-                return false;
+                return true;
             }
             if(allSynced && (ptp->proposed || !ptp->agree))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_DESIGNATED_AGREED(ptp);
-                return false;
+                return true;
             }
             if(!ptp->forward && !ptp->agreed && !ptp->proposing
                && !prt->operEdge)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_DESIGNATED_PROPOSE(ptp);
-                return false;
+                return true;
             }
             /* Dont transition to learn/forward when BA inconsistent */
             if(((0 == ptp->fdWhile) || ptp->agreed || prt->operEdge)
@@ -4488,17 +5503,13 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             {
                 if(!ptp->learn)
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PRTSM_to_DESIGNATED_LEARN(ptp, forwardDelay);
-                    return false;
+                    return true;
                 }
                 else if(!ptp->forward)
                 {
-                    if(dry_run) /* state change */
-                        return true;
                     PRTSM_to_DESIGNATED_FORWARD(ptp);
-                    return false;
+                    return true;
                 }
             }
             /* Transition to discarding when BA inconsistent */
@@ -4510,10 +5521,8 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                && !prt->operEdge && (ptp->learn || ptp->forward)
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_DESIGNATED_DISCARD(ptp, forwardDelay);
-                return false;
+                return true;
             }
             return false;
      /* AlternatePort and BackupPort role transitions */
@@ -4522,9 +5531,8 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                && !ptp->learning && !ptp->forwarding
               )
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ALTERNATE_PORT(ptp, forwardDelay);
+                return true;
             }
             return false;
         case PRTSM_BACKUP_PORT:
@@ -4532,41 +5540,31 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         case PRTSM_ALTERNATE_PROPOSED:
             /* return; */
         case PRTSM_ALTERNATE_AGREED:
-            if(dry_run) /* state change */
-                return true;
             PRTSM_to_ALTERNATE_PORT(ptp, forwardDelay);
-            return false;
+            return true;
         case PRTSM_ALTERNATE_PORT:
             if(!(ptp->selected && !ptp->updtInfo))
                 return false;
             if((allSynced && !ptp->agree) || (ptp->proposed && ptp->agree))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ALTERNATE_AGREED(ptp);
-                return false;
+                return true;
             }
             if(ptp->proposed && !ptp->agree)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ALTERNATE_PROPOSED(ptp);
-                return false;
+                return true;
             }
             if((ptp->rbWhile != 2 * HelloTime) && (roleBackup == ptp->role))
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_BACKUP_PORT(ptp, HelloTime);
-                return false;
+                return true;
             }
             if((ptp->fdWhile != forwardDelay) || ptp->sync || ptp->reRoot
                || !ptp->synced)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PRTSM_to_ALTERNATE_PORT(ptp, forwardDelay);
-                return false;
+                return true;
             }
             return false;
     }
@@ -4576,7 +5574,7 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
 
 /* 13.35  Port State Transition state machine */
 
-static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run);
+static bool PSTSM_run(per_tree_port_t *ptp);
 #define PSTSM_begin(ptp) PSTSM_to_DISCARDING((ptp), true)
 
 static void PSTSM_to_DISCARDING(per_tree_port_t *ptp, bool begin)
@@ -4596,7 +5594,7 @@ static void PSTSM_to_DISCARDING(per_tree_port_t *ptp, bool begin)
     ptp->forwarding = false;
 
     if(!begin)
-        PSTSM_run(ptp, false /* actual run */);
+        PSTSM_run(ptp);
 }
 
 static void PSTSM_to_LEARNING(per_tree_port_t *ptp)
@@ -4611,7 +5609,7 @@ static void PSTSM_to_LEARNING(per_tree_port_t *ptp)
     }
     ptp->learning = true;
 
-    PSTSM_run(ptp, false /* actual run */);
+    PSTSM_run(ptp);
 }
 
 static void PSTSM_to_FORWARDING(per_tree_port_t *ptp)
@@ -4627,41 +5625,37 @@ static void PSTSM_to_FORWARDING(per_tree_port_t *ptp)
     ptp->forwarding = true;
 
     /* No need to run, no one condition will be met
-      PSTSM_run(ptp, false); */
+      PSTSM_run(ptp); */
 }
 
-static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run)
+static bool PSTSM_run(per_tree_port_t *ptp)
 {
     switch(ptp->PSTSM_state)
     {
         case PSTSM_DISCARDING:
             if(ptp->learn)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PSTSM_to_LEARNING(ptp);
+                return true;
             }
             return false;
         case PSTSM_LEARNING:
             if(!ptp->learn)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PSTSM_to_DISCARDING(ptp, false);
+                return true;
             }
             else if(ptp->forward)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PSTSM_to_FORWARDING(ptp);
+                return true;
             }
             return false;
         case PSTSM_FORWARDING:
             if(!ptp->forward)
             {
-                if(dry_run) /* state change */
-                    return true;
                 PSTSM_to_DISCARDING(ptp, false);
+                return true;
             }
             return false;
     }
@@ -4681,40 +5675,26 @@ static void TCSM_to_INACTIVE(per_tree_port_t *ptp, bool begin)
     assign(ptp->tcWhile, 0u);
     set_TopologyChange(ptp->tree, false, ptp->port);
     if(0 == ptp->MSTID) /* CIST */
-        ptp->port->tcAck = false;
+        set_status(prt, ptp->port, tcAck, false);
 
     if(!begin)
-        TCSM_run(ptp, false /* actual run */);
+        TCSM_run(ptp);
 }
 
-static bool TCSM_to_LEARNING(per_tree_port_t *ptp, bool dry_run)
+static void TCSM_to_LEARNING(per_tree_port_t *ptp)
 {
-    if(dry_run)
-    {
-        if((ptp->TCSM_state != TCSM_LEARNING) || ptp->rcvdTc || ptp->tcProp)
-            return true;
-        if(0 == ptp->MSTID) /* CIST */
-        {
-            port_t *prt = ptp->port;
-            if(prt->rcvdTcn || prt->rcvdTcAck)
-                return true;
-        }
-        return false;
-    }
-
     ptp->TCSM_state = TCSM_LEARNING;
 
     if(0 == ptp->MSTID) /* CIST */
     {
         port_t *prt = ptp->port;
-        prt->rcvdTcn = false;
-        prt->rcvdTcAck = false;
+        set_status(prt, prt, rcvdTcn, false);
+        set_status(prt, prt, rcvdTcAck, false);
     }
     ptp->rcvdTc = false;
     ptp->tcProp = false;
 
-    TCSM_run(ptp, false /* actual run */);
-    return false;
+    TCSM_run(ptp);
 }
 
 static void TCSM_to_DETECTED(per_tree_port_t *ptp)
@@ -4730,7 +5710,7 @@ static void TCSM_to_DETECTED(per_tree_port_t *ptp)
     else
         prt->newInfoMsti = true;
 
-    TCSM_run(ptp, false /* actual run */);
+    TCSM_run(ptp);
 }
 
 static void TCSM_to_NOTIFIED_TCN(per_tree_port_t *ptp)
@@ -4739,7 +5719,7 @@ static void TCSM_to_NOTIFIED_TCN(per_tree_port_t *ptp)
 
     newTcWhile(ptp);
 
-    TCSM_run(ptp, false /* actual run */);
+    TCSM_run(ptp);
 }
 
 static void TCSM_to_NOTIFIED_TC(per_tree_port_t *ptp)
@@ -4750,13 +5730,13 @@ static void TCSM_to_NOTIFIED_TC(per_tree_port_t *ptp)
     if(0 == ptp->MSTID) /* CIST */
     {
         port_t *prt = ptp->port;
-        prt->rcvdTcn = false;
+        set_status(prt, prt, rcvdTcn, false);
         if(roleDesignated == ptp->role)
-            prt->tcAck = true;
+            set_status(prt, prt, tcAck, true);
     }
     setTcPropTree(ptp);
 
-    TCSM_run(ptp, false /* actual run */);
+    TCSM_run(ptp);
 }
 
 static void TCSM_to_PROPAGATING(per_tree_port_t *ptp)
@@ -4767,7 +5747,7 @@ static void TCSM_to_PROPAGATING(per_tree_port_t *ptp)
     set_fdbFlush(ptp);
     ptp->tcProp = false;
 
-    TCSM_run(ptp, false /* actual run */);
+    TCSM_run(ptp);
 }
 
 static void TCSM_to_ACKNOWLEDGED(per_tree_port_t *ptp)
@@ -4776,19 +5756,19 @@ static void TCSM_to_ACKNOWLEDGED(per_tree_port_t *ptp)
 
     assign(ptp->tcWhile, 0u);
     set_TopologyChange(ptp->tree, false, ptp->port);
-    ptp->port->rcvdTcAck = false;
+    set_status(prt, ptp->port, rcvdTcAck, false);
 
-    TCSM_run(ptp, false /* actual run */);
+    TCSM_run(ptp);
 }
 
 static void TCSM_to_ACTIVE(per_tree_port_t *ptp)
 {
     ptp->TCSM_state = TCSM_ACTIVE;
 
-    TCSM_run(ptp, false /* actual run */);
+    TCSM_run(ptp);
 }
 
-static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
+static bool TCSM_run(per_tree_port_t *ptp)
 {
     bool active_port;
     port_t *prt = ptp->port;
@@ -4798,9 +5778,8 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
         case TCSM_INACTIVE:
             if(ptp->learn && !ptp->fdbFlush)
             {
-                if(dry_run) /* state change */
-                    return true;
-                TCSM_to_LEARNING(ptp, false /* actual run */);
+                TCSM_to_LEARNING(ptp);
+                return true;
             }
             return false;
         case TCSM_LEARNING:
@@ -4809,27 +5788,26 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
                           || (roleMaster == ptp->role);
             if(active_port && ptp->forward && !prt->operEdge)
             {
-                if(dry_run) /* state change */
-                    return true;
                 TCSM_to_DETECTED(ptp);
-                return false;
+                return true;
             }
             if(ptp->rcvdTc || prt->rcvdTcn || prt->rcvdTcAck || ptp->tcProp)
             {
-                return TCSM_to_LEARNING(ptp, dry_run);
+                /* rcvdTcn and rcvdTcAck are cleared only by the CIST */
+                if(!ptp->rcvdTc && !ptp->tcProp && (0 != ptp->MSTID))
+                    return false;
+                TCSM_to_LEARNING(ptp);
+                return true;
             }
             else if(!active_port && !(ptp->learn || ptp->learning))
             {
-                if(dry_run) /* state change */
-                    return true;
                 TCSM_to_INACTIVE(ptp, false);
+                return true;
             }
             return false;
         case TCSM_NOTIFIED_TCN:
-            if(dry_run) /* state change */
-                return true;
             TCSM_to_NOTIFIED_TC(ptp);
-            return false;
+            return true;
         case TCSM_DETECTED:
             /* return; */
         case TCSM_NOTIFIED_TC:
@@ -4837,48 +5815,36 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
         case TCSM_PROPAGATING:
             /* return; */
         case TCSM_ACKNOWLEDGED:
-            if(dry_run) /* state change */
-                return true;
             TCSM_to_ACTIVE(ptp);
-            return false;
+            return true;
         case TCSM_ACTIVE:
             active_port = (roleRoot == ptp->role)
                           || (roleDesignated == ptp->role)
                           || (roleMaster == ptp->role);
             if(!active_port || prt->operEdge)
             {
-                if(dry_run) /* state change */
-                    return true;
-                TCSM_to_LEARNING(ptp, false /* actual run */);
-                return false;
+                TCSM_to_LEARNING(ptp);
+                return true;
             }
             if(prt->rcvdTcn)
             {
-                if(dry_run) /* state change */
-                    return true;
                 TCSM_to_NOTIFIED_TCN(ptp);
-                return false;
+                return true;
             }
             if(ptp->rcvdTc)
             {
-                if(dry_run) /* state change */
-                    return true;
                 TCSM_to_NOTIFIED_TC(ptp);
-                return false;
+                return true;
             }
             if(ptp->tcProp/* && !prt->operEdge */)
             {
-                if(dry_run) /* state change */
-                    return true;
                 TCSM_to_PROPAGATING(ptp);
-                return false;
+                return true;
             }
             if(prt->rcvdTcAck)
             {
-                if(dry_run) /* state change */
-                    return true;
                 TCSM_to_ACKNOWLEDGED(ptp);
-                return false;
+                return true;
             }
             return false;
     }
@@ -4949,7 +5915,7 @@ static void prt_state_machines_begin(port_t *prt)
 
     /* 13.33  Port Role Selection state machine */
     FOREACH_TREE_IN_BRIDGE(tree, br)
-        PRSSM_run(tree, false /* actual run */);
+        PRSSM_run(tree);
 
     /* 13.34  Port Role Transitions state machine */
     FOREACH_PTP_IN_PORT(ptp, prt)
@@ -5022,15 +5988,15 @@ static void br_state_machines_begin(bridge_t *br)
     br_state_machines_run(br);
 }
 
-/* Run each state machine.
- * Return false iff all state machines in dry run indicate that
- * state will not be changed. Otherwise return true.
+/* Run each state machine once.
+ * Return true if any of them made a transition.
  */
-static bool __br_state_machines_run(bridge_t *br, bool dry_run)
+static bool __br_state_machines_run(bridge_t *br)
 {
     port_t *prt;
     per_tree_port_t *ptp;
     tree_t *tree;
+    bool progress = false;
 
     /* Check if bridge assurance timer expires */
     FOREACH_PORT_IN_BRIDGE(prt, br)
@@ -5039,9 +6005,8 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
            && (0 == prt->brAssuRcvdInfoWhile) && !prt->BaInconsistent
           )
         {
-            if(dry_run) /* state change */
-                return true;
-            prt->BaInconsistent = true;
+            set_status(prt, prt, BaInconsistent, true);
+            progress = true;
             ERROR_PRTNAME(prt->bridge, prt, "Bridge assurance inconsistent");
         }
     }
@@ -5049,26 +6014,26 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
     /* 13.28  Port Receive state machine */
     FOREACH_PORT_IN_BRIDGE(prt, br)
     {
-        if(PRSM_run(prt, dry_run) && dry_run)
-            return true;
+        if(PRSM_run(prt))
+            progress = true;
     }
     /* 13.29  Port Protocol Migration state machine */
     FOREACH_PORT_IN_BRIDGE(prt, br)
     {
-        if(PPMSM_run(prt, dry_run) && dry_run)
-            return true;
+        if(PPMSM_run(prt))
+            progress = true;
     }
     /* 13.30  Bridge Detection state machine */
     FOREACH_PORT_IN_BRIDGE(prt, br)
     {
-        if(BDSM_run(prt, dry_run) && dry_run)
-            return true;
+        if(BDSM_run(prt))
+            progress = true;
     }
     /* 13.31  Port Transmit state machine */
     FOREACH_PORT_IN_BRIDGE(prt, br)
     {
-        if(PTSM_run(prt, dry_run) && dry_run)
-            return true;
+        if(PTSM_run(prt))
+            progress = true;
     }
 
     /* 13.32  Port Information state machine */
@@ -5076,16 +6041,16 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
     {
         FOREACH_PTP_IN_PORT(ptp, prt)
         {
-            if(PISM_run(ptp, dry_run) && dry_run)
-                return true;
+            if(PISM_run(ptp))
+                progress = true;
         }
     }
 
     /* 13.33  Port Role Selection state machine */
     FOREACH_TREE_IN_BRIDGE(tree, br)
     {
-        if(PRSSM_run(tree, dry_run) && dry_run)
-            return true;
+        if(PRSSM_run(tree))
+            progress = true;
     }
 
     /* 13.34  Port Role Transitions state machine */
@@ -5093,8 +6058,8 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
     {
         FOREACH_PTP_IN_PORT(ptp, prt)
         {
-            if(PRTSM_run(ptp, dry_run) && dry_run)
-                return true;
+            if(PRTSM_run(ptp))
+                progress = true;
         }
     }
     /* 13.35  Port State Transition state machine */
@@ -5102,8 +6067,8 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
     {
         FOREACH_PTP_IN_PORT(ptp, prt)
         {
-            if(PSTSM_run(ptp, dry_run) && dry_run)
-                return true;
+            if(PSTSM_run(ptp))
+                progress = true;
         }
     }
     /* 13.36  Topology Change state machine */
@@ -5111,42 +6076,53 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
     {
         FOREACH_PTP_IN_PORT(ptp, prt)
         {
-            if(TCSM_run(ptp, dry_run) && dry_run)
-                return true;
+            if(TCSM_run(ptp))
+                progress = true;
         }
     }
 
-    return false;
+    return progress;
 }
 
-/* Run state machines until their state stabilizes.
- * Do not consume more than 1 second.
+/* Run state machines until their state stabilizes, but do not do more than
+ * SM_RUN_BUDGET passes at once: a bridge that does not settle (oscillating
+ * topology or livelocked machines) must not monopolize the event loop.
+ * The unfinished work is queued and resumed from MSTP_IN_run_deferred().
  */
 static void br_state_machines_run(bridge_t *br)
 {
-    struct timespec tv, tv_end;
-    signed long delta;
+    int pass;
 
-    if(!br->bridgeEnabled)
+    if(br->configDepth)
+    {
+        br->configRunPending = true;
         return;
+    }
 
-    clock_gettime(CLOCK_MONOTONIC, &tv_end);
-    ++(tv_end.tv_sec);
-
-    do {
-        if(!__br_state_machines_run(br, true /* dry run */))
-            return;
-        __br_state_machines_run(br, false /* actual run */);
+    if(!br->bridgeEnabled)
+        return;
 
-        /* Check for the timeout */
-        clock_gettime(CLOCK_MONOTONIC, &tv);
-        if(0 < (delta = tv.tv_sec - tv_end.tv_sec))
-            return;
-        if(0 == delta)
+    for(pass = 0; pass < SM_RUN_BUDGET; ++pass)
+    {
+        if(!__br_state_machines_run(br))
         {
-            delta = tv.tv_nsec - tv_end.tv_nsec;
-            if(0 < delta)
-                return;
+            list_del_init(&br->deferred_list);
+            br->smExhaustedRuns = 0;
+            MSTP_OUT_state_machines_ran(br);
+            return;
         }
-    } while(true);
+    }
+
+    ++(br->num_sm_budget_exhausted);
+    br_changed(br);
+    if(SM_LIVELOCK_RUNS <= ++(br->smExhaustedRuns))
+    {
+        ++(br->num_sm_livelock);
+        br->smExhaustedRuns = 0;
+        ERROR_BRNAME(br, "State machines did not settle in %u passes, "
+                     "livelock suspected", SM_RUN_BUDGET * SM_LIVELOCK_RUNS);
+    }
+    if(list_empty(&br->deferred_list))
+        list_add_tail(&br->deferred_list, &br->engine->deferred_bridges);
+    MSTP_OUT_state_machines_ran(br);
 }
@@ -14,6 +14,7 @@
 
 #include <sys/types.h>
 #include <stdlib.h>
+#include <stdarg.h>
 
 #include "bridge_ctl.h"
 #include "list.h"
@@ -50,52 +51,6 @@ extern void hmac_md5(unsigned char * text, int text_len, unsigned char * key,
 extern bool MD5TestSuite(void);
 #endif /* HMAC_MDS_TEST_FUNCTIONS */
 
-#define MAX_PORT_NUMBER 4095
-#define MAX_VID         4094
-#define MAX_FID         4095
-#define MAX_MSTID       4094
-
-/* MAX_xxx_MSTIS: CIST not counted */
-#define MAX_STANDARD_MSTIS          64
-#define MAX_IMPLEMENTATION_MSTIS    63
-
-/* 13.37.1 */
-#define MAX_PATH_COST   200000000u
-
-typedef union
-{
-    __u64 u;
-    struct
-    {
-        __be16 priority;
-        __u8 mac_address[ETH_ALEN];
-    } __attribute__((packed)) s;
-} bridge_identifier_t;
-
-typedef __be16 port_identifier_t;
-
-/* These macros work well for both PortID and BridgeID */
-#define GET_PRIORITY_FROM_IDENTIFIER(id)    (((__u8 *)(&(id)))[0] & 0xF0)
-#define SET_PRIORITY_IN_IDENTIFIER(pri, id) do{ \
-    __u8 *first_octet = (__u8 *)(&(id));        \
-    *first_octet &= 0x0F;                       \
-    *first_octet |= (pri) & 0xF0;               \
-    }while(0)
-
-#define CONFIGURATION_NAME_LEN   32
-#define CONFIGURATION_DIGEST_LEN 16
-typedef union
-{
-    __u8 a[1 + CONFIGURATION_NAME_LEN + 2 + CONFIGURATION_DIGEST_LEN];
-    struct
-    {
-        __u8 selector; /* always 0 */
-        __u8 configuration_name[CONFIGURATION_NAME_LEN];
-        __be16 revision_level;
-        __u8 configuration_digest[CONFIGURATION_DIGEST_LEN];
-    } __attribute__((packed)) s;
-} __attribute__((packed)) mst_configuration_identifier_t;
-
 typedef struct
 {
     bridge_identifier_t RRootID;
@@ -187,16 +142,6 @@ typedef enum
     ioReceived
 } port_info_origin_t;
 
-typedef enum
-{
-    roleDisabled,
-    roleRoot,
-    roleDesignated,
-    roleAlternate,
-    roleBackup,
-    roleMaster
-} port_role_t;
-
 typedef enum
 {
     encodedRoleMaster = 0,
@@ -205,13 +150,6 @@ typedef enum
     encodedRoleDesignated = 3
 } port_encoded_role_t;
 
-typedef enum
-{
-    protoSTP = 0,
-    protoRSTP = 2,
-    protoMSTP = 3
-} protocol_version_t;
-
 typedef enum
 {
     bpduTypeConfig = 0,
@@ -236,14 +174,6 @@ typedef enum
 #define BPDU_FLAGS_ROLE_SET(role)   (((role) & 3) << offsetRole)
 #define BPDU_FLAGS_ROLE_GET(flags)  (((flags) >> offsetRole) & 3)
 
-typedef enum
-{
-    p2pAuto,
-    p2pForceTrue,
-    p2pForceFalse
-}
-admin_p2p_t;
-
 /* 13.28  Port Receive state machine */
 typedef enum
 {
@@ -402,6 +332,30 @@ typedef struct
 
     /* not in standard */
     unsigned int uptime;
+    /* Incremented whenever the bridge configuration changes.
+     * Used to validate the rx BPDU fast path.
+     */
+    unsigned int configEpoch;
+    /* Anchor in the list of bridges whose state machines did not settle
+     * within one run budget, see br_state_machines_run() */
+    struct list_head deferred_list;
+    unsigned int smExhaustedRuns; /* consecutive runs out of budget */
+    unsigned int num_sm_budget_exhausted;
+    unsigned int num_sm_livelock;
+    /* After a flush of a port for a tree, the flushes asked for the same
+     * port and tree during the next FdbFlushWindow seconds are done as one
+     * when the window ends. 0 = every flush is done at once. */
+    unsigned int FdbFlushWindow;
+    /* Between MSTP_IN_begin_config() and MSTP_IN_end_config() the runs of
+     * the state machines are postponed, so that a set of configuration
+     * changes is applied with one run. Transactions may nest. */
+    unsigned int configDepth;
+    bool configRunPending;
+    /* Generation of the last change of the status, given where the fields
+     * of the status are written; see MSTP_IN_get_changes() */
+    __u64 generation;
+
+    struct mstp_engine *engine;
 
     sysdep_br_data_t sysdeps;
 } bridge_t;
@@ -438,6 +392,7 @@ typedef struct
     /* State machines */
     PRSSM_states_t PRSSM_state;
 
+    __u64 generation; /* see bridge_t */
 } tree_t;
 
 typedef struct
@@ -478,9 +433,22 @@ typedef struct
     bool BaInconsistent;
     bool dontTxmtBpdu;
     bool bpduFilterPort;
-
+    /* BPDU rate limit: a bucket of bpduRateLimit BPDUs, refilled every
+     * second. The BPDUs in excess are dropped, or the latest of them is
+     * kept for the next second if bpduRateKeepLatest. 0 = no limit. */
+    unsigned int bpduRateLimit;
+    bool bpduRateKeepLatest;
+    unsigned int bpduTokens;
+    bool bpduRateLimited;     /* the limit has engaged */
+    bool bpduRateLimitedNow;  /* BPDUs were limited during this second */
+    bpdu_t limitedBpdu;
+    int limitedBpduSize;      /* 0 = no BPDU kept */
+
+    /* The ageing time is short while any port of the bridge is in rapid
+     * ageing: the periods of the ports make one bridge-wide period */
     unsigned int rapidAgeingWhile;
     unsigned int brAssuRcvdInfoWhile;
+    unsigned int num_rapid_ageing;
 
     /* State machines */
     PRSM_states_t PRSM_state;
@@ -491,6 +459,19 @@ typedef struct
     /* Copy of the received BPDU */
     bpdu_t rcvdBpduData;
     int rcvdBpduNumOfMstis;
+    /* Size of rcvdBpduData and bridge's configEpoch after it was
+     * processed. Used to skip the state machines when an identical BPDU
+     * is received (see rx_bpdu_fast_path).
+     */
+    int rcvdBpduSize;
+    unsigned int rcvdBpduEpoch;
+
+    /* BPDU last encoded for transmission. Everything but the flags is
+     * reused until txBpduValid is cleared (see txConfig and txMstp).
+     */
+    bpdu_t txBpduData;
+    int txBpduSize;
+    bool txBpduValid;
 
     bool deleted;
 
@@ -502,6 +483,13 @@ typedef struct
     unsigned int num_tx_tcn;
     unsigned int num_trans_fwd;
     unsigned int num_trans_blk;
+    unsigned int num_rx_unknown_msti;
+    unsigned int num_tx_errors;
+    unsigned int num_rx_bpdu_fast;
+    unsigned int num_rx_bpdu_rate_limited;
+    unsigned int num_bpdu_rate_limit_engaged;
+
+    __u64 generation; /* see bridge_t */
 } port_t;
 
 typedef struct
@@ -555,14 +543,63 @@ typedef struct
 
     /* Auxiliary flag, helps preventing infinite recursion */
     bool calledFromFlushRoutine;
+    /* Flush scheduler, see bridge_t.FdbFlushWindow */
+    unsigned int fdbFlushHoldWhile;
+    bool fdbFlushPending;
+    unsigned int num_fdb_flush_requests;
+    unsigned int num_fdb_flushes;
 
     /* Pointer to the corresponding MSTI Configuration Message
      * in the port->rcvdBpduData */
     msti_configuration_message_t *rcvdMstiConfig;
+    /* rcvdInfo is still what rcvInfo() would return for the last received
+     * message: portPriority, portTimes and infoIs haven't changed since */
+    bool rcvdInfoRepeatable;
+
+    __u64 generation; /* see bridge_t */
 } per_tree_port_t;
 
+/* External actions (outputs) of an engine. Any of them may be NULL.
+ * The objects are created by the client, which fills in their sysdeps. */
+typedef struct
+{
+    void (*set_state)(per_tree_port_t *ptp, int new_state);
+    /* Flush all entries of the port in all FIDs of the tree, then call
+     * MSTP_IN_all_fids_flushed(ptp); at once when NULL */
+    void (*flush_all_fids)(per_tree_port_t *ptp);
+    void (*set_ageing_time)(port_t *prt, unsigned int ageingTime);
+    void (*tx_bpdu)(port_t *prt, bpdu_t *bpdu, int size);
+    void (*shutdown_port)(port_t *prt);
+    /* Called before a bridge or port is created; false refuses it */
+    bool (*create_bridge)(bridge_t *br, __u8 *macaddr);
+    bool (*create_port)(port_t *prt, __u16 portno);
+    void (*delete_bridge)(bridge_t *br);
+    void (*delete_port)(port_t *prt);
+    /* After a run of the state machines of the bridge, settled or not */
+    void (*state_machines_ran)(bridge_t *br);
+    /* Log a message of function func at LOG_LEVEL_xxx of log.h */
+    void (*log)(struct mstp_engine *eng, int level, const char *func,
+                const char *fmt, va_list ap);
+} mstp_ops_t;
+
+/* An instance of the protocol, serving any number of bridges. Time goes by
+ * only with MSTP_IN_one_second(): the client is the clock of the engine. */
+typedef struct mstp_engine
+{
+    const mstp_ops_t *ops;
+    void *arg;  /* for the client */
+    bool rx_fast_path;
+    /* Last generation given to a change, see MSTP_IN_get_changes() */
+    __u64 generation;
+    /* Bridges whose state machines did not settle within one run budget */
+    struct list_head deferred_bridges;
+} mstp_engine_t;
+
+void MSTP_IN_init_engine(mstp_engine_t *eng, const mstp_ops_t *ops,
+                         void *arg);
+
 /* External events (inputs) */
-bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr);
+bool MSTP_IN_bridge_create(mstp_engine_t *eng, bridge_t *br, __u8 *macaddr);
 bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno);
 void MSTP_IN_delete_port(port_t *prt);
 void MSTP_IN_delete_bridge(bridge_t *br);
@@ -572,97 +609,42 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex);
 void MSTP_IN_one_second(bridge_t *br);
 void MSTP_IN_all_fids_flushed(per_tree_port_t *ptp);
 void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
+/* BPDUs of a BPDU filtered port which were dropped before the engine */
+void MSTP_IN_rx_bpdus_filtered(port_t *prt, unsigned int count);
+/* BPDUs over the rate limit of the port dropped before the engine */
+void MSTP_IN_rx_bpdus_rate_limited(port_t *prt, unsigned int count);
+void MSTP_IN_set_rx_fast_path(mstp_engine_t *eng, bool enable);
+void MSTP_IN_begin_config(bridge_t *br);
+void MSTP_IN_end_config(bridge_t *br);
+bool MSTP_IN_run_deferred(mstp_engine_t *eng);
+void MSTP_IN_restore_bridge(bridge_t *br, const bridge_t *saved,
+                            const tree_t *saved_trees);
+void MSTP_IN_restore_port(port_t *prt, const port_t *saved,
+                          const per_tree_port_t *saved_ptps);
 
 bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid);
 bool MSTP_IN_set_all_vids2fids(bridge_t *br, __u16 *vids2fids);
 bool MSTP_IN_set_fid2mstid(bridge_t *br, __u16 fid, __u16 mstid);
 bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids);
+bool MSTP_IN_set_vid2fid_ranges(bridge_t *br, int num_ranges,
+                                MapRange *ranges, int *num_changed,
+                                __u16 *changed_mstids);
+bool MSTP_IN_set_fid2mstid_ranges(bridge_t *br, int num_ranges,
+                                  MapRange *ranges, int *num_changed,
+                                  __u16 *changed_mstids);
 bool MSTP_IN_get_mstilist(bridge_t *br, int *num_mstis, __u16 *mstids);
 bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid);
 bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid);
 void MSTP_IN_set_mst_config_id(bridge_t *br, __u16 revision, __u8 *name);
 
-/* External actions (outputs) */
-void MSTP_OUT_set_state(per_tree_port_t *ptp, int new_state);
-void MSTP_OUT_flush_all_fids(per_tree_port_t *ptp);
-void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime);
-void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
-void MSTP_OUT_shutdown_port(port_t *prt);
-
-/* Structures for communicating with user */
+/* Communicating with user, the structures are in mstp_types.h */
  /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
-typedef struct
-{
-    bridge_identifier_t bridge_id;
-    unsigned int time_since_topology_change;
-    unsigned int topology_change_count;
-    bool topology_change;
-    char topology_change_port[IFNAMSIZ];
-    char last_topology_change_port[IFNAMSIZ];
-    bridge_identifier_t designated_root;
-    unsigned int root_path_cost;
-    port_identifier_t root_port_id;
-    __u8 root_max_age;
-    __u8 root_forward_delay;
-    __u8 bridge_max_age;
-    __u8 bridge_forward_delay;
-    unsigned int tx_hold_count;
-    protocol_version_t protocol_version;
-    bridge_identifier_t regional_root;
-    unsigned int internal_path_cost;
-    bool enabled; /* not in standard */
-    unsigned int Ageing_Time;
-    __u8 max_hops;
-    __u8 bridge_hello_time;
-} CIST_BridgeStatus;
-
 void MSTP_IN_get_cist_bridge_status(bridge_t *br, CIST_BridgeStatus *status);
 
  /* 12.8.1.2 Read MSTI Bridge Protocol Parameters */
-typedef struct
-{
-    bridge_identifier_t bridge_id;
-    unsigned int time_since_topology_change;
-    unsigned int topology_change_count;
-    bool topology_change;
-    char topology_change_port[IFNAMSIZ];
-    char last_topology_change_port[IFNAMSIZ];
-    bridge_identifier_t regional_root;
-    unsigned int internal_path_cost;
-    port_identifier_t root_port_id;
-} MSTI_BridgeStatus;
-
 void MSTP_IN_get_msti_bridge_status(tree_t *tree, MSTI_BridgeStatus *status);
 
 /* 12.8.1.3 Set CIST Bridge Protocol Parameters */
-typedef struct
-{
-    __u8 bridge_max_age;
-    bool set_bridge_max_age;
-
-    __u8 bridge_forward_delay;
-    bool set_bridge_forward_delay;
-
-    /* Superseded by MSTP_IN_set_msti_bridge_config for the CIST.
-     * __u8 bridge_priority;
-     * bool set_bridge_priority; */
-
-    protocol_version_t protocol_version;
-    bool set_protocol_version;
-
-    unsigned int tx_hold_count;
-    bool set_tx_hold_count;
-
-    __u8 max_hops;
-    bool set_max_hops;
-
-    __u8 bridge_hello_time;
-    bool set_bridge_hello_time;
-
-    unsigned int bridge_ageing_time;
-    bool set_bridge_ageing_time;
-} CIST_BridgeConfig;
-
 int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg);
 
 /* 12.8.1.4 Set MSTI Bridge Protocol Parameters */
@@ -671,131 +653,45 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg);
 int MSTP_IN_set_msti_bridge_config(tree_t *tree, __u8 bridge_priority);
 
 /* 12.8.2.1 Read CIST Port Parameters */
-typedef struct
-{
-    unsigned int uptime;
-    int state; /* BR_STATE_xxx */
-    port_identifier_t port_id;
-    __u32 admin_external_port_path_cost; /* not in standard. 0 = auto */
-    __u32 external_port_path_cost;
-    bridge_identifier_t designated_root; /* from portPriority */
-    __u32 designated_external_cost; /* from portPriority */
-    bridge_identifier_t designated_bridge; /* from portPriority */
-    port_identifier_t designated_port; /* from portPriority */
-    bool tc_ack; /* tcAck */
-    __u8 port_hello_time; /* from portTimes */
-    bool admin_edge_port;
-    bool auto_edge_port; /* not in standard */
-    bool oper_edge_port;
-    /* 802.1Q-2005 wants here MAC_Enabled & MAC_Operational. We don't know
-     * neither of these. Return portEnabled and feel happy. */
-    bool enabled;
-    admin_p2p_t admin_p2p;
-    bool oper_p2p;
-    bool restricted_role;
-    bool restricted_tcn;
-    port_role_t role;
-    bool disputed;
-    bridge_identifier_t designated_regional_root; /* from portPriority */
-    __u32 designated_internal_cost; /* from portPriority */
-    __u32 admin_internal_port_path_cost; /* not in standard. 0 = auto */
-    __u32 internal_port_path_cost; /* not in standard */
-    bool bpdu_guard_port;
-    bool bpdu_guard_error;
-    bool bpdu_filter_port;
-    bool network_port;
-    bool ba_inconsistent;
-    unsigned int num_rx_bpdu_filtered;
-    unsigned int num_rx_bpdu;
-    unsigned int num_rx_tcn;
-    unsigned int num_tx_bpdu;
-    unsigned int num_tx_tcn;
-    unsigned int num_trans_fwd;
-    unsigned int num_trans_blk;
-    bool rcvdBpdu;
-    bool rcvdRSTP;
-    bool rcvdSTP;
-    bool rcvdTcAck;
-    bool rcvdTcn;
-    bool sendRSTP;
-} CIST_PortStatus;
-
 void MSTP_IN_get_cist_port_status(port_t *prt, CIST_PortStatus *status);
 
 /* 12.8.2.2 Read MSTI Port Parameters */
-typedef struct
-{
-    unsigned int uptime;
-    int state; /* BR_STATE_xxx */
-    port_identifier_t port_id;
-    __u32 admin_internal_port_path_cost; /* not in standard. 0 = auto */
-    __u32 internal_port_path_cost;
-    bridge_identifier_t designated_regional_root; /* from portPriority */
-    __u32 designated_internal_cost; /* from portPriority */
-    bridge_identifier_t designated_bridge; /* from portPriority */
-    port_identifier_t designated_port; /* from portPriority */
-    port_role_t role;
-    bool disputed;
-} MSTI_PortStatus;
-
 void MSTP_IN_get_msti_port_status(per_tree_port_t *ptp,
                                   MSTI_PortStatus *status);
 
-/* 12.8.2.3 Set CIST port parameters */
+/* Change feed, of the types in mstp_types.h */
 typedef struct
 {
-    __u32 admin_external_port_path_cost; /* not in standard. 0 = auto */
-    bool set_admin_external_port_path_cost;
-
-    /* Superseded by MSTP_IN_set_msti_port_config for the CIST.
-     * __u32 admin_internal_port_path_cost;
-     * bool set_admin_internal_port_path_cost;
-     *
-     * __u8 port_priority;
-     * bool set_port_priority;
-     */
-
-    bool admin_edge_port;
-    bool set_admin_edge_port;
-
-    bool auto_edge_port; /* not in standard */
-    bool set_auto_edge_port;
-
-    admin_p2p_t admin_p2p;
-    bool set_admin_p2p;
-
-    bool restricted_role;
-    bool set_restricted_role;
-
-    bool restricted_tcn;
-    bool set_restricted_tcn;
-
-    bool bpdu_guard_port;
-    bool set_bpdu_guard_port;
-
-    bool network_port;
-    bool set_network_port;
-
-    bool dont_txmt;
-    bool set_dont_txmt;
-
-    bool bpdu_filter_port;
-    bool set_bpdu_filter_port;
-} CIST_PortConfig;
+    __u64 generation;
+    mstp_change_type_t type;
+    tree_t *tree;          /* MSTP_CHANGE_TREE */
+    port_t *port;          /* MSTP_CHANGE_PORT */
+    per_tree_port_t *ptp;  /* MSTP_CHANGE_TREE_PORT */
+} mstp_change_t;
+
+/* The objects of the bridge which changed after generation since, oldest
+ * change first, at most max of them. The statuses are those returned by
+ * the functions above, except the times (time since topology change,
+ * uptime). An object is stamped when a field of its status is written, so a
+ * status which changed and then changed back since the previous call is
+ * reported too.
+ * Afterwards br->engine->generation is the current generation.
+ * Return the number of changes, or -1.
+ */
+int MSTP_IN_get_changes(bridge_t *br, __u64 since, int max,
+                        mstp_change_t *changes);
+/* For the fields of the status written by the client (the state and the
+ * counts of the port), after writing them */
+void MSTP_IN_port_status_changed(per_tree_port_t *ptp);
 
+/* 12.8.2.3 Set CIST port parameters */
 int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg);
 
 /* 12.8.2.4 Set MSTI port parameters */
-typedef struct
-{
-    __u32 admin_internal_port_path_cost; /* 0 = auto */
-    bool set_admin_internal_port_path_cost;
-
-    __u8 port_priority;
-    bool set_port_priority;
-} MSTI_PortConfig;
-
 int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg);
+/* Return -1 if MSTP_IN_set_msti_port_config() would refuse cfg */
+int MSTP_IN_check_msti_port_config(per_tree_port_t *ptp,
+                                   const MSTI_PortConfig *cfg);
 
 /* 12.8.2.5 Force BPDU Migration Check */
 int MSTP_IN_port_mcheck(port_t *prt);
@@ -0,0 +1,266 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/*
+ * mstp-bench: time MSTP_IN_rx_bpdu() for an MST BPDU carrying the messages of
+ * many MSTIs, with libmstp alone.
+ *
+ * Two bridges with the same MSTIs run in one engine, linked by their ports
+ * until they have converged. Then the hello BPDU of the first one (the root
+ * of every tree) is given over and over to the port of the second one, with
+ * the fast path for repeated BPDUs off so that every BPDU goes through the
+ * state machines (setRcvdMsgs() and the rest), then on.
+ * With -m 63, the most mstpd supports, a message for an unknown MSTI fills the
+ * 64th slot of the BPDU.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+
+#define LINK_QUEUE_LEN  16
+#define SETTLE_SECONDS  60
+
+/* The last BPDU sent by the root bridge */
+static bpdu_t root_bpdu;
+static int root_bpdu_size;
+static port_t *root_port;
+
+/* The BPDUs on their way between the two ports, while they are linked */
+static bool linked;
+static struct
+{
+    port_t *from;
+    bpdu_t bpdu;
+    int size;
+} link_queue[LINK_QUEUE_LEN];
+static int link_queued;
+
+static void bench_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    if(prt == root_port)
+    {
+        memcpy(&root_bpdu, bpdu, size);
+        root_bpdu_size = size;
+    }
+    if(!linked || (LINK_QUEUE_LEN <= link_queued))
+        return;
+    link_queue[link_queued].from = prt;
+    memcpy(&link_queue[link_queued].bpdu, bpdu, size);
+    link_queue[link_queued].size = size;
+    ++link_queued;
+}
+
+/* Received from the queue, as the state machines must not be reentered */
+static void link_deliver(port_t *a, port_t *b)
+{
+    bpdu_t bpdu;
+    port_t *to;
+    int i, n;
+
+    while((n = link_queued))
+    {
+        for(i = 0; i < n; ++i)
+        {
+            to = (link_queue[i].from == a) ? b : a;
+            memcpy(&bpdu, &link_queue[i].bpdu, link_queue[i].size);
+            MSTP_IN_rx_bpdu(to, &bpdu, link_queue[i].size);
+        }
+        /* What was sent meanwhile */
+        memmove(link_queue, link_queue + n,
+                (link_queued - n) * sizeof(link_queue[0]));
+        link_queued -= n;
+    }
+}
+
+static const mstp_ops_t bench_ops =
+{
+    .tx_bpdu = bench_tx_bpdu,
+};
+
+static int num_msti_msgs(void)
+{
+    return (root_bpdu_size - (int)MST_BPDU_SIZE_WO_MSTI_MSGS)
+           / (int)sizeof(msti_configuration_message_t);
+}
+
+static bool bench_bridge(mstp_engine_t *eng, bridge_t *br, port_t *prt,
+                         __u8 mac_last, int num_mstis)
+{
+    __u8 macaddr[ETH_ALEN] = { 0x02, 0, 0, 0, 0, mac_last };
+    __u8 name[CONFIGURATION_NAME_LEN] = "bench";
+    CIST_BridgeConfig cfg;
+    int mstid;
+
+    memset(br, 0, sizeof(*br));
+    memset(prt, 0, sizeof(*prt));
+    if(!MSTP_IN_bridge_create(eng, br, macaddr))
+        return false;
+    MSTP_IN_set_mst_config_id(br, 0, name);
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.protocol_version = protoMSTP;
+    cfg.set_protocol_version = true;
+    if(MSTP_IN_set_cist_bridge_config(br, &cfg))
+        return false;
+    for(mstid = 1; mstid <= num_mstis; ++mstid)
+        if(!MSTP_IN_create_msti(br, mstid))
+            return false;
+    prt->bridge = br;
+    if(!MSTP_IN_port_create_and_add_tail(prt, 1))
+        return false;
+    MSTP_IN_set_bridge_enable(br, true);
+    MSTP_IN_set_port_enable(prt, true, 1000, 1);
+    return true;
+}
+
+static unsigned long long time_diff_ns(const struct timespec *second,
+                                       const struct timespec *first)
+{
+    return (second->tv_sec - first->tv_sec) * 1000000000ULL
+           + second->tv_nsec - first->tv_nsec;
+}
+
+static void bench_rx(mstp_engine_t *eng, port_t *prt, bool fast_path,
+                     unsigned int count, int num_mstis)
+{
+    bpdu_t bpdu;
+    struct timespec start, end;
+    unsigned long long ns;
+    unsigned int i;
+
+    MSTP_IN_set_rx_fast_path(eng, fast_path);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < count; ++i)
+    {
+        memcpy(&bpdu, &root_bpdu, root_bpdu_size);
+        MSTP_IN_rx_bpdu(prt, &bpdu, root_bpdu_size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = time_diff_ns(&end, &start);
+    printf("%-10s %6d %6d %10u %14llu %10llu\n",
+           fast_path ? "fast-path" : "full", num_mstis, num_msti_msgs(),
+           count, ns, ns / count);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mstp-bench [-m <mstis>] [-n <bpdus>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static bridge_t root_br, br;
+    static port_t root_prt, prt;
+    mstp_engine_t eng;
+    msti_configuration_message_t *msg;
+    unsigned int count = 100000;
+    int c, num_mstis = MAX_IMPLEMENTATION_MSTIS, num_msgs;
+
+    while((c = getopt(argc, argv, "m:n:")) != -1)
+    {
+        switch (c)
+        {
+            case 'm':
+                num_mstis = atoi(optarg);
+                if((num_mstis < 1) || (num_mstis > MAX_IMPLEMENTATION_MSTIS))
+                {
+                    fprintf(stderr, "MSTIs must be between 1 and %d\n",
+                            MAX_IMPLEMENTATION_MSTIS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                if(!count)
+                {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind != argc)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    MSTP_IN_init_engine(&eng, &bench_ops, NULL);
+    root_port = &root_prt;
+    if(!bench_bridge(&eng, &root_br, root_port, 1, num_mstis)
+       || !bench_bridge(&eng, &br, &prt, 2, num_mstis))
+    {
+        fprintf(stderr, "Couldn't create the bridges\n");
+        return EXIT_FAILURE;
+    }
+    linked = true;
+    link_deliver(root_port, &prt);
+    for(c = 0; c < SETTLE_SECONDS; ++c)
+    {
+        MSTP_IN_one_second(&root_br);
+        MSTP_IN_one_second(&br);
+        link_deliver(root_port, &prt);
+    }
+    linked = false;
+    if((MST_BPDU_SIZE_WO_MSTI_MSGS > root_bpdu_size)
+       || (root_bpdu.flags & ((1 << offsetTc) | (1 << offsetProposal))))
+    {
+        fprintf(stderr, "The bridges didn't converge\n");
+        return EXIT_FAILURE;
+    }
+
+    num_msgs = num_msti_msgs();
+    if((MAX_STANDARD_MSTIS > num_msgs) && (0 < num_msgs)
+       && (MAX_IMPLEMENTATION_MSTIS == num_mstis))
+    {
+        /* The MSTID is in the low bits of the regional root priority */
+        msg = &root_bpdu.mstConfiguration[num_msgs];
+        *msg = root_bpdu.mstConfiguration[num_msgs - 1];
+        msg->mstiRRootID.s.priority =
+            __cpu_to_be16((__be16_to_cpu(msg->mstiRRootID.s.priority)
+                           & 0xF000) | MAX_MSTID);
+        root_bpdu_size += sizeof(*msg);
+        root_bpdu.version3_len =
+            __cpu_to_be16(__be16_to_cpu(root_bpdu.version3_len)
+                          + sizeof(*msg));
+    }
+
+    printf("%-10s %6s %6s %10s %14s %10s\n",
+           "run", "mstis", "msgs", "bpdus", "total-ns", "avg-ns");
+    bench_rx(&eng, &prt, false, count, num_mstis);
+    bench_rx(&eng, &prt, true, count, num_mstis);
+
+    if(prt.num_rx_bpdu_fast + 1 < count)
+    {
+        fprintf(stderr, "The BPDUs were not taken as repeated ones\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,399 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/*
+ * mstp-check: print the transitions of the Port Information, Port Role
+ * Transitions and Port State Transitions state machines of every (bridge,
+ * port, tree) over a fixed scenario, with libmstp alone. make check
+ * compares them with mstp_check.expected.
+ *
+ * mstp.c is built in with PISM_ENABLE_LOG and PRTSM_ENABLE_LOG, so that
+ * these transitions are logged; those of the Port State Transitions state
+ * machine are the states given to set_state. The fast path for repeated
+ * BPDUs is off: every BPDU goes through the state machines.
+ *
+ * Five bridges in one engine: b1 to b4 in a ring with a diagonal b1-b3, in
+ * the same region with MSTIs 1 and 2; b5 in another region, linked to b2
+ * and b4, and running RSTP. The links deliver the BPDUs in the order they
+ * were sent. The transitions of each (bridge, port, tree) are printed
+ * together, in the order they happened: the interleaving between them is
+ * not part of the check.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <asm/byteorder.h>
+#include <linux/if_bridge.h>
+
+#include "mstp.h"
+#include "log.h"
+
+#define NUM_BRIDGES     5
+#define MAX_PORTS       3
+#define NUM_LINKS       7
+#define QUEUE_LEN       256
+#define MAX_EVENTS      (1 << 17)
+#define KEY_LEN         (2 * IFNAMSIZ + 8)
+#define STATE_LEN       32
+/* The longest sequence of states folded when repeated */
+#define MAX_PERIOD      4
+
+static bridge_t bridges[NUM_BRIDGES];
+static port_t ports[NUM_BRIDGES][MAX_PORTS];
+static int num_ports[NUM_BRIDGES];
+
+static struct
+{
+    int br1, br2;
+    port_t *a, *b;
+    bool up;
+} links[NUM_LINKS] =
+{
+    { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 }, { 0, 2 }, /* the region */
+    { 4, 1 }, { 4, 3 },                              /* b5 */
+};
+
+/* The BPDUs on their way, oldest first */
+static struct
+{
+    port_t *to;
+    bpdu_t bpdu;
+    int size;
+} queue[QUEUE_LEN];
+static int queue_head, queue_count;
+
+/* The transitions, in the order they happened */
+typedef struct
+{
+    char key[KEY_LEN]; /* <bridge>:<port>:<mstid> */
+    char machine[8];
+    char state[STATE_LEN];
+    int seq;
+} event_t;
+static event_t *events;
+static int num_events;
+static bool events_overflow;
+
+static void add_event(const char *key, const char *machine,
+                      const char *state)
+{
+    event_t *ev;
+
+    if(MAX_EVENTS <= num_events)
+    {
+        events_overflow = true;
+        return;
+    }
+    ev = &events[num_events];
+    snprintf(ev->key, KEY_LEN, "%s", key);
+    snprintf(ev->machine, sizeof(ev->machine), "%s", machine);
+    snprintf(ev->state, STATE_LEN, "%s", state);
+    ev->seq = num_events++;
+}
+
+static void check_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
+{
+    int i, slot;
+
+    for(i = 0; i < NUM_LINKS; ++i)
+    {
+        if(!links[i].up || ((links[i].a != prt) && (links[i].b != prt)))
+            continue;
+        if(QUEUE_LEN <= queue_count)
+        {
+            fprintf(stderr, "BPDU queue overflow\n");
+            exit(EXIT_FAILURE);
+        }
+        slot = (queue_head + queue_count++) % QUEUE_LEN;
+        queue[slot].to = (links[i].a == prt) ? links[i].b : links[i].a;
+        memcpy(&queue[slot].bpdu, bpdu, size);
+        queue[slot].size = size;
+    }
+}
+
+static void check_set_state(per_tree_port_t *ptp, int new_state)
+{
+    static const char *names[] =
+    {
+        [BR_STATE_DISABLED] = "DISABLED",
+        [BR_STATE_LISTENING] = "LISTENING",
+        [BR_STATE_LEARNING] = "LEARNING",
+        [BR_STATE_FORWARDING] = "FORWARDING",
+        [BR_STATE_BLOCKING] = "BLOCKING",
+    };
+    char key[KEY_LEN];
+
+    /* As mstpd does, only the changes */
+    if(ptp->state == new_state)
+        return;
+    snprintf(key, KEY_LEN, "%s:%s:%hu", ptp->port->bridge->sysdeps.name,
+             ptp->port->sysdeps.name, __be16_to_cpu(ptp->MSTID));
+    add_event(key, "PSTSM", names[new_state]);
+    ptp->state = new_state;
+}
+
+/* SMLOG_MSTINAME gives "<bridge>:<port>:<mstid> ..." in the function
+ * entering the state, e.g. PISM_to_CURRENT */
+static void check_log(mstp_engine_t *eng, int level, const char *func,
+                      const char *fmt, va_list ap)
+{
+    char key[KEY_LEN], machine[8], *end;
+    const char *state;
+
+    if((LOG_LEVEL_STATE_MACHINE_TRANSITION != level)
+       || !(state = strstr(func, "_to_"))
+       || (sizeof(machine) <= state - func))
+        return;
+    memcpy(machine, func, state - func);
+    machine[state - func] = '\0';
+    vsnprintf(key, KEY_LEN, fmt, ap);
+    if((end = strchr(key, ' ')))
+        *end = '\0';
+    add_event(key, machine, state + strlen("_to_"));
+}
+
+static const mstp_ops_t check_ops =
+{
+    .set_state = check_set_state,
+    .tx_bpdu = check_tx_bpdu,
+    .log = check_log,
+};
+
+/* Received from the queue, as the state machines must not be reentered */
+static void deliver(mstp_engine_t *eng)
+{
+    bpdu_t bpdu;
+    port_t *to;
+    int size;
+
+    do {
+        while(queue_count)
+        {
+            to = queue[queue_head].to;
+            size = queue[queue_head].size;
+            memcpy(&bpdu, &queue[queue_head].bpdu, size);
+            queue_head = (queue_head + 1) % QUEUE_LEN;
+            --queue_count;
+            MSTP_IN_rx_bpdu(to, &bpdu, size);
+        }
+    } while(MSTP_IN_run_deferred(eng) || queue_count);
+}
+
+static port_t *add_port(mstp_engine_t *eng, int b)
+{
+    bridge_t *br = &bridges[b];
+    port_t *prt = &ports[b][num_ports[b]++];
+
+    snprintf(prt->sysdeps.name, IFNAMSIZ, "p%d", num_ports[b]);
+    prt->bridge = br;
+    if(!MSTP_IN_port_create_and_add_tail(prt, num_ports[b]))
+    {
+        fprintf(stderr, "Couldn't create port %d of b%d\n", num_ports[b],
+                b + 1);
+        exit(EXIT_FAILURE);
+    }
+    return prt;
+}
+
+static tree_t *find_tree(bridge_t *br, __u16 mstid)
+{
+    tree_t *tree;
+
+    list_for_each_entry(tree, &br->trees, bridge_list)
+        if(__be16_to_cpu(tree->MSTID) == mstid)
+            return tree;
+    return NULL;
+}
+
+static void create_bridge(mstp_engine_t *eng, int b)
+{
+    __u8 macaddr[ETH_ALEN] = { 0x02, 0, 0, 0, 0, b + 1 };
+    __u8 region[CONFIGURATION_NAME_LEN] = "check";
+    __u8 other[CONFIGURATION_NAME_LEN] = "other";
+    bridge_t *br = &bridges[b];
+    CIST_BridgeConfig cfg;
+
+    snprintf(br->sysdeps.name, IFNAMSIZ, "b%d", b + 1);
+    if(!MSTP_IN_bridge_create(eng, br, macaddr))
+    {
+        fprintf(stderr, "Couldn't create b%d\n", b + 1);
+        exit(EXIT_FAILURE);
+    }
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.protocol_version = (4 == b) ? protoRSTP : protoMSTP;
+    cfg.set_protocol_version = true;
+    MSTP_IN_set_cist_bridge_config(br, &cfg);
+    MSTP_IN_set_mst_config_id(br, 0, (4 == b) ? other : region);
+    MSTP_IN_create_msti(br, 1);
+    MSTP_IN_create_msti(br, 2);
+}
+
+static void set_link(mstp_engine_t *eng, int i, bool up)
+{
+    links[i].up = up;
+    MSTP_IN_set_port_enable(links[i].a, up, 1000, 1);
+    MSTP_IN_set_port_enable(links[i].b, up, 1000, 1);
+    deliver(eng);
+}
+
+static void set_priority(mstp_engine_t *eng, int b, __u16 mstid, __u8 prio)
+{
+    MSTP_IN_set_msti_bridge_config(find_tree(&bridges[b], mstid), prio);
+    deliver(eng);
+}
+
+static void run_seconds(mstp_engine_t *eng, int seconds)
+{
+    int b;
+
+    while(seconds--)
+    {
+        for(b = 0; b < NUM_BRIDGES; ++b)
+            MSTP_IN_one_second(&bridges[b]);
+        deliver(eng);
+    }
+}
+
+static int cmp_events(const void *a, const void *b)
+{
+    const event_t *ea = a, *eb = b;
+    int r;
+
+    if((r = strcmp(ea->key, eb->key))
+       || (r = strcmp(ea->machine, eb->machine)))
+        return r;
+    /* The transitions of a state machine stay in order */
+    return ea->seq - eb->seq;
+}
+
+static bool same_states(const event_t *a, const event_t *b, int len)
+{
+    while(len--)
+        if(strcmp((a++)->state, (b++)->state))
+            return false;
+    return true;
+}
+
+/* Print the transitions of one state machine, n of them from ev, folding
+ * the repeated sequences: e.g. the Port Information state machine goes
+ * through RECEIVE, REPEATED_DESIGNATED, CURRENT for every BPDU */
+static void print_machine(const event_t *ev, int n)
+{
+    int i, len, reps, best_len, best_reps;
+
+    for(i = 0; i < n; i += best_len * best_reps)
+    {
+        best_len = best_reps = 1;
+        for(len = 1; (len <= MAX_PERIOD) && (i + 2 * len <= n); ++len)
+        {
+            for(reps = 1; i + (reps + 1) * len <= n; ++reps)
+                if(!same_states(ev + i, ev + i + reps * len, len))
+                    break;
+            if((1 < reps) && (best_len * best_reps < len * reps))
+            {
+                best_len = len;
+                best_reps = reps;
+            }
+        }
+        printf("%s %s", ev->key, ev->machine);
+        for(len = 0; len < best_len; ++len)
+            printf(" %s", ev[i + len].state);
+        if(1 < best_reps)
+            printf(" x%d", best_reps);
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    mstp_engine_t eng;
+    int b, i;
+
+    if(1 != argc)
+    {
+        fprintf(stderr, "Usage: mstp-check\n");
+        return EXIT_FAILURE;
+    }
+    if(NULL == (events = calloc(MAX_EVENTS, sizeof(*events))))
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    MSTP_IN_init_engine(&eng, &check_ops, NULL);
+    MSTP_IN_set_rx_fast_path(&eng, false);
+    for(b = 0; b < NUM_BRIDGES; ++b)
+        create_bridge(&eng, b);
+    for(i = 0; i < NUM_LINKS; ++i)
+    {
+        links[i].a = add_port(&eng, links[i].br1);
+        links[i].b = add_port(&eng, links[i].br2);
+    }
+    /* b1 is the root of the CIST, b2 of MSTI 1 and b3 of MSTI 2 */
+    set_priority(&eng, 0, 0, 2);
+    set_priority(&eng, 1, 1, 2);
+    set_priority(&eng, 2, 2, 2);
+    for(b = 0; b < NUM_BRIDGES; ++b)
+        MSTP_IN_set_bridge_enable(&bridges[b], true);
+    for(i = 0; i < NUM_LINKS; ++i)
+        set_link(&eng, i, true);
+    run_seconds(&eng, 40);
+
+    /* The root port of b2 for the CIST goes down, and back up */
+    set_link(&eng, 0, false);
+    run_seconds(&eng, 30);
+    set_link(&eng, 0, true);
+    run_seconds(&eng, 30);
+
+    /* b4 takes over MSTI 1, then b5 the CIST from outside the region */
+    set_priority(&eng, 3, 1, 1);
+    run_seconds(&eng, 30);
+    set_priority(&eng, 4, 0, 0);
+    run_seconds(&eng, 30);
+
+    /* The root of MSTI 2 loses both its links to b2 and b4 */
+    set_link(&eng, 1, false);
+    set_link(&eng, 2, false);
+    run_seconds(&eng, 30);
+    set_link(&eng, 1, true);
+    set_link(&eng, 2, true);
+    run_seconds(&eng, 30);
+
+    if(events_overflow)
+    {
+        fprintf(stderr, "More than %d transitions\n", MAX_EVENTS);
+        return EXIT_FAILURE;
+    }
+    qsort(events, num_events, sizeof(*events), cmp_events);
+    for(i = 0; i < num_events; i = b)
+    {
+        for(b = i + 1; b < num_events; ++b)
+            if(strcmp(events[b].key, events[i].key)
+               || strcmp(events[b].machine, events[i].machine))
+                break;
+        print_machine(events + i, b - i);
+    }
+    free(events);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,388 @@
+/*****************************************************************************
+  Copyright (c) 2006 EMC Corporation.
+  Copyright (c) 2011 Factor-SPE
+
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/* Types of the statuses and configurations which mstpd exchanges with the
+ * clients of libmstpctl. Installed along with ctl_functions.h, so it has no
+ * dependencies but the system headers. */
+
+#ifndef MSTP_TYPES_H
+#define MSTP_TYPES_H
+
+#include <stdbool.h>
+#include <net/if.h>
+#include <linux/types.h>
+#include <linux/if_ether.h>
+
+#define MAX_PORT_NUMBER 4095
+#define MAX_VID         4094
+#define MAX_FID         4095
+#define MAX_MSTID       4094
+
+/* MAX_xxx_MSTIS: CIST not counted */
+#define MAX_STANDARD_MSTIS          64
+#define MAX_IMPLEMENTATION_MSTIS    63
+
+/* 13.37.1 */
+#define MAX_PATH_COST   200000000u
+
+typedef union
+{
+    __u64 u;
+    struct
+    {
+        __be16 priority;
+        __u8 mac_address[ETH_ALEN];
+    } __attribute__((packed)) s;
+} bridge_identifier_t;
+
+typedef __be16 port_identifier_t;
+
+/* These macros work well for both PortID and BridgeID */
+#define GET_PRIORITY_FROM_IDENTIFIER(id)    (((__u8 *)(&(id)))[0] & 0xF0)
+#define SET_PRIORITY_IN_IDENTIFIER(pri, id) do{ \
+    __u8 *first_octet = (__u8 *)(&(id));        \
+    *first_octet &= 0x0F;                       \
+    *first_octet |= (pri) & 0xF0;               \
+    }while(0)
+
+#define CONFIGURATION_NAME_LEN   32
+#define CONFIGURATION_DIGEST_LEN 16
+typedef union
+{
+    __u8 a[1 + CONFIGURATION_NAME_LEN + 2 + CONFIGURATION_DIGEST_LEN];
+    struct
+    {
+        __u8 selector; /* always 0 */
+        __u8 configuration_name[CONFIGURATION_NAME_LEN];
+        __be16 revision_level;
+        __u8 configuration_digest[CONFIGURATION_DIGEST_LEN];
+    } __attribute__((packed)) s;
+} __attribute__((packed)) mst_configuration_identifier_t;
+
+typedef enum
+{
+    roleDisabled,
+    roleRoot,
+    roleDesignated,
+    roleAlternate,
+    roleBackup,
+    roleMaster
+} port_role_t;
+
+typedef enum
+{
+    protoSTP = 0,
+    protoRSTP = 2,
+    protoMSTP = 3
+} protocol_version_t;
+
+typedef enum
+{
+    p2pAuto,
+    p2pForceTrue,
+    p2pForceFalse
+}
+admin_p2p_t;
+
+/* Consecutive VIDs (FIDs) lo to hi, all mapped to the same FID (MSTID) */
+typedef struct
+{
+    __u16 lo, hi;
+    __u16 value;
+} MapRange;
+
+/* Structures for communicating with user */
+ /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
+typedef struct
+{
+    bridge_identifier_t bridge_id;
+    unsigned int time_since_topology_change;
+    unsigned int topology_change_count;
+    bool topology_change;
+    char topology_change_port[IFNAMSIZ];
+    char last_topology_change_port[IFNAMSIZ];
+    bridge_identifier_t designated_root;
+    unsigned int root_path_cost;
+    port_identifier_t root_port_id;
+    __u8 root_max_age;
+    __u8 root_forward_delay;
+    __u8 bridge_max_age;
+    __u8 bridge_forward_delay;
+    unsigned int tx_hold_count;
+    protocol_version_t protocol_version;
+    bridge_identifier_t regional_root;
+    unsigned int internal_path_cost;
+    bool enabled; /* not in standard */
+    unsigned int Ageing_Time;
+    __u8 max_hops;
+    __u8 bridge_hello_time;
+    unsigned int num_sm_budget_exhausted;
+    unsigned int num_sm_livelock;
+    unsigned int fdb_flush_window;
+    bool rapid_ageing;
+} CIST_BridgeStatus;
+
+ /* 12.8.1.2 Read MSTI Bridge Protocol Parameters */
+typedef struct
+{
+    bridge_identifier_t bridge_id;
+    unsigned int time_since_topology_change;
+    unsigned int topology_change_count;
+    bool topology_change;
+    char topology_change_port[IFNAMSIZ];
+    char last_topology_change_port[IFNAMSIZ];
+    bridge_identifier_t regional_root;
+    unsigned int internal_path_cost;
+    port_identifier_t root_port_id;
+} MSTI_BridgeStatus;
+
+/* 12.8.1.3 Set CIST Bridge Protocol Parameters */
+typedef struct
+{
+    __u8 bridge_max_age;
+    bool set_bridge_max_age;
+
+    __u8 bridge_forward_delay;
+    bool set_bridge_forward_delay;
+
+    /* Superseded by MSTP_IN_set_msti_bridge_config for the CIST.
+     * __u8 bridge_priority;
+     * bool set_bridge_priority; */
+
+    protocol_version_t protocol_version;
+    bool set_protocol_version;
+
+    unsigned int tx_hold_count;
+    bool set_tx_hold_count;
+
+    __u8 max_hops;
+    bool set_max_hops;
+
+    __u8 bridge_hello_time;
+    bool set_bridge_hello_time;
+
+    unsigned int bridge_ageing_time;
+    bool set_bridge_ageing_time;
+
+    unsigned int fdb_flush_window; /* not in standard */
+    bool set_fdb_flush_window;
+} CIST_BridgeConfig;
+
+/* 12.8.2.1 Read CIST Port Parameters */
+typedef struct
+{
+    unsigned int uptime;
+    int state; /* BR_STATE_xxx */
+    port_identifier_t port_id;
+    __u32 admin_external_port_path_cost; /* not in standard. 0 = auto */
+    __u32 external_port_path_cost;
+    bridge_identifier_t designated_root; /* from portPriority */
+    __u32 designated_external_cost; /* from portPriority */
+    bridge_identifier_t designated_bridge; /* from portPriority */
+    port_identifier_t designated_port; /* from portPriority */
+    bool tc_ack; /* tcAck */
+    __u8 port_hello_time; /* from portTimes */
+    bool admin_edge_port;
+    bool auto_edge_port; /* not in standard */
+    bool oper_edge_port;
+    /* 802.1Q-2005 wants here MAC_Enabled & MAC_Operational. We don't know
+     * neither of these. Return portEnabled and feel happy. */
+    bool enabled;
+    admin_p2p_t admin_p2p;
+    bool oper_p2p;
+    bool restricted_role;
+    bool restricted_tcn;
+    port_role_t role;
+    bool disputed;
+    bridge_identifier_t designated_regional_root; /* from portPriority */
+    __u32 designated_internal_cost; /* from portPriority */
+    __u32 admin_internal_port_path_cost; /* not in standard. 0 = auto */
+    __u32 internal_port_path_cost; /* not in standard */
+    bool bpdu_guard_port;
+    bool bpdu_guard_error;
+    bool bpdu_filter_port;
+    bool network_port;
+    bool dont_txmt;
+    bool ba_inconsistent;
+    unsigned int num_rx_bpdu_filtered;
+    unsigned int num_rx_bpdu;
+    unsigned int num_rx_tcn;
+    unsigned int num_tx_bpdu;
+    unsigned int num_tx_tcn;
+    unsigned int num_trans_fwd;
+    unsigned int num_trans_blk;
+    unsigned int num_rx_unknown_msti;
+    unsigned int num_tx_errors;
+    unsigned int num_rx_bpdu_fast;
+    unsigned int bpdu_rate_limit; /* not in standard. 0 = no limit */
+    bool bpdu_rate_keep_latest;
+    bool bpdu_rate_limited;
+    unsigned int num_rx_bpdu_rate_limited;
+    unsigned int num_bpdu_rate_limit_engaged;
+    unsigned int num_rapid_ageing;
+    unsigned int num_fdb_flush_requests; /* of the CIST */
+    unsigned int num_fdb_flushes;
+    bool rcvdBpdu;
+    bool rcvdRSTP;
+    bool rcvdSTP;
+    bool rcvdTcAck;
+    bool rcvdTcn;
+    bool sendRSTP;
+} CIST_PortStatus;
+
+/* 12.8.2.2 Read MSTI Port Parameters */
+typedef struct
+{
+    unsigned int uptime;
+    int state; /* BR_STATE_xxx */
+    port_identifier_t port_id;
+    __u32 admin_internal_port_path_cost; /* not in standard. 0 = auto */
+    __u32 internal_port_path_cost;
+    bridge_identifier_t designated_regional_root; /* from portPriority */
+    __u32 designated_internal_cost; /* from portPriority */
+    bridge_identifier_t designated_bridge; /* from portPriority */
+    port_identifier_t designated_port; /* from portPriority */
+    port_role_t role;
+    bool disputed;
+    unsigned int num_fdb_flush_requests;
+    unsigned int num_fdb_flushes;
+} MSTI_PortStatus;
+
+/* Change feed: every object whose status changes gets the next generation
+ * of the engine */
+typedef enum
+{
+    MSTP_CHANGE_BRIDGE,    /* CIST bridge status, or the ports or MSTIs */
+    MSTP_CHANGE_TREE,      /* MSTI bridge status */
+    MSTP_CHANGE_PORT,      /* CIST port status */
+    MSTP_CHANGE_TREE_PORT, /* MSTI port status */
+} mstp_change_type_t;
+
+/* 12.8.2.3 Set CIST port parameters */
+typedef struct
+{
+    __u32 admin_external_port_path_cost; /* not in standard. 0 = auto */
+    bool set_admin_external_port_path_cost;
+
+    /* Superseded by MSTP_IN_set_msti_port_config for the CIST.
+     * __u32 admin_internal_port_path_cost;
+     * bool set_admin_internal_port_path_cost;
+     *
+     * __u8 port_priority;
+     * bool set_port_priority;
+     */
+
+    bool admin_edge_port;
+    bool set_admin_edge_port;
+
+    bool auto_edge_port; /* not in standard */
+    bool set_auto_edge_port;
+
+    admin_p2p_t admin_p2p;
+    bool set_admin_p2p;
+
+    bool restricted_role;
+    bool set_restricted_role;
+
+    bool restricted_tcn;
+    bool set_restricted_tcn;
+
+    bool bpdu_guard_port;
+    bool set_bpdu_guard_port;
+
+    bool network_port;
+    bool set_network_port;
+
+    bool dont_txmt;
+    bool set_dont_txmt;
+
+    bool bpdu_filter_port;
+    bool set_bpdu_filter_port;
+
+    unsigned int bpdu_rate_limit; /* BPDUs per second, 0 = no limit */
+    bool bpdu_rate_keep_latest;
+    bool set_bpdu_rate_limit; /* sets both */
+} CIST_PortConfig;
+
+/* 12.8.2.4 Set MSTI port parameters */
+typedef struct
+{
+    __u32 admin_internal_port_path_cost; /* 0 = auto */
+    bool set_admin_internal_port_path_cost;
+
+    __u8 port_priority;
+    bool set_port_priority;
+} MSTI_PortConfig;
+
+/* Timings of the BPDUs of a port, in microseconds */
+typedef struct
+{
+    unsigned int count, last, max;
+    unsigned long long total;
+} latency_stats_t;
+
+typedef struct
+{
+    /* From the kernel receiving a BPDU to mstpd reading it */
+    latency_stats_t rx_queue;
+    /* From mstpd reading a BPDU to the state machines settled */
+    latency_stats_t rx_processing;
+    /* Between two BPDUs of any kind sent by the kernel, the hello time in a
+     * stable topology */
+    latency_stats_t tx_bpdu_interval;
+} port_latency_t;
+
+/* Dispatch classes, served in this order on every loop turn */
+enum
+{
+    EPOLL_PRIO_PROTOCOL = 0, /* BPDUs, after the timer tick */
+    EPOLL_PRIO_LINK,         /* kernel link events */
+    EPOLL_PRIO_CONTROL,      /* control and monitoring requests */
+    EPOLL_NUM_PRIO
+};
+
+typedef struct
+{
+    unsigned int events;       /* ready events served */
+    unsigned int calls;        /* handler calls */
+    unsigned int max_depth;    /* max handler calls in one turn */
+    unsigned int quota_hits;   /* turns which left events for the next one */
+    unsigned int max_latency;  /* max time from wakeup to handler call, us */
+    unsigned long long total_latency; /* us */
+} epoll_class_stats_t;
+
+typedef struct
+{
+    unsigned int turns;
+    unsigned int ev_size;      /* current size of the ready events array */
+    unsigned int low_prio_quota;
+    unsigned int ticks;
+    unsigned int tick_overruns; /* ticks handled late, in a batch */
+    unsigned int last_lag_us;  /* actual versus scheduled time of the tick */
+    unsigned int max_lag_us;
+    unsigned int lag_alarm_ms; /* 0 = alarm disabled */
+    unsigned int lag_alarms;
+    epoll_class_stats_t classes[EPOLL_NUM_PRIO];
+} epoll_loop_stats_t;
+
+#endif /* MSTP_TYPES_H */
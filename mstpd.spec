@@ -117,6 +117,12 @@ END
 %{_sbindir}/mstpctl
 %{_sbindir}/bridge-stp
 %{_sbindir}/mstp_restart
+%{_libdir}/libmstpctl.so*
+%exclude %{_libdir}/libmstpctl.la
+%{_libdir}/libmstp.so*
+%exclude %{_libdir}/libmstp.la
+%exclude %{_libdir}/libmstp*.a
+%{_includedir}/mstpd/
 %config(noreplace) %{_sysconfdir}/bridge-stp.conf
 %config(noreplace) %{_sysconfdir}/sysconfig/network-scripts/bridge-stp
 %{_sysconfdir}/bash_completion.d/mstpctl
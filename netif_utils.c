@@ -38,6 +38,7 @@
 #include <linux/sockios.h>
 
 #include "log.h"
+#include "record.h"
 
 #ifndef SYSFS_CLASS_NET
 #define SYSFS_CLASS_NET "/sys/class/net"
@@ -56,34 +57,42 @@ int netsock_init(void)
     return 0;
 }
 
+/* The answers of the kernel are recorded for mstpd-replay, see record.h */
+
 int get_hwaddr(char *ifname, __u8 *hwaddr)
 {
     struct ifreq ifr;
+    int r;
+    if(record_replay_answer(RECORD_Q_HWADDR, &r, hwaddr, ETH_ALEN))
+        return r;
     memset(&ifr, 0, sizeof(ifr));
     strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
     if(0 > ioctl(netsock, SIOCGIFHWADDR, &ifr))
     {
         ERROR("%s: get hw address failed: %m", ifname);
-        return -1;
+        return record_answer(RECORD_Q_HWADDR, -1, NULL, 0);
     }
     memcpy(hwaddr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
-    return 0;
+    return record_answer(RECORD_Q_HWADDR, 0, hwaddr, ETH_ALEN);
 }
 
 int get_flags(char *ifname)
 {
     struct ifreq ifr;
+    int r;
+    if(record_replay_answer(RECORD_Q_FLAGS, &r, NULL, 0))
+        return r;
     memset(&ifr, 0, sizeof(ifr));
     strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
     if(0 > ioctl(netsock, SIOCGIFFLAGS, &ifr))
     {
         ERROR("%s: get interface flags failed: %m", ifname);
-        return -1;
+        return record_answer(RECORD_Q_FLAGS, -1, NULL, 0);
     }
-    return ifr.ifr_flags;
+    return record_answer(RECORD_Q_FLAGS, ifr.ifr_flags, NULL, 0);
 }
 
-int if_shutdown(char *ifname)
+static int __if_shutdown(char *ifname)
 {
     struct ifreq ifr;
 
@@ -103,8 +112,24 @@ int if_shutdown(char *ifname)
     return 0;
 }
 
+int if_shutdown(char *ifname)
+{
+    int r;
+    if(record_replay_answer(RECORD_Q_SHUTDOWN, &r, NULL, 0))
+        return r;
+    return record_answer(RECORD_Q_SHUTDOWN, __if_shutdown(ifname), NULL, 0);
+}
+
 int ethtool_get_speed_duplex(char *ifname, int *speed, int *duplex)
 {
+    int r, answer[2];
+    if(record_replay_answer(RECORD_Q_SPEED_DUPLEX, &r, answer, sizeof(answer)))
+    {
+        *speed = answer[0];
+        *duplex = answer[1];
+        return r;
+    }
+
     struct ifreq ifr;
     memset(&ifr, 0, sizeof(ifr));
     strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
@@ -115,22 +140,29 @@ int ethtool_get_speed_duplex(char *ifname, int *speed, int *duplex)
     if(0 > ioctl(netsock, SIOCETHTOOL, &ifr))
     {
         ERROR("Cannot get speed/duplex for %s: %m\n", ifname);
-        return -1;
+        return record_answer(RECORD_Q_SPEED_DUPLEX, -1, NULL, 0);
     }
     *speed = ecmd.speed;   /* Ethtool speed is in Mbps */
     *duplex = ecmd.duplex; /* We have same convention as ethtool.
                                0 = half, 1 = full */
-    return 0;
+    answer[0] = *speed;
+    answer[1] = *duplex;
+    return record_answer(RECORD_Q_SPEED_DUPLEX, 0, answer, sizeof(answer));
 }
 
 char *index_to_name(int index, char *name)
 {
-    return if_indextoname(index, name);
+    int r;
+    if(!record_replay_answer(RECORD_Q_IFNAME, &r, name, IFNAMSIZ))
+        r = record_answer(RECORD_Q_IFNAME,
+                          if_indextoname(index, name) ? 0 : -1,
+                          name, IFNAMSIZ);
+    return r ? NULL : name;
 }
 
 char *index_to_port_name(int index, char *name)
 {
-    return if_indextoname(index, name);
+    return index_to_name(index, name);
 }
 
 /********* Sysfs based utility functions *************/
@@ -139,11 +171,15 @@ char *index_to_port_name(int index, char *name)
 bool is_bridge(char *if_name)
 {
     char path[32 + IFNAMSIZ];
+    int r;
+    if(record_replay_answer(RECORD_Q_IS_BRIDGE, &r, NULL, 0))
+        return (0 < r);
     sprintf(path, SYSFS_CLASS_NET "/%s/bridge", if_name);
-    return (0 == access(path, R_OK));
+    return record_answer(RECORD_Q_IS_BRIDGE, (0 == access(path, R_OK)),
+                         NULL, 0);
 }
 
-int get_bridge_portno(char *if_name)
+static int __get_bridge_portno(char *if_name)
 {
     char path[32 + IFNAMSIZ];
     sprintf(path, SYSFS_CLASS_NET "/%s/brport/port_no", if_name);
@@ -177,3 +213,12 @@ out:
     close(fd);
     return res;
 }
+
+int get_bridge_portno(char *if_name)
+{
+    int r;
+    if(record_replay_answer(RECORD_Q_PORTNO, &r, NULL, 0))
+        return r;
+    return record_answer(RECORD_Q_PORTNO, __get_bridge_portno(if_name),
+                         NULL, 0);
+}
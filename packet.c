@@ -25,19 +25,29 @@
 
 /* #define PACKET_DEBUG */
 
+#include <config.h>
+
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <linux/if_packet.h>
 #include <linux/filter.h>
 #include <asm/byteorder.h>
+#ifdef HAVE_LINUX_BPF_H
+#include <linux/bpf.h>
+#endif
 
 #include "epoll_loop.h"
 #include "netif_utils.h"
 #include "bridge_ctl.h"
 #include "packet.h"
+#include "handover.h"
+#include "record.h"
 #include "log.h"
 
 static struct epoll_event_handler packet_event;
@@ -57,72 +67,169 @@ static void dump_packet(const unsigned char *buf, int cc)
 }
 #endif
 
+/* Transmit queue.
+ * BPDUs sent while handling one event (e.g. all the hellos of one tick)
+ * are collected here and handed to the kernel with one sendmmsg() call
+ * by packet_flush(), which the main loop calls before going to sleep.
+ */
+#define TX_QUEUE_LEN    64
+#define TX_FRAME_MAXLEN 1536
+
+static struct
+{
+    int ifindex;
+    struct sockaddr_ll sl;
+    struct iovec iov;
+    unsigned char frame[TX_FRAME_MAXLEN];
+} tx_queue[TX_QUEUE_LEN];
+static struct mmsghdr tx_msgs[TX_QUEUE_LEN];
+static int tx_queue_count;
+
+static void tx_failed(int ifindex, int err)
+{
+    if(err != EWOULDBLOCK)
+    {
+        errno = err;
+        ERROR("send failed on ifindex %d: %m", ifindex);
+    }
+    bridge_bpdu_tx_error(ifindex);
+}
+
+void packet_flush(void)
+{
+    int i, n, sent = 0;
+
+    while(sent < tx_queue_count)
+    {
+        n = sendmmsg(packet_event.fd, &tx_msgs[sent], tx_queue_count - sent,
+                     0);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            /* Error refers to the first message, skip it and go on */
+            tx_failed(tx_queue[sent].ifindex, errno);
+            ++sent;
+            continue;
+        }
+        for(i = sent; i < sent + n; ++i)
+        {
+            if(tx_msgs[i].msg_len != tx_queue[i].iov.iov_len)
+            {
+                ERROR("short write in sendmmsg: %u instead of %zu",
+                      tx_msgs[i].msg_len, tx_queue[i].iov.iov_len);
+                bridge_bpdu_tx_error(tx_queue[i].ifindex);
+            }
+            else
+                bridge_bpdu_sent(tx_queue[i].ifindex);
+        }
+        sent += n;
+    }
+    tx_queue_count = 0;
+}
+
 /*
  * To send/receive Spanning Tree packets we use PF_PACKET because
  * it allows the filtering we want but gives raw data
  */
 void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
 {
-    int l;
-    struct sockaddr_ll sl =
+    int i, l;
+
+    /* The frame is copied into the queue: check its actual length first */
+    for(i = 0, l = 0; i < iov_count; ++i)
     {
-        .sll_family = AF_PACKET,
-        .sll_protocol = __constant_cpu_to_be16(ETH_P_802_2),
-        .sll_ifindex = ifindex,
-        .sll_halen = ETH_ALEN,
-    };
+        if(iov[i].iov_len > (size_t)(TX_FRAME_MAXLEN - l))
+        {
+            ERROR("frame too long for transmit queue: %d", len);
+            bridge_bpdu_tx_error(ifindex);
+            return;
+        }
+        l += iov[i].iov_len;
+    }
+    if(l != len)
+    {
+        ERROR("frame length mismatch: %d instead of %d", l, len);
+        bridge_bpdu_tx_error(ifindex);
+        return;
+    }
+
+    if(TX_QUEUE_LEN == tx_queue_count)
+        packet_flush();
+
+    struct sockaddr_ll *sl = &tx_queue[tx_queue_count].sl;
+    memset(sl, 0, sizeof(*sl));
+    sl->sll_family = AF_PACKET;
+    sl->sll_protocol = __constant_cpu_to_be16(ETH_P_802_2);
+    sl->sll_ifindex = ifindex;
+    sl->sll_halen = ETH_ALEN;
 
     if(iov_count > 0 && iov[0].iov_len > ETH_ALEN)
-        memcpy(&sl.sll_addr, iov[0].iov_base, ETH_ALEN);
+        memcpy(&sl->sll_addr, iov[0].iov_base, ETH_ALEN);
 
-    struct msghdr msg =
+    unsigned char *frame = tx_queue[tx_queue_count].frame;
+    for(i = 0, l = 0; i < iov_count; ++i)
     {
-        .msg_name = &sl,
-        .msg_namelen = sizeof(sl),
-        .msg_iov = (struct iovec *)iov,
-        .msg_iovlen = iov_count,
-        .msg_control = NULL,
-        .msg_controllen = 0,
-        .msg_flags = 0,
-    };
+        memcpy(frame + l, iov[i].iov_base, iov[i].iov_len);
+        l += iov[i].iov_len;
+    }
+    record_output(RECORD_TX_BPDU, ifindex, 0, frame, l);
 
 #ifdef PACKET_DEBUG
     printf("Transmit Dst index %d %02x:%02x:%02x:%02x:%02x:%02x\n",
-           sl.sll_ifindex,
-           sl.sll_addr[0], sl.sll_addr[1], sl.sll_addr[2],
-           sl.sll_addr[3], sl.sll_addr[4], sl.sll_addr[5]);
-    {
-        int i;
-        for(i = 0; i < iov_count; ++i)
-            dump_packet(iov[i].iov_base, iov[i].iov_len);
-    }
+           sl->sll_ifindex,
+           sl->sll_addr[0], sl->sll_addr[1], sl->sll_addr[2],
+           sl->sll_addr[3], sl->sll_addr[4], sl->sll_addr[5]);
+    dump_packet(frame, l);
 #endif
 
-    l = sendmsg(packet_event.fd, &msg, 0);
+    tx_queue[tx_queue_count].ifindex = ifindex;
+    tx_queue[tx_queue_count].iov.iov_base = frame;
+    tx_queue[tx_queue_count].iov.iov_len = l;
 
-    if(l < 0)
-    {
-        if(errno != EWOULDBLOCK)
-            ERROR("send failed: %m");
-    }
-    else if(l != len)
-        ERROR("short write in sendto: %d instead of %d", l, len);
+    struct msghdr *msg = &tx_msgs[tx_queue_count].msg_hdr;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = sl;
+    msg->msg_namelen = sizeof(*sl);
+    msg->msg_iov = &tx_queue[tx_queue_count].iov;
+    msg->msg_iovlen = 1;
+
+    ++tx_queue_count;
 }
 
-static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
+static bool packet_rcv(uint32_t events, struct epoll_event_handler *h)
 {
     int cc;
     unsigned char buf[2048];
     struct sockaddr_ll sl;
-    socklen_t salen = sizeof sl;
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    char cbuf[CMSG_SPACE(sizeof(struct timespec))];
+    struct msghdr msg =
+    {
+        .msg_name = &sl, .msg_namelen = sizeof(sl),
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = cbuf, .msg_controllen = sizeof(cbuf),
+    };
+    struct cmsghdr *cmsg;
+    struct timespec rx_time, *ts = NULL;
 
-    cc = recvfrom(h->fd, &buf, sizeof(buf), 0, (struct sockaddr *) &sl, &salen);
+    cc = recvmsg(h->fd, &msg, 0);
     if(cc <= 0)
     {
-        ERROR("recvfrom failed: %m");
-        return;
+        if((0 > cc) && (EAGAIN != errno) && (EWOULDBLOCK != errno))
+            ERROR("recvmsg failed: %m");
+        return false;
     }
 
+    /* When the kernel got the frame, see SO_TIMESTAMPNS */
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if((SOL_SOCKET == cmsg->cmsg_level)
+           && (SCM_TIMESTAMPNS == cmsg->cmsg_type))
+        {
+            memcpy(&rx_time, CMSG_DATA(cmsg), sizeof(rx_time));
+            ts = &rx_time;
+        }
+
 #ifdef PACKET_DEBUG
     printf("Receive Src ifindex %d %02x:%02x:%02x:%02x:%02x:%02x\n",
            sl.sll_ifindex,
@@ -132,7 +239,9 @@ static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
     dump_packet(buf, cc);
 #endif
 
-    bridge_bpdu_rcv(sl.sll_ifindex, buf, cc);
+    record_input(RECORD_BPDU, sl.sll_ifindex, 0, buf, cc);
+    bridge_bpdu_rcv(sl.sll_ifindex, buf, cc, ts);
+    return true;
 }
 
 /* Berkeley Packet filter code to filter out spanning tree packets.
@@ -147,6 +256,286 @@ static struct sock_filter stp_filter[] = {
     { 0x6, 0, 0, 0x00000000 },
 };
 
+static int attach_stp_filter(int s)
+{
+    struct sock_fprog prog =
+    {
+        .len = sizeof(stp_filter) / sizeof(stp_filter[0]),
+        .filter = stp_filter,
+    };
+
+    if(setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    {
+        ERROR("setsockopt packet filter failed: %m");
+        return -1;
+    }
+    return 0;
+}
+
+/* Kernel drop of the unwanted BPDUs.
+ * The eBPF filter of the socket does what stp_filter does, and then looks
+ * up the ifindex of the frame in a map of the managed ports: BPDUs from
+ * other interfaces are dropped, so are those of the BPDU filtered ports,
+ * which are counted in the map. The map is maintained by bridge_track.c.
+ * The BPDUs of a port over its rate limit are dropped and counted too: the
+ * limit is a GCRA, so a burst of up to rate BPDUs passes, then one BPDU
+ * every 1/rate second. Two CPUs may race on tat, which is harmless: mstpd
+ * enforces the limit again.
+ */
+#if defined(HAVE_LINUX_BPF_H) && defined(SO_ATTACH_BPF)
+
+/* Value of the map, the key is the ifindex */
+struct bpf_port
+{
+    __u32 flags;    /* PACKET_PORT_xxx */
+    __u32 pad;
+    __u64 dropped;
+    __u64 interval; /* ns between two BPDUs at the rate limit, 0 = no limit */
+    __u64 burst;    /* ns, tolerance for a burst of rate BPDUs */
+    __u64 tat;      /* ns, theoretical arrival time of the next BPDU */
+    __u64 limited;
+};
+
+#define BPF_MAX_PORTS   65536
+
+#define INSN(_code, _dst, _src, _off, _imm) \
+    ((struct bpf_insn){ .code = (_code), .dst_reg = (_dst), \
+                        .src_reg = (_src), .off = (_off), .imm = (_imm) })
+
+static int bpf_map_fd = -1;
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int bpf_map_create(void)
+{
+    union bpf_attr attr;
+    struct rlimit rl = { RLIM_INFINITY, RLIM_INFINITY };
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_HASH;
+    attr.key_size = sizeof(__u32);
+    attr.value_size = sizeof(struct bpf_port);
+    attr.max_entries = BPF_MAX_PORTS;
+    attr.map_flags = BPF_F_NO_PREALLOC;
+    fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    /* Kernels before 5.11 charge the map to RLIMIT_MEMLOCK */
+    if((0 > fd) && (EPERM == errno) && (0 == setrlimit(RLIMIT_MEMLOCK, &rl)))
+        fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    return fd;
+}
+
+static int bpf_prog_load(int map_fd)
+{
+    /* Jump offsets count from the next instruction */
+    struct bpf_insn insns[] =
+    {
+        /* 0: r6 = skb, for the absolute loads */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        /* 1: 802.3 length, not an Ethertype */
+        INSN(BPF_LD | BPF_ABS | BPF_H, 0, 0, 0, 12),
+        INSN(BPF_JMP | BPF_JGT | BPF_K, BPF_REG_0, 0, 32, ETH_DATA_LEN),
+        /* 3: DSAP of the spanning tree */
+        INSN(BPF_LD | BPF_ABS | BPF_B, 0, 0, 0, 14),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 30, 0x42),
+        /* 5: look up skb->ifindex */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6,
+             offsetof(struct __sk_buff, ifindex), 0),
+        INSN(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_2, -4, 0),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+             map_fd),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        /* 12: not a managed port */
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 22, 0),
+        /* 13: r7 = value, kept across the helper calls */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0),
+        /* 14: BPDU filtered port, unless BPDU guarded */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_7,
+             offsetof(struct bpf_port, flags), 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_1, 0, 3, PACKET_PORT_FILTER),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1),
+        INSN(BPF_STX | BPF_XADD | BPF_DW, BPF_REG_7, BPF_REG_1,
+             offsetof(struct bpf_port, dropped), 0),
+        INSN(BPF_JMP | BPF_JA, 0, 0, 16, 0),
+        /* 19: rate limit: r1 = max(tat, now) */
+        INSN(BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_7,
+             offsetof(struct bpf_port, interval), 0),
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_1, 0, 16, 0),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ktime_get_ns),
+        INSN(BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_7,
+             offsetof(struct bpf_port, tat), 0),
+        INSN(BPF_JMP | BPF_JGE | BPF_X, BPF_REG_1, BPF_REG_0, 1, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_0, 0, 0),
+        /* 25: over the limit if tat - now > burst */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_1, 0, 0),
+        INSN(BPF_ALU64 | BPF_SUB | BPF_X, BPF_REG_2, BPF_REG_0, 0, 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_3, BPF_REG_7,
+             offsetof(struct bpf_port, burst), 0),
+        INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_2, BPF_REG_3, 4, 0),
+        /* 29: tat += interval, accept */
+        INSN(BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_2, BPF_REG_7,
+             offsetof(struct bpf_port, interval), 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_X, BPF_REG_1, BPF_REG_2, 0, 0),
+        INSN(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_7, BPF_REG_1,
+             offsetof(struct bpf_port, tat), 0),
+        INSN(BPF_JMP | BPF_JA, 0, 0, 4, 0),
+        /* 33: count the BPDU over the limit */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1),
+        INSN(BPF_STX | BPF_XADD | BPF_DW, BPF_REG_7, BPF_REG_1,
+             offsetof(struct bpf_port, limited), 0),
+        /* 35: drop */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 0),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        /* 37: accept, as much as stp_filter */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, 1152),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    union bpf_attr attr;
+    static char log[4096];
+    int fd, err;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t)"GPL";
+    if(0 <= (fd = sys_bpf(BPF_PROG_LOAD, &attr)))
+        return fd;
+
+    /* The verifier log costs a lot: only to tell why it failed */
+    err = errno;
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    log[0] = '\0';
+    if(0 <= (fd = sys_bpf(BPF_PROG_LOAD, &attr)))
+        return fd;
+    LOG("eBPF verifier: %s", log);
+    errno = err;
+    return -1;
+}
+
+/* Replace the filter of the socket by the eBPF one */
+static int attach_bpf_filter(int s)
+{
+    int prog_fd;
+
+    if(0 > bpf_map_fd)
+        return -1;
+    if(0 > (prog_fd = bpf_prog_load(bpf_map_fd)))
+    {
+        INFO("Couldn't load the eBPF filter, BPDUs are filtered by mstpd: %m");
+        return -1;
+    }
+    if(setsockopt(s, SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd))
+       < 0)
+    {
+        INFO("Couldn't attach the eBPF filter, BPDUs are filtered by mstpd: "
+             "%m");
+        close(prog_fd);
+        return -1;
+    }
+    /* The socket holds the program */
+    close(prog_fd);
+    INFO("Unwanted BPDUs are dropped by the kernel");
+    return 0;
+}
+
+void packet_port_set(int ifindex, unsigned int flags, unsigned int rate)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+    struct bpf_port value;
+
+    if(0 > bpf_map_fd)
+        return;
+    /* Keep the counts. Drops in between the two calls are lost, which is
+     * rare enough: the flags change on configuration only. */
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = bpf_map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    if(0 != sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr))
+        memset(&value, 0, sizeof(value));
+    value.flags = flags;
+    value.interval = rate ? 1000000000ULL / rate : 0;
+    value.burst = rate ? (rate - 1) * value.interval : 0;
+    attr.flags = BPF_ANY;
+    if(0 != sys_bpf(BPF_MAP_UPDATE_ELEM, &attr))
+        ERROR("Couldn't add ifindex %d to the eBPF filter: %m", ifindex);
+}
+
+void packet_port_del(int ifindex)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+
+    if(0 > bpf_map_fd)
+        return;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = bpf_map_fd;
+    attr.key = (uintptr_t)&key;
+    if(0 != sys_bpf(BPF_MAP_DELETE_ELEM, &attr) && (ENOENT != errno))
+        ERROR("Couldn't remove ifindex %d from the eBPF filter: %m", ifindex);
+}
+
+void packet_port_dropped(int ifindex, unsigned long long *filtered,
+                         unsigned long long *limited)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+    struct bpf_port value;
+
+    *filtered = *limited = 0;
+    if(0 > bpf_map_fd)
+        return;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = bpf_map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    if(0 != sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr))
+        return;
+    *filtered = value.dropped;
+    *limited = value.limited;
+}
+
+#else /* no eBPF */
+
+static int bpf_map_fd = -1;
+
+static int bpf_map_create(void)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static int attach_bpf_filter(int s)
+{
+    return -1;
+}
+
+void packet_port_set(int ifindex, unsigned int flags, unsigned int rate)
+{
+}
+
+void packet_port_del(int ifindex)
+{
+}
+
+void packet_port_dropped(int ifindex, unsigned long long *filtered,
+                         unsigned long long *limited)
+{
+    *filtered = *limited = 0;
+}
+
+#endif
+
 /*
  * Open up a raw packet socket to catch all 802.2 packets.
  * and install a packet filter to only see STP (SAP 42)
@@ -154,35 +543,77 @@ static struct sock_filter stp_filter[] = {
  * Since any bridged devices are already in promiscious mode
  * no need to add multicast address.
  */
-int packet_sock_init(void)
+int packet_sock_init(bool qdisc_bypass)
 {
-    int s;
-    struct sock_fprog prog =
-    {
-        .len = sizeof(stp_filter) / sizeof(stp_filter[0]),
-        .filter = stp_filter,
-    };
+    int s, one = 1;
+    bool fresh = false;
 
-    s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_802_2));
+    /* Socket of the previous instance keeps the BPDUs received meanwhile,
+     * its filter is kept until packet_filter_init() */
+    if(0 > (s = handover_get_fd(HANDOVER_FD_PACKET)))
+    {
+        s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_802_2));
+        fresh = true;
+    }
     if(s < 0)
     {
         ERROR("socket failed: %m");
         return -1;
     }
 
-    if(setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
-        ERROR("setsockopt packet filter failed: %m");
-    else if(fcntl(s, F_SETFL, O_NONBLOCK) < 0)
+    /* Filled in by bridge_track.c as the ports are created */
+    if(0 > (bpf_map_fd = bpf_map_create()))
+        LOG("Couldn't create the eBPF map of the ports: %m");
+
+    /* Stamp the received BPDUs, for the queue latency of the ports */
+    if(0 > setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)))
+        ERROR("setsockopt receive timestamps failed: %m");
+
+    if(qdisc_bypass)
+    {
+#ifdef PACKET_QDISC_BYPASS
+        if(setsockopt(s, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one))
+           < 0)
+            ERROR("setsockopt qdisc bypass failed: %m");
+        else
+            INFO("Transmitting BPDUs bypassing qdisc layer");
+#else
+        ERROR("qdisc bypass is not supported by this build");
+#endif
+    }
+
+    if(fresh && attach_stp_filter(s))
+        goto err;
+    if(fcntl(s, F_SETFL, O_NONBLOCK) < 0)
         ERROR("fcntl set nonblock failed: %m");
     else
     {
         packet_event.fd = s;
         packet_event.handler = packet_rcv;
+        packet_event.priority = EPOLL_PRIO_PROTOCOL;
 
         if(0 == add_epoll(&packet_event))
+        {
+            handover_set_fd(HANDOVER_FD_PACKET, s);
             return 0;
+        }
     }
 
+err:
     close(s);
     return -1;
 }
+
+/* The ports are known now: switch to the eBPF filter, or else make sure
+ * that the socket has the classic one */
+void packet_filter_init(void)
+{
+    if(0 == attach_bpf_filter(packet_event.fd))
+        return;
+    if(0 <= bpf_map_fd)
+    {
+        close(bpf_map_fd);
+        bpf_map_fd = -1;
+    }
+    attach_stp_filter(packet_event.fd);
+}
@@ -25,9 +25,24 @@
 #ifndef PACKET_SOCK_H
 #define PACKET_SOCK_H
 
+#include <stdbool.h>
 #include <sys/uio.h>
 
 void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len);
-int packet_sock_init(void);
+void packet_flush(void);
+int packet_sock_init(bool qdisc_bypass);
+void packet_filter_init(void);
+
+/* Flags of a port for the kernel filter */
+#define PACKET_PORT_FILTER  0x01    /* BPDU filtered: drop and count */
+#define PACKET_PORT_GUARD   0x02    /* BPDU guarded: always to mstpd */
+
+/* Managed ports; the BPDUs of the other interfaces are dropped.
+ * rate: BPDUs per second over which the BPDUs are dropped, 0 = no limit */
+void packet_port_set(int ifindex, unsigned int flags, unsigned int rate);
+void packet_port_del(int ifindex);
+/* BPDUs dropped on a BPDU filtered port, and over the rate limit */
+void packet_port_dropped(int ifindex, unsigned long long *filtered,
+                         unsigned long long *limited);
 
 #endif /* PACKET_SOCK_H */
@@ -0,0 +1,315 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "record.h"
+#include "clock_gettime.h"
+#include "log.h"
+
+/* Mismatches logged in full, the others are only counted */
+#define MAX_MISMATCH_LOGS   20
+
+/* mstpd -r */
+static FILE *record_file;
+static struct timespec record_start;
+
+/* mstpd-replay: the whole recording, and the records between the current
+ * input and the next one */
+static bool replaying;
+static unsigned char *replay_buf;
+static size_t replay_size;
+static size_t window_end, answer_pos, output_pos;
+static unsigned int input_no, mismatches;
+
+static const char *record_type_name(int type)
+{
+    switch(type)
+    {
+        case RECORD_BPDU:
+            return "BPDU";
+        case RECORD_NETLINK:
+            return "link event";
+        case RECORD_CTL:
+            return "control request";
+        case RECORD_TICK:
+            return "tick";
+        case RECORD_DEFERRED:
+            return "deferred run";
+        case RECORD_START:
+            return "start";
+        case RECORD_STOP:
+            return "stop";
+        case RECORD_RELOAD:
+            return "reload";
+        case RECORD_FLUSH_DONE:
+            return "flush done";
+        case RECORD_ANSWER:
+            return "kernel answer";
+        case RECORD_TX_BPDU:
+            return "BPDU sent";
+        case RECORD_STATE:
+            return "port state";
+        default:
+            return "unknown record";
+    }
+}
+
+int record_open(const char *path)
+{
+    struct record_file_hdr fh = { RECORD_MAGIC, RECORD_VERSION };
+
+    if(NULL == (record_file = fopen(path, "w")))
+    {
+        ERROR("Couldn't open recording %s: %m", path);
+        return -1;
+    }
+    /* Flushed once per event loop turn */
+    setvbuf(record_file, NULL, _IOFBF, 65536);
+    if(1 != fwrite(&fh, sizeof(fh), 1, record_file))
+    {
+        ERROR("Couldn't write recording %s: %m", path);
+        fclose(record_file);
+        record_file = NULL;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &record_start);
+    INFO("Recording the inputs to %s", path);
+    return 0;
+}
+
+void record_close(void)
+{
+    if(!record_file)
+        return;
+    fclose(record_file);
+    record_file = NULL;
+}
+
+void record_flush(void)
+{
+    if(record_file)
+        fflush(record_file);
+}
+
+static void record_write(int type, int arg, unsigned int arg2,
+                         const void *data, unsigned int len)
+{
+    struct record_hdr h;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    h.time = (now.tv_sec - record_start.tv_sec) * 1000000000ULL
+             + now.tv_nsec - record_start.tv_nsec;
+    h.len = len;
+    h.arg = arg;
+    h.arg2 = arg2;
+    h.type = type;
+    if((1 != fwrite(&h, sizeof(h), 1, record_file))
+       || (len && (1 != fwrite(data, len, 1, record_file))))
+    {
+        ERROR("Couldn't write the recording, stopped: %m");
+        fclose(record_file);
+        record_file = NULL;
+    }
+}
+
+void record_input(int type, int arg, unsigned int arg2,
+                  const void *data, unsigned int len)
+{
+    if(record_file)
+        record_write(type, arg, arg2, data, len);
+}
+
+/* Replay */
+
+static const struct record_hdr *replay_rec(size_t pos)
+{
+    return (const struct record_hdr *)(replay_buf + pos);
+}
+
+static size_t replay_skip(size_t pos)
+{
+    return pos + sizeof(struct record_hdr) + replay_rec(pos)->len;
+}
+
+#define MISMATCH(_fmt, _args...)                                    \
+    do {                                                            \
+        if(MAX_MISMATCH_LOGS > mismatches++)                        \
+            ERROR("Input #%u: " _fmt, input_no, ##_args);           \
+    } while(0)
+
+void record_output(int type, int arg, unsigned int arg2,
+                   const void *data, unsigned int len)
+{
+    const struct record_hdr *h;
+
+    if(record_file)
+        record_write(type, arg, arg2, data, len);
+    if(!replaying)
+        return;
+
+    while((output_pos < window_end)
+          && !RECORD_IS_OUTPUT(replay_rec(output_pos)->type))
+        output_pos = replay_skip(output_pos);
+    if(output_pos >= window_end)
+    {
+        MISMATCH("unexpected %s, ifindex %d, %u", record_type_name(type),
+                 arg, arg2);
+        return;
+    }
+    h = replay_rec(output_pos);
+    output_pos = replay_skip(output_pos);
+    if((h->type != type) || (h->arg != arg) || (h->arg2 != arg2))
+        MISMATCH("%s, ifindex %d, %u instead of %s, ifindex %d, %u",
+                 record_type_name(type), arg, arg2,
+                 record_type_name(h->type), h->arg, h->arg2);
+    else if((h->len != len) || (len && memcmp(h + 1, data, len)))
+        MISMATCH("%s, ifindex %d, %u differs from the recording",
+                 record_type_name(type), arg, arg2);
+}
+
+int record_answer(int query, int ret, const void *data, unsigned int len)
+{
+    if(record_file)
+        record_write(RECORD_ANSWER, query, ret, data, len);
+    return ret;
+}
+
+bool record_replay_answer(int query, int *ret, void *data, unsigned int len)
+{
+    const struct record_hdr *h;
+
+    if(!replaying)
+        return false;
+
+    if(len)
+        memset(data, 0, len);
+    while((answer_pos < window_end)
+          && (RECORD_ANSWER != replay_rec(answer_pos)->type))
+        answer_pos = replay_skip(answer_pos);
+    if((answer_pos >= window_end)
+       || (query != (h = replay_rec(answer_pos))->arg))
+    {
+        /* Never ask the kernel of the replaying host */
+        MISMATCH("no recorded answer to kernel query %d", query);
+        *ret = -1;
+        return true;
+    }
+    answer_pos = replay_skip(answer_pos);
+    *ret = (int)h->arg2;
+    memcpy(data, h + 1, (len < h->len) ? len : h->len);
+    return true;
+}
+
+int replay_open(const char *path)
+{
+    const struct record_file_hdr *fh;
+    struct stat st;
+    size_t pos, l;
+    ssize_t r;
+    int fd;
+
+    if(0 > (fd = open(path, O_RDONLY)))
+    {
+        ERROR("Couldn't open recording %s: %m", path);
+        return -1;
+    }
+    if(fstat(fd, &st) || (NULL == (replay_buf = malloc(st.st_size + 1))))
+    {
+        ERROR("Couldn't load recording %s: %m", path);
+        close(fd);
+        return -1;
+    }
+    for(l = 0; l < st.st_size; l += r)
+        if(0 >= (r = read(fd, replay_buf + l, st.st_size - l)))
+        {
+            ERROR("Couldn't read recording %s: %m", path);
+            close(fd);
+            return -1;
+        }
+    close(fd);
+    replay_size = st.st_size;
+
+    fh = (const struct record_file_hdr *)replay_buf;
+    if((sizeof(*fh) > replay_size) || (RECORD_MAGIC != fh->magic)
+       || (RECORD_VERSION != fh->version))
+    {
+        ERROR("%s is not a recording of this version of mstpd", path);
+        return -1;
+    }
+    /* A recording cut short by a crash ends with a partial record */
+    for(pos = sizeof(*fh); pos < replay_size; pos = replay_skip(pos))
+        if((replay_size - pos < sizeof(struct record_hdr))
+           || (replay_size < replay_skip(pos)))
+        {
+            INFO("%zu bytes of a partial record ignored", replay_size - pos);
+            replay_size = pos;
+            break;
+        }
+
+    window_end = answer_pos = output_pos = sizeof(*fh);
+    replaying = true;
+    return 0;
+}
+
+const struct record_hdr *replay_next_input(void)
+{
+    const struct record_hdr *h;
+    size_t pos;
+
+    /* The outputs of the previous input which were not made */
+    for(pos = output_pos; pos < window_end; pos = replay_skip(pos))
+    {
+        h = replay_rec(pos);
+        if(RECORD_IS_OUTPUT(h->type))
+            MISMATCH("missing %s, ifindex %d, %u", record_type_name(h->type),
+                     h->arg, h->arg2);
+    }
+
+    /* Before the first input: startup of mstpd, not replayed */
+    for(pos = window_end; (pos < replay_size)
+        && !RECORD_IS_INPUT(replay_rec(pos)->type); pos = replay_skip(pos))
+        ;
+    if(pos >= replay_size)
+        return NULL;
+
+    h = replay_rec(pos);
+    answer_pos = output_pos = window_end = replay_skip(pos);
+    while((window_end < replay_size)
+          && !RECORD_IS_INPUT(replay_rec(window_end)->type))
+        window_end = replay_skip(window_end);
+    ++input_no;
+    return h;
+}
+
+bool record_replaying(void)
+{
+    return replaying;
+}
+
+unsigned int replay_mismatches(void)
+{
+    return mismatches;
+}
@@ -0,0 +1,120 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/* Recording of the inputs of mstpd (mstpd -r <file>), for mstpd-replay.
+ *
+ * Every external input is logged before it is handled. Then come, in the
+ * order mstpd makes them, the answers of the kernel to the queries made while
+ * handling the input, and the outputs (BPDUs sent, port state changes).
+ * mstpd-replay feeds the inputs through the same entry points, answers the
+ * queries from the recording and checks the outputs against it.
+ */
+
+#define RECORD_MAGIC    0x5253544d  /* "MSTR" */
+#define RECORD_VERSION  2
+
+struct record_file_hdr
+{
+    __u32 magic;
+    __u32 version;
+} __attribute__((packed));
+
+struct record_hdr
+{
+    __u64 time;     /* ns since the start of the recording, CLOCK_MONOTONIC */
+    __u32 len;      /* of the data following the header */
+    __s32 arg;
+    __u32 arg2;
+    __u16 type;     /* RECORD_xxx */
+} __attribute__((packed));
+
+enum
+{
+    /* Inputs */
+    RECORD_BPDU = 1,    /* arg: ifindex; data: the frame */
+    RECORD_NETLINK,     /* data: the link message */
+    RECORD_CTL,         /* arg: command, arg2: lout; data: the request */
+    RECORD_TICK,        /* the one second tick */
+    RECORD_DEFERRED,    /* resume the state machines out of budget */
+    RECORD_START,       /* arg: auto adopt, arg2: with a configuration file;
+                         * data: the capabilities of the driver plugin */
+    RECORD_STOP,
+    RECORD_RELOAD,      /* SIGHUP; data: the configuration file */
+    RECORD_FLUSH_DONE,  /* arg: ifindex, arg2: mstid; data: br_ifindex */
+    RECORD_NUM_INPUTS,
+    /* Answers of the kernel; arg: RECORD_Q_xxx, arg2: returned value */
+    RECORD_ANSWER = 0x10,
+    /* Outputs */
+    RECORD_TX_BPDU = 0x20,  /* arg: ifindex; data: the frame */
+    RECORD_STATE,           /* arg: ifindex, arg2: mstid << 8 | state */
+};
+
+#define RECORD_IS_INPUT(type)   ((type) < RECORD_ANSWER)
+#define RECORD_IS_OUTPUT(type)  ((type) >= RECORD_TX_BPDU)
+
+/* Kernel queries */
+enum
+{
+    RECORD_Q_IFNAME = 1,    /* data: the name */
+    RECORD_Q_HWADDR,        /* data: the MAC address */
+    RECORD_Q_FLAGS,
+    RECORD_Q_SHUTDOWN,
+    RECORD_Q_SPEED_DUPLEX,  /* data: speed, duplex */
+    RECORD_Q_IS_BRIDGE,
+    RECORD_Q_PORTNO,
+    RECORD_Q_LINKS,         /* a dump: the number of links which follow */
+    RECORD_Q_LINK,          /* data: if_index, value */
+};
+
+/* mstpd: start recording to path. Return 0 or -1 */
+int record_open(const char *path);
+void record_close(void);
+/* Write what is buffered, once per event loop turn */
+void record_flush(void);
+
+void record_input(int type, int arg, unsigned int arg2,
+                  const void *data, unsigned int len);
+/* When replaying, check the output against the recording */
+void record_output(int type, int arg, unsigned int arg2,
+                   const void *data, unsigned int len);
+
+/* The answer of the kernel to a query of mstpd; return ret */
+int record_answer(int query, int ret, const void *data, unsigned int len);
+/* When replaying, get the answer from the recording and return true;
+ * a missing answer is a failure (*ret = -1). Return false otherwise, the
+ * kernel must then be asked. */
+bool record_replay_answer(int query, int *ret, void *data, unsigned int len);
+
+/* mstpd-replay: load the recording. Return 0 or -1 */
+int replay_open(const char *path);
+bool record_replaying(void);
+/* The next input, NULL at the end of the recording. Its answers and outputs
+ * are expected until the next call. */
+const struct record_hdr *replay_next_input(void);
+/* Outputs and answers which didn't match the recording */
+unsigned int replay_mismatches(void);
+
+#endif /* RECORD_H */
@@ -0,0 +1,398 @@
+/*****************************************************************************
+  This program is free software; you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by the Free
+  Software Foundation; either version 2 of the License, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+  more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this program; if not, write to the Free Software Foundation, Inc., 59
+  Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+  The full GNU General Public License is included in this distribution in the
+  file called LICENSE.
+
+******************************************************************************/
+
+/*
+ * mstpd-replay: feed a recording of mstpd -r through the entry points of
+ * mstpd, as fast as possible, and check that the same BPDUs are sent and the
+ * same port states are set. The kernel is replaced by the stubs below and by
+ * the answers of the recording (see record.h).
+ *
+ * The options of mstpd which change its behaviour (-A, -b, -c, -F, -W) must
+ * be given again. The configuration file is read from the replaying host at
+ * the start; the reloads (SIGHUP) use the contents recorded then.
+ *
+ * The driver plugin is emulated by the replay driver, which takes its
+ * capabilities and reports its flushes done when the recording says so.
+ * The plugin and the kernel driver are one driver here: the state changes
+ * and the flushes given to them are not checked, only those asked for by
+ * the state machines.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <linux/netlink.h>
+
+#include "bridge_ctl.h"
+#include "bridge_track.h"
+#include "ctl_socket_server.h"
+#include "conf_file.h"
+#include "driver.h"
+#include "driver_plugin.h"
+#include "epoll_loop.h"
+#include "packet.h"
+#include "handover.h"
+#include "record.h"
+#include "clock_gettime.h"
+#include "log.h"
+
+int log_level = LOG_LEVEL_ERROR;
+
+/* Processing time of the inputs of a type, in ns */
+typedef struct
+{
+    unsigned int count;
+    unsigned long long total, max;
+} replay_stats_t;
+
+static replay_stats_t stats[RECORD_NUM_INPUTS];
+
+static const char *input_names[RECORD_NUM_INPUTS] =
+{
+    [RECORD_BPDU] = "bpdu",
+    [RECORD_NETLINK] = "link",
+    [RECORD_CTL] = "control",
+    [RECORD_TICK] = "tick",
+    [RECORD_DEFERRED] = "deferred",
+    [RECORD_START] = "start",
+    [RECORD_STOP] = "stop",
+    [RECORD_RELOAD] = "reload",
+    [RECORD_FLUSH_DONE] = "flush-done",
+};
+
+void vDprintf(int level, const char *fmt, va_list ap)
+{
+    if(level > log_level)
+        return;
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+}
+
+void Dprintf(int level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vDprintf(level, fmt, ap);
+    va_end(ap);
+}
+
+/* The stub kernel layer */
+
+void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
+{
+    unsigned char frame[2048];
+    int i, l;
+
+    for(i = 0, l = 0; i < iov_count; ++i)
+    {
+        if(sizeof(frame) < l + iov[i].iov_len)
+            break;
+        memcpy(frame + l, iov[i].iov_base, iov[i].iov_len);
+        l += iov[i].iov_len;
+    }
+    record_output(RECORD_TX_BPDU, ifindex, 0, frame, l);
+}
+
+void packet_flush(void)
+{
+}
+
+void packet_port_set(int ifindex, unsigned int flags, unsigned int rate)
+{
+}
+
+void packet_port_del(int ifindex)
+{
+}
+
+void packet_port_dropped(int ifindex, unsigned long long *filtered,
+                         unsigned long long *limited)
+{
+    *filtered = *limited = 0;
+}
+
+/* A flush of a plugin with MSTPD_DRIVER_CAP_ASYNC_FLUSH is done when the
+ * recording says so */
+static void replay_flush(const struct mstpd_driver_flush *v, int n)
+{
+}
+
+/* The port states are checked in driver_set_new_state().
+ * The capabilities are those of the recorded plugin, see replay_start() */
+static struct mstpd_driver replay_driver =
+{
+    .abi_version = MSTPD_DRIVER_ABI_VERSION,
+    .name = "replay",
+    .flush = replay_flush,
+};
+
+static const struct mstpd_driver_host *replay_host;
+
+const struct mstpd_driver *
+driver_linux_init(const struct mstpd_driver_host *host)
+{
+    replay_host = host;
+    return &replay_driver;
+}
+
+int add_epoll(struct epoll_event_handler *h)
+{
+    return 0;
+}
+
+int remove_epoll(struct epoll_event_handler *h)
+{
+    return 0;
+}
+
+void epoll_get_stats(epoll_loop_stats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+}
+
+int handover_get_fd(int which)
+{
+    return -1;
+}
+
+void handover_set_fd(int which, int fd)
+{
+}
+
+int CTL_handover(void)
+{
+    return -1;
+}
+
+bool handover_done(void)
+{
+    return false;
+}
+
+/* Replay */
+
+static unsigned long long time_diff_ns(const struct timespec *second,
+                                       const struct timespec *first)
+{
+    return (second->tv_sec - first->tv_sec) * 1000000000ULL
+           + second->tv_nsec - first->tv_nsec;
+}
+
+static void replay_start(const struct record_hdr *h, const void *data,
+                         bool auto_adopt, const char *conf_path)
+{
+    unsigned int caps = 0;
+
+    if(sizeof(caps) <= h->len)
+        memcpy(&caps, data, sizeof(caps));
+    replay_driver.caps = caps;
+    if(h->arg != auto_adopt)
+        ERROR("Recorded %s -A, replayed %s", h->arg ? "with" : "without",
+              auto_adopt ? "with" : "without");
+    if(h->arg2 && !conf_path)
+        ERROR("Recorded with a configuration file, replayed without -c");
+    if(conf_path && conf_file_init(conf_path))
+        ERROR("Couldn't load configuration file %s", conf_path);
+    if(auto_adopt)
+        dump_bridge_stp_states();
+}
+
+static void replay_input(const struct record_hdr *h, bool auto_adopt,
+                         const char *conf_path)
+{
+    /* The data of a record is not aligned */
+    static void *buf;
+    static unsigned int size;
+    int br_ifindex;
+
+    /* And a NUL, for the configuration file */
+    if(size < h->len + 1)
+    {
+        free(buf);
+        if(NULL == (buf = malloc(h->len + 1)))
+        {
+            size = 0;
+            ERROR("Out of memory for a record of %u bytes", h->len);
+            return;
+        }
+        size = h->len + 1;
+    }
+    memcpy(buf, h + 1, h->len);
+    ((char *)buf)[h->len] = '\0';
+
+    switch(h->type)
+    {
+        case RECORD_BPDU:
+            bridge_bpdu_rcv(h->arg, buf, h->len, NULL);
+            break;
+        case RECORD_NETLINK:
+            if(NLMSG_HDRLEN <= h->len)
+                brmon_replay_msg(buf);
+            break;
+        case RECORD_CTL:
+            ctl_replay_message(h->arg, buf, h->len, h->arg2);
+            break;
+        case RECORD_TICK:
+            bridge_one_second();
+            break;
+        case RECORD_DEFERRED:
+            bridge_run_deferred();
+            break;
+        case RECORD_START:
+            replay_start(h, buf, auto_adopt, conf_path);
+            break;
+        case RECORD_STOP:
+            bridge_track_fini();
+            break;
+        case RECORD_RELOAD:
+            conf_file_reload(buf);
+            break;
+        case RECORD_FLUSH_DONE:
+            if(sizeof(br_ifindex) <= h->len)
+            {
+                memcpy(&br_ifindex, buf, sizeof(br_ifindex));
+                replay_host->flush_done(br_ifindex, h->arg, (int)h->arg2);
+            }
+            break;
+        default:
+            ERROR("Unknown input type %u", h->type);
+    }
+    /* End of the event loop turn */
+    driver_commit();
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mstpd-replay [-A] [-b <bridge>] [-c <conf>] [-F] "
+                    "[-W] [-e] [-v <level>] <recording>\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const struct record_hdr *h;
+    replay_stats_t *s;
+    struct timespec start, before, after;
+    unsigned long long ns, total = 0, last_time = 0;
+    const char *conf_path = NULL;
+    bool auto_adopt = false, each = false;
+    unsigned int num = 0;
+    int c, type;
+
+    while((c = getopt(argc, argv, "Ab:c:eFv:W")) != -1)
+    {
+        switch (c)
+        {
+            case 'A':
+                auto_adopt = true;
+                bridge_set_auto_adopt(true);
+                break;
+            case 'b':
+                if(bridge_add_auto_adopt_name(optarg))
+                {
+                    ERROR("Invalid bridge name %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                conf_path = optarg;
+                break;
+            case 'e':
+                each = true;
+                break;
+            case 'F':
+                bridge_set_rx_fast_path(false);
+                break;
+            case 'v':
+            {
+                char *end;
+                long l;
+                l = strtoul(optarg, &end, 0);
+                if(*optarg == 0 || *end != 0 || l > LOG_LEVEL_MAX)
+                {
+                    ERROR("Invalid loglevel %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                log_level = l;
+                break;
+            }
+            case 'W':
+                bridge_set_warm_start(true);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind + 1 != argc)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if(replay_open(argv[optind]))
+        return EXIT_FAILURE;
+    TST(driver_mstp_init() == 0, EXIT_FAILURE);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while((h = replay_next_input()))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        replay_input(h, auto_adopt, conf_path);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+
+        ns = time_diff_ns(&after, &before);
+        type = (RECORD_NUM_INPUTS > h->type) ? h->type : 0;
+        s = &stats[type];
+        ++(s->count);
+        s->total += ns;
+        if(s->max < ns)
+            s->max = ns;
+        last_time = h->time;
+        ++num;
+        if(each)
+            printf("%u %s %llu.%09llu %llu\n", num,
+                   input_names[type] ? : "unknown",
+                   h->time / 1000000000ULL, h->time % 1000000000ULL, ns);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    total = time_diff_ns(&after, &start);
+
+    printf("%-10s %10s %14s %10s %10s\n",
+           "input", "count", "total-ns", "avg-ns", "max-ns");
+    for(c = 0; c < RECORD_NUM_INPUTS; ++c)
+    {
+        s = &stats[c];
+        if(!s->count)
+            continue;
+        printf("%-10s %10u %14llu %10llu %10llu\n",
+               input_names[c] ? : "unknown", s->count, s->total,
+               s->total / s->count, s->max);
+    }
+    printf("%u inputs recorded over %llu.%03llu s, replayed in %llu.%06llu s\n",
+           num, last_time / 1000000000ULL, last_time % 1000000000ULL / 1000000,
+           total / 1000000000ULL, total % 1000000000ULL / 1000);
+    printf("%u mismatches\n", replay_mismatches());
+
+    driver_mstp_fini();
+    return replay_mismatches() ? EXIT_FAILURE : EXIT_SUCCESS;
+}